@@ -0,0 +1,115 @@
+// Compile-time scene transforms, see baked_scene.h
+#include "baked_scene.h"
+#include "maths_funcs.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <math.h>
+#include <stdio.h>
+
+// tolerance between the fused trs() path and the chained matrix products
+#define BAKE_EPSILON 1e-5f
+
+static constexpr vec3 rail_positions[NUM_BAKED_RAILS] = {
+	vec3 (0.0f, -0.570f, 2.5f),
+	vec3 (1.0f, -0.570f, 2.5f),
+	vec3 (2.0f, -0.570f, 2.5f)
+};
+
+static constexpr vec3 light_positions[NUM_BAKED_LAMPS + 1] = {
+	vec3 (0.7f, 0.2f, 2.0f),
+	vec3 (2.3f, -3.3f, -4.0f),
+	vec3 (-4.0f, 2.0f, -12.0f),
+	vec3 (1.2f, 0.2f, 2.0f)
+};
+
+static constexpr versor no_rotation = versor (1.0f, 0.0f, 0.0f, 0.0f);
+
+static constexpr mat4 rail_models[NUM_BAKED_RAILS] = {
+	trs (rail_positions[0], no_rotation, vec3 (0.005f, 0.005f, 0.005f)),
+	trs (rail_positions[1], no_rotation, vec3 (0.005f, 0.005f, 0.005f)),
+	trs (rail_positions[2], no_rotation, vec3 (0.005f, 0.005f, 0.005f))
+};
+
+static constexpr mat4 train_local = trs (vec3 (0.0f, 0.0f, 0.0f), quat_from_axis_deg (90.0f, 0.0f, 1.0f, 0.0f), vec3 (0.001f, 0.001f, 0.001f));
+
+static constexpr mat4 box_car_offset = translate (identity_mat4 (), vec3 (-170.0f, -10.0f, -500.0f));
+
+static constexpr mat4 lit_cube_model = trs (light_positions[3], no_rotation, vec3 (0.2f, 0.2f, 0.2f));
+
+static constexpr mat4 lamp_models[NUM_BAKED_LAMPS] = {
+	trs (light_positions[0], no_rotation, vec3 (0.1f, 0.1f, 0.1f)),
+	trs (light_positions[1], no_rotation, vec3 (0.1f, 0.1f, 0.1f)),
+	trs (light_positions[2], no_rotation, vec3 (0.1f, 0.1f, 0.1f))
+};
+
+// the same transforms the long way round: scale, then rotate, then translate
+static constexpr mat4 chained (const vec3& t, float y_deg, const vec3& s) {
+	return translate (rotate_y_deg (scale (identity_mat4 (), s), y_deg), t);
+}
+
+// the fused path has to agree with the chained one while still compiling
+static_assert (nearly_equal (rail_models[1], chained (rail_positions[1], 0.0f, vec3 (0.005f, 0.005f, 0.005f)), BAKE_EPSILON),
+	"trs() does not match translate * scale");
+static_assert (nearly_equal (train_local, chained (vec3 (0.0f, 0.0f, 0.0f), 90.0f, vec3 (0.001f, 0.001f, 0.001f)), BAKE_EPSILON),
+	"trs() does not match rotate_y_deg * scale");
+static_assert (nearly_equal (lit_cube_model, chained (light_positions[3], 0.0f, vec3 (0.2f, 0.2f, 0.2f)), BAKE_EPSILON),
+	"trs() does not match translate * scale");
+static_assert (train_local.m[8] > 0.0f && train_local.m[2] < 0.0f,
+	"rotation about y turned the wrong way");
+
+const float* const baked_rail_models[NUM_BAKED_RAILS] = { rail_models[0].m, rail_models[1].m, rail_models[2].m };
+const float* const baked_train_local = train_local.m;
+const float* const baked_box_car_offset = box_car_offset.m;
+const float* const baked_lit_cube_model = lit_cube_model.m;
+const float* const baked_lamp_models[NUM_BAKED_LAMPS] = { lamp_models[0].m, lamp_models[1].m, lamp_models[2].m };
+
+// glm's rotate() and the constexpr sin/cos round differently, so each element
+// may be off by this much of its size, or by the floor where it should be 0
+#define GLM_TOLERANCE 1e-5f
+#define GLM_FLOOR 1e-7f
+
+static bool check_baked (const char* name, const mat4& baked, const glm::mat4& chain) {
+	const float* expected = glm::value_ptr (chain);
+	float worst = 0.0f;
+	bool ok = true;
+	for (int i = 0; i < 16; i++) {
+		float diff = fabsf (baked.m[i] - expected[i]);
+		float allowed = GLM_TOLERANCE * fmaxf (fabsf (baked.m[i]), fabsf (expected[i])) + GLM_FLOOR;
+		worst = fmaxf (worst, diff);
+		ok &= diff <= allowed;
+	}
+	printf ("%-12s largest difference %g%s\n", name, worst, ok ? "" : ", too large");
+	if (!ok) {
+		print (baked);
+		for (int r = 0; r < 4; r++) {
+			printf ("[%.2f][%.2f][%.2f][%.2f]\n", expected[r], expected[r + 4], expected[r + 8], expected[r + 12]);
+		}
+	}
+	return ok;
+}
+
+bool verify_baked_scene (const float* point_lights) {
+	// the rail positions main.cpp translated each segment to
+	const glm::vec3 rails[NUM_BAKED_RAILS] = {
+		glm::vec3 (0.0f, -0.570f, 2.5f),
+		glm::vec3 (1.0f, -0.570f, 2.5f),
+		glm::vec3 (2.0f, -0.570f, 2.5f)
+	};
+	bool ok = true;
+	for (int i = 0; i < NUM_BAKED_RAILS; i++) {
+		glm::mat4 m = glm::translate (glm::mat4 (1.0f), rails[i]);
+		ok &= check_baked ("rail", rail_models[i], glm::scale (m, glm::vec3 (0.005f, 0.005f, 0.005f)));
+	}
+	glm::mat4 train = glm::rotate (glm::mat4 (1.0f), 90.0f, glm::vec3 (0.0f, 1.0f, 0.0f));
+	ok &= check_baked ("train", train_local, glm::scale (train, glm::vec3 (0.001f, 0.001f, 0.001f)));
+	ok &= check_baked ("box car", box_car_offset, glm::translate (glm::mat4 (1.0f), glm::vec3 (-170.0f, -10.0f, -500.0f)));
+	glm::mat4 cube = glm::translate (glm::mat4 (1.0f), glm::make_vec3 (point_lights + 3 * NUM_BAKED_LAMPS));
+	ok &= check_baked ("lit cube", lit_cube_model, glm::scale (cube, glm::vec3 (0.2f)));
+	for (int i = 0; i < NUM_BAKED_LAMPS; i++) {
+		glm::mat4 m = glm::translate (glm::mat4 (1.0f), glm::make_vec3 (point_lights + 3 * i));
+		ok &= check_baked ("lamp", lamp_models[i], glm::scale (m, glm::vec3 (0.1f)));
+	}
+	printf (ok ? "baked scene transforms match glm\n" : "baked scene transforms do not match glm\n");
+	return ok;
+}
@@ -0,0 +1,28 @@
+#ifndef BAKED_SCENE_H
+#define BAKED_SCENE_H
+
+// Transforms of the scene that never change, worked out by the compiler from
+// the constexpr maths_funcs paths. Each one is 16 column major floats so
+// main.cpp can hand them to glm::make_mat4 without seeing the maths_funcs types.
+
+#define NUM_BAKED_RAILS 3
+#define NUM_BAKED_LAMPS 3
+
+// track segments, translate(rails[i]) * scale(0.005)
+extern const float* const baked_rail_models[NUM_BAKED_RAILS];
+// train mesh relative to its position, rotate 90 about y then scale 0.001
+extern const float* const baked_train_local;
+// box car relative to the train
+extern const float* const baked_box_car_offset;
+// lit cube at the last point light, scaled to 0.2
+extern const float* const baked_lit_cube_model;
+// lamp cubes at the first three point lights, scaled to 0.1
+extern const float* const baked_lamp_models[NUM_BAKED_LAMPS];
+
+// Compares every baked matrix with the glm translate/rotate/scale chain
+// main.cpp built it with before, printing the largest difference of each.
+// point_lights is main.cpp's four light positions, xyz each. Run by
+// --verify-baked
+bool verify_baked_scene(const float* point_lights);
+
+#endif
@@ -1,8 +1,7 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
-#include <GL/glew.h>
-#include <GL/freeglut.h>
+#include "gl_includes.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
@@ -0,0 +1,382 @@
+// Relaxed cone step maps and the CPU parallax references, see cone_map.h
+#include "cone_map.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+
+#include "job_system.h"
+#include "maths_funcs.h"
+#include "platform.h"
+#include "simd_f4.h"
+#include "stb_image.h"
+
+// As in parallax_fragment.txt: the gap to the surface a cone step counts as
+// on it, and the binary search steps once past it
+#define CONE_TOLERANCE 0.002f
+#define CONE_SEARCH_STEPS 5
+
+// Depth a candidate ray moves at most per step of the bake
+#define CONE_BAKE_STEP (1.0f / 256.0f)
+
+// A texel relative to the one being baked, reach its distance in texture space
+struct ConeOffset {
+	int dx;
+	int dy;
+	float reach;
+};
+
+static bool nearer (const ConeOffset& a, const ConeOffset& b) {
+	return a.reach < b.reach;
+}
+
+static inline float field_at (const float* field, int width, int height, float x, float y) {
+	int ix = (int)floorf (x) % width, iy = (int)floorf (y) % height;
+	ix += ix < 0 ? width : 0;
+	iy += iy < 0 ? height : 0;
+	return field[iy * width + ix];
+}
+
+// Ray i starts at (x[i], y[i], z[i]), in texels across a width x height
+// field of depths (rows of floats, 0 at the top, wrapping at the edges) and
+// in depth downwards, and moves (dx[i], dy[i], dz[i]) a step. Steps each ray
+// on while the texel under it is no deeper than the ray, so until it comes
+// out of the solid, or until z reaches max_z. x, y and z are left there.
+// Four rays at a time, each lane stepping until its own ray is out; the
+// field is read lane by lane, there is no gather before AVX2.
+static void march_rays_out (const float* field, int width, int height, float* x, float* y, float* z,
+	const float* dx, const float* dy, const float* dz, size_t count, float max_z) {
+	f4 limit = f4_splat (max_z);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		f4 px = f4_load (x + i), py = f4_load (y + i), pz = f4_load (z + i);
+		f4 sx = f4_load (dx + i), sy = f4_load (dy + i), sz = f4_load (dz + i);
+		int active = 15 & ~f4_le_mask (limit, pz);
+		while (active) {
+			f4 on = f4_set ((float)(active & 1), (float)((active >> 1) & 1), (float)((active >> 2) & 1), (float)((active >> 3) & 1));
+			px = f4_madd (sx, on, px);
+			py = f4_madd (sy, on, py);
+			pz = f4_madd (sz, on, pz);
+			float lx[4], ly[4], surface[4];
+			f4_store (lx, px);
+			f4_store (ly, py);
+			for (int lane = 0; lane < 4; lane++) {
+				surface[lane] = active & (1 << lane) ? field_at (field, width, height, lx[lane], ly[lane]) : 2.0f;
+			}
+			// still inside where the surface is no deeper than the ray
+			active &= f4_le_mask (f4_load (surface), pz) & ~f4_le_mask (limit, pz);
+		}
+		f4_store (x + i, px);
+		f4_store (y + i, py);
+		f4_store (z + i, pz);
+	}
+	for (; i < count; i++) {
+		while (z[i] < max_z) {
+			x[i] += dx[i];
+			y[i] += dy[i];
+			z[i] += dz[i];
+			if (field_at (field, width, height, x[i], y[i]) > z[i])
+				break;
+		}
+	}
+}
+
+// The ratio over texel (x, y): the ray into each shallower texel aimed at
+// this texel's floor is followed through the solid until it comes out, or
+// gets as deep as the floor. A ray out at depth z a distance r away allows
+// r / (floor - z). Taken nearest first, no ray from further than
+// ratio * floor can do better, so the search ends there.
+static float cone_ratio (const DepthField& field, int x, int y, const std::vector<ConeOffset>& offsets) {
+	float floorDepth = field.at (x, y);
+	float best = 1.0f;
+	if (floorDepth <= 0.0f)
+		return best;
+	float sx = x + 0.5f, sy = y + 0.5f;
+	float rx[4], ry[4], rz[4], stepX[4], stepY[4], stepZ[4];
+	int lanes = 0;
+	for (size_t i = 0; i <= offsets.size (); i++) {
+		bool last = i == offsets.size () || offsets[i].reach >= best * floorDepth;
+		if (!last) {
+			const ConeOffset& o = offsets[i];
+			float top = field.at (x + o.dx, y + o.dy);
+			// a ray going in no higher than the floor can't come out above it
+			if (top >= floorDepth)
+				continue;
+			// per unit depth the ray moves -(dx, dy) / (floor - top) texels, a
+			// step is at most a texel across
+			float ux = -o.dx / (floorDepth - top), uy = -o.dy / (floorDepth - top);
+			float dz = std::min (CONE_BAKE_STEP, 1.0f / std::max (fabsf (ux), fabsf (uy)));
+			rx[lanes] = sx + o.dx;
+			ry[lanes] = sy + o.dy;
+			rz[lanes] = top;
+			stepX[lanes] = ux * dz;
+			stepY[lanes] = uy * dz;
+			stepZ[lanes] = dz;
+			lanes++;
+		}
+		if (lanes == 4 || (last && lanes > 0)) {
+			march_rays_out (&field.depth[0], field.width, field.height, rx, ry, rz, stepX, stepY, stepZ, lanes, floorDepth);
+			for (int l = 0; l < lanes; l++) {
+				// out over this texel is on the way in to its floor
+				if (rz[l] >= floorDepth || (fabsf (rx[l] - sx) < 0.5f && fabsf (ry[l] - sy) < 0.5f))
+					continue;
+				float u = (rx[l] - sx) / field.width, v = (ry[l] - sy) / field.height;
+				best = std::min (best, sqrtf (u * u + v * v) / (floorDepth - rz[l]));
+			}
+			lanes = 0;
+		}
+		if (last)
+			break;
+	}
+	return best;
+}
+
+void build_cone_ratios (const DepthField& field, std::vector<float>& ratios) {
+	int w = field.width, h = field.height;
+	ratios.assign ((size_t)w * h, 1.0f);
+	// every texel within a ratio of 1 at full depth, the field repeating
+	std::vector<ConeOffset> offsets;
+	for (int dy = -h; dy <= h; dy++) {
+		for (int dx = -w; dx <= w; dx++) {
+			float u = (float)dx / w, v = (float)dy / h;
+			ConeOffset o = { dx, dy, sqrtf (u * u + v * v) };
+			if ((dx || dy) && o.reach < 1.0f)
+				offsets.push_back (o);
+		}
+	}
+	std::sort (offsets.begin (), offsets.end (), nearer);
+
+	float* out = &ratios[0];
+	job_system.parallel_for (0, h, 1, [&field, &offsets, out, w] (size_t begin, size_t end) {
+		for (size_t y = begin; y < end; y++) {
+			for (int x = 0; x < w; x++)
+				out[y * w + x] = cone_ratio (field, x, (int)y, offsets);
+		}
+	});
+}
+
+// GL_LINEAR with GL_REPEAT, texel centres at (i + 0.5) / size
+static float sample (const DepthField& field, float u, float v) {
+	float x = u * field.width - 0.5f, y = v * field.height - 0.5f;
+	float fx = floorf (x), fy = floorf (y);
+	int ix = (int)fx, iy = (int)fy;
+	float tx = x - fx, ty = y - fy;
+	float top = field.at (ix, iy) * (1.0f - tx) + field.at (ix + 1, iy) * tx;
+	float bottom = field.at (ix, iy + 1) * (1.0f - tx) + field.at (ix + 1, iy + 1) * tx;
+	return top * (1.0f - ty) + bottom * ty;
+}
+
+ParallaxHit parallax_layers (const DepthField& depth, float u, float v, const float viewDir[3], float heightScale, int maxLayers) {
+	float minLayers = maxLayers / 4.0f;
+	float numLayers = maxLayers + (minLayers - maxLayers) * fabsf (viewDir[2]);
+	float layerDepth = 1.0f / numLayers;
+	float deltaU = viewDir[0] / viewDir[2] * heightScale / numLayers;
+	float deltaV = viewDir[1] / viewDir[2] * heightScale / numLayers;
+
+	ParallaxHit hit = { u, v, 1 };
+	float current = 0.0f;
+	float mapValue = sample (depth, hit.u, hit.v);
+	while (current < mapValue) {
+		hit.u -= deltaU;
+		hit.v -= deltaV;
+		mapValue = sample (depth, hit.u, hit.v);
+		hit.fetches++;
+		current += layerDepth;
+	}
+	// between the last two layers where the depths cross
+	float prevU = hit.u + deltaU, prevV = hit.v + deltaV;
+	float after = mapValue - current;
+	float before = sample (depth, prevU, prevV) - current + layerDepth;
+	hit.fetches++;
+	float weight = after / (after - before);
+	hit.u = prevU * weight + hit.u * (1.0f - weight);
+	hit.v = prevV * weight + hit.v * (1.0f - weight);
+	return hit;
+}
+
+ParallaxHit parallax_cones (const DepthField& depth, const DepthField& cones, float u, float v, const float viewDir[3],
+	float heightScale, int coneSteps) {
+	// the ray per unit of depth
+	float rayU = -viewDir[0] / viewDir[2] * heightScale, rayV = -viewDir[1] / viewDir[2] * heightScale;
+	float rayRatio = sqrtf (rayU * rayU + rayV * rayV);
+
+	ParallaxHit hit = { u, v, 0 };
+	float z = 0.0f;
+	float aboveU = u, aboveV = v, aboveZ = 0.0f;
+	bool crossed = false;
+	for (int i = 0; i < coneSteps; i++) {
+		float gap = sample (depth, hit.u, hit.v) - z;
+		float cone = sample (cones, hit.u, hit.v);
+		hit.fetches++;
+		if (gap < CONE_TOLERANCE) {
+			crossed = gap < 0.0f;
+			break;
+		}
+		aboveU = hit.u;
+		aboveV = hit.v;
+		aboveZ = z;
+		cone *= cone;
+		float t = cone * gap / (rayRatio + cone);
+		hit.u += rayU * t;
+		hit.v += rayV * t;
+		z += t;
+	}
+	if (crossed) {
+		for (int i = 0; i < CONE_SEARCH_STEPS; i++) {
+			float midU = (aboveU + hit.u) * 0.5f, midV = (aboveV + hit.v) * 0.5f, midZ = (aboveZ + z) * 0.5f;
+			hit.fetches++;
+			if (sample (depth, midU, midV) > midZ) {
+				aboveU = midU;
+				aboveV = midV;
+				aboveZ = midZ;
+			} else {
+				hit.u = midU;
+				hit.v = midV;
+				z = midZ;
+			}
+		}
+	}
+	return hit;
+}
+
+// Uncompressed 24 bit TGA, top row first
+static bool write_tga (const char* path, int width, int height, const std::vector<unsigned char>& rgb) {
+	FILE* fp = platform_fopen (path, "wb");
+	if (!fp) {
+		fprintf (stderr, "ERROR: could not open %s for writing\n", path);
+		return false;
+	}
+	unsigned char header[18] = { 0 };
+	header[2] = 2;
+	header[12] = width & 255;
+	header[13] = (width >> 8) & 255;
+	header[14] = height & 255;
+	header[15] = (height >> 8) & 255;
+	header[16] = 24;
+	header[17] = 0x20;
+	std::vector<unsigned char> bgr (rgb.size ());
+	for (size_t i = 0; i < rgb.size (); i += 3) {
+		bgr[i] = rgb[i + 2];
+		bgr[i + 1] = rgb[i + 1];
+		bgr[i + 2] = rgb[i];
+	}
+	bool ok = fwrite (header, 1, sizeof (header), fp) == sizeof (header) && fwrite (&bgr[0], 1, bgr.size (), fp) == bgr.size ();
+	ok = fclose (fp) == 0 && ok;
+	if (!ok)
+		fprintf (stderr, "ERROR: could not write %s\n", path);
+	return ok;
+}
+
+struct ParallaxTally {
+	double fetches;
+	double error;
+	int maxFetches;
+	float maxError;
+	long count;
+
+	void add (const ParallaxHit& hit, const ParallaxHit& reference, int width, int height) {
+		float du = (hit.u - reference.u) * width, dv = (hit.v - reference.v) * height;
+		float off = sqrtf (du * du + dv * dv);
+		fetches += hit.fetches;
+		error += off;
+		maxFetches = std::max (maxFetches, hit.fetches);
+		maxError = std::max (maxError, off);
+		count++;
+	}
+
+	void add (const ParallaxTally& other) {
+		fetches += other.fetches;
+		error += other.error;
+		maxFetches = std::max (maxFetches, other.maxFetches);
+		maxError = std::max (maxError, other.maxError);
+		count += other.count;
+	}
+
+	void print () const {
+		printf ("  %5.2f %3d  %6.3f %6.2f", count > 0 ? fetches / count : 0.0, maxFetches, count > 0 ? error / count : 0.0, maxError);
+	}
+};
+
+// Both techniques over a grid of pixels and view directions from grazing to
+// head on, against linear stepping with 64 times the layers. Errors are in
+// texels.
+static void compare_techniques (const DepthField& depth, const DepthField& cones, float heightScale, int layers, int coneSteps) {
+	static const float elevations[] = { 15.0f, 30.0f, 45.0f, 60.0f, 75.0f, 90.0f };
+	const int azimuths = 8, grid = 64;
+	ParallaxTally linearAll = {}, coneAll = {};
+	char linearName[32], coneName[32];
+	snprintf (linearName, sizeof (linearName), "linear, %d layers", layers);
+	snprintf (coneName, sizeof (coneName), "cones, %d steps", coneSteps);
+	printf ("%10s  %-24s  %s\n", "", linearName, coneName);
+	printf ("%10s  %-24s  %s\n", "elevation", " fetches        error", " fetches        error");
+	printf ("%10s  %-24s  %s\n", "", "  avg max     avg    max", "  avg max     avg    max");
+	for (size_t e = 0; e < sizeof (elevations) / sizeof (elevations[0]); e++) {
+		ParallaxTally linear = {}, cone = {};
+		for (int a = 0; a < (elevations[e] < 90.0f ? azimuths : 1); a++) {
+			float up = elevations[e] * ONE_DEG_IN_RAD, around = a * 360.0f / azimuths * ONE_DEG_IN_RAD;
+			float viewDir[3] = { cosf (up) * cosf (around), cosf (up) * sinf (around), sinf (up) };
+			for (int j = 0; j < grid; j++) {
+				for (int i = 0; i < grid; i++) {
+					float u = (i + 0.5f) / grid, v = (j + 0.5f) / grid;
+					ParallaxHit reference = parallax_layers (depth, u, v, viewDir, heightScale, layers * 64);
+					linear.add (parallax_layers (depth, u, v, viewDir, heightScale, layers), reference, depth.width, depth.height);
+					cone.add (parallax_cones (depth, cones, u, v, viewDir, heightScale, coneSteps), reference, depth.width, depth.height);
+				}
+			}
+		}
+		printf ("%6.0f deg", elevations[e]);
+		linear.print ();
+		cone.print ();
+		printf ("\n");
+		linearAll.add (linear);
+		coneAll.add (cone);
+	}
+	printf ("%10s", "all");
+	linearAll.print ();
+	coneAll.print ();
+	printf ("\n");
+}
+
+int run_cone_map_tool (const char* input, const char* output, float heightScale, int layers, int coneSteps) {
+	int width = 0, height = 0, channels = 0;
+	unsigned char* pixels = stbi_load (input, &width, &height, &channels, 0);
+	if (!pixels) {
+		fprintf (stderr, "ERROR: could not load %s\n", input);
+		return 1;
+	}
+	size_t texels = (size_t)width * height;
+	DepthField depth = { width, height, std::vector<float> (texels) };
+	std::vector<unsigned char> packed (texels * 3, 0);
+	for (size_t i = 0; i < texels; i++) {
+		packed[i * 3] = pixels[i * channels];
+		depth.depth[i] = pixels[i * channels] / 255.0f;
+	}
+	stbi_image_free (pixels);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	std::vector<float> ratios;
+	build_cone_ratios (depth, ratios);
+	std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now () - start;
+
+	// rounded down, a narrower cone is still safe; cones is what the shader reads
+	DepthField cones = { width, height, std::vector<float> (texels) };
+	double sum = 0.0;
+	float least = 1.0f, most = 0.0f;
+	for (size_t i = 0; i < texels; i++) {
+		unsigned char root = (unsigned char)floorf (sqrtf (ratios[i]) * 255.0f);
+		packed[i * 3 + 1] = root;
+		cones.depth[i] = root / 255.0f;
+		sum += ratios[i];
+		least = std::min (least, ratios[i]);
+		most = std::max (most, ratios[i]);
+	}
+	if (!write_tga (output, width, height, packed))
+		return 1;
+
+	printf ("cone map: %s %dx%d -> %s in %.1f ms, %d threads\n", input, width, height, output, ms.count (),
+		job_system.worker_count () + 1);
+	printf ("cone ratios: min %.4f avg %.4f max %.4f\n", least, sum / texels, most);
+	compare_techniques (depth, cones, heightScale, layers, coneSteps);
+	return 0;
+}
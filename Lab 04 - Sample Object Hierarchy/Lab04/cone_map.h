@@ -0,0 +1,63 @@
+#ifndef CONE_MAP_H
+#define CONE_MAP_H
+
+// Relaxed cone step maps for parallax occlusion mapping (Policarpo and
+// Oliveira, "Relaxed Cone Stepping for Relief Mapping", GPU Gems 3). Over
+// each texel of a depth map stands the widest upside down cone, apex on the
+// texel's floor, that no ray from the top surface can come into, cross the
+// floor and leave again. A ray can then always step as far as the cone
+// under it reaches, crossing the surface at most once, so the CONE_STEPS
+// variant of parallax_fragment.txt gets to the surface in a handful of
+// fetches where linear stepping takes one per layer, and a short binary
+// search finds the crossing.
+//
+//   Lab04 --bake-cone-map heightmap.bmp heightmap_cone.tga
+//
+// bakes the map offline. Red keeps the depth, green holds the square root of
+// the cone ratio (horizontal texture space reach per unit of depth, at most
+// 1) rounded down, the root for more precision on the narrow cones. The
+// result is an uncompressed TGA for stb_image. The bake then runs both
+// shader techniques on the CPU over a spread of view angles and prints the
+// fetches per pixel each took and how far each landed from a fine reference.
+
+#include <vector>
+
+// Depths in [0, 1] by rows, 0 at the surface. Wraps like GL_REPEAT.
+struct DepthField {
+	int width;
+	int height;
+	std::vector<float> depth;
+
+	float at(int x, int y) const
+	{
+		x %= width;
+		y %= height;
+		return depth[(y < 0 ? y + height : y) * width + (x < 0 ? x + width : x)];
+	}
+};
+
+// The relaxed cone ratio of every texel. Rows are shared out over the job
+// system and each texel's candidate rays are marched four at a time on the
+// f4 wrapper from simd_f4.h.
+void build_cone_ratios(const DepthField& field, std::vector<float>& ratios);
+
+// Where one of the reference marches put the surface, and the texture
+// fetches it took to get there
+struct ParallaxHit {
+	float u;
+	float v;
+	int fetches;
+};
+
+// parallax_fragment.txt's two techniques on the CPU, sampling bilinearly like
+// the shader does. viewDir points at the eye in tangent space. cones holds
+// the square roots of the ratios as the shader reads them from green.
+ParallaxHit parallax_layers(const DepthField& depth, float u, float v, const float viewDir[3], float heightScale, int maxLayers);
+ParallaxHit parallax_cones(const DepthField& depth, const DepthField& cones, float u, float v, const float viewDir[3],
+	float heightScale, int coneSteps);
+
+// --bake-cone-map: reads input's red channel as depth, writes output and
+// prints the comparison. 0 on success.
+int run_cone_map_tool(const char* input, const char* output, float heightScale, int layers, int coneSteps);
+
+#endif
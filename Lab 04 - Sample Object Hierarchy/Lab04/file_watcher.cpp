@@ -0,0 +1,136 @@
+// Changed file detection, see file_watcher.h
+#include "file_watcher.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#define FILE_WATCHER_INOTIFY
+#endif
+
+static time_t modified_time (const char* path) {
+#ifdef _WIN32
+	struct _stat st;
+	return _stat (path, &st) == 0 ? st.st_mtime : 0;
+#else
+	struct stat st;
+	return stat (path, &st) == 0 ? st.st_mtime : 0;
+#endif
+}
+
+FileWatcher::FileWatcher () : fd (-1) {
+	lastScan = std::chrono::steady_clock::now ();
+#ifdef FILE_WATCHER_INOTIFY
+	fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		fprintf (stderr, "WARNING: no inotify, watching files by their modification times\n");
+#endif
+}
+
+FileWatcher::~FileWatcher () {
+	release ();
+}
+
+void FileWatcher::add (const char* path) {
+	for (size_t i = 0; i < files.size (); i++) {
+		if (files[i].path == path)
+			return;
+	}
+	File file;
+	file.path = path;
+	size_t slash = file.path.find_last_of ("/\\");
+	file.dir = slash == std::string::npos ? "." : file.path.substr (0, slash);
+	file.name = slash == std::string::npos ? file.path : file.path.substr (slash + 1);
+	file.mtime = modified_time (path);
+	file.changed = false;
+	files.push_back (file);
+
+#ifdef FILE_WATCHER_INOTIFY
+	if (fd < 0)
+		return;
+	for (size_t i = 0; i < dirs.size (); i++) {
+		if (dirs[i].second == file.dir)
+			return;
+	}
+	// a save that renames a temporary file over the original ends in IN_MOVED_TO
+	int wd = inotify_add_watch (fd, file.dir.c_str (), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (wd < 0) {
+		fprintf (stderr, "WARNING: can't watch %s, watching files by their modification times\n", file.dir.c_str ());
+		release ();
+		return;
+	}
+	dirs.push_back (std::make_pair (wd, file.dir));
+#endif
+}
+
+int FileWatcher::poll (std::vector<std::string>& changed) {
+	changed.clear ();
+	if (fd >= 0) {
+		read_events ();
+	}
+	else {
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now ();
+		if (now - lastScan < std::chrono::milliseconds (FILE_WATCHER_INTERVAL_MS))
+			return 0;
+		lastScan = now;
+		scan_times ();
+	}
+	for (size_t i = 0; i < files.size (); i++) {
+		if (files[i].changed)
+			changed.push_back (files[i].path);
+		files[i].changed = false;
+	}
+	return (int)changed.size ();
+}
+
+void FileWatcher::release () {
+#ifdef FILE_WATCHER_INOTIFY
+	if (fd >= 0)
+		close (fd);
+#endif
+	// the files stay and are watched by their times from now on
+	fd = -1;
+	dirs.clear ();
+}
+
+void FileWatcher::read_events () {
+#ifdef FILE_WATCHER_INOTIFY
+	// aligned for the struct inotify_event at its start
+	alignas (struct inotify_event) char buffer[4096];
+	for (;;) {
+		ssize_t got = read (fd, buffer, sizeof (buffer));
+		if (got <= 0)
+			return;
+		for (char* p = buffer; p < buffer + got; ) {
+			const struct inotify_event* event = (const struct inotify_event*)p;
+			p += sizeof (struct inotify_event) + event->len;
+			if (event->len == 0)
+				continue;
+			const std::string* dir = NULL;
+			for (size_t i = 0; i < dirs.size (); i++) {
+				if (dirs[i].first == event->wd)
+					dir = &dirs[i].second;
+			}
+			for (size_t i = 0; dir && i < files.size (); i++) {
+				if (files[i].dir == *dir && files[i].name == event->name)
+					files[i].changed = true;
+			}
+		}
+	}
+#endif
+}
+
+void FileWatcher::scan_times () {
+	for (size_t i = 0; i < files.size (); i++) {
+		time_t mtime = modified_time (files[i].path.c_str ());
+		// 0 while an editor has the file moved away, look again next time
+		if (mtime != 0 && mtime != files[i].mtime) {
+			files[i].mtime = mtime;
+			files[i].changed = true;
+		}
+	}
+}
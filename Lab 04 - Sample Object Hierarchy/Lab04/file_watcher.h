@@ -0,0 +1,61 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+// Tells which of a set of files have been written since the last look, for
+// reloading assets while the program runs. On Linux inotify watches the
+// directories the files are in (editors often save by writing a new file and
+// renaming it over the old one, which a watch on the file itself would lose);
+// elsewhere, or if inotify can't be had, the modification times are compared
+// every FILE_WATCHER_INTERVAL_MS.
+//
+//   watcher.add("MultiLightFragment.txt");
+//   std::vector<std::string> changed;
+//   if (watcher.poll(changed) > 0) ... reload changed[i] ...
+//
+// poll() never blocks and doesn't allocate while nothing has changed.
+
+#include <time.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#define FILE_WATCHER_INTERVAL_MS 250
+
+class FileWatcher
+{
+public:
+	FileWatcher();
+	~FileWatcher();
+
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	// Watching the same path twice is harmless
+	void add(const char* path);
+
+	// Replaces changed with the watched paths written since the last call, as
+	// they were given to add(), each once. Returns how many.
+	int poll(std::vector<std::string>& changed);
+
+	void release();
+
+private:
+	struct File {
+		std::string path;
+		std::string dir;
+		std::string name;
+		time_t mtime;
+		bool changed;
+	};
+
+	std::vector<File> files;
+	// inotify descriptor and the watch of each directory, -1 if not used
+	int fd;
+	std::vector<std::pair<int, std::string> > dirs;
+	std::chrono::steady_clock::time_point lastScan;
+
+	void read_events();
+	void scan_times();
+};
+
+#endif
@@ -0,0 +1,28 @@
+// Global heap counter for frame_arena.h. Replacing operator new and delete
+// puts every C++ allocation of the program through here, the arrays and the
+// nothrow forms call these as well.
+#include "frame_arena.h"
+
+#include <atomic>
+
+static std::atomic<unsigned long long> heap_allocations (0);
+
+unsigned long long heap_allocation_count () {
+	return heap_allocations.load (std::memory_order_relaxed);
+}
+
+void* operator new (size_t bytes) {
+	heap_allocations.fetch_add (1, std::memory_order_relaxed);
+	void* p = malloc (bytes > 0 ? bytes : 1);
+	if (!p)
+		throw std::bad_alloc ();
+	return p;
+}
+
+void operator delete (void* p) noexcept {
+	free (p);
+}
+
+void operator delete (void* p, size_t) noexcept {
+	free (p);
+}
@@ -0,0 +1,269 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+// Bump allocator for data that lives for a frame: draw packets, per-frame
+// scratch lists. Allocating is a pointer bump and nothing is freed on its
+// own, the whole arena is reset when its frame comes round again.
+// FrameArenas keeps two and alternates, so whatever was allocated last frame
+// is still valid while this one is built and is only reused the frame after.
+//
+//   frame_arenas.begin_frame();
+//   FrameVector<DrawPacket> list(&frame_arenas.current());
+//
+// With FRAME_ARENA_DEBUG (the default without NDEBUG) every allocation is
+// followed by guard bytes that reset() checks, fresh memory is filled with
+// 0xCD and released memory with 0xDD so stale reads stand out. A full arena
+// falls back to the heap for the rest of the frame and says so once.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#if !defined(NDEBUG) && !defined(FRAME_ARENA_DEBUG)
+#define FRAME_ARENA_DEBUG
+#endif
+
+#define FRAME_ARENA_ALIGN 16
+#define FRAME_ARENA_GUARD_SIZE 8
+#define FRAME_ARENA_GUARD 0xFD
+#define FRAME_ARENA_FRESH 0xCD
+#define FRAME_ARENA_DEAD 0xDD
+
+class FrameArena
+{
+public:
+	explicit FrameArena(size_t bytes = 0)
+		: base(NULL), capacity(0), offset(0), highWater(0), last(0), overflow(NULL), overflows(0), warned(false)
+	{
+		if (bytes > 0)
+			init(bytes);
+	}
+
+	~FrameArena() { release(); }
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	void init(size_t bytes)
+	{
+		release();
+		base = (uint8_t*)malloc(bytes);
+		capacity = base ? bytes : 0;
+#ifdef FRAME_ARENA_DEBUG
+		if (base)
+			memset(base, FRAME_ARENA_DEAD, capacity);
+#endif
+	}
+
+	void release()
+	{
+		reset();
+		free(base);
+		base = NULL;
+		capacity = 0;
+	}
+
+	// align must be a power of two
+	void* allocate(size_t bytes, size_t align = FRAME_ARENA_ALIGN)
+	{
+#ifdef FRAME_ARENA_DEBUG
+		if (align < sizeof(size_t))
+			align = sizeof(size_t);
+		// the size and the previous allocation sit just before the block so
+		// reset() can walk back through them and check the guards
+		size_t start = align_up(offset + 2 * sizeof(size_t), align);
+		size_t end = start + bytes + FRAME_ARENA_GUARD_SIZE;
+		if (end > capacity)
+			return heap_allocate(bytes, align);
+		size_t* header = (size_t*)(base + start) - 2;
+		header[0] = bytes;
+		header[1] = last;
+		last = start;
+		memset(base + start, FRAME_ARENA_FRESH, bytes);
+		memset(base + start + bytes, FRAME_ARENA_GUARD, FRAME_ARENA_GUARD_SIZE);
+#else
+		size_t start = align_up(offset, align);
+		size_t end = start + bytes;
+		if (end > capacity)
+			return heap_allocate(bytes, align);
+#endif
+		offset = end;
+		if (offset > highWater)
+			highWater = offset;
+		return base + start;
+	}
+
+	// Everything allocated since the last reset is gone after this
+	void reset()
+	{
+#ifdef FRAME_ARENA_DEBUG
+		check_guards();
+		if (base)
+			memset(base, FRAME_ARENA_DEAD, offset);
+#endif
+		offset = 0;
+		last = 0;
+		while (overflow)
+		{
+			OverflowBlock* next = overflow->next;
+			free(overflow);
+			overflow = next;
+		}
+	}
+
+	size_t used() const { return offset; }
+	size_t size() const { return capacity; }
+	size_t high_water() const { return highWater; }
+	// allocations that did not fit and went to the heap, since init()
+	unsigned int overflow_count() const { return overflows; }
+
+#ifdef FRAME_ARENA_DEBUG
+	// Aborts if anything wrote past the end of its allocation
+	void check_guards() const
+	{
+		for (size_t start = last; start != 0; )
+		{
+			const size_t* header = (const size_t*)(base + start) - 2;
+			const uint8_t* guard = base + start + header[0];
+			for (int i = 0; i < FRAME_ARENA_GUARD_SIZE; i++)
+			{
+				if (guard[i] != FRAME_ARENA_GUARD)
+				{
+					fprintf(stderr, "ERROR: frame arena allocation of %zu bytes at +%zu was overrun\n", header[0], start);
+					abort();
+				}
+			}
+			start = header[1];
+		}
+	}
+#endif
+
+private:
+	// heap blocks of a full arena, freed together on reset
+	struct OverflowBlock {
+		OverflowBlock* next;
+	};
+
+	uint8_t* base;
+	size_t capacity;
+	size_t offset;
+	size_t highWater;
+	// start of the newest allocation, debug builds only
+	size_t last;
+	OverflowBlock* overflow;
+	unsigned int overflows;
+	bool warned;
+
+	static size_t align_up(size_t value, size_t align)
+	{
+		return (value + align - 1) & ~(align - 1);
+	}
+
+	void* heap_allocate(size_t bytes, size_t align)
+	{
+		if (!warned)
+		{
+			fprintf(stderr, "WARNING: frame arena of %zu KB is full, the rest of the frame uses the heap\n", capacity / 1024);
+			warned = true;
+		}
+		overflows++;
+		if (align < sizeof(OverflowBlock))
+			align = sizeof(OverflowBlock);
+		size_t head = align_up(sizeof(OverflowBlock), align);
+		uint8_t* block = (uint8_t*)malloc(head + bytes + align);
+		if (!block)
+			throw std::bad_alloc();
+		OverflowBlock* link = (OverflowBlock*)block;
+		link->next = overflow;
+		overflow = link;
+		return (void*)align_up((size_t)(block + head), align);
+	}
+};
+
+// Two arenas used on alternate frames
+class FrameArenas
+{
+public:
+	explicit FrameArenas(size_t bytes_each) : index(0), frames(0)
+	{
+		arenas[0].init(bytes_each);
+		arenas[1].init(bytes_each);
+	}
+
+	// Switches to the other arena and empties it, call before the frame allocates
+	void begin_frame()
+	{
+		index ^= 1;
+		arenas[index].reset();
+		frames++;
+	}
+
+	FrameArena& current() { return arenas[index]; }
+	FrameArena& previous() { return arenas[index ^ 1]; }
+
+	void print() const
+	{
+		size_t high = arenas[0].high_water() > arenas[1].high_water() ? arenas[0].high_water() : arenas[1].high_water();
+		printf("frame arena: 2 x %zu KB, %.1f KB used at most, %u allocations went to the heap over %u frames\n",
+			arenas[0].size() / 1024, high / 1024.0, arenas[0].overflow_count() + arenas[1].overflow_count(), frames);
+	}
+
+private:
+	FrameArena arenas[2];
+	int index;
+	unsigned int frames;
+};
+
+// Standard allocator over a FrameArena, deallocate does nothing and the
+// memory comes back when the arena is reset. Without an arena it is the heap.
+// Moving or swapping a container takes its allocator along, so a member list
+// can be pointed at a new frame's arena with
+//   list = FrameVector<T>(&arena);
+template <typename T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+
+	FrameArena* arena;
+
+	ArenaAllocator(FrameArena* arena = NULL) : arena(arena) {}
+
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(size_t n)
+	{
+		if (!arena)
+			return (T*)::operator new(n * sizeof(T));
+		return (T*)arena->allocate(n * sizeof(T), alignof(T));
+	}
+
+	void deallocate(T* p, size_t)
+	{
+		if (!arena)
+			::operator delete(p);
+	}
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena == b.arena; }
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena != b.arena; }
+
+template <typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T> >;
+
+// Calls to the global operator new since the program started, from any
+// thread. Counts C++ allocations only, malloc inside drivers is not seen.
+unsigned long long heap_allocation_count();
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+// Lock-free handoffs between the simulation thread and the render thread.
+// Each has exactly one producer and one consumer, neither side ever blocks
+// the other.
+
+#include <atomic>
+#include <stddef.h>
+
+// Latest-value handoff. The producer fills write_buffer() and publishes it,
+// the consumer takes the newest published value and reads it for as long as
+// it likes. With two slots the producer would have to wait for the consumer
+// to let go of one; the third is what lets both run freely, so the reader
+// always has a whole, unchanging snapshot and the writer always has a free one.
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : middle(1), back(0), front(2) {}
+
+	// Producer side
+	T& write_buffer() { return slots[back]; }
+
+	void publish()
+	{
+		int prev = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+		back = prev & INDEX;
+	}
+
+	// true until the consumer has taken the last published value
+	bool pending() const { return (middle.load(std::memory_order_acquire) & FRESH) != 0; }
+
+	// Consumer side, false when nothing new has been published
+	bool take()
+	{
+		if (!pending())
+			return false;
+		int prev = middle.exchange(front, std::memory_order_acq_rel);
+		front = prev & INDEX;
+		return true;
+	}
+
+	const T& read_buffer() const { return slots[front]; }
+
+private:
+	enum { INDEX = 3, FRESH = 4 };
+
+	T slots[3];
+	// index of the slot between the two sides, plus FRESH when it is unread
+	std::atomic<int> middle;
+	int back;
+	int front;
+};
+
+// Fixed size single producer, single consumer queue. push fails when full.
+template <typename T, size_t N>
+class SpscQueue
+{
+public:
+	SpscQueue() : head(0), tail(0) {}
+
+	bool push(const T& value)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == N)
+			return false;
+		items[t % N] = value;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& value)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+		value = items[h % N];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	T items[N];
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+#include <math.h>
+
+// Axis aligned box in whatever space its owner says (mesh local for arena meshes)
+struct AABB {
+	glm::vec3 min;
+	glm::vec3 max;
+
+	AABB() : min(1e30f), max(-1e30f) {}
+	AABB(const glm::vec3& lo, const glm::vec3& hi) : min(lo), max(hi) {}
+
+	void extend(const glm::vec3& p)
+	{
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+
+	bool empty() const { return min.x > max.x; }
+
+	glm::vec3 centre() const { return (min + max) * 0.5f; }
+	glm::vec3 extents() const { return (max - min) * 0.5f; }
+
+	// Box enclosing this one after an affine transform (Arvo's method)
+	AABB transformed(const glm::mat4& m) const
+	{
+		glm::vec3 c = glm::vec3(m * glm::vec4(centre(), 1.0f));
+		glm::vec3 e = extents();
+		glm::vec3 r;
+		for (int i = 0; i < 3; i++)
+			r[i] = fabsf(m[0][i]) * e.x + fabsf(m[1][i]) * e.y + fabsf(m[2][i]) * e.z;
+		return AABB(c - r, c + r);
+	}
+};
+
+// Six clip planes pulled out of a view-projection matrix (Gribb/Hartmann),
+// normals point inwards.
+class Frustum
+{
+public:
+	glm::vec4 planes[6];
+
+	Frustum() {}
+
+	explicit Frustum(const glm::mat4& viewProj)
+	{
+		set(viewProj);
+	}
+
+	void set(const glm::mat4& m)
+	{
+		// glm is column major, row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+		glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+		planes[0] = row3 + row0; // left
+		planes[1] = row3 - row0; // right
+		planes[2] = row3 + row1; // bottom
+		planes[3] = row3 - row1; // top
+		planes[4] = row3 + row2; // near
+		planes[5] = row3 - row2; // far
+		for (int i = 0; i < 6; i++)
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+
+	// Conservative: may keep boxes that are just outside a corner
+	bool intersects(const AABB& box) const
+	{
+		glm::vec3 c = box.centre();
+		glm::vec3 e = box.extents();
+		for (int i = 0; i < 6; i++)
+		{
+			glm::vec3 n(planes[i]);
+			float r = e.x * fabsf(n.x) + e.y * fabsf(n.y) + e.z * fabsf(n.z);
+			if (glm::dot(n, c) + planes[i].w + r < 0.0f)
+				return false;
+		}
+		return true;
+	}
+
+	bool intersects_sphere(const glm::vec3& centre, float radius) const
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			if (glm::dot(glm::vec3(planes[i]), centre) + planes[i].w < -radius)
+				return false;
+		}
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef GAME_LOOP_H
+#define GAME_LOOP_H
+
+#include "platform.h"
+
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+
+// Runs the simulation in fixed steps, however fast frames are drawn. Real time
+// goes into an accumulator and whole steps are taken out of it, the part of a
+// step left over is alpha(), which the renderer uses to blend between the
+// previous and the current simulation state. Falling far behind (a breakpoint,
+// a window drag) runs at most max_steps and drops the rest rather than trying
+// to catch up forever.
+//
+// With a frame cap, advance() sleeps until the next frame is due instead of
+// letting the idle callback spin. Without one, frames go as fast as the swap
+// allows, with vsync on that paces the loop to the display.
+class GameLoop
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	explicit GameLoop(double step_seconds = 1.0 / 60.0, int max_steps = 5)
+		: step(step_seconds), max_steps(max_steps), frame_interval(0.0), started(false), paced(false), accumulator(0.0)
+	{
+		reset_stats();
+	}
+
+	// 0 turns the cap off
+	void set_frame_cap(double fps)
+	{
+		frame_interval = fps > 0.0 ? 1.0 / fps : 0.0;
+		if (fps > 0.0)
+			platform_fine_sleep();
+	}
+
+	// Sleeps until the next frame is due when capped. advance() calls it, a
+	// loop that only draws can use it on its own.
+	void wait_frame()
+	{
+		if (frame_interval <= 0.0)
+			return;
+		Clock::time_point now = Clock::now();
+		if (!paced)
+		{
+			paced = true;
+			next_frame = now;
+		}
+		wait_until(next_frame);
+		now = Clock::now();
+		next_frame += to_duration(frame_interval);
+		// more than a frame late, start counting again from now
+		if (next_frame < now)
+			next_frame = now + to_duration(frame_interval);
+	}
+
+	// Waits for the next frame if capped, then calls step_fn(dt) for every
+	// step that is due. Returns the number of steps taken.
+	template <typename StepFn>
+	int advance(StepFn step_fn)
+	{
+		wait_frame();
+		Clock::time_point now = Clock::now();
+		if (!started)
+		{
+			started = true;
+			last = now;
+		}
+
+		accumulator += std::chrono::duration<double>(now - last).count();
+		last = now;
+
+		int steps = 0;
+		Clock::time_point sim_start = Clock::now();
+		while (accumulator >= step && steps < max_steps)
+		{
+			step_fn((float)step);
+			accumulator -= step;
+			steps++;
+		}
+		if (accumulator >= step)
+		{
+			int skipped = (int)(accumulator / step);
+			dropped_steps += skipped;
+			accumulator -= skipped * step;
+		}
+
+		frames++;
+		total_steps += steps;
+		sim_seconds += std::chrono::duration<double>(Clock::now() - sim_start).count();
+		return steps;
+	}
+
+	// How far the simulation is into the next step, 0 to 1
+	float alpha() const { return (float)(accumulator / step); }
+	float step_seconds() const { return (float)step; }
+
+	void reset_stats()
+	{
+		frames = 0;
+		total_steps = 0;
+		dropped_steps = 0;
+		sim_seconds = 0.0;
+	}
+
+	void print() const
+	{
+		printf("loop: %u frames, %u steps of %.2f ms (%.2f per frame), %.3f ms per step, %u steps dropped, cap %s\n",
+			frames, total_steps, step * 1000.0, frames ? (double)total_steps / frames : 0.0,
+			total_steps ? sim_seconds * 1000.0 / total_steps : 0.0, dropped_steps,
+			frame_interval > 0.0 ? "on" : "off");
+	}
+
+private:
+	double step;
+	int max_steps;
+	double frame_interval;
+	bool started;
+	bool paced;
+	double accumulator;
+	Clock::time_point last;
+	Clock::time_point next_frame;
+
+	unsigned int frames;
+	unsigned int total_steps;
+	unsigned int dropped_steps;
+	double sim_seconds;
+
+	static Clock::duration to_duration(double seconds)
+	{
+		return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+	}
+
+	// Sleeps most of the way and yields for the last millisecond, OS sleeps
+	// tend to wake late
+	static void wait_until(Clock::time_point deadline)
+	{
+		const Clock::duration margin = std::chrono::milliseconds(1);
+		Clock::time_point now = Clock::now();
+		if (deadline - now > margin)
+			std::this_thread::sleep_for(deadline - now - margin);
+		while (Clock::now() < deadline)
+			std::this_thread::yield();
+	}
+};
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+// OpenGL includes
+#include "gl_includes.h"
+
+#include <stdio.h>
+
+// Render targets of the geometry pass of deferred shading. The lit meshes
+// write what the lighting needs per pixel and the lighting is then done once
+// per pixel in a full-screen pass, rather than once per fragment drawn.
+// Sixteen bytes a pixel:
+//   albedo    RGBA8, the diffuse texel
+//   specular  RGBA8, the specular texel with material.shininess / 255 in alpha
+//   normal    RG16, the world space normal folded onto an octahedron
+//   depth     DEPTH_COMPONENT24, positions are rebuilt from it and the
+//             inverse view-projection, so no position target
+#define GBUFFER_TARGETS 3
+
+enum GBufferTexture {
+	GBUFFER_ALBEDO = 0,
+	GBUFFER_SPECULAR,
+	GBUFFER_NORMAL,
+	GBUFFER_DEPTH,
+	GBUFFER_TEXTURES
+};
+
+class GBuffer
+{
+public:
+	GLuint fbo;
+	GLuint textures[GBUFFER_TEXTURES];
+	int width;
+	int height;
+
+	GBuffer() : fbo(0), width(0), height(0)
+	{
+		for (int i = 0; i < GBUFFER_TEXTURES; i++)
+			textures[i] = 0;
+	}
+
+	// (Re)creates the targets at width x height, nothing to do if they
+	// already are that size. The bound framebuffer is left bound.
+	bool create(int w, int h)
+	{
+		if (fbo && w == width && h == height)
+			return true;
+		release();
+		GLint previous = 0;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+		width = w;
+		height = h;
+
+		static const GLint formats[GBUFFER_TEXTURES] = { GL_RGBA8, GL_RGBA8, GL_RG16, GL_DEPTH_COMPONENT24 };
+		static const GLenum layouts[GBUFFER_TEXTURES] = { GL_RGBA, GL_RGBA, GL_RG, GL_DEPTH_COMPONENT };
+		static const GLenum types[GBUFFER_TEXTURES] = { GL_UNSIGNED_BYTE, GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, GL_UNSIGNED_INT };
+		glGenTextures(GBUFFER_TEXTURES, textures);
+		for (int i = 0; i < GBUFFER_TEXTURES; i++)
+		{
+			glBindTexture(GL_TEXTURE_2D, textures[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, formats[i], width, height, 0, layouts[i], types[i], NULL);
+			// read with texelFetch, one texel per pixel
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		GLenum buffers[GBUFFER_TARGETS];
+		for (int i = 0; i < GBUFFER_TARGETS; i++)
+		{
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, textures[i], 0);
+			buffers[i] = GL_COLOR_ATTACHMENT0 + i;
+		}
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, textures[GBUFFER_DEPTH], 0);
+		glDrawBuffers(GBUFFER_TARGETS, buffers);
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindFramebuffer(GL_FRAMEBUFFER, previous);
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+		{
+			fprintf(stderr, "ERROR: g-buffer framebuffer incomplete (0x%x)\n", status);
+			release();
+			return false;
+		}
+		return true;
+	}
+
+	void release()
+	{
+		if (fbo)
+			glDeleteFramebuffers(1, &fbo);
+		if (textures[0])
+			glDeleteTextures(GBUFFER_TEXTURES, textures);
+		fbo = 0;
+		for (int i = 0; i < GBUFFER_TEXTURES; i++)
+			textures[i] = 0;
+		width = height = 0;
+	}
+
+	// The geometry pass draws here. Only depth needs clearing, the lighting
+	// pass skips pixels still at the far plane without reading the rest.
+	void begin_geometry()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glClear(GL_DEPTH_BUFFER_BIT);
+	}
+
+	// Binds the targets to units firstUnit.. in GBufferTexture order
+	void bind_textures(GLuint firstUnit) const
+	{
+		for (int i = 0; i < GBUFFER_TEXTURES; i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+			glBindTexture(GL_TEXTURE_2D, textures[i]);
+		}
+	}
+
+	// Takes them off again before the next geometry pass renders to them
+	void unbind_textures(GLuint firstUnit) const
+	{
+		for (int i = 0; i < GBUFFER_TEXTURES; i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+	}
+
+	size_t bytes() const
+	{
+		return (size_t)width * height * 16;
+	}
+};
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+// OpenGL includes
+#include "gl_includes.h"
+#include <glm/glm.hpp>
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "frustum.h"
+
+// Attribute slot of the per-draw index used by the indirect path
+#define DRAW_ID_LOCATION 12
+// the mesh itself and up to three simplified levels, see mesh_lod.h
+#define MAX_MESH_LODS 4
+
+// Interleaved vertex as stored in the arena
+struct ArenaVertex {
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 uv;
+};
+
+// A level of detail of a mesh, indices over the same vertices
+struct MeshLod {
+	GLuint firstIndex;
+	GLuint indexCount;
+	// simplification error, a fraction of the bounds' diagonal
+	float error;
+};
+
+// Where a mesh lives inside the arena, in the units glDrawElements* wants
+struct MeshRange {
+	GLuint firstIndex;
+	GLuint indexCount;
+	GLint baseVertex;
+	GLuint vertexCount;
+	AABB bounds;
+	// lods[0] is firstIndex and indexCount
+	int lodCount;
+	MeshLod lods[MAX_MESH_LODS];
+};
+
+// All static meshes share one vertex buffer, one index buffer and one VAO so
+// they can be drawn by a single multi-draw call. Identical vertices inside a
+// mesh are welded while building the index list.
+class GeometryArena
+{
+public:
+	GLuint vao;
+	GLuint vbo;
+	GLuint ibo;
+	// the same meshes with positions only, for depth-only passes
+	GLuint depthVao;
+	GLuint positionVbo;
+
+	GeometryArena() : vao(0), vbo(0), ibo(0), depthVao(0), positionVbo(0), uploaded(false) {}
+
+	// Adds a non-indexed triangle list. normals and uvs may be NULL.
+	int add_mesh(const glm::vec3* positions, const glm::vec3* normals, const glm::vec2* uvs, size_t count)
+	{
+		MeshRange range;
+		range.firstIndex = (GLuint)indices.size();
+		range.baseVertex = (GLint)vertices.size();
+
+		// open addressing table of local vertex index + 1, 0 is empty
+		size_t tableSize = 64;
+		while (tableSize < count * 2)
+			tableSize <<= 1;
+		std::vector<GLuint> table(tableSize, 0);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			ArenaVertex v;
+			v.position = positions[i];
+			v.normal = normals ? normals[i] : glm::vec3(0.0f, 1.0f, 0.0f);
+			v.uv = uvs ? uvs[i] : glm::vec2(0.0f);
+			range.bounds.extend(v.position);
+
+			size_t slot = hash_vertex(v) & (tableSize - 1);
+			GLuint local = 0;
+			for (;;)
+			{
+				GLuint entry = table[slot];
+				if (entry == 0)
+				{
+					vertices.push_back(v);
+					local = (GLuint)(vertices.size() - range.baseVertex - 1);
+					table[slot] = local + 1;
+					break;
+				}
+				if (memcmp(&vertices[range.baseVertex + entry - 1], &v, sizeof(ArenaVertex)) == 0)
+				{
+					local = entry - 1;
+					break;
+				}
+				slot = (slot + 1) & (tableSize - 1);
+			}
+			indices.push_back(local);
+		}
+
+		range.indexCount = (GLuint)indices.size() - range.firstIndex;
+		range.vertexCount = (GLuint)vertices.size() - range.baseVertex;
+		range.lodCount = 1;
+		range.lods[0].firstIndex = range.firstIndex;
+		range.lods[0].indexCount = range.indexCount;
+		range.lods[0].error = 0.0f;
+		meshes.push_back(range);
+		printf("  arena mesh %d: %u indices, %u unique vertices\n", (int)meshes.size() - 1, range.indexCount, range.vertexCount);
+		return (int)meshes.size() - 1;
+	}
+
+	// Adds interleaved position/normal/uv floats, as in cube.h
+	int add_interleaved(const float* data, size_t count)
+	{
+		std::vector<glm::vec3> p(count), n(count);
+		std::vector<glm::vec2> t(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			const float* v = data + i * 8;
+			p[i] = glm::vec3(v[0], v[1], v[2]);
+			n[i] = glm::vec3(v[3], v[4], v[5]);
+			t[i] = glm::vec2(v[6], v[7]);
+		}
+		return add_mesh(&p[0], &n[0], &t[0], count);
+	}
+
+	// Appends a coarser level to a mesh, its indices counting from the mesh's
+	// base vertex. Has to come before upload().
+	void add_lod(int id, const std::vector<GLuint>& lodIndices, float error)
+	{
+		MeshRange& range = meshes[id];
+		if (uploaded || range.lodCount >= MAX_MESH_LODS || lodIndices.empty())
+			return;
+		MeshLod& lod = range.lods[range.lodCount++];
+		lod.firstIndex = (GLuint)indices.size();
+		lod.indexCount = (GLuint)lodIndices.size();
+		lod.error = error;
+		indices.insert(indices.end(), lodIndices.begin(), lodIndices.end());
+	}
+
+	const MeshRange& mesh(int id) const { return meshes[id]; }
+	int mesh_count() const { return (int)meshes.size(); }
+	// the CPU copy the buffers are made from, index_data()[range.firstIndex]
+	// on counting from vertex_data()[range.baseVertex]
+	const ArenaVertex* vertex_data() const { return vertices.empty() ? NULL : &vertices[0]; }
+	const GLuint* index_data() const { return indices.empty() ? NULL : &indices[0]; }
+
+	// Creates the GPU buffers. drawIds is a buffer of consecutive uints used
+	// as an instanced attribute so base instance doubles as the draw index.
+	void upload(GLuint drawIds)
+	{
+		if (vertices.empty())
+			return;
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+
+		glGenBuffers(1, &vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(ArenaVertex), &vertices[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(ArenaVertex), (void*)0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(ArenaVertex), (void*)sizeof(glm::vec3));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(ArenaVertex), (void*)(2 * sizeof(glm::vec3)));
+
+		glGenBuffers(1, &ibo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+
+		glBindBuffer(GL_ARRAY_BUFFER, drawIds);
+		glEnableVertexAttribArray(DRAW_ID_LOCATION);
+		glVertexAttribIPointer(DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+		glVertexAttribDivisor(DRAW_ID_LOCATION, 1);
+
+		// 12 bytes a vertex rather than 32, a depth pass fetches nothing else
+		// but the draw id
+		std::vector<glm::vec3> positions(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+			positions[i] = vertices[i].position;
+		glGenVertexArrays(1, &depthVao);
+		glBindVertexArray(depthVao);
+		glGenBuffers(1, &positionVbo);
+		glBindBuffer(GL_ARRAY_BUFFER, positionVbo);
+		glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), &positions[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		glBindBuffer(GL_ARRAY_BUFFER, drawIds);
+		glEnableVertexAttribArray(DRAW_ID_LOCATION);
+		glVertexAttribIPointer(DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+		glVertexAttribDivisor(DRAW_ID_LOCATION, 1);
+
+		glBindVertexArray(0);
+		printf("geometry arena: %u vertices, %u indices\n", (unsigned)vertices.size(), (unsigned)indices.size());
+		uploaded = true;
+	}
+
+	bool ready() const { return uploaded; }
+
+private:
+	std::vector<ArenaVertex> vertices;
+	std::vector<GLuint> indices;
+	std::vector<MeshRange> meshes;
+	bool uploaded;
+
+	// FNV-1a over the raw vertex bytes
+	static size_t hash_vertex(const ArenaVertex& v)
+	{
+		const unsigned char* bytes = (const unsigned char*)&v;
+		unsigned int h = 2166136261u;
+		for (size_t i = 0; i < sizeof(ArenaVertex); i++)
+		{
+			h ^= bytes[i];
+			h *= 16777619u;
+		}
+		return h;
+	}
+};
+
+#endif
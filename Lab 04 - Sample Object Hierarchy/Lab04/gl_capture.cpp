@@ -0,0 +1,584 @@
+// GL call recorder, see gl_capture.h
+#define GL_CAPTURE_IMPL
+#include "gl_includes.h"
+#include "platform.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// bytes kept in memory before they are written out
+#define CAPTURE_FLUSH_SIZE (1 << 20)
+
+static struct {
+	FILE* file;
+	std::vector<unsigned char> buffer;
+	unsigned int frames;
+	unsigned long long calls;
+	unsigned long long uploaded;
+	unsigned long long written;
+	// fences made while recording, by the id the trace knows them by
+	std::vector<GLsync> syncs;
+} capture = {};
+
+static void flush_capture () {
+	if (!capture.buffer.empty ()) {
+		fwrite (&capture.buffer[0], 1, capture.buffer.size (), capture.file);
+		capture.written += capture.buffer.size ();
+		capture.buffer.clear ();
+	}
+}
+
+static void put_u32 (unsigned int v) {
+	unsigned char b[4] = { (unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24) };
+	capture.buffer.insert (capture.buffer.end (), b, b + 4);
+}
+
+static void put_u64 (unsigned long long v) {
+	put_u32 ((unsigned int)v);
+	put_u32 ((unsigned int)(v >> 32));
+}
+
+static void put_f32 (float f) {
+	unsigned int v;
+	memcpy (&v, &f, 4);
+	put_u32 (v);
+}
+
+static void put_blob (const void* data, size_t bytes) {
+	if (data == NULL) {
+		put_u32 (GL_CAPTURE_NULL);
+		return;
+	}
+	put_u32 ((unsigned int)bytes);
+	const unsigned char* p = (const unsigned char*)data;
+	capture.buffer.insert (capture.buffer.end (), p, p + bytes);
+	capture.uploaded += bytes;
+}
+
+static void put_names (GLsizei n, const GLuint* names) {
+	put_u32 ((unsigned int)n);
+	for (GLsizei i = 0; i < n; i++) {
+		put_u32 (names[i]);
+	}
+}
+
+static void put_string (const char* s) {
+	put_blob (s, strlen (s));
+}
+
+static void begin_call (GLCaptureOp op) {
+	capture.buffer.push_back ((unsigned char)op);
+	capture.calls++;
+}
+
+// size of the pixel data glTexImage reads, with the default unpack alignment of 4
+static size_t image_bytes (GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type) {
+	size_t components = 4;
+	switch (format) {
+		case GL_RED: case GL_RED_INTEGER: case GL_DEPTH_COMPONENT: components = 1; break;
+		case GL_RG: case GL_RG_INTEGER: case GL_DEPTH_STENCIL: components = 2; break;
+		case GL_RGB: case GL_BGR: case GL_RGB_INTEGER: components = 3; break;
+		default: break;
+	}
+	size_t size = 1;
+	switch (type) {
+		case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: size = 2; break;
+		case GL_UNSIGNED_INT: case GL_INT: case GL_FLOAT: size = 4; break;
+		case GL_UNSIGNED_INT_24_8: size = 4; components = 1; break;
+		default: break;
+	}
+	size_t row = ((size_t)width * components * size + 3) & ~(size_t)3;
+	return row * height * depth;
+}
+
+bool gl_capture_begin (const char* path) {
+	capture.file = platform_fopen (path, "wb");
+	if (capture.file == NULL) {
+		fprintf (stderr, "capture: can't write %s\n", path);
+		return false;
+	}
+	capture.frames = 0;
+	capture.calls = capture.uploaded = capture.written = 0;
+	capture.syncs.clear ();
+	put_u32 (GL_CAPTURE_MAGIC);
+	put_u32 (GL_CAPTURE_VERSION);
+	printf ("capture: recording GL calls to %s\n", path);
+	return true;
+}
+
+bool gl_capture_active () {
+	return capture.file != NULL;
+}
+
+void gl_capture_frame () {
+	if (capture.file == NULL) {
+		return;
+	}
+	capture.buffer.push_back ((unsigned char)CAPTURE_FRAME_END);
+	capture.frames++;
+	if (capture.buffer.size () > CAPTURE_FLUSH_SIZE) {
+		flush_capture ();
+	}
+}
+
+void gl_capture_end () {
+	if (capture.file == NULL) {
+		return;
+	}
+	flush_capture ();
+	fclose (capture.file);
+	capture.file = NULL;
+	printf ("capture: %u frames, %llu calls, %llu KB of data, trace is %llu KB\n",
+		capture.frames, capture.calls, capture.uploaded / 1024, capture.written / 1024);
+}
+
+/*--------------------------------WRAPPERS-----------------------------------*/
+// each one makes the real call, and records it while a capture is running.
+// calls that hand out names record the names they got back.
+
+void capture_glGenBuffers (GLsizei n, GLuint* buffers) {
+	glGenBuffers (n, buffers);
+	if (capture.file) { begin_call (CAPTURE_GEN_BUFFERS); put_names (n, buffers); }
+}
+
+void capture_glGenVertexArrays (GLsizei n, GLuint* arrays) {
+	glGenVertexArrays (n, arrays);
+	if (capture.file) { begin_call (CAPTURE_GEN_VERTEX_ARRAYS); put_names (n, arrays); }
+}
+
+void capture_glGenTextures (GLsizei n, GLuint* textures) {
+	glGenTextures (n, textures);
+	if (capture.file) { begin_call (CAPTURE_GEN_TEXTURES); put_names (n, textures); }
+}
+
+void capture_glGenFramebuffers (GLsizei n, GLuint* framebuffers) {
+	glGenFramebuffers (n, framebuffers);
+	if (capture.file) { begin_call (CAPTURE_GEN_FRAMEBUFFERS); put_names (n, framebuffers); }
+}
+
+void capture_glGenRenderbuffers (GLsizei n, GLuint* renderbuffers) {
+	glGenRenderbuffers (n, renderbuffers);
+	if (capture.file) { begin_call (CAPTURE_GEN_RENDERBUFFERS); put_names (n, renderbuffers); }
+}
+
+void capture_glDeleteFramebuffers (GLsizei n, const GLuint* framebuffers) {
+	if (capture.file) { begin_call (CAPTURE_DELETE_FRAMEBUFFERS); put_names (n, framebuffers); }
+	glDeleteFramebuffers (n, framebuffers);
+}
+
+void capture_glDeleteTextures (GLsizei n, const GLuint* textures) {
+	if (capture.file) { begin_call (CAPTURE_DELETE_TEXTURES); put_names (n, textures); }
+	glDeleteTextures (n, textures);
+}
+
+void capture_glDeleteBuffers (GLsizei n, const GLuint* buffers) {
+	if (capture.file) { begin_call (CAPTURE_DELETE_BUFFERS); put_names (n, buffers); }
+	glDeleteBuffers (n, buffers);
+}
+
+// a deleted fence's id goes to the next one made
+GLsync capture_glFenceSync (GLenum condition, GLbitfield flags) {
+	GLsync sync = glFenceSync (condition, flags);
+	if (capture.file) {
+		size_t id = 0;
+		while (id < capture.syncs.size () && capture.syncs[id] != NULL) {
+			id++;
+		}
+		if (id == capture.syncs.size ()) {
+			capture.syncs.push_back (sync);
+		} else {
+			capture.syncs[id] = sync;
+		}
+		begin_call (CAPTURE_FENCE_SYNC); put_u32 (condition); put_u32 (flags); put_u32 ((unsigned int)id);
+	}
+	return sync;
+}
+
+// fences made before the capture started are left out, replay never had them
+void capture_glDeleteSync (GLsync sync) {
+	if (capture.file && sync != NULL) {
+		for (size_t id = 0; id < capture.syncs.size (); id++) {
+			if (capture.syncs[id] == sync) {
+				capture.syncs[id] = NULL;
+				begin_call (CAPTURE_DELETE_SYNC); put_u32 ((unsigned int)id);
+				break;
+			}
+		}
+	}
+	glDeleteSync (sync);
+}
+
+GLuint capture_glCreateProgram () {
+	GLuint program = glCreateProgram ();
+	if (capture.file) { begin_call (CAPTURE_CREATE_PROGRAM); put_u32 (program); }
+	return program;
+}
+
+GLuint capture_glCreateShader (GLenum type) {
+	GLuint shader = glCreateShader (type);
+	if (capture.file) { begin_call (CAPTURE_CREATE_SHADER); put_u32 (type); put_u32 (shader); }
+	return shader;
+}
+
+void capture_glBindBuffer (GLenum target, GLuint buffer) {
+	if (capture.file) { begin_call (CAPTURE_BIND_BUFFER); put_u32 (target); put_u32 (buffer); }
+	glBindBuffer (target, buffer);
+}
+
+void capture_glBindVertexArray (GLuint array) {
+	if (capture.file) { begin_call (CAPTURE_BIND_VERTEX_ARRAY); put_u32 (array); }
+	glBindVertexArray (array);
+}
+
+void capture_glBindTexture (GLenum target, GLuint texture) {
+	if (capture.file) { begin_call (CAPTURE_BIND_TEXTURE); put_u32 (target); put_u32 (texture); }
+	glBindTexture (target, texture);
+}
+
+void capture_glBindFramebuffer (GLenum target, GLuint framebuffer) {
+	if (capture.file) { begin_call (CAPTURE_BIND_FRAMEBUFFER); put_u32 (target); put_u32 (framebuffer); }
+	glBindFramebuffer (target, framebuffer);
+}
+
+void capture_glBindRenderbuffer (GLenum target, GLuint renderbuffer) {
+	if (capture.file) { begin_call (CAPTURE_BIND_RENDERBUFFER); put_u32 (target); put_u32 (renderbuffer); }
+	glBindRenderbuffer (target, renderbuffer);
+}
+
+void capture_glActiveTexture (GLenum texture) {
+	if (capture.file) { begin_call (CAPTURE_ACTIVE_TEXTURE); put_u32 (texture); }
+	glActiveTexture (texture);
+}
+
+void capture_glUseProgram (GLuint program) {
+	if (capture.file) { begin_call (CAPTURE_USE_PROGRAM); put_u32 (program); }
+	glUseProgram (program);
+}
+
+void capture_glBufferData (GLenum target, GLsizeiptr size, const void* data, GLenum usage) {
+	if (capture.file) {
+		begin_call (CAPTURE_BUFFER_DATA);
+		put_u32 (target);
+		put_u64 ((unsigned long long)size);
+		put_blob (data, (size_t)size);
+		put_u32 (usage);
+	}
+	glBufferData (target, size, data, usage);
+}
+
+void capture_glBufferSubData (GLenum target, GLintptr offset, GLsizeiptr size, const void* data) {
+	if (capture.file) {
+		begin_call (CAPTURE_BUFFER_SUB_DATA);
+		put_u32 (target);
+		put_u64 ((unsigned long long)offset);
+		put_blob (data, (size_t)size);
+	}
+	glBufferSubData (target, offset, size, data);
+}
+
+// replays as a mutable buffer, the trace carries the data the app mapped in
+void capture_glBufferStorage (GLenum target, GLsizeiptr size, const void* data, GLbitfield flags) {
+	if (capture.file) {
+		begin_call (CAPTURE_BUFFER_STORAGE);
+		put_u32 (target);
+		put_u64 ((unsigned long long)size);
+		put_blob (data, (size_t)size);
+		put_u32 (flags);
+	}
+	glBufferStorage (target, size, data, flags);
+}
+
+void gl_capture_buffer_write (GLenum target, size_t offset, size_t bytes, const void* data) {
+	if (capture.file) {
+		begin_call (CAPTURE_BUFFER_SUB_DATA);
+		put_u32 (target);
+		put_u64 ((unsigned long long)offset);
+		put_blob (data, bytes);
+	}
+}
+
+void capture_glTexImage2D (GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels) {
+	if (capture.file) {
+		begin_call (CAPTURE_TEX_IMAGE_2D);
+		put_u32 (target); put_u32 (level); put_u32 (internalformat);
+		put_u32 (width); put_u32 (height); put_u32 (border);
+		put_u32 (format); put_u32 (type);
+		put_blob (pixels, image_bytes (width, height, 1, format, type));
+	}
+	glTexImage2D (target, level, internalformat, width, height, border, format, type, pixels);
+}
+
+void capture_glTexImage3D (GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const void* pixels) {
+	if (capture.file) {
+		begin_call (CAPTURE_TEX_IMAGE_3D);
+		put_u32 (target); put_u32 (level); put_u32 (internalformat);
+		put_u32 (width); put_u32 (height); put_u32 (depth); put_u32 (border);
+		put_u32 (format); put_u32 (type);
+		put_blob (pixels, image_bytes (width, height, depth, format, type));
+	}
+	glTexImage3D (target, level, internalformat, width, height, depth, border, format, type, pixels);
+}
+
+void capture_glTexBuffer (GLenum target, GLenum internalformat, GLuint buffer) {
+	if (capture.file) { begin_call (CAPTURE_TEX_BUFFER); put_u32 (target); put_u32 (internalformat); put_u32 (buffer); }
+	glTexBuffer (target, internalformat, buffer);
+}
+
+void capture_glTexBufferRange (GLenum target, GLenum internalformat, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+	if (capture.file) {
+		begin_call (CAPTURE_TEX_BUFFER_RANGE);
+		put_u32 (target); put_u32 (internalformat); put_u32 (buffer);
+		put_u64 ((unsigned long long)offset); put_u64 ((unsigned long long)size);
+	}
+	glTexBufferRange (target, internalformat, buffer, offset, size);
+}
+
+void capture_glTexParameteri (GLenum target, GLenum pname, GLint param) {
+	if (capture.file) { begin_call (CAPTURE_TEX_PARAMETERI); put_u32 (target); put_u32 (pname); put_u32 (param); }
+	glTexParameteri (target, pname, param);
+}
+
+void capture_glGenerateMipmap (GLenum target) {
+	if (capture.file) { begin_call (CAPTURE_GENERATE_MIPMAP); put_u32 (target); }
+	glGenerateMipmap (target);
+}
+
+void capture_glRenderbufferStorage (GLenum target, GLenum internalformat, GLsizei width, GLsizei height) {
+	if (capture.file) { begin_call (CAPTURE_RENDERBUFFER_STORAGE); put_u32 (target); put_u32 (internalformat); put_u32 (width); put_u32 (height); }
+	glRenderbufferStorage (target, internalformat, width, height);
+}
+
+void capture_glFramebufferTexture2D (GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level) {
+	if (capture.file) { begin_call (CAPTURE_FRAMEBUFFER_TEXTURE_2D); put_u32 (target); put_u32 (attachment); put_u32 (textarget); put_u32 (texture); put_u32 (level); }
+	glFramebufferTexture2D (target, attachment, textarget, texture, level);
+}
+
+void capture_glFramebufferTextureLayer (GLenum target, GLenum attachment, GLuint texture, GLint level, GLint layer) {
+	if (capture.file) { begin_call (CAPTURE_FRAMEBUFFER_TEXTURE_LAYER); put_u32 (target); put_u32 (attachment); put_u32 (texture); put_u32 (level); put_u32 (layer); }
+	glFramebufferTextureLayer (target, attachment, texture, level, layer);
+}
+
+void capture_glFramebufferRenderbuffer (GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer) {
+	if (capture.file) { begin_call (CAPTURE_FRAMEBUFFER_RENDERBUFFER); put_u32 (target); put_u32 (attachment); put_u32 (renderbuffertarget); put_u32 (renderbuffer); }
+	glFramebufferRenderbuffer (target, attachment, renderbuffertarget, renderbuffer);
+}
+
+void capture_glBlitFramebuffer (GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter) {
+	if (capture.file) {
+		begin_call (CAPTURE_BLIT_FRAMEBUFFER);
+		put_u32 (srcX0); put_u32 (srcY0); put_u32 (srcX1); put_u32 (srcY1);
+		put_u32 (dstX0); put_u32 (dstY0); put_u32 (dstX1); put_u32 (dstY1);
+		put_u32 (mask); put_u32 (filter);
+	}
+	glBlitFramebuffer (srcX0, srcY0, srcX1, srcY1, dstX0, dstY0, dstX1, dstY1, mask, filter);
+}
+
+void capture_glEnable (GLenum cap) {
+	if (capture.file) { begin_call (CAPTURE_ENABLE); put_u32 (cap); }
+	glEnable (cap);
+}
+
+void capture_glDisable (GLenum cap) {
+	if (capture.file) { begin_call (CAPTURE_DISABLE); put_u32 (cap); }
+	glDisable (cap);
+}
+
+void capture_glDepthMask (GLboolean flag) {
+	if (capture.file) { begin_call (CAPTURE_DEPTH_MASK); put_u32 (flag); }
+	glDepthMask (flag);
+}
+
+void capture_glDepthFunc (GLenum func) {
+	if (capture.file) { begin_call (CAPTURE_DEPTH_FUNC); put_u32 (func); }
+	glDepthFunc (func);
+}
+
+void capture_glBlendFunc (GLenum sfactor, GLenum dfactor) {
+	if (capture.file) { begin_call (CAPTURE_BLEND_FUNC); put_u32 (sfactor); put_u32 (dfactor); }
+	glBlendFunc (sfactor, dfactor);
+}
+
+void capture_glClearColor (GLfloat r, GLfloat g, GLfloat b, GLfloat a) {
+	if (capture.file) { begin_call (CAPTURE_CLEAR_COLOR); put_f32 (r); put_f32 (g); put_f32 (b); put_f32 (a); }
+	glClearColor (r, g, b, a);
+}
+
+void capture_glClear (GLbitfield mask) {
+	if (capture.file) { begin_call (CAPTURE_CLEAR); put_u32 (mask); }
+	glClear (mask);
+}
+
+void capture_glViewport (GLint x, GLint y, GLsizei width, GLsizei height) {
+	if (capture.file) { begin_call (CAPTURE_VIEWPORT); put_u32 (x); put_u32 (y); put_u32 (width); put_u32 (height); }
+	glViewport (x, y, width, height);
+}
+
+void capture_glDrawBuffers (GLsizei n, const GLenum* bufs) {
+	if (capture.file) { begin_call (CAPTURE_DRAW_BUFFERS); put_u32 (n); put_blob (bufs, n * sizeof (GLenum)); }
+	glDrawBuffers (n, bufs);
+}
+
+void capture_glReadBuffer (GLenum src) {
+	if (capture.file) { begin_call (CAPTURE_READ_BUFFER); put_u32 (src); }
+	glReadBuffer (src);
+}
+
+void capture_glColorMask (GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha) {
+	if (capture.file) { begin_call (CAPTURE_COLOR_MASK); put_u32 (red); put_u32 (green); put_u32 (blue); put_u32 (alpha); }
+	glColorMask (red, green, blue, alpha);
+}
+
+void capture_glEnableVertexAttribArray (GLuint index) {
+	if (capture.file) { begin_call (CAPTURE_ENABLE_VERTEX_ATTRIB_ARRAY); put_u32 (index); }
+	glEnableVertexAttribArray (index);
+}
+
+void capture_glDisableVertexAttribArray (GLuint index) {
+	if (capture.file) { begin_call (CAPTURE_DISABLE_VERTEX_ATTRIB_ARRAY); put_u32 (index); }
+	glDisableVertexAttribArray (index);
+}
+
+void capture_glVertexAttribPointer (GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer) {
+	if (capture.file) {
+		begin_call (CAPTURE_VERTEX_ATTRIB_POINTER);
+		put_u32 (index); put_u32 (size); put_u32 (type); put_u32 (normalized); put_u32 (stride);
+		put_u64 ((unsigned long long)(size_t)pointer);
+	}
+	glVertexAttribPointer (index, size, type, normalized, stride, pointer);
+}
+
+void capture_glVertexAttribIPointer (GLuint index, GLint size, GLenum type, GLsizei stride, const void* pointer) {
+	if (capture.file) {
+		begin_call (CAPTURE_VERTEX_ATTRIB_I_POINTER);
+		put_u32 (index); put_u32 (size); put_u32 (type); put_u32 (stride);
+		put_u64 ((unsigned long long)(size_t)pointer);
+	}
+	glVertexAttribIPointer (index, size, type, stride, pointer);
+}
+
+void capture_glVertexAttribDivisor (GLuint index, GLuint divisor) {
+	if (capture.file) { begin_call (CAPTURE_VERTEX_ATTRIB_DIVISOR); put_u32 (index); put_u32 (divisor); }
+	glVertexAttribDivisor (index, divisor);
+}
+
+void capture_glVertexAttribI1ui (GLuint index, GLuint x) {
+	if (capture.file) { begin_call (CAPTURE_VERTEX_ATTRIB_I1UI); put_u32 (index); put_u32 (x); }
+	glVertexAttribI1ui (index, x);
+}
+
+void capture_glShaderSource (GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length) {
+	if (capture.file) {
+		// stored as one string, which compiles the same
+		std::string source;
+		for (GLsizei i = 0; i < count; i++) {
+			if (length && length[i] >= 0) {
+				source.append (string[i], length[i]);
+			} else {
+				source.append (string[i]);
+			}
+		}
+		begin_call (CAPTURE_SHADER_SOURCE);
+		put_u32 (shader);
+		put_blob (source.c_str (), source.size ());
+	}
+	glShaderSource (shader, count, (const GLchar**)string, length);
+}
+
+void capture_glCompileShader (GLuint shader) {
+	if (capture.file) { begin_call (CAPTURE_COMPILE_SHADER); put_u32 (shader); }
+	glCompileShader (shader);
+}
+
+void capture_glAttachShader (GLuint program, GLuint shader) {
+	if (capture.file) { begin_call (CAPTURE_ATTACH_SHADER); put_u32 (program); put_u32 (shader); }
+	glAttachShader (program, shader);
+}
+
+void capture_glLinkProgram (GLuint program) {
+	if (capture.file) { begin_call (CAPTURE_LINK_PROGRAM); put_u32 (program); }
+	glLinkProgram (program);
+}
+
+GLint capture_glGetUniformLocation (GLuint program, const GLchar* name) {
+	GLint location = glGetUniformLocation (program, name);
+	if (capture.file) { begin_call (CAPTURE_GET_UNIFORM_LOCATION); put_u32 (program); put_string (name); put_u32 (location); }
+	return location;
+}
+
+void capture_glUniform1i (GLint location, GLint v0) {
+	if (capture.file) { begin_call (CAPTURE_UNIFORM_1I); put_u32 (location); put_u32 (v0); }
+	glUniform1i (location, v0);
+}
+
+void capture_glUniform1f (GLint location, GLfloat v0) {
+	if (capture.file) { begin_call (CAPTURE_UNIFORM_1F); put_u32 (location); put_f32 (v0); }
+	glUniform1f (location, v0);
+}
+
+void capture_glUniform2fv (GLint location, GLsizei count, const GLfloat* value) {
+	if (capture.file) { begin_call (CAPTURE_UNIFORM_2FV); put_u32 (location); put_u32 (count); put_blob (value, count * 2 * sizeof (GLfloat)); }
+	glUniform2fv (location, count, value);
+}
+
+void capture_glUniform3fv (GLint location, GLsizei count, const GLfloat* value) {
+	if (capture.file) { begin_call (CAPTURE_UNIFORM_3FV); put_u32 (location); put_u32 (count); put_blob (value, count * 3 * sizeof (GLfloat)); }
+	glUniform3fv (location, count, value);
+}
+
+void capture_glUniform4fv (GLint location, GLsizei count, const GLfloat* value) {
+	if (capture.file) { begin_call (CAPTURE_UNIFORM_4FV); put_u32 (location); put_u32 (count); put_blob (value, count * 4 * sizeof (GLfloat)); }
+	glUniform4fv (location, count, value);
+}
+
+void capture_glUniformMatrix4fv (GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) {
+	if (capture.file) { begin_call (CAPTURE_UNIFORM_MATRIX_4FV); put_u32 (location); put_u32 (count); put_u32 (transpose); put_blob (value, count * 16 * sizeof (GLfloat)); }
+	glUniformMatrix4fv (location, count, transpose, value);
+}
+
+void capture_glDrawArrays (GLenum mode, GLint first, GLsizei count) {
+	if (capture.file) { begin_call (CAPTURE_DRAW_ARRAYS); put_u32 (mode); put_u32 (first); put_u32 (count); }
+	glDrawArrays (mode, first, count);
+}
+
+void capture_glDrawArraysInstanced (GLenum mode, GLint first, GLsizei count, GLsizei instancecount) {
+	if (capture.file) { begin_call (CAPTURE_DRAW_ARRAYS_INSTANCED); put_u32 (mode); put_u32 (first); put_u32 (count); put_u32 (instancecount); }
+	glDrawArraysInstanced (mode, first, count, instancecount);
+}
+
+// index and indirect pointers are offsets into the bound buffer, client
+// memory arrays are not supported
+void capture_glDrawElements (GLenum mode, GLsizei count, GLenum type, const void* indices) {
+	if (capture.file) { begin_call (CAPTURE_DRAW_ELEMENTS); put_u32 (mode); put_u32 (count); put_u32 (type); put_u64 ((unsigned long long)(size_t)indices); }
+	glDrawElements (mode, count, type, indices);
+}
+
+void capture_glDrawElementsInstanced (GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instancecount) {
+	if (capture.file) { begin_call (CAPTURE_DRAW_ELEMENTS_INSTANCED); put_u32 (mode); put_u32 (count); put_u32 (type); put_u64 ((unsigned long long)(size_t)indices); put_u32 (instancecount); }
+	glDrawElementsInstanced (mode, count, type, indices, instancecount);
+}
+
+void capture_glDrawElementsBaseVertex (GLenum mode, GLsizei count, GLenum type, const void* indices, GLint basevertex) {
+	if (capture.file) { begin_call (CAPTURE_DRAW_ELEMENTS_BASE_VERTEX); put_u32 (mode); put_u32 (count); put_u32 (type); put_u64 ((unsigned long long)(size_t)indices); put_u32 (basevertex); }
+	glDrawElementsBaseVertex (mode, count, type, indices, basevertex);
+}
+
+void capture_glDrawElementsInstancedBaseVertexBaseInstance (GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instancecount, GLint basevertex, GLuint baseinstance) {
+	if (capture.file) {
+		begin_call (CAPTURE_DRAW_ELEMENTS_INSTANCED_BASE_VERTEX_BASE_INSTANCE);
+		put_u32 (mode); put_u32 (count); put_u32 (type); put_u64 ((unsigned long long)(size_t)indices);
+		put_u32 (instancecount); put_u32 (basevertex); put_u32 (baseinstance);
+	}
+	glDrawElementsInstancedBaseVertexBaseInstance (mode, count, type, indices, instancecount, basevertex, baseinstance);
+}
+
+void capture_glMultiDrawElementsIndirect (GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride) {
+	if (capture.file) { begin_call (CAPTURE_MULTI_DRAW_ELEMENTS_INDIRECT); put_u32 (mode); put_u32 (type); put_u64 ((unsigned long long)(size_t)indirect); put_u32 (drawcount); put_u32 (stride); }
+	glMultiDrawElementsIndirect (mode, type, indirect, drawcount, stride);
+}
+
+void capture_glFinish () {
+	if (capture.file) { begin_call (CAPTURE_FINISH); }
+	glFinish ();
+}
@@ -0,0 +1,325 @@
+#ifndef GL_CAPTURE_H
+#define GL_CAPTURE_H
+
+// Records the GL calls the renderer makes into a binary trace that
+// gl_replay.cpp can play back, so renderer changes can be compared on exactly
+// the same command stream. Included from gl_includes.h: every GL call below is
+// routed through a capture_ wrapper that writes it to the trace while a
+// capture is running and otherwise just forwards it. Queries and getters are
+// not recorded, apart from the ones that hand out names or uniform locations,
+// which replay needs to remap. Fences are recorded by the order they were
+// made in, so replay can delete the ones it made.
+//
+// Trace layout: "GLTR", version, then one record per call. A record is a one
+// byte opcode followed by its arguments as 32 bit words (64 bit for sizes and
+// offsets). Data behind pointers is stored as a 32 bit length and the bytes,
+// a length of GL_CAPTURE_NULL stands for a NULL pointer.
+
+#define GL_CAPTURE_MAGIC 0x52544c47 // "GLTR"
+#define GL_CAPTURE_VERSION 1
+#define GL_CAPTURE_NULL 0xffffffffu
+
+enum GLCaptureOp {
+	CAPTURE_FRAME_END = 0,
+	CAPTURE_GEN_BUFFERS,
+	CAPTURE_GEN_VERTEX_ARRAYS,
+	CAPTURE_GEN_TEXTURES,
+	CAPTURE_GEN_FRAMEBUFFERS,
+	CAPTURE_GEN_RENDERBUFFERS,
+	CAPTURE_DELETE_FRAMEBUFFERS,
+	CAPTURE_CREATE_PROGRAM,
+	CAPTURE_CREATE_SHADER,
+	CAPTURE_BIND_BUFFER,
+	CAPTURE_BIND_VERTEX_ARRAY,
+	CAPTURE_BIND_TEXTURE,
+	CAPTURE_BIND_FRAMEBUFFER,
+	CAPTURE_BIND_RENDERBUFFER,
+	CAPTURE_ACTIVE_TEXTURE,
+	CAPTURE_USE_PROGRAM,
+	CAPTURE_BUFFER_DATA,
+	CAPTURE_BUFFER_SUB_DATA,
+	CAPTURE_TEX_IMAGE_2D,
+	CAPTURE_TEX_IMAGE_3D,
+	CAPTURE_TEX_BUFFER,
+	CAPTURE_TEX_PARAMETERI,
+	CAPTURE_GENERATE_MIPMAP,
+	CAPTURE_RENDERBUFFER_STORAGE,
+	CAPTURE_FRAMEBUFFER_TEXTURE_2D,
+	CAPTURE_FRAMEBUFFER_TEXTURE_LAYER,
+	CAPTURE_FRAMEBUFFER_RENDERBUFFER,
+	CAPTURE_BLIT_FRAMEBUFFER,
+	CAPTURE_ENABLE,
+	CAPTURE_DISABLE,
+	CAPTURE_DEPTH_MASK,
+	CAPTURE_DEPTH_FUNC,
+	CAPTURE_BLEND_FUNC,
+	CAPTURE_CLEAR_COLOR,
+	CAPTURE_CLEAR,
+	CAPTURE_VIEWPORT,
+	CAPTURE_ENABLE_VERTEX_ATTRIB_ARRAY,
+	CAPTURE_DISABLE_VERTEX_ATTRIB_ARRAY,
+	CAPTURE_VERTEX_ATTRIB_POINTER,
+	CAPTURE_VERTEX_ATTRIB_I_POINTER,
+	CAPTURE_VERTEX_ATTRIB_DIVISOR,
+	CAPTURE_VERTEX_ATTRIB_I1UI,
+	CAPTURE_SHADER_SOURCE,
+	CAPTURE_COMPILE_SHADER,
+	CAPTURE_ATTACH_SHADER,
+	CAPTURE_LINK_PROGRAM,
+	CAPTURE_GET_UNIFORM_LOCATION,
+	CAPTURE_UNIFORM_1I,
+	CAPTURE_UNIFORM_1F,
+	CAPTURE_UNIFORM_2FV,
+	CAPTURE_UNIFORM_3FV,
+	CAPTURE_UNIFORM_4FV,
+	CAPTURE_UNIFORM_MATRIX_4FV,
+	CAPTURE_DRAW_ARRAYS,
+	CAPTURE_DRAW_ARRAYS_INSTANCED,
+	CAPTURE_DRAW_ELEMENTS,
+	CAPTURE_DRAW_ELEMENTS_INSTANCED,
+	CAPTURE_DRAW_ELEMENTS_BASE_VERTEX,
+	CAPTURE_DRAW_ELEMENTS_INSTANCED_BASE_VERTEX_BASE_INSTANCE,
+	CAPTURE_MULTI_DRAW_ELEMENTS_INDIRECT,
+	CAPTURE_FINISH,
+	CAPTURE_BUFFER_STORAGE,
+	CAPTURE_TEX_BUFFER_RANGE,
+	CAPTURE_DRAW_BUFFERS,
+	CAPTURE_READ_BUFFER,
+	CAPTURE_COLOR_MASK,
+	CAPTURE_DELETE_TEXTURES,
+	CAPTURE_DELETE_BUFFERS,
+	CAPTURE_FENCE_SYNC,
+	CAPTURE_DELETE_SYNC,
+	CAPTURE_OP_COUNT
+};
+
+// Starts writing a trace, false if the file can't be created
+bool gl_capture_begin(const char* path);
+// Marks the end of a frame in the trace
+void gl_capture_frame();
+// Closes the trace and prints what went into it
+void gl_capture_end();
+bool gl_capture_active();
+// Records bytes the app wrote to a mapped buffer as a glBufferSubData of the
+// buffer bound to target, mapped writes are otherwise invisible to the trace
+void gl_capture_buffer_write(GLenum target, size_t offset, size_t bytes, const void* data);
+
+// Plays a trace back as fast as possible, see gl_replay.cpp
+int gl_replay(const char* path, int repeat);
+
+#ifndef GL_CAPTURE_IMPL
+
+void capture_glGenBuffers(GLsizei n, GLuint* buffers);
+void capture_glGenVertexArrays(GLsizei n, GLuint* arrays);
+void capture_glGenTextures(GLsizei n, GLuint* textures);
+void capture_glGenFramebuffers(GLsizei n, GLuint* framebuffers);
+void capture_glGenRenderbuffers(GLsizei n, GLuint* renderbuffers);
+void capture_glDeleteFramebuffers(GLsizei n, const GLuint* framebuffers);
+void capture_glDeleteTextures(GLsizei n, const GLuint* textures);
+void capture_glDeleteBuffers(GLsizei n, const GLuint* buffers);
+GLsync capture_glFenceSync(GLenum condition, GLbitfield flags);
+void capture_glDeleteSync(GLsync sync);
+GLuint capture_glCreateProgram();
+GLuint capture_glCreateShader(GLenum type);
+void capture_glBindBuffer(GLenum target, GLuint buffer);
+void capture_glBindVertexArray(GLuint array);
+void capture_glBindTexture(GLenum target, GLuint texture);
+void capture_glBindFramebuffer(GLenum target, GLuint framebuffer);
+void capture_glBindRenderbuffer(GLenum target, GLuint renderbuffer);
+void capture_glActiveTexture(GLenum texture);
+void capture_glUseProgram(GLuint program);
+void capture_glBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage);
+void capture_glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data);
+void capture_glBufferStorage(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+void capture_glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels);
+void capture_glTexImage3D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const void* pixels);
+void capture_glTexBuffer(GLenum target, GLenum internalformat, GLuint buffer);
+void capture_glTexBufferRange(GLenum target, GLenum internalformat, GLuint buffer, GLintptr offset, GLsizeiptr size);
+void capture_glTexParameteri(GLenum target, GLenum pname, GLint param);
+void capture_glGenerateMipmap(GLenum target);
+void capture_glRenderbufferStorage(GLenum target, GLenum internalformat, GLsizei width, GLsizei height);
+void capture_glFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+void capture_glFramebufferTextureLayer(GLenum target, GLenum attachment, GLuint texture, GLint level, GLint layer);
+void capture_glFramebufferRenderbuffer(GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer);
+void capture_glBlitFramebuffer(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter);
+void capture_glEnable(GLenum cap);
+void capture_glDisable(GLenum cap);
+void capture_glDepthMask(GLboolean flag);
+void capture_glDepthFunc(GLenum func);
+void capture_glBlendFunc(GLenum sfactor, GLenum dfactor);
+void capture_glClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a);
+void capture_glClear(GLbitfield mask);
+void capture_glViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+void capture_glDrawBuffers(GLsizei n, const GLenum* bufs);
+void capture_glReadBuffer(GLenum src);
+void capture_glColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha);
+void capture_glEnableVertexAttribArray(GLuint index);
+void capture_glDisableVertexAttribArray(GLuint index);
+void capture_glVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer);
+void capture_glVertexAttribIPointer(GLuint index, GLint size, GLenum type, GLsizei stride, const void* pointer);
+void capture_glVertexAttribDivisor(GLuint index, GLuint divisor);
+void capture_glVertexAttribI1ui(GLuint index, GLuint x);
+void capture_glShaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length);
+void capture_glCompileShader(GLuint shader);
+void capture_glAttachShader(GLuint program, GLuint shader);
+void capture_glLinkProgram(GLuint program);
+GLint capture_glGetUniformLocation(GLuint program, const GLchar* name);
+void capture_glUniform1i(GLint location, GLint v0);
+void capture_glUniform1f(GLint location, GLfloat v0);
+void capture_glUniform2fv(GLint location, GLsizei count, const GLfloat* value);
+void capture_glUniform3fv(GLint location, GLsizei count, const GLfloat* value);
+void capture_glUniform4fv(GLint location, GLsizei count, const GLfloat* value);
+void capture_glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value);
+void capture_glDrawArrays(GLenum mode, GLint first, GLsizei count);
+void capture_glDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instancecount);
+void capture_glDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices);
+void capture_glDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instancecount);
+void capture_glDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const void* indices, GLint basevertex);
+void capture_glDrawElementsInstancedBaseVertexBaseInstance(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instancecount, GLint basevertex, GLuint baseinstance);
+void capture_glMultiDrawElementsIndirect(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+void capture_glFinish();
+
+// GLEW defines the entry points as macros, libGL as functions
+#undef glGenBuffers
+#undef glGenVertexArrays
+#undef glGenTextures
+#undef glGenFramebuffers
+#undef glGenRenderbuffers
+#undef glDeleteFramebuffers
+#undef glDeleteTextures
+#undef glDeleteBuffers
+#undef glFenceSync
+#undef glDeleteSync
+#undef glCreateProgram
+#undef glCreateShader
+#undef glBindBuffer
+#undef glBindVertexArray
+#undef glBindTexture
+#undef glBindFramebuffer
+#undef glBindRenderbuffer
+#undef glActiveTexture
+#undef glUseProgram
+#undef glBufferData
+#undef glBufferSubData
+#undef glBufferStorage
+#undef glTexImage2D
+#undef glTexImage3D
+#undef glTexBuffer
+#undef glTexBufferRange
+#undef glTexParameteri
+#undef glGenerateMipmap
+#undef glRenderbufferStorage
+#undef glFramebufferTexture2D
+#undef glFramebufferTextureLayer
+#undef glFramebufferRenderbuffer
+#undef glBlitFramebuffer
+#undef glEnable
+#undef glDisable
+#undef glDepthMask
+#undef glDepthFunc
+#undef glBlendFunc
+#undef glClearColor
+#undef glClear
+#undef glViewport
+#undef glDrawBuffers
+#undef glReadBuffer
+#undef glColorMask
+#undef glEnableVertexAttribArray
+#undef glDisableVertexAttribArray
+#undef glVertexAttribPointer
+#undef glVertexAttribIPointer
+#undef glVertexAttribDivisor
+#undef glVertexAttribI1ui
+#undef glShaderSource
+#undef glCompileShader
+#undef glAttachShader
+#undef glLinkProgram
+#undef glGetUniformLocation
+#undef glUniform1i
+#undef glUniform1f
+#undef glUniform2fv
+#undef glUniform3fv
+#undef glUniform4fv
+#undef glUniformMatrix4fv
+#undef glDrawArrays
+#undef glDrawArraysInstanced
+#undef glDrawElements
+#undef glDrawElementsInstanced
+#undef glDrawElementsBaseVertex
+#undef glDrawElementsInstancedBaseVertexBaseInstance
+#undef glMultiDrawElementsIndirect
+#undef glFinish
+
+#define glGenBuffers capture_glGenBuffers
+#define glGenVertexArrays capture_glGenVertexArrays
+#define glGenTextures capture_glGenTextures
+#define glGenFramebuffers capture_glGenFramebuffers
+#define glGenRenderbuffers capture_glGenRenderbuffers
+#define glDeleteFramebuffers capture_glDeleteFramebuffers
+#define glDeleteTextures capture_glDeleteTextures
+#define glDeleteBuffers capture_glDeleteBuffers
+#define glFenceSync capture_glFenceSync
+#define glDeleteSync capture_glDeleteSync
+#define glCreateProgram capture_glCreateProgram
+#define glCreateShader capture_glCreateShader
+#define glBindBuffer capture_glBindBuffer
+#define glBindVertexArray capture_glBindVertexArray
+#define glBindTexture capture_glBindTexture
+#define glBindFramebuffer capture_glBindFramebuffer
+#define glBindRenderbuffer capture_glBindRenderbuffer
+#define glActiveTexture capture_glActiveTexture
+#define glUseProgram capture_glUseProgram
+#define glBufferData capture_glBufferData
+#define glBufferSubData capture_glBufferSubData
+#define glBufferStorage capture_glBufferStorage
+#define glTexImage2D capture_glTexImage2D
+#define glTexImage3D capture_glTexImage3D
+#define glTexBuffer capture_glTexBuffer
+#define glTexBufferRange capture_glTexBufferRange
+#define glTexParameteri capture_glTexParameteri
+#define glGenerateMipmap capture_glGenerateMipmap
+#define glRenderbufferStorage capture_glRenderbufferStorage
+#define glFramebufferTexture2D capture_glFramebufferTexture2D
+#define glFramebufferTextureLayer capture_glFramebufferTextureLayer
+#define glFramebufferRenderbuffer capture_glFramebufferRenderbuffer
+#define glBlitFramebuffer capture_glBlitFramebuffer
+#define glEnable capture_glEnable
+#define glDisable capture_glDisable
+#define glDepthMask capture_glDepthMask
+#define glDepthFunc capture_glDepthFunc
+#define glBlendFunc capture_glBlendFunc
+#define glClearColor capture_glClearColor
+#define glClear capture_glClear
+#define glViewport capture_glViewport
+#define glDrawBuffers capture_glDrawBuffers
+#define glReadBuffer capture_glReadBuffer
+#define glColorMask capture_glColorMask
+#define glEnableVertexAttribArray capture_glEnableVertexAttribArray
+#define glDisableVertexAttribArray capture_glDisableVertexAttribArray
+#define glVertexAttribPointer capture_glVertexAttribPointer
+#define glVertexAttribIPointer capture_glVertexAttribIPointer
+#define glVertexAttribDivisor capture_glVertexAttribDivisor
+#define glVertexAttribI1ui capture_glVertexAttribI1ui
+#define glShaderSource capture_glShaderSource
+#define glCompileShader capture_glCompileShader
+#define glAttachShader capture_glAttachShader
+#define glLinkProgram capture_glLinkProgram
+#define glGetUniformLocation capture_glGetUniformLocation
+#define glUniform1i capture_glUniform1i
+#define glUniform1f capture_glUniform1f
+#define glUniform2fv capture_glUniform2fv
+#define glUniform3fv capture_glUniform3fv
+#define glUniform4fv capture_glUniform4fv
+#define glUniformMatrix4fv capture_glUniformMatrix4fv
+#define glDrawArrays capture_glDrawArrays
+#define glDrawArraysInstanced capture_glDrawArraysInstanced
+#define glDrawElements capture_glDrawElements
+#define glDrawElementsInstanced capture_glDrawElementsInstanced
+#define glDrawElementsBaseVertex capture_glDrawElementsBaseVertex
+#define glDrawElementsInstancedBaseVertexBaseInstance capture_glDrawElementsInstancedBaseVertexBaseInstance
+#define glMultiDrawElementsIndirect capture_glMultiDrawElementsIndirect
+#define glFinish capture_glFinish
+
+#endif
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef GL_INCLUDES_H
+#define GL_INCLUDES_H
+
+// GLEW loads the GL entry points on Windows. The Linux build (LAB04_NO_GLEW,
+// set by CMakeLists.txt) links straight against libGL, which exports every
+// core and ARB function, and stands in for the parts of the GLEW API we use.
+
+#include <string.h>
+
+#ifndef LAB04_NO_GLEW
+#include <GL/glew.h>
+#else
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#define GLEW_OK 0
+
+inline GLenum glewInit()
+{
+	return GLEW_OK;
+}
+
+inline const GLubyte* glewGetErrorString(GLenum)
+{
+	return (const GLubyte*)"no error";
+}
+
+inline bool gl_version_at_least(int major, int minor)
+{
+	GLint ma = 0, mi = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &ma);
+	glGetIntegerv(GL_MINOR_VERSION, &mi);
+	return ma > major || (ma == major && mi >= minor);
+}
+
+#define GLEW_VERSION_4_1 gl_version_at_least(4, 1)
+#define GLEW_VERSION_4_2 gl_version_at_least(4, 2)
+#define GLEW_VERSION_4_3 gl_version_at_least(4, 3)
+#define GLEW_VERSION_4_4 gl_version_at_least(4, 4)
+#define GLEW_ARB_base_instance gl_has_extension("GL_ARB_base_instance")
+#define GLEW_ARB_multi_draw_indirect gl_has_extension("GL_ARB_multi_draw_indirect")
+#define GLEW_ARB_get_program_binary gl_has_extension("GL_ARB_get_program_binary")
+#define GLEW_ARB_buffer_storage gl_has_extension("GL_ARB_buffer_storage")
+#define GLEW_ARB_texture_buffer_range gl_has_extension("GL_ARB_texture_buffer_range")
+
+#endif
+
+// For extensions newer than the GLEW we ship (1.10)
+inline bool gl_has_extension(const char* name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		const char* ext = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (ext && strcmp(ext, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+// KHR/ARB_parallel_shader_compile
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// ARB_pipeline_statistics_query, core in 4.6
+#ifndef GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+#endif
+
+// routes the GL calls through the trace recorder
+#include "gl_capture.h"
+
+#endif
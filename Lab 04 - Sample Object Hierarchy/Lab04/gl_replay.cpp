@@ -0,0 +1,610 @@
+// Plays back a trace written by gl_capture.cpp as fast as the driver allows
+// and reports calls, bytes and time per frame. The first frame of a trace is
+// the app's setup, it is replayed once before the timed frames.
+#define GL_CAPTURE_IMPL
+#include "gl_includes.h"
+#include "headless.h"
+#include "platform.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock replay_clock;
+
+// names the app got while recording -> names the driver hands out now
+class NameMap {
+public:
+	void set (GLuint recorded, GLuint actual) {
+		if (recorded >= names.size ()) {
+			names.resize (recorded + 1, 0);
+		}
+		names[recorded] = actual;
+	}
+
+	GLuint operator() (GLuint recorded) const {
+		if (recorded == 0 || recorded >= names.size ()) {
+			return recorded;
+		}
+		return names[recorded];
+	}
+
+private:
+	std::vector<GLuint> names;
+};
+
+struct TraceReader {
+	const unsigned char* p;
+	const unsigned char* end;
+
+	bool done () const { return p >= end; }
+
+	unsigned int u32 () {
+		if (end - p < 4) {
+			p = end;
+			return 0;
+		}
+		unsigned int v = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+		p += 4;
+		return v;
+	}
+
+	unsigned long long u64 () {
+		unsigned long long lo = u32 ();
+		return lo | ((unsigned long long)u32 () << 32);
+	}
+
+	float f32 () {
+		unsigned int v = u32 ();
+		float f;
+		memcpy (&f, &v, 4);
+		return f;
+	}
+
+	// points into the trace, NULL for a recorded NULL pointer
+	const void* blob (size_t& bytes) {
+		unsigned int len = u32 ();
+		if (len == GL_CAPTURE_NULL) {
+			bytes = 0;
+			return NULL;
+		}
+		if ((size_t)(end - p) < len) {
+			p = end;
+			bytes = 0;
+			return NULL;
+		}
+		const void* data = p;
+		p += len;
+		bytes = len;
+		return data;
+	}
+
+	const void* offset () {
+		return (const void*)(size_t)u64 ();
+	}
+};
+
+struct ReplayStats {
+	unsigned int calls;
+	unsigned int draws;
+	size_t bytes;
+};
+
+class Replayer {
+public:
+	Replayer () : program (0) {}
+
+	// Runs records up to the end of the current frame, false at the end of the trace
+	bool frame (TraceReader& r, ReplayStats& stats) {
+		stats.calls = stats.draws = 0;
+		stats.bytes = 0;
+		while (!r.done ()) {
+			unsigned char op = *r.p++;
+			if (op == CAPTURE_FRAME_END) {
+				return true;
+			}
+			if (op >= CAPTURE_OP_COUNT) {
+				fprintf (stderr, "replay: bad opcode %u, trace is corrupt\n", op);
+				r.p = r.end;
+				return false;
+			}
+			stats.calls++;
+			call ((GLCaptureOp)op, r, stats);
+		}
+		return false;
+	}
+
+private:
+	NameMap buffers, arrays, textures, framebuffers, renderbuffers, programs, shaders;
+	std::vector<std::vector<GLint> > uniforms; // by recorded program, recorded location -> location
+	GLuint program; // recorded name of the bound program
+	std::vector<GLsync> syncs; // by recorded fence id
+
+	// reads a list of recorded names and deletes what they map to now
+	void remove (TraceReader& r, const NameMap& map, void (*delete_names) (GLsizei, const GLuint*)) {
+		GLsizei n = r.u32 ();
+		std::vector<GLuint> names (n);
+		for (GLsizei i = 0; i < n; i++) {
+			names[i] = map (r.u32 ());
+		}
+		if (n > 0) {
+			delete_names (n, &names[0]);
+		}
+	}
+
+	void gen (TraceReader& r, NameMap& map, void (*gen_names) (GLsizei, GLuint*)) {
+		GLsizei n = r.u32 ();
+		std::vector<GLuint> names (n);
+		if (n > 0) {
+			gen_names (n, &names[0]);
+		}
+		for (GLsizei i = 0; i < n; i++) {
+			map.set (r.u32 (), names[i]);
+		}
+	}
+
+	GLint uniform (GLint recorded) const {
+		if (recorded < 0 || program >= uniforms.size () || recorded >= (GLint)uniforms[program].size ()) {
+			return recorded;
+		}
+		return uniforms[program][recorded];
+	}
+
+	static void gen_buffers (GLsizei n, GLuint* names) { glGenBuffers (n, names); }
+	static void gen_arrays (GLsizei n, GLuint* names) { glGenVertexArrays (n, names); }
+	static void gen_textures (GLsizei n, GLuint* names) { glGenTextures (n, names); }
+	static void gen_framebuffers (GLsizei n, GLuint* names) { glGenFramebuffers (n, names); }
+	static void gen_renderbuffers (GLsizei n, GLuint* names) { glGenRenderbuffers (n, names); }
+	static void delete_buffers (GLsizei n, const GLuint* names) { glDeleteBuffers (n, names); }
+	static void delete_textures (GLsizei n, const GLuint* names) { glDeleteTextures (n, names); }
+	static void delete_framebuffers (GLsizei n, const GLuint* names) { glDeleteFramebuffers (n, names); }
+
+	void call (GLCaptureOp op, TraceReader& r, ReplayStats& stats) {
+		size_t bytes = 0;
+		const void* data;
+		switch (op) {
+		case CAPTURE_GEN_BUFFERS: gen (r, buffers, gen_buffers); break;
+		case CAPTURE_GEN_VERTEX_ARRAYS: gen (r, arrays, gen_arrays); break;
+		case CAPTURE_GEN_TEXTURES: gen (r, textures, gen_textures); break;
+		case CAPTURE_GEN_FRAMEBUFFERS: gen (r, framebuffers, gen_framebuffers); break;
+		case CAPTURE_GEN_RENDERBUFFERS: gen (r, renderbuffers, gen_renderbuffers); break;
+		case CAPTURE_DELETE_FRAMEBUFFERS: remove (r, framebuffers, delete_framebuffers); break;
+		case CAPTURE_DELETE_TEXTURES: remove (r, textures, delete_textures); break;
+		case CAPTURE_DELETE_BUFFERS: remove (r, buffers, delete_buffers); break;
+		case CAPTURE_FENCE_SYNC: {
+			GLenum condition = r.u32 ();
+			GLbitfield flags = r.u32 ();
+			unsigned int id = r.u32 ();
+			if (id >= syncs.size ()) {
+				syncs.resize (id + 1, NULL);
+			}
+			syncs[id] = glFenceSync (condition, flags);
+			break;
+		}
+		case CAPTURE_DELETE_SYNC: {
+			unsigned int id = r.u32 ();
+			if (id < syncs.size () && syncs[id] != NULL) {
+				glDeleteSync (syncs[id]);
+				syncs[id] = NULL;
+			}
+			break;
+		}
+		case CAPTURE_CREATE_PROGRAM: programs.set (r.u32 (), glCreateProgram ()); break;
+		case CAPTURE_CREATE_SHADER: {
+			GLenum type = r.u32 ();
+			shaders.set (r.u32 (), glCreateShader (type));
+			break;
+		}
+		case CAPTURE_BIND_BUFFER: {
+			GLenum target = r.u32 ();
+			glBindBuffer (target, buffers (r.u32 ()));
+			break;
+		}
+		case CAPTURE_BIND_VERTEX_ARRAY: glBindVertexArray (arrays (r.u32 ())); break;
+		case CAPTURE_BIND_TEXTURE: {
+			GLenum target = r.u32 ();
+			glBindTexture (target, textures (r.u32 ()));
+			break;
+		}
+		case CAPTURE_BIND_FRAMEBUFFER: {
+			GLenum target = r.u32 ();
+			glBindFramebuffer (target, framebuffers (r.u32 ()));
+			break;
+		}
+		case CAPTURE_BIND_RENDERBUFFER: {
+			GLenum target = r.u32 ();
+			glBindRenderbuffer (target, renderbuffers (r.u32 ()));
+			break;
+		}
+		case CAPTURE_ACTIVE_TEXTURE: glActiveTexture (r.u32 ()); break;
+		case CAPTURE_USE_PROGRAM:
+			program = r.u32 ();
+			glUseProgram (programs (program));
+			break;
+		case CAPTURE_BUFFER_DATA: {
+			GLenum target = r.u32 ();
+			GLsizeiptr size = (GLsizeiptr)r.u64 ();
+			data = r.blob (bytes);
+			glBufferData (target, size, data, r.u32 ());
+			stats.bytes += bytes;
+			break;
+		}
+		case CAPTURE_BUFFER_SUB_DATA: {
+			GLenum target = r.u32 ();
+			GLintptr offset = (GLintptr)r.u64 ();
+			data = r.blob (bytes);
+			glBufferSubData (target, offset, bytes, data);
+			stats.bytes += bytes;
+			break;
+		}
+		case CAPTURE_BUFFER_STORAGE: {
+			GLenum target = r.u32 ();
+			GLsizeiptr size = (GLsizeiptr)r.u64 ();
+			data = r.blob (bytes);
+			r.u32 ();
+			// mutable so the recorded writes can be replayed with glBufferSubData
+			glBufferData (target, size, data, GL_STREAM_DRAW);
+			stats.bytes += bytes;
+			break;
+		}
+		case CAPTURE_TEX_IMAGE_2D: {
+			GLuint a[8];
+			for (int i = 0; i < 8; i++) {
+				a[i] = r.u32 ();
+			}
+			data = r.blob (bytes);
+			glTexImage2D (a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], data);
+			stats.bytes += bytes;
+			break;
+		}
+		case CAPTURE_TEX_IMAGE_3D: {
+			GLuint a[9];
+			for (int i = 0; i < 9; i++) {
+				a[i] = r.u32 ();
+			}
+			data = r.blob (bytes);
+			glTexImage3D (a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8], data);
+			stats.bytes += bytes;
+			break;
+		}
+		case CAPTURE_TEX_BUFFER: {
+			GLenum target = r.u32 ();
+			GLenum format = r.u32 ();
+			glTexBuffer (target, format, buffers (r.u32 ()));
+			break;
+		}
+		case CAPTURE_TEX_BUFFER_RANGE: {
+			GLenum target = r.u32 ();
+			GLenum format = r.u32 ();
+			GLuint buffer = buffers (r.u32 ());
+			GLintptr offset = (GLintptr)r.u64 ();
+			glTexBufferRange (target, format, buffer, offset, (GLsizeiptr)r.u64 ());
+			break;
+		}
+		case CAPTURE_TEX_PARAMETERI: {
+			GLenum target = r.u32 ();
+			GLenum pname = r.u32 ();
+			glTexParameteri (target, pname, r.u32 ());
+			break;
+		}
+		case CAPTURE_GENERATE_MIPMAP: glGenerateMipmap (r.u32 ()); break;
+		case CAPTURE_RENDERBUFFER_STORAGE: {
+			GLuint a[4];
+			for (int i = 0; i < 4; i++) {
+				a[i] = r.u32 ();
+			}
+			glRenderbufferStorage (a[0], a[1], a[2], a[3]);
+			break;
+		}
+		case CAPTURE_FRAMEBUFFER_TEXTURE_2D: {
+			GLenum target = r.u32 ();
+			GLenum attachment = r.u32 ();
+			GLenum textarget = r.u32 ();
+			GLuint texture = textures (r.u32 ());
+			glFramebufferTexture2D (target, attachment, textarget, texture, r.u32 ());
+			break;
+		}
+		case CAPTURE_FRAMEBUFFER_TEXTURE_LAYER: {
+			GLenum target = r.u32 ();
+			GLenum attachment = r.u32 ();
+			GLuint texture = textures (r.u32 ());
+			GLint level = r.u32 ();
+			glFramebufferTextureLayer (target, attachment, texture, level, r.u32 ());
+			break;
+		}
+		case CAPTURE_FRAMEBUFFER_RENDERBUFFER: {
+			GLenum target = r.u32 ();
+			GLenum attachment = r.u32 ();
+			GLenum rbtarget = r.u32 ();
+			glFramebufferRenderbuffer (target, attachment, rbtarget, renderbuffers (r.u32 ()));
+			break;
+		}
+		case CAPTURE_BLIT_FRAMEBUFFER: {
+			GLuint a[10];
+			for (int i = 0; i < 10; i++) {
+				a[i] = r.u32 ();
+			}
+			glBlitFramebuffer (a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8], a[9]);
+			break;
+		}
+		case CAPTURE_ENABLE: glEnable (r.u32 ()); break;
+		case CAPTURE_DISABLE: glDisable (r.u32 ()); break;
+		case CAPTURE_DEPTH_MASK: glDepthMask ((GLboolean)r.u32 ()); break;
+		case CAPTURE_DEPTH_FUNC: glDepthFunc (r.u32 ()); break;
+		case CAPTURE_BLEND_FUNC: {
+			GLenum s = r.u32 ();
+			glBlendFunc (s, r.u32 ());
+			break;
+		}
+		case CAPTURE_CLEAR_COLOR: {
+			float c[4];
+			for (int i = 0; i < 4; i++) {
+				c[i] = r.f32 ();
+			}
+			glClearColor (c[0], c[1], c[2], c[3]);
+			break;
+		}
+		case CAPTURE_CLEAR: glClear (r.u32 ()); break;
+		case CAPTURE_VIEWPORT: {
+			GLint a[4];
+			for (int i = 0; i < 4; i++) {
+				a[i] = r.u32 ();
+			}
+			glViewport (a[0], a[1], a[2], a[3]);
+			break;
+		}
+		case CAPTURE_DRAW_BUFFERS: {
+			GLsizei n = r.u32 ();
+			data = r.blob (bytes);
+			glDrawBuffers (n, (const GLenum*)data);
+			break;
+		}
+		case CAPTURE_READ_BUFFER: glReadBuffer (r.u32 ()); break;
+		case CAPTURE_COLOR_MASK: {
+			GLboolean m[4];
+			for (int i = 0; i < 4; i++) {
+				m[i] = (GLboolean)r.u32 ();
+			}
+			glColorMask (m[0], m[1], m[2], m[3]);
+			break;
+		}
+		case CAPTURE_ENABLE_VERTEX_ATTRIB_ARRAY: glEnableVertexAttribArray (r.u32 ()); break;
+		case CAPTURE_DISABLE_VERTEX_ATTRIB_ARRAY: glDisableVertexAttribArray (r.u32 ()); break;
+		case CAPTURE_VERTEX_ATTRIB_POINTER: {
+			GLuint a[5];
+			for (int i = 0; i < 5; i++) {
+				a[i] = r.u32 ();
+			}
+			glVertexAttribPointer (a[0], a[1], a[2], (GLboolean)a[3], a[4], r.offset ());
+			break;
+		}
+		case CAPTURE_VERTEX_ATTRIB_I_POINTER: {
+			GLuint a[4];
+			for (int i = 0; i < 4; i++) {
+				a[i] = r.u32 ();
+			}
+			glVertexAttribIPointer (a[0], a[1], a[2], a[3], r.offset ());
+			break;
+		}
+		case CAPTURE_VERTEX_ATTRIB_DIVISOR: {
+			GLuint index = r.u32 ();
+			glVertexAttribDivisor (index, r.u32 ());
+			break;
+		}
+		case CAPTURE_VERTEX_ATTRIB_I1UI: {
+			GLuint index = r.u32 ();
+			glVertexAttribI1ui (index, r.u32 ());
+			break;
+		}
+		case CAPTURE_SHADER_SOURCE: {
+			GLuint shader = shaders (r.u32 ());
+			data = r.blob (bytes);
+			const GLchar* source = (const GLchar*)data;
+			GLint length = (GLint)bytes;
+			glShaderSource (shader, 1, &source, &length);
+			break;
+		}
+		case CAPTURE_COMPILE_SHADER: glCompileShader (shaders (r.u32 ())); break;
+		case CAPTURE_ATTACH_SHADER: {
+			GLuint prog = programs (r.u32 ());
+			glAttachShader (prog, shaders (r.u32 ()));
+			break;
+		}
+		case CAPTURE_LINK_PROGRAM: glLinkProgram (programs (r.u32 ())); break;
+		case CAPTURE_GET_UNIFORM_LOCATION: {
+			GLuint recorded = r.u32 ();
+			data = r.blob (bytes);
+			std::string name ((const char*)data, bytes);
+			GLint location = glGetUniformLocation (programs (recorded), name.c_str ());
+			GLint was = (GLint)r.u32 ();
+			if (was >= 0) {
+				if (recorded >= uniforms.size ()) {
+					uniforms.resize (recorded + 1);
+				}
+				std::vector<GLint>& map = uniforms[recorded];
+				if (was >= (GLint)map.size ()) {
+					map.resize (was + 1, -1);
+				}
+				map[was] = location;
+			}
+			break;
+		}
+		case CAPTURE_UNIFORM_1I: {
+			GLint location = uniform (r.u32 ());
+			glUniform1i (location, r.u32 ());
+			break;
+		}
+		case CAPTURE_UNIFORM_1F: {
+			GLint location = uniform (r.u32 ());
+			glUniform1f (location, r.f32 ());
+			break;
+		}
+		case CAPTURE_UNIFORM_2FV:
+		case CAPTURE_UNIFORM_3FV:
+		case CAPTURE_UNIFORM_4FV: {
+			GLint location = uniform (r.u32 ());
+			GLsizei count = r.u32 ();
+			data = r.blob (bytes);
+			if (op == CAPTURE_UNIFORM_2FV) glUniform2fv (location, count, (const GLfloat*)data);
+			else if (op == CAPTURE_UNIFORM_3FV) glUniform3fv (location, count, (const GLfloat*)data);
+			else glUniform4fv (location, count, (const GLfloat*)data);
+			stats.bytes += bytes;
+			break;
+		}
+		case CAPTURE_UNIFORM_MATRIX_4FV: {
+			GLint location = uniform (r.u32 ());
+			GLsizei count = r.u32 ();
+			GLboolean transpose = (GLboolean)r.u32 ();
+			data = r.blob (bytes);
+			glUniformMatrix4fv (location, count, transpose, (const GLfloat*)data);
+			stats.bytes += bytes;
+			break;
+		}
+		case CAPTURE_DRAW_ARRAYS: {
+			GLenum mode = r.u32 ();
+			GLint first = r.u32 ();
+			glDrawArrays (mode, first, r.u32 ());
+			stats.draws++;
+			break;
+		}
+		case CAPTURE_DRAW_ARRAYS_INSTANCED: {
+			GLenum mode = r.u32 ();
+			GLint first = r.u32 ();
+			GLsizei count = r.u32 ();
+			glDrawArraysInstanced (mode, first, count, r.u32 ());
+			stats.draws++;
+			break;
+		}
+		case CAPTURE_DRAW_ELEMENTS: {
+			GLenum mode = r.u32 ();
+			GLsizei count = r.u32 ();
+			GLenum type = r.u32 ();
+			glDrawElements (mode, count, type, r.offset ());
+			stats.draws++;
+			break;
+		}
+		case CAPTURE_DRAW_ELEMENTS_INSTANCED: {
+			GLenum mode = r.u32 ();
+			GLsizei count = r.u32 ();
+			GLenum type = r.u32 ();
+			const void* indices = r.offset ();
+			glDrawElementsInstanced (mode, count, type, indices, r.u32 ());
+			stats.draws++;
+			break;
+		}
+		case CAPTURE_DRAW_ELEMENTS_BASE_VERTEX: {
+			GLenum mode = r.u32 ();
+			GLsizei count = r.u32 ();
+			GLenum type = r.u32 ();
+			const void* indices = r.offset ();
+			glDrawElementsBaseVertex (mode, count, type, indices, r.u32 ());
+			stats.draws++;
+			break;
+		}
+		case CAPTURE_DRAW_ELEMENTS_INSTANCED_BASE_VERTEX_BASE_INSTANCE: {
+			GLenum mode = r.u32 ();
+			GLsizei count = r.u32 ();
+			GLenum type = r.u32 ();
+			const void* indices = r.offset ();
+			GLsizei instances = r.u32 ();
+			GLint basevertex = r.u32 ();
+			glDrawElementsInstancedBaseVertexBaseInstance (mode, count, type, indices, instances, basevertex, r.u32 ());
+			stats.draws++;
+			break;
+		}
+		case CAPTURE_MULTI_DRAW_ELEMENTS_INDIRECT: {
+			GLenum mode = r.u32 ();
+			GLenum type = r.u32 ();
+			const void* indirect = r.offset ();
+			GLsizei drawcount = r.u32 ();
+			glMultiDrawElementsIndirect (mode, type, indirect, drawcount, r.u32 ());
+			stats.draws++;
+			break;
+		}
+		case CAPTURE_FINISH: glFinish (); break;
+		default: break;
+		}
+	}
+};
+
+static bool read_trace (const char* path, std::vector<unsigned char>& trace) {
+	FILE* fp = platform_fopen (path, "rb");
+	if (fp == NULL) {
+		fprintf (stderr, "replay: can't open %s\n", path);
+		return false;
+	}
+	fseek (fp, 0L, SEEK_END);
+	long size = ftell (fp);
+	fseek (fp, 0L, SEEK_SET);
+	trace.resize (size > 0 ? size : 0);
+	size_t got = size > 0 ? fread (&trace[0], 1, size, fp) : 0;
+	fclose (fp);
+	return got == trace.size ();
+}
+
+int gl_replay (const char* path, int repeat) {
+	std::vector<unsigned char> trace;
+	if (!read_trace (path, trace) || trace.size () < 8) {
+		fprintf (stderr, "replay: %s is not a trace\n", path);
+		return 1;
+	}
+	TraceReader r = { &trace[0], &trace[0] + trace.size () };
+	if (r.u32 () != GL_CAPTURE_MAGIC || r.u32 () != GL_CAPTURE_VERSION) {
+		fprintf (stderr, "replay: %s is not a version %d trace\n", path, GL_CAPTURE_VERSION);
+		return 1;
+	}
+
+	HeadlessContext context;
+	if (!context.create ()) {
+		return 1;
+	}
+
+	Replayer replayer;
+	ReplayStats stats;
+	replay_clock::time_point start = replay_clock::now ();
+	if (!replayer.frame (r, stats)) {
+		fprintf (stderr, "replay: trace has no frames\n");
+		return 1;
+	}
+	glFinish ();
+	std::chrono::duration<double, std::milli> setup = replay_clock::now () - start;
+	printf ("replay: setup %u calls, %u KB, %.3f ms\n", stats.calls, (unsigned)(stats.bytes / 1024), setup.count ());
+
+	const unsigned char* first_frame = r.p;
+	unsigned long long calls = 0, draws = 0, bytes = 0;
+	double submit_total = 0.0, frame_total = 0.0, frame_min = 1e30, frame_max = 0.0;
+	int frames = 0;
+	for (int pass = 0; pass < repeat; pass++) {
+		r.p = first_frame;
+		for (int f = 0; ; f++) {
+			start = replay_clock::now ();
+			if (!replayer.frame (r, stats)) {
+				break;
+			}
+			std::chrono::duration<double, std::milli> submit = replay_clock::now () - start;
+			glFinish ();
+			std::chrono::duration<double, std::milli> frame = replay_clock::now () - start;
+			if (pass == 0) {
+				printf ("frame %4d  %5u calls  %4u draws  %8.1f KB  submit %8.3f ms  frame %8.3f ms\n",
+					f, stats.calls, stats.draws, stats.bytes / 1024.0, submit.count (), frame.count ());
+			}
+			calls += stats.calls;
+			draws += stats.draws;
+			bytes += stats.bytes;
+			submit_total += submit.count ();
+			frame_total += frame.count ();
+			frame_min = fmin (frame_min, frame.count ());
+			frame_max = fmax (frame_max, frame.count ());
+			frames++;
+		}
+	}
+	if (frames > 0) {
+		printf ("replayed %d frames (%d pass%s)  %.1f calls/frame  %.1f draws/frame  %.1f KB/frame  submit %.3f ms  frame avg %.3f ms min %.3f ms max %.3f ms\n",
+			frames, repeat, repeat == 1 ? "" : "es", (double)calls / frames, (double)draws / frames, bytes / 1024.0 / frames,
+			submit_total / frames, frame_total / frames, frame_min, frame_max);
+	}
+	return 0;
+}
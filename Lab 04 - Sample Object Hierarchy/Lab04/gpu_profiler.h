@@ -0,0 +1,343 @@
+#ifndef GPU_PROFILER_H
+#define GPU_PROFILER_H
+
+// OpenGL includes
+#include "gl_includes.h"
+#include "platform.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Frames of queries in flight. A frame's results are read back when its slot
+// comes round again, by then the GPU has normally finished with it.
+#define GPU_PROFILER_FRAMES 3
+// Scopes per frame, later ones are not timed. Also the number of passes kept,
+// the last one being "other", where scopes go once the rest are taken
+#define GPU_PROFILER_MAX_SCOPES 32
+// Frames each rolling average covers
+#define GPU_PROFILER_WINDOW 60
+
+// Rolling GPU time of one named pass
+struct GpuPassStats {
+	const char* name;
+	int depth;
+	float samples[GPU_PROFILER_WINDOW];
+	int count;
+	int next;
+
+	void add(float ms)
+	{
+		samples[next] = ms;
+		next = (next + 1) % GPU_PROFILER_WINDOW;
+		if (count < GPU_PROFILER_WINDOW)
+			count++;
+	}
+
+	float last() const { return count ? samples[(next + GPU_PROFILER_WINDOW - 1) % GPU_PROFILER_WINDOW] : 0.0f; }
+
+	float average() const
+	{
+		float sum = 0.0f;
+		for (int i = 0; i < count; i++)
+			sum += samples[i];
+		return count ? sum / count : 0.0f;
+	}
+
+	float minimum() const
+	{
+		float m = count ? samples[0] : 0.0f;
+		for (int i = 1; i < count; i++)
+			m = samples[i] < m ? samples[i] : m;
+		return m;
+	}
+
+	float maximum() const
+	{
+		float m = 0.0f;
+		for (int i = 0; i < count; i++)
+			m = samples[i] > m ? samples[i] : m;
+		return m;
+	}
+};
+
+// Times named passes on the GPU with GL_TIMESTAMP queries. Timestamps, unlike
+// GL_TIME_ELAPSED, may nest, so every frame is also a "frame" scope around
+// its passes. Results are only read once the driver reports them available,
+// the profiler never waits on the GPU; a frame whose queries are still
+// pending when its slot is reused is dropped instead.
+// Software rasterisers such as llvmpipe take the timestamps when the
+// commands are processed and rasterise later, there the times are the cost
+// of command processing, not of filling pixels.
+// With ARB_pipeline_statistics_query each frame also counts the fragment
+// shaders it ran, one GL_FRAGMENT_SHADER_INVOCATIONS query around the whole
+// frame as those can't nest. Unlike the times that count is right on any
+// driver, it shows what overdraw costs.
+class GpuProfiler
+{
+public:
+	GpuProfiler() : ready(false), countFragments(false), frame(0), open(0), dropped(0), fragments() {}
+
+	// false if the context has no timestamp counter, every call is then a no-op
+	bool init()
+	{
+		GLint bits = 0;
+		glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+		if (bits == 0)
+		{
+			printf("gpu profiler: no timestamp queries\n");
+			return false;
+		}
+		for (int i = 0; i < GPU_PROFILER_FRAMES; i++)
+		{
+			glGenQueries(2 * GPU_PROFILER_MAX_SCOPES, slots[i].queries);
+			slots[i].count = 0;
+			slots[i].counting = false;
+		}
+		countFragments = gl_has_extension("GL_ARB_pipeline_statistics_query");
+		if (countFragments)
+		{
+			for (int i = 0; i < GPU_PROFILER_FRAMES; i++)
+				glGenQueries(1, &slots[i].fragmentQuery);
+		}
+		// passes are found while running, this keeps that from allocating
+		passes.reserve(GPU_PROFILER_MAX_SCOPES);
+		ready = true;
+		return true;
+	}
+
+	void release()
+	{
+		if (!ready)
+			return;
+		for (int i = 0; i < GPU_PROFILER_FRAMES; i++)
+		{
+			glDeleteQueries(2 * GPU_PROFILER_MAX_SCOPES, slots[i].queries);
+			if (countFragments)
+				glDeleteQueries(1, &slots[i].fragmentQuery);
+		}
+		ready = false;
+	}
+
+	// Collects the results of the frame that last used this slot, then opens the frame scope
+	void begin_frame()
+	{
+		if (!ready)
+			return;
+		Slot& slot = slots[frame % GPU_PROFILER_FRAMES];
+		collect(slot);
+		slot.count = 0;
+		open = 0;
+		if (countFragments)
+		{
+			glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, slot.fragmentQuery);
+			slot.counting = true;
+		}
+		begin("frame");
+	}
+
+	void end_frame()
+	{
+		if (!ready)
+			return;
+		while (open > 0)
+			end();
+		if (countFragments)
+			glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+		frame++;
+	}
+
+	// Reads back the frames still in flight, oldest first. For the end of a
+	// run, after glFinish, when no more frames will come round to collect them.
+	void collect_pending()
+	{
+		if (!ready)
+			return;
+		for (unsigned int f = frame < GPU_PROFILER_FRAMES ? 0 : frame - GPU_PROFILER_FRAMES; f < frame; f++)
+		{
+			Slot& slot = slots[f % GPU_PROFILER_FRAMES];
+			collect(slot);
+			slot.count = 0;
+		}
+	}
+
+	// name must outlive the profiler, only the pointer is kept
+	void begin(const char* name)
+	{
+		if (!ready)
+			return;
+		Slot& slot = slots[frame % GPU_PROFILER_FRAMES];
+		int scope = -1;
+		if (slot.count < GPU_PROFILER_MAX_SCOPES)
+		{
+			scope = slot.count++;
+			slot.names[scope] = name;
+			slot.depths[scope] = open;
+			glQueryCounter(slot.queries[2 * scope], GL_TIMESTAMP);
+		}
+		if (open < GPU_PROFILER_MAX_SCOPES)
+			stack[open] = scope;
+		open++;
+	}
+
+	void end()
+	{
+		if (!ready || open == 0)
+			return;
+		open--;
+		if (open < GPU_PROFILER_MAX_SCOPES && stack[open] >= 0)
+			glQueryCounter(slots[frame % GPU_PROFILER_FRAMES].queries[2 * stack[open] + 1], GL_TIMESTAMP);
+	}
+
+	// One line per pass, indented by nesting, in the order the passes first ran
+	std::vector<std::string> report() const
+	{
+		std::vector<std::string> lines;
+		char line[128];
+		// up to the last GPU_PROFILER_WINDOW frames, fewer in a short run
+		int frames = 0;
+		for (size_t i = 0; i < passes.size(); i++)
+			frames = passes[i].count > frames ? passes[i].count : frames;
+		char title[32];
+		snprintf(title, sizeof(title), "gpu ms over %d frame%s", frames, frames == 1 ? "" : "s");
+		snprintf(line, sizeof(line), "%-24s %7s %7s %7s", title, "avg", "min", "max");
+		lines.push_back(line);
+		for (size_t i = 0; i < passes.size(); i++)
+		{
+			const GpuPassStats& p = passes[i];
+			snprintf(line, sizeof(line), "%*s%-*s %7.3f %7.3f %7.3f", 2 * p.depth, "", 24 - 2 * p.depth, p.name,
+				p.average(), p.minimum(), p.maximum());
+			lines.push_back(line);
+		}
+		if (fragments.count > 0)
+		{
+			snprintf(line, sizeof(line), "%-24s %7.0f %7.0f %7.0f", "fragment shaders (k)",
+				fragments.average(), fragments.minimum(), fragments.maximum());
+			lines.push_back(line);
+		}
+		if (dropped > 0)
+		{
+			snprintf(line, sizeof(line), "%u frames dropped, results were not ready", dropped);
+			lines.push_back(line);
+		}
+		return lines;
+	}
+
+	void print() const
+	{
+		std::vector<std::string> lines = report();
+		for (size_t i = 0; i < lines.size(); i++)
+			printf("%s\n", lines[i].c_str());
+	}
+
+	bool write_csv(const char* path) const
+	{
+		FILE* fp = platform_fopen(path, "w");
+		if (!fp)
+		{
+			fprintf(stderr, "ERROR: could not write %s\n", path);
+			return false;
+		}
+		fprintf(fp, "pass,depth,avg_ms,min_ms,max_ms,last_ms,samples\n");
+		for (size_t i = 0; i < passes.size(); i++)
+		{
+			const GpuPassStats& p = passes[i];
+			fprintf(fp, "%s,%d,%.4f,%.4f,%.4f,%.4f,%d\n", p.name, p.depth,
+				p.average(), p.minimum(), p.maximum(), p.last(), p.count);
+		}
+		fclose(fp);
+		return true;
+	}
+
+	const std::vector<GpuPassStats>& stats() const { return passes; }
+
+private:
+	struct Slot {
+		GLuint queries[2 * GPU_PROFILER_MAX_SCOPES];
+		const char* names[GPU_PROFILER_MAX_SCOPES];
+		int depths[GPU_PROFILER_MAX_SCOPES];
+		int count;
+		GLuint fragmentQuery;
+		// fragmentQuery was run and not read back yet
+		bool counting;
+	};
+
+	bool ready;
+	bool countFragments;
+	unsigned int frame;
+	Slot slots[GPU_PROFILER_FRAMES];
+	int stack[GPU_PROFILER_MAX_SCOPES];
+	int open;
+	unsigned int dropped;
+	std::vector<GpuPassStats> passes;
+	// fragment shader invocations of each frame, in thousands
+	GpuPassStats fragments;
+
+	void collect(Slot& slot)
+	{
+		if (slot.counting)
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(slot.fragmentQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available)
+			{
+				GLuint64 invocations = 0;
+				glGetQueryObjectui64v(slot.fragmentQuery, GL_QUERY_RESULT, &invocations);
+				fragments.add(invocations / 1000.0f);
+			}
+			slot.counting = false;
+		}
+		if (slot.count == 0)
+			return;
+		for (int i = 0; i < 2 * slot.count; i++)
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(slot.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+			{
+				dropped++;
+				return;
+			}
+		}
+		float other_ms = 0.0f;
+		bool others = false;
+		for (int i = 0; i < slot.count; i++)
+		{
+			GLuint64 begin_ns = 0, end_ns = 0;
+			glGetQueryObjectui64v(slot.queries[2 * i], GL_QUERY_RESULT, &begin_ns);
+			glGetQueryObjectui64v(slot.queries[2 * i + 1], GL_QUERY_RESULT, &end_ns);
+			float ms = end_ns > begin_ns ? (end_ns - begin_ns) / 1.0e6f : 0.0f;
+			GpuPassStats* p = find(slot.names[i], slot.depths[i]);
+			if (p)
+				p->add(ms);
+			else
+			{
+				other_ms += ms;
+				others = true;
+			}
+		}
+		// one sample a frame for all the scopes that found no room
+		GpuPassStats* other = others ? find("other", 0, true) : NULL;
+		if (other)
+			other->add(other_ms);
+	}
+
+	// NULL once the passes are full, so a new pass can't allocate mid-frame
+	GpuPassStats* find(const char* name, int depth, bool last_slot = false)
+	{
+		for (size_t i = 0; i < passes.size(); i++)
+		{
+			if (passes[i].name == name && passes[i].depth == depth)
+				return &passes[i];
+		}
+		if (passes.size() >= (size_t)GPU_PROFILER_MAX_SCOPES - (last_slot ? 0 : 1))
+			return NULL;
+		GpuPassStats p = {};
+		p.name = name;
+		p.depth = depth;
+		passes.push_back(p);
+		return &passes.back();
+	}
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+// OpenGL includes
+#include "gl_includes.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef LAB04_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// A GL context with no window, for benchmarking the renderer on machines
+// without a display or GPU. Uses EGL's surfaceless platform when Mesa offers
+// it (llvmpipe on CPU-only boxes), otherwise the default EGL display. Only
+// builds with LAB04_HEADLESS (the CMake target) have it.
+class HeadlessContext
+{
+public:
+#ifdef LAB04_HEADLESS
+	HeadlessContext() : display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT) {}
+#else
+	HeadlessContext() {}
+#endif
+	~HeadlessContext() { destroy(); }
+
+	bool create()
+	{
+#ifdef LAB04_HEADLESS
+		const char* clientExts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay && clientExts && strstr(clientExts, "EGL_MESA_platform_surfaceless"))
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		if (display == EGL_NO_DISPLAY)
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+		EGLint major = 0, minor = 0;
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+		{
+			fprintf(stderr, "headless: no EGL display (0x%x)\n", eglGetError());
+			return false;
+		}
+		if (!eglBindAPI(EGL_OPENGL_API))
+		{
+			fprintf(stderr, "headless: EGL %d.%d has no desktop OpenGL\n", major, minor);
+			return false;
+		}
+
+		const EGLint configAttribs[] = {
+			EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+			EGL_DEPTH_SIZE, 24,
+			EGL_NONE
+		};
+		EGLConfig config;
+		EGLint configCount = 0;
+		if (!eglChooseConfig(display, configAttribs, &config, 1, &configCount) || configCount == 0)
+		{
+			fprintf(stderr, "headless: no EGL config for desktop OpenGL\n");
+			return false;
+		}
+
+		// compatibility profile like the GLUT window, core if the driver only has that
+		EGLint contextAttribs[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 3,
+			EGL_CONTEXT_MINOR_VERSION, 3,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+			EGL_NONE
+		};
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+		if (context == EGL_NO_CONTEXT)
+		{
+			contextAttribs[5] = EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT;
+			context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+		}
+		if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+		{
+			fprintf(stderr, "headless: could not create a GL 3.3 context (0x%x)\n", eglGetError());
+			return false;
+		}
+		printf("headless: %s, %s\n", (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
+		return true;
+#else
+		fprintf(stderr, "headless: this build has no EGL support, use the CMake build on Linux\n");
+		return false;
+#endif
+	}
+
+	void destroy()
+	{
+#ifdef LAB04_HEADLESS
+		if (display == EGL_NO_DISPLAY)
+			return;
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (context != EGL_NO_CONTEXT)
+			eglDestroyContext(display, context);
+		eglTerminate(display);
+		display = EGL_NO_DISPLAY;
+		context = EGL_NO_CONTEXT;
+#endif
+	}
+
+private:
+#ifdef LAB04_HEADLESS
+	EGLDisplay display;
+	EGLContext context;
+#endif
+};
+
+// Colour and depth renderbuffers to draw into in place of a window
+class OffscreenTarget
+{
+public:
+	GLuint fbo;
+
+	OffscreenTarget() : fbo(0), colour(0), depth(0) {}
+
+	bool create(int width, int height)
+	{
+		glGenRenderbuffers(1, &colour);
+		glBindRenderbuffer(GL_RENDERBUFFER, colour);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glGenRenderbuffers(1, &depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colour);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth);
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+		{
+			fprintf(stderr, "headless: offscreen framebuffer incomplete (0x%x)\n", status);
+			return false;
+		}
+		glViewport(0, 0, width, height);
+		return true;
+	}
+
+	void bind()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	}
+
+private:
+	GLuint colour;
+	GLuint depth;
+};
+
+#endif
@@ -0,0 +1,357 @@
+#ifndef INDIRECT_DRAW_H
+#define INDIRECT_DRAW_H
+
+// OpenGL includes
+#include "gl_includes.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "frustum.h"
+#include "geometry_arena.h"
+#include "stream_buffer.h"
+
+// Upper bound on draws per frame, sizes the draw id buffer
+#define MAX_INDIRECT_DRAWS 4096
+// vec4 texels per draw in the per-draw data buffer: model (4), normal matrix (3), material (1)
+#define DRAW_DATA_TEXELS 8
+
+// Layout fixed by the GL spec for GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+struct DrawData {
+	glm::mat4 model;
+	glm::vec4 normal[3];
+	glm::vec4 material; // x diffuse layer, y specular layer
+};
+
+// Packs a set of 2D textures of any size into one texture array so draws
+// with different materials can share a single draw call. Layers are scaled
+// on the GPU with a framebuffer blit.
+class MaterialArray
+{
+public:
+	GLuint texture;
+
+	MaterialArray() : texture(0) {}
+
+	int add(GLuint source)
+	{
+		for (size_t i = 0; i < sources.size(); i++)
+		{
+			if (sources[i] == source)
+				return (int)i;
+		}
+		sources.push_back(source);
+		return (int)sources.size() - 1;
+	}
+
+	void build(int size)
+	{
+		if (sources.empty())
+			return;
+		int levels = 1;
+		while ((size >> levels) > 0)
+			levels++;
+
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		for (int l = 0; l < levels; l++)
+		{
+			int s = size >> l;
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, l, GL_RGBA8, s, s, (GLsizei)sources.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		}
+
+		GLuint fbos[2];
+		glGenFramebuffers(2, fbos);
+		for (size_t i = 0; i < sources.size(); i++)
+		{
+			GLint w = 0, h = 0;
+			glBindTexture(GL_TEXTURE_2D, sources[i]);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos[0]);
+			glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sources[i], 0);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbos[1]);
+			glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, (GLint)i);
+			if (w > 0 && h > 0 && glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE
+				&& glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE)
+			{
+				glBlitFramebuffer(0, 0, w, h, 0, 0, size, size, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+			}
+			else
+			{
+				printf("material array: could not copy texture %u into layer %d\n", sources[i], (int)i);
+			}
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(2, fbos);
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+
+private:
+	std::vector<GLuint> sources;
+};
+
+struct IndirectStats {
+	unsigned int submitted;
+	unsigned int culled;
+	unsigned int commands;
+	unsigned int apiCalls;
+};
+
+// Culls the frame's opaque objects on the CPU, writes one indirect command per
+// visible object and issues the whole set with one glMultiDrawElementsIndirect.
+// Per-draw transforms and material layers are read in the vertex shader from
+// a buffer texture indexed by the draw id attribute (base instance). Both are
+// written into streamBuffer when it is set and has room, the per-draw data
+// only where a buffer texture can start at an offset (GL 4.3).
+// The commands go out nearest first and are uploaded once a frame, so a
+// depth pre-pass and the shading after it draw the same set.
+class IndirectRenderer
+{
+public:
+	GeometryArena arena;
+	IndirectStats stats;
+	GLuint drawDataTexture;
+	StreamBuffer* streamBuffer;
+
+	IndirectRenderer() : drawDataTexture(0), streamBuffer(NULL), drawIdBuffer(0), commandBuffer(0), drawDataBuffer(0), commandCapacity(0), dataCapacity(0), multiDraw(false), baseInstance(false), textureRange(false), texelAlign(1),
+		frameUploaded(false), dataInStream(false), commandsInStream(false), dataOffset(0), dataBytes(0), commandOffset(0)
+	{
+		stats.submitted = stats.culled = stats.commands = stats.apiCalls = 0;
+	}
+
+	// Call once all meshes have been added to the arena
+	void init()
+	{
+		std::vector<GLuint> ids(MAX_INDIRECT_DRAWS);
+		for (GLuint i = 0; i < MAX_INDIRECT_DRAWS; i++)
+			ids[i] = i;
+		glGenBuffers(1, &drawIdBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+		glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(GLuint), &ids[0], GL_STATIC_DRAW);
+		arena.upload(drawIdBuffer);
+
+		glGenBuffers(1, &commandBuffer);
+		glGenBuffers(1, &drawDataBuffer);
+		glGenTextures(1, &drawDataTexture);
+
+		multiDraw = GLEW_ARB_multi_draw_indirect || GLEW_VERSION_4_3;
+		baseInstance = GLEW_ARB_base_instance || GLEW_VERSION_4_2;
+		textureRange = GLEW_ARB_texture_buffer_range || GLEW_VERSION_4_3;
+		if (textureRange)
+			glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &texelAlign);
+		printf("indirect draws: %s\n", multiDraw ? "glMultiDrawElementsIndirect"
+			: baseInstance ? "draw loop with base instance" : "draw loop");
+	}
+
+	bool ready() const { return arena.ready(); }
+	bool empty() const { return commands.empty(); }
+
+	void begin_frame(const glm::mat4& viewProj)
+	{
+		frustum.set(viewProj);
+		this->viewProj = viewProj;
+		commands.clear();
+		drawData.clear();
+		depths.clear();
+		frameUploaded = false;
+		stats.submitted = stats.culled = stats.commands = stats.apiCalls = 0;
+	}
+
+	// Queues a mesh at one of its levels of detail unless it is outside the
+	// view frustum. false if it was culled.
+	bool add(int mesh, const glm::mat4& model, int diffuseLayer, int specularLayer, int lod = 0)
+	{
+		const MeshRange& range = arena.mesh(mesh);
+		stats.submitted++;
+		if (!frustum.intersects(range.bounds.transformed(model)) || commands.size() >= MAX_INDIRECT_DRAWS)
+		{
+			stats.culled++;
+			return false;
+		}
+		const MeshLod& level = range.lods[std::min(std::max(lod, 0), range.lodCount - 1)];
+
+		DrawElementsIndirectCommand cmd;
+		cmd.count = level.indexCount;
+		cmd.instanceCount = 1;
+		cmd.firstIndex = level.firstIndex;
+		cmd.baseVertex = range.baseVertex;
+		cmd.baseInstance = (GLuint)commands.size();
+		commands.push_back(cmd);
+
+		DrawData d;
+		d.model = model;
+		glm::mat3 n = glm::inverseTranspose(glm::mat3(model));
+		for (int c = 0; c < 3; c++)
+			d.normal[c] = glm::vec4(n[c], 0.0f);
+		d.material = glm::vec4((float)diffuseLayer, (float)specularLayer, 0.0f, 0.0f);
+		drawData.push_back(d);
+		// clip w is the distance along the view axis
+		depths.push_back((viewProj * model[3]).w);
+		return true;
+	}
+
+	// Draws the frame's commands, uploading them and the per-draw data the
+	// first time it is called in the frame. The caller has the program bound
+	// and its samplers set, drawData is bound to dataUnit. depthOnly draws
+	// from the arena's position-only vertices, for a depth pre-pass.
+	void draw(GLuint dataUnit, bool depthOnly = false)
+	{
+		stats.commands = (unsigned int)commands.size();
+		if (commands.empty())
+			return;
+		if (!frameUploaded)
+			upload();
+
+		glActiveTexture(GL_TEXTURE0 + dataUnit);
+		glBindTexture(GL_TEXTURE_BUFFER, drawDataTexture);
+		if (dataInStream)
+			glTexBufferRange(GL_TEXTURE_BUFFER, GL_RGBA32F, streamBuffer->buffer(), dataOffset, dataBytes);
+		else
+			glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, drawDataBuffer);
+
+		glBindVertexArray(depthOnly ? arena.depthVao : arena.vao);
+		if (multiDraw)
+		{
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandsInStream ? streamBuffer->buffer() : commandBuffer);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)commandOffset, (GLsizei)commands.size(), 0);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			stats.apiCalls++;
+		}
+		else
+		{
+			// same commands, issued one at a time
+			if (!baseInstance)
+				glDisableVertexAttribArray(DRAW_ID_LOCATION);
+			for (size_t i = 0; i < commands.size(); i++)
+			{
+				const DrawElementsIndirectCommand& c = commands[i];
+				void* offset = (void*)(c.firstIndex * sizeof(GLuint));
+				if (baseInstance)
+				{
+					glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, c.count, GL_UNSIGNED_INT, offset, 1, c.baseVertex, c.baseInstance);
+				}
+				else
+				{
+					glVertexAttribI1ui(DRAW_ID_LOCATION, c.baseInstance);
+					glDrawElementsBaseVertex(GL_TRIANGLES, c.count, GL_UNSIGNED_INT, offset, c.baseVertex);
+				}
+			}
+			if (!baseInstance)
+				glEnableVertexAttribArray(DRAW_ID_LOCATION);
+			stats.apiCalls += (unsigned int)commands.size();
+		}
+		glBindVertexArray(0);
+	}
+
+	void print_stats() const
+	{
+		printf("indirect: %u submitted, %u culled, %u commands in %u draw call(s)\n",
+			stats.submitted, stats.culled, stats.commands, stats.apiCalls);
+	}
+
+private:
+	GLuint drawIdBuffer;
+	GLuint commandBuffer;
+	GLuint drawDataBuffer;
+	size_t commandCapacity;
+	size_t dataCapacity;
+	bool multiDraw;
+	bool baseInstance;
+	bool textureRange;
+	GLint texelAlign;
+	Frustum frustum;
+	glm::mat4 viewProj;
+	std::vector<DrawElementsIndirectCommand> commands;
+	std::vector<DrawData> drawData;
+	// view depth of each command, and the scratch space sorting by it
+	std::vector<float> depths;
+	std::vector<std::pair<float, GLuint> > order;
+	std::vector<DrawElementsIndirectCommand> sortedCommands;
+	std::vector<DrawData> sortedData;
+	// where this frame's upload went
+	bool frameUploaded;
+	bool dataInStream;
+	bool commandsInStream;
+	size_t dataOffset;
+	size_t dataBytes;
+	size_t commandOffset;
+
+	// Puts the commands in front to back order and writes them and the
+	// per-draw data to the GPU
+	void upload()
+	{
+		size_t count = commands.size();
+		order.resize(count);
+		for (size_t i = 0; i < count; i++)
+			order[i] = std::make_pair(depths[i], (GLuint)i);
+		std::sort(order.begin(), order.end());
+		sortedCommands.resize(count);
+		sortedData.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			sortedCommands[i] = commands[order[i].second];
+			sortedCommands[i].baseInstance = (GLuint)i;
+			sortedData[i] = drawData[order[i].second];
+		}
+		commands.swap(sortedCommands);
+		drawData.swap(sortedData);
+
+		dataBytes = drawData.size() * sizeof(DrawData);
+		size_t commandBytes = commands.size() * sizeof(DrawElementsIndirectCommand);
+		dataOffset = commandOffset = 0;
+		void* dataDst = streamBuffer && textureRange ? streamBuffer->allocate(dataBytes, texelAlign, &dataOffset) : NULL;
+		void* commandDst = dataDst && multiDraw ? streamBuffer->allocate(commandBytes, sizeof(GLuint), &commandOffset) : NULL;
+		dataInStream = dataDst != NULL;
+		commandsInStream = commandDst != NULL;
+		if (dataDst)
+		{
+			memcpy(dataDst, &drawData[0], dataBytes);
+			if (commandDst)
+				memcpy(commandDst, &commands[0], commandBytes);
+			streamBuffer->commit();
+		}
+		else
+		{
+			stream(GL_TEXTURE_BUFFER, drawDataBuffer, &drawData[0], dataBytes, dataCapacity);
+		}
+		if (multiDraw && !commandDst)
+		{
+			stream(GL_DRAW_INDIRECT_BUFFER, commandBuffer, &commands[0], commandBytes, commandCapacity);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		}
+		frameUploaded = true;
+	}
+
+	// Orphan-and-fill upload, the buffer only ever grows
+	static void stream(GLenum target, GLuint buffer, const void* data, size_t bytes, size_t& capacity)
+	{
+		glBindBuffer(target, buffer);
+		if (bytes > capacity)
+			capacity = bytes * 2;
+		glBufferData(target, capacity, NULL, GL_STREAM_DRAW);
+		glBufferSubData(target, 0, bytes, data);
+	}
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+// OpenGL includes
+#include "gl_includes.h"
+#include "stream_buffer.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+
+// Vertex attribute slots taken by the per-instance data, after the mesh
+// attributes (0-4 are position, normal, uv, tangent, bitangent)
+#define INSTANCE_MODEL_LOCATION 5
+#define INSTANCE_NORMAL_LOCATION 9
+
+// One instance as it sits in the instance buffer. The normal matrix columns
+// are padded to vec4 so every column starts on a 16 byte boundary.
+struct InstanceData {
+	glm::mat4 model;
+	glm::vec4 normal[3];
+};
+
+inline InstanceData make_instance(const glm::mat4& model)
+{
+	InstanceData d;
+	d.model = model;
+	glm::mat3 n = glm::inverseTranspose(glm::mat3(model));
+	for (int c = 0; c < 3; c++)
+		d.normal[c] = glm::vec4(n[c], 0.0f);
+	return d;
+}
+
+// Collects per-instance data for a frame and streams it to the GPU in a single
+// upload. Batches reference their slice of the buffer by first instance.
+// With a StreamBuffer the upload is a copy into its mapped ring, otherwise
+// (or when the ring is full) the buffer of our own is orphaned and refilled.
+class InstanceBuffer
+{
+public:
+	GLuint vbo;
+	StreamBuffer* stream;
+
+	InstanceBuffer() : vbo(0), stream(NULL), capacity(0), source(0), baseOffset(0) {}
+
+	void begin_frame()
+	{
+		staging.clear();
+	}
+
+	// Appends an instance, returns its index in this frame's buffer
+	GLuint add(const glm::mat4& model)
+	{
+		staging.push_back(make_instance(model));
+		return (GLuint)staging.size() - 1;
+	}
+
+	size_t size() const { return staging.size(); }
+
+	void upload()
+	{
+		size_t bytes = staging.size() * sizeof(InstanceData);
+		void* dst = stream ? stream->allocate(bytes, 16, &baseOffset) : NULL;
+		if (dst)
+		{
+			memcpy(dst, &staging[0], bytes);
+			stream->commit();
+			source = stream->buffer();
+			return;
+		}
+
+		// orphans the old storage so the driver never waits on last frame's draws
+		source = vbo;
+		baseOffset = 0;
+		if (vbo == 0)
+		{
+			glGenBuffers(1, &vbo);
+			source = vbo;
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		if (staging.size() > capacity)
+		{
+			capacity = staging.size() * 2;
+		}
+		glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+		if (!staging.empty())
+			glBufferSubData(GL_ARRAY_BUFFER, 0, staging.size() * sizeof(InstanceData), &staging[0]);
+	}
+
+	// Points the instance attributes of the bound VAO at the given instance.
+	// Offsetting the pointers stands in for a base instance, which needs GL 4.2.
+	void bind_attributes(GLuint first_instance)
+	{
+		const GLsizei stride = sizeof(InstanceData);
+		size_t base = baseOffset + first_instance * sizeof(InstanceData);
+		glBindBuffer(GL_ARRAY_BUFFER, source);
+		for (int c = 0; c < 4; c++)
+		{
+			GLuint loc = INSTANCE_MODEL_LOCATION + c;
+			glEnableVertexAttribArray(loc);
+			glVertexAttribPointer(loc, 4, GL_FLOAT, GL_FALSE, stride, (void*)(base + offsetof(InstanceData, model) + c * sizeof(glm::vec4)));
+			glVertexAttribDivisor(loc, 1);
+		}
+		for (int c = 0; c < 3; c++)
+		{
+			GLuint loc = INSTANCE_NORMAL_LOCATION + c;
+			glEnableVertexAttribArray(loc);
+			glVertexAttribPointer(loc, 3, GL_FLOAT, GL_FALSE, stride, (void*)(base + offsetof(InstanceData, normal) + c * sizeof(glm::vec4)));
+			glVertexAttribDivisor(loc, 1);
+		}
+	}
+
+private:
+	std::vector<InstanceData> staging;
+	size_t capacity;
+	// where this frame's instances were uploaded
+	GLuint source;
+	size_t baseOffset;
+};
+
+#endif
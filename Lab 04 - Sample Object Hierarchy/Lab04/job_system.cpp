@@ -0,0 +1,259 @@
+// Work-stealing job scheduler, see job_system.h
+#include "job_system.h"
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+JobSystem job_system;
+
+// Each start() is a new generation, a thread's queue index from an earlier
+// one (or another JobSystem) is not reused
+static std::atomic<unsigned int> next_generation (1);
+
+struct ThreadQueue {
+	unsigned int generation;
+	int index;
+};
+static thread_local ThreadQueue thread_queue = { 0, -1 };
+
+// worker track names for the profiler, they have to be literals
+static const char* const worker_names[] = {
+	"job worker 1", "job worker 2", "job worker 3", "job worker 4",
+	"job worker 5", "job worker 6", "job worker 7", "job worker 8"
+};
+
+JobSystem::JobSystem () : queues (NULL), queue_count (0), running (false), sleeping (0), generation (0) {
+}
+
+JobSystem::~JobSystem () {
+	stop ();
+}
+
+void JobSystem::start (int workers) {
+	stop ();
+	if (workers < 0) {
+		int cores = (int)std::thread::hardware_concurrency ();
+		workers = cores > 1 ? cores - 1 : 0;
+	}
+	// the workers and the thread calling start leave room for a few more submitters
+	if (workers > JOB_MAX_QUEUES - 4)
+		workers = JOB_MAX_QUEUES - 4;
+	if (workers == 0)
+		return;
+
+	queues = new Queue[JOB_MAX_QUEUES];
+	queue_count.store (0);
+	generation = next_generation++;
+	running.store (true);
+	this_queue ();
+	for (int i = 0; i < workers; i++) {
+		threads.push_back (std::thread (&JobSystem::worker, this, i));
+	}
+}
+
+void JobSystem::stop () {
+	if (threads.empty ())
+		return;
+	running.store (false);
+	{
+		std::lock_guard<std::mutex> lock (sleep_mutex);
+		wake.notify_all ();
+	}
+	for (size_t i = 0; i < threads.size (); i++) {
+		threads[i].join ();
+	}
+	threads.clear ();
+	delete[] queues;
+	queues = NULL;
+}
+
+JobSystem::Queue& JobSystem::this_queue () {
+	if (thread_queue.generation != generation) {
+		int index = queue_count.fetch_add (1);
+		if (index >= JOB_MAX_QUEUES) {
+			fprintf (stderr, "ERROR: more than %d threads submit jobs\n", JOB_MAX_QUEUES);
+			abort ();
+		}
+		queues[index].allocated = 0;
+		thread_queue.generation = generation;
+		thread_queue.index = index;
+	}
+	return queues[thread_queue.index];
+}
+
+void JobSystem::run (JobFn fn, void* data, JobCounter* counter, size_t begin, size_t end) {
+	if (threads.empty ()) {
+		fn (data, begin, end);
+		return;
+	}
+	Queue& queue = this_queue ();
+	Job* job = &queue.pool[queue.allocated++ & (JOB_POOL_SIZE - 1)];
+	job->fn = fn;
+	job->data = data;
+	job->begin = begin;
+	job->end = end;
+	job->counter = counter;
+	if (counter)
+		counter->pending.fetch_add (1, std::memory_order_relaxed);
+	submit (job);
+}
+
+void JobSystem::run_after (JobCounter* dependency, JobFn fn, void* data, JobCounter* counter, size_t begin, size_t end) {
+	if (threads.empty ()) {
+		fn (data, begin, end);
+		return;
+	}
+	int pending = dependency->pending.load (std::memory_order_acquire);
+	while (true) {
+		if (pending == 0) {
+			run (fn, data, counter, begin, end);
+			return;
+		}
+		if (pending & JOB_COUNTER_LOCKED)
+			pending = dependency->pending.load (std::memory_order_acquire);
+		else if (dependency->pending.compare_exchange_weak (pending, pending | JOB_COUNTER_LOCKED, std::memory_order_acquire))
+			break;
+	}
+	// jobs may still finish meanwhile, but the last one waits for the lock
+	if (dependency->continuation_count == JOB_MAX_CONTINUATIONS) {
+		fprintf (stderr, "ERROR: more than %d jobs wait on one counter\n", JOB_MAX_CONTINUATIONS);
+		abort ();
+	}
+	Job& job = dependency->continuations[dependency->continuation_count++];
+	job.fn = fn;
+	job.data = data;
+	job.begin = begin;
+	job.end = end;
+	job.counter = counter;
+	// held up from now, not from when the dependency drains
+	if (counter)
+		counter->pending.fetch_add (1, std::memory_order_relaxed);
+	dependency->pending.fetch_and (~JOB_COUNTER_LOCKED, std::memory_order_release);
+}
+
+void JobSystem::submit (Job* job) {
+	if (!this_queue ().deque.push (job)) {
+		// deque full, no point queueing behind four thousand jobs
+		execute (job);
+		return;
+	}
+	if (sleeping.load () > 0) {
+		std::lock_guard<std::mutex> lock (sleep_mutex);
+		wake.notify_one ();
+	}
+}
+
+void JobSystem::execute (Job* job) {
+	job->fn (job->data, job->begin, job->end);
+	if (job->counter)
+		finish (job->counter);
+}
+
+void JobSystem::finish (JobCounter* counter) {
+	int pending = counter->pending.load (std::memory_order_relaxed);
+	while (true) {
+		if ((pending & ~JOB_COUNTER_LOCKED) > 1) {
+			if (counter->pending.compare_exchange_weak (pending, pending - 1, std::memory_order_acq_rel))
+				return;
+		}
+		else if (pending & JOB_COUNTER_LOCKED) {
+			// last one out, but run_after is adding a continuation
+			pending = counter->pending.load (std::memory_order_acquire);
+		}
+		else if (counter->pending.compare_exchange_weak (pending, 1 | JOB_COUNTER_LOCKED, std::memory_order_acquire)) {
+			break;
+		}
+	}
+
+	// last job, take the continuations before letting the count reach zero
+	int count = counter->continuation_count;
+	Job continuations[JOB_MAX_CONTINUATIONS];
+	for (int i = 0; i < count; i++) {
+		continuations[i] = counter->continuations[i];
+	}
+	counter->continuation_count = 0;
+	// unlocks and drains together, the counter is not touched after this
+	counter->pending.fetch_sub (1 | JOB_COUNTER_LOCKED, std::memory_order_acq_rel);
+
+	for (int i = 0; i < count; i++) {
+		const Job& c = continuations[i];
+		Queue& queue = this_queue ();
+		Job* job = &queue.pool[queue.allocated++ & (JOB_POOL_SIZE - 1)];
+		*job = c;
+		// the counter was raised by run_after already
+		submit (job);
+	}
+}
+
+Job* JobSystem::find_job () {
+	Queue& own = this_queue ();
+	Job* job = own.deque.pop ();
+	if (job)
+		return job;
+	int count = queue_count.load (std::memory_order_acquire);
+	if (count > JOB_MAX_QUEUES)
+		count = JOB_MAX_QUEUES;
+	// start at the next queue so thieves spread out
+	for (int i = 1; i < count; i++) {
+		Queue& victim = queues[(thread_queue.index + i) % count];
+		job = victim.deque.steal ();
+		if (job)
+			return job;
+	}
+	return NULL;
+}
+
+bool JobSystem::has_work () const {
+	int count = queue_count.load (std::memory_order_acquire);
+	for (int i = 0; i < count && i < JOB_MAX_QUEUES; i++) {
+		if (!queues[i].deque.empty ())
+			return true;
+	}
+	return false;
+}
+
+void JobSystem::wait (JobCounter* counter) {
+	if (threads.empty ())
+		return;
+	while (!counter->done ()) {
+		Job* job = find_job ();
+		if (job)
+			execute (job);
+		else
+			std::this_thread::yield ();
+	}
+}
+
+void JobSystem::worker (int index) {
+	if (index < (int)(sizeof (worker_names) / sizeof (worker_names[0])))
+		PROFILE_THREAD (worker_names[index]);
+	this_queue ();
+	int idle = 0;
+	while (true) {
+		Job* job = find_job ();
+		if (job) {
+			execute (job);
+			idle = 0;
+			continue;
+		}
+		if (!running.load ())
+			break;
+		// spin a little before sleeping, work tends to come in bursts
+		if (++idle < 64) {
+			std::this_thread::yield ();
+			continue;
+		}
+		sleeping.fetch_add (1);
+		{
+			std::unique_lock<std::mutex> lock (sleep_mutex);
+			// a push can land between the last look and sleeping going up,
+			// look again under the lock, the timeout covers whatever is left
+			if (running.load () && !has_work ())
+				wake.wait_for (lock, std::chrono::milliseconds (1));
+		}
+		sleeping.fetch_sub (1);
+		idle = 0;
+	}
+}
@@ -0,0 +1,215 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+// Work-stealing job scheduler shared by everything that wants more than one
+// core. Each thread that submits work gets its own Chase-Lev deque: it pushes
+// and pops at the bottom, idle workers steal from the top of the others.
+// Jobs come from a per-thread ring of JOB_POOL_SIZE slots that is reused in
+// order, so submitting never allocates; a slot is only overwritten
+// JOB_POOL_SIZE submissions later, long after its job has run.
+//
+// Completion is tracked with JobCounters: every job run against a counter
+// holds it up until it finishes, wait() runs other jobs while it waits, and
+// run_after() starts a job once a counter has drained.
+//
+//   JobCounter done;
+//   job_system.parallel_for(0, n, 256, [&](size_t begin, size_t end) { ... });
+//   job_system.run(decode, &image, &done);
+//   job_system.wait(&done);
+//
+// With no worker threads (one core, or start() never called) every job runs
+// inline when it is submitted, the results are the same.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// powers of two, per submitting thread. The pool is twice the deque so a
+// full deque plus the jobs thieves are running never share a slot.
+#define JOB_POOL_SIZE 8192
+#define JOB_DEQUE_SIZE 4096
+// workers plus other threads that submit jobs
+#define JOB_MAX_QUEUES 16
+// jobs a single counter can start when it drains
+#define JOB_MAX_CONTINUATIONS 4
+
+struct JobCounter;
+
+// Runs the half open range [begin, end) of whatever data points at
+typedef void (*JobFn)(void* data, size_t begin, size_t end);
+
+struct Job {
+	JobFn fn;
+	void* data;
+	size_t begin;
+	size_t end;
+	JobCounter* counter;
+};
+
+// Jobs outstanding in the low bits, JOB_COUNTER_LOCKED while the
+// continuations are being changed. The count only reaches zero with the lock
+// released in the same store, so once done() a waiter may destroy the counter.
+#define JOB_COUNTER_LOCKED (1 << 30)
+
+struct JobCounter {
+	std::atomic<int> pending;
+	Job continuations[JOB_MAX_CONTINUATIONS];
+	int continuation_count;
+
+	JobCounter() : pending(0), continuation_count(0) {}
+
+	bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+// Chase-Lev deque of fixed size, see "Correct and Efficient Work-Stealing
+// for Weak Memory Models" (Le et al. 2013). Only the owning thread may push
+// and pop, any thread may steal.
+class JobDeque
+{
+public:
+	JobDeque() : top(0), bottom(0)
+	{
+		for (int i = 0; i < JOB_DEQUE_SIZE; i++)
+			slots[i].store(NULL, std::memory_order_relaxed);
+	}
+
+	// false when full, the caller runs the job itself
+	bool push(Job* job)
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		if (b - t >= JOB_DEQUE_SIZE)
+			return false;
+		slots[b & (JOB_DEQUE_SIZE - 1)].store(job, std::memory_order_relaxed);
+		// publishes the job, pairs with the acquire load of bottom in steal
+		bottom.store(b + 1, std::memory_order_release);
+		return true;
+	}
+
+	Job* pop()
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+		if (t > b)
+		{
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return NULL;
+		}
+		Job* job = slots[b & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+		if (t == b)
+		{
+			// last one, race the thieves for it
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				job = NULL;
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return job;
+	}
+
+	Job* steal()
+	{
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return NULL;
+		Job* job = slots[t & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_acquire);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return NULL;
+		return job;
+	}
+
+	bool empty() const
+	{
+		return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire);
+	}
+
+private:
+	std::atomic<int64_t> top;
+	std::atomic<int64_t> bottom;
+	std::atomic<Job*> slots[JOB_DEQUE_SIZE];
+};
+
+class JobSystem
+{
+public:
+	JobSystem();
+	~JobSystem();
+
+	// Starts the workers, -1 for one per core besides the calling thread
+	void start(int workers = -1);
+	// Finishes the queued jobs and joins the workers
+	void stop();
+	int worker_count() const { return (int)threads.size(); }
+
+	// Queues fn(data, begin, end), counter (if any) is held up until it has run
+	void run(JobFn fn, void* data, JobCounter* counter, size_t begin = 0, size_t end = 0);
+	// Queues the job once dependency has drained, at once if it already has
+	void run_after(JobCounter* dependency, JobFn fn, void* data, JobCounter* counter, size_t begin = 0, size_t end = 0);
+	// Runs queued jobs until the counter drains
+	void wait(JobCounter* counter);
+
+	// Calls body(begin, end) over [first, last) in chunks of grain items and
+	// returns when all of them are done
+	template <typename Body>
+	void parallel_for(size_t first, size_t last, size_t grain, const Body& body)
+	{
+		if (grain == 0)
+			grain = 1;
+		if (threads.empty() || last - first <= grain)
+		{
+			if (first < last)
+				body(first, last);
+			return;
+		}
+		JobCounter counter;
+		for (size_t begin = first; begin < last; begin += grain)
+		{
+			size_t end = last - begin > grain ? begin + grain : last;
+			run(&call_range<Body>, (void*)&body, &counter, begin, end);
+		}
+		wait(&counter);
+	}
+
+private:
+	struct Queue {
+		JobDeque deque;
+		Job pool[JOB_POOL_SIZE];
+		unsigned int allocated;
+	};
+
+	Queue* queues;
+	std::atomic<int> queue_count;
+	std::vector<std::thread> threads;
+	std::atomic<bool> running;
+	// idle workers sleep here rather than spin
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+	std::atomic<int> sleeping;
+	unsigned int generation;
+
+	template <typename Body>
+	static void call_range(void* data, size_t begin, size_t end)
+	{
+		(*(const Body*)data)(begin, end);
+	}
+
+	Queue& this_queue();
+	void submit(Job* job);
+	void execute(Job* job);
+	void finish(JobCounter* counter);
+	Job* find_job();
+	bool has_work() const;
+	void worker(int index);
+};
+
+// the scheduler the whole program shares, started in main()
+extern JobSystem job_system;
+
+#endif
@@ -0,0 +1,124 @@
+// Micro benchmark of the job system: what it costs to spawn and run a job,
+// and how parallel_for scales with the number of workers. Run with --bench-jobs.
+#include "job_system.h"
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock bench_clock;
+
+// keeps results alive so the optimiser can't drop the loops
+static volatile float bench_sink;
+
+static double elapsed_ms (bench_clock::time_point start) {
+	std::chrono::duration<double, std::milli> d = bench_clock::now () - start;
+	return d.count ();
+}
+
+static void empty_job (void*, size_t, size_t) {
+}
+
+struct BenchParticle {
+	float pos[3];
+	float vel[3];
+	float life;
+};
+
+// a few hundred cycles per particle, like a heavier particle update
+static void integrate (BenchParticle* p, size_t begin, size_t end) {
+	for (size_t i = begin; i < end; i++) {
+		for (int step = 0; step < 16; step++) {
+			for (int k = 0; k < 3; k++) {
+				p[i].vel[k] += -0.1f * p[i].pos[k] * (1.0f / 60.0f);
+				p[i].pos[k] += p[i].vel[k] * (1.0f / 60.0f);
+			}
+			p[i].life -= sqrtf (p[i].vel[0] * p[i].vel[0] + p[i].vel[1] * p[i].vel[1] + p[i].vel[2] * p[i].vel[2]) * 0.001f;
+		}
+	}
+}
+
+static void reset (std::vector<BenchParticle>& particles) {
+	for (size_t i = 0; i < particles.size (); i++) {
+		BenchParticle& p = particles[i];
+		for (int k = 0; k < 3; k++) {
+			p.pos[k] = (float)((i * (k + 3)) % 97) * 0.1f;
+			p.vel[k] = 0.0f;
+		}
+		p.life = 1.0f;
+	}
+}
+
+// Jobs whose cost grows with their index, so the first worker to finish
+// its share has to steal to keep busy
+static void uneven_job (void* data, size_t begin, size_t) {
+	float x = 0.0f;
+	for (size_t i = 0; i < begin * 2000; i++) {
+		x += sqrtf ((float)i);
+	}
+	((float*)data)[begin] = x;
+}
+
+int run_jobs_bench () {
+	int cores = (int)std::thread::hardware_concurrency ();
+	printf ("%d hardware threads\n", cores);
+
+	std::vector<int> worker_counts;
+	for (int w = 0; w < cores; w = w ? w * 2 : 1) {
+		worker_counts.push_back (w);
+	}
+	if (cores > 1 && worker_counts.back () != cores - 1)
+		worker_counts.push_back (cores - 1);
+	// one oversubscribed run, on a single core it is the only threaded one
+	worker_counts.push_back (cores > 1 ? cores : 1);
+
+	const int spawn = 100000;
+	const size_t count = 1 << 18;
+	std::vector<BenchParticle> particles (count);
+	double serial_ms = 0.0;
+	for (size_t c = 0; c < worker_counts.size (); c++) {
+		JobSystem jobs;
+		jobs.start (worker_counts[c]);
+
+		// spawn, run and retire empty jobs through a counter
+		JobCounter counter;
+		bench_clock::time_point start = bench_clock::now ();
+		for (int i = 0; i < spawn; i++) {
+			jobs.run (empty_job, NULL, &counter);
+			if ((i & 1023) == 1023)
+				jobs.wait (&counter);
+		}
+		jobs.wait (&counter);
+		double spawn_ns = elapsed_ms (start) * 1.0e6 / spawn;
+
+		// parallel_for over a particle array, best of five
+		double best = 1.0e9;
+		for (int rep = 0; rep < 5; rep++) {
+			reset (particles);
+			BenchParticle* p = &particles[0];
+			start = bench_clock::now ();
+			jobs.parallel_for (0, count, 4096, [p](size_t begin, size_t end) {
+				integrate (p, begin, end);
+			});
+			double ms = elapsed_ms (start);
+			best = ms < best ? ms : best;
+		}
+		if (c == 0)
+			serial_ms = best;
+
+		// uneven jobs, finished only if idle workers steal
+		float sums[64];
+		JobCounter uneven;
+		start = bench_clock::now ();
+		for (size_t i = 0; i < 64; i++) {
+			jobs.run (uneven_job, sums, &uneven, i);
+		}
+		jobs.wait (&uneven);
+		double uneven_ms = elapsed_ms (start);
+		bench_sink = sums[63];
+
+		printf ("%2d workers  spawn %7.1f ns/job  parallel_for %8.3f ms (x%.2f)  uneven %8.3f ms\n",
+			worker_counts[c], spawn_ns, best, serial_ms / best, uneven_ms);
+	}
+	return 0;
+}
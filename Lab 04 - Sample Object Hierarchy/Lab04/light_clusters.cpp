@@ -0,0 +1,332 @@
+// Light binning for clustered forward lighting, see light_clusters.h
+#include "light_clusters.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#include "job_system.h"
+#include "profiler.h"
+#include "simd_f4.h"
+
+// how much every cluster's bounds grow on each side, as a fraction of the
+// cluster, so a fragment whose depth comes out a little off in the shader
+// still finds its lights
+#define CLUSTER_PADDING 0.01f
+
+// Sphere i has centre (x[i], y[i], z[i]) and radius r[i]. Writes the index
+// of every sphere touching the box [lo, hi] to hits, in order, returns how
+// many. Four spheres at a time: the squared distance from each centre to the
+// box, per axis how far the centre lies outside it, against the squared radius.
+static size_t spheres_touching_box (const float* x, const float* y, const float* z, const float* r, size_t count,
+	const float* lo, const float* hi, unsigned int* hits) {
+	f4 lo_x = f4_splat (lo[0]), lo_y = f4_splat (lo[1]), lo_z = f4_splat (lo[2]);
+	f4 hi_x = f4_splat (hi[0]), hi_y = f4_splat (hi[1]), hi_z = f4_splat (hi[2]);
+	f4 zero = f4_splat (0.0f);
+	size_t n = 0;
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		f4 cx = f4_load (x + i), cy = f4_load (y + i), cz = f4_load (z + i), cr = f4_load (r + i);
+		f4 dx = f4_max (f4_max (f4_sub (lo_x, cx), f4_sub (cx, hi_x)), zero);
+		f4 dy = f4_max (f4_max (f4_sub (lo_y, cy), f4_sub (cy, hi_y)), zero);
+		f4 dz = f4_max (f4_max (f4_sub (lo_z, cz), f4_sub (cz, hi_z)), zero);
+		f4 d2 = f4_madd (dz, dz, f4_madd (dy, dy, f4_mul (dx, dx)));
+		int mask = f4_le_mask (d2, f4_mul (cr, cr));
+		for (int lane = 0; mask != 0; lane++, mask >>= 1) {
+			if (mask & 1)
+				hits[n++] = (unsigned int)(i + lane);
+		}
+	}
+	for (; i < count; i++) {
+		float dx = fmaxf (fmaxf (lo[0] - x[i], x[i] - hi[0]), 0.0f);
+		float dy = fmaxf (fmaxf (lo[1] - y[i], y[i] - hi[1]), 0.0f);
+		float dz = fmaxf (fmaxf (lo[2] - z[i], z[i] - hi[2]), 0.0f);
+		if (dx * dx + dy * dy + dz * dz <= r[i] * r[i])
+			hits[n++] = (unsigned int)i;
+	}
+	return n;
+}
+
+float light_range (const SceneLight& light) {
+	float brightest = 0.0f;
+	for (int c = 0; c < 3; c++) {
+		brightest = fmaxf (brightest, light.ambient[c]);
+		brightest = fmaxf (brightest, light.diffuse[c]);
+		brightest = fmaxf (brightest, light.specular[c]);
+	}
+	// solve constant + linear d + quadratic d^2 = brightest / LIGHT_CUTOFF
+	float reach = brightest / LIGHT_CUTOFF - light.constant;
+	if (reach <= 0.0f)
+		return 0.0f;
+	if (light.quadratic > 0.0f)
+		return (-light.linear + sqrtf (light.linear * light.linear + 4.0f * light.quadratic * reach)) / (2.0f * light.quadratic);
+	if (light.linear > 0.0f)
+		return reach / light.linear;
+	return FLT_MAX;
+}
+
+LightClusters::LightClusters () : streamBuffer (NULL), fovy (0.0f), aspect (0.0f), nearPlane (0.0f), farPlane (0.0f),
+	projectionSet (false), textureRange (false), texelAlign (1) {
+	memset (&stats, 0, sizeof (stats));
+	viewLights.count = 0;
+	for (int i = 0; i < 3; i++) {
+		textures[i] = 0;
+		buffers[i] = 0;
+		capacities[i] = 0;
+	}
+	clusterBoxes.resize (CLUSTER_COUNT);
+	rowBoxes.resize (CLUSTERS_Y * CLUSTERS_Z);
+	grid.resize (CLUSTER_COUNT * 2);
+}
+
+void LightClusters::init () {
+	glGenTextures (3, textures);
+	glGenBuffers (3, buffers);
+	textureRange = GLEW_ARB_texture_buffer_range || GLEW_VERSION_4_3;
+	if (textureRange)
+		glGetIntegerv (GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &texelAlign);
+}
+
+void LightClusters::release () {
+	glDeleteTextures (3, textures);
+	glDeleteBuffers (3, buffers);
+	for (int i = 0; i < 3; i++) {
+		textures[i] = 0;
+		buffers[i] = 0;
+		capacities[i] = 0;
+	}
+}
+
+void LightClusters::set_projection (float fovy_degrees, float aspect_ratio, float near_plane, float far_plane) {
+	if (projectionSet && fovy == fovy_degrees && aspect == aspect_ratio && nearPlane == near_plane && farPlane == far_plane)
+		return;
+	fovy = fovy_degrees;
+	aspect = aspect_ratio;
+	nearPlane = near_plane;
+	farPlane = far_plane;
+	projectionSet = true;
+
+	// view space x and y per unit of depth at the edges of the screen
+	float tan_y = tanf (glm::radians (fovy * 0.5f));
+	float tan_x = tan_y * aspect;
+	float ratio = farPlane / nearPlane;
+	float pad_x = CLUSTER_PADDING * 2.0f / CLUSTERS_X;
+	float pad_y = CLUSTER_PADDING * 2.0f / CLUSTERS_Y;
+	for (int z = 0; z < CLUSTERS_Z; z++) {
+		float d0 = nearPlane * powf (ratio, (float)z / CLUSTERS_Z);
+		float d1 = nearPlane * powf (ratio, (float)(z + 1) / CLUSTERS_Z);
+		float pad = (d1 - d0) * CLUSTER_PADDING;
+		sliceNear[z] = d0 - pad;
+		sliceFar[z] = d1 + pad;
+		for (int y = 0; y < CLUSTERS_Y; y++) {
+			// normalised device y of the row's edges
+			float y0 = -1.0f + 2.0f * y / CLUSTERS_Y - pad_y;
+			float y1 = -1.0f + 2.0f * (y + 1) / CLUSTERS_Y + pad_y;
+			Box& row = rowBoxes[z * CLUSTERS_Y + y];
+			for (int x = 0; x < CLUSTERS_X; x++) {
+				float x0 = -1.0f + 2.0f * x / CLUSTERS_X - pad_x;
+				float x1 = -1.0f + 2.0f * (x + 1) / CLUSTERS_X + pad_x;
+				// the tile's frustum between the slice's depths lies within
+				// its corners at either depth, the camera looks down -z
+				Box& box = clusterBoxes[(z * CLUSTERS_Y + y) * CLUSTERS_X + x];
+				box.lo[0] = fminf (x0 * sliceNear[z], x0 * sliceFar[z]) * tan_x;
+				box.hi[0] = fmaxf (x1 * sliceNear[z], x1 * sliceFar[z]) * tan_x;
+				box.lo[1] = fminf (y0 * sliceNear[z], y0 * sliceFar[z]) * tan_y;
+				box.hi[1] = fmaxf (y1 * sliceNear[z], y1 * sliceFar[z]) * tan_y;
+				box.lo[2] = -sliceFar[z];
+				box.hi[2] = -sliceNear[z];
+				box.lo[3] = box.hi[3] = 0.0f;
+				if (x == 0) {
+					row = box;
+				}
+				else {
+					row.lo[0] = fminf (row.lo[0], box.lo[0]);
+					row.hi[0] = fmaxf (row.hi[0], box.hi[0]);
+				}
+			}
+		}
+	}
+}
+
+void LightClusters::resize (Spheres& spheres, size_t count) {
+	if (spheres.x.size () < count) {
+		spheres.x.resize (count);
+		spheres.y.resize (count);
+		spheres.z.resize (count);
+		spheres.r.resize (count);
+		spheres.ids.resize (count);
+	}
+	spheres.count = 0;
+}
+
+void LightClusters::build (const glm::mat4& view, const SceneLight* lights, size_t count) {
+	PROFILE_FUNCTION ();
+	if (!projectionSet) {
+		fprintf (stderr, "ERROR: LightClusters::build before set_projection\n");
+		return;
+	}
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+
+	// bounding spheres in view space, and the lights as the shader reads them
+	resize (viewLights, count);
+	lightData.resize (count > 0 ? count * LIGHT_DATA_TEXELS : 1);
+	for (size_t i = 0; i < count; i++) {
+		const SceneLight& light = lights[i];
+		glm::vec4 p = view * glm::vec4 (light.position, 1.0f);
+		viewLights.x[i] = p.x;
+		viewLights.y[i] = p.y;
+		viewLights.z[i] = p.z;
+		viewLights.r[i] = light_range (light);
+		glm::vec4* texels = &lightData[i * LIGHT_DATA_TEXELS];
+		texels[0] = glm::vec4 (light.position, light.constant);
+		texels[1] = glm::vec4 (light.direction, light.linear);
+		texels[2] = glm::vec4 (light.ambient, light.quadratic);
+		texels[3] = glm::vec4 (light.diffuse, light.bounds);
+		texels[4] = glm::vec4 (light.specular, light.outerBounds);
+	}
+	viewLights.count = count;
+	for (int z = 0; z < CLUSTERS_Z; z++) {
+		resize (slices[z].lights, count);
+		resize (slices[z].row, count);
+		if (slices[z].hits.size () < count)
+			slices[z].hits.resize (count);
+	}
+
+	job_system.parallel_for (0, CLUSTERS_Z, 1, [this] (size_t begin, size_t end) {
+		for (size_t z = begin; z < end; z++)
+			bin_slice ((int)z);
+	});
+
+	// the slices' lists one after the other, slices are contiguous in the grid
+	indexList.clear ();
+	stats.lit = 0;
+	stats.maxLights = 0;
+	for (int z = 0; z < CLUSTERS_Z; z++) {
+		GLuint base = (GLuint)indexList.size ();
+		GLuint* cluster = &grid[z * CLUSTERS_X * CLUSTERS_Y * 2];
+		for (int c = 0; c < CLUSTERS_X * CLUSTERS_Y; c++) {
+			cluster[c * 2] += base;
+			GLuint lit = cluster[c * 2 + 1];
+			stats.lit += lit > 0;
+			stats.maxLights = lit > stats.maxLights ? lit : stats.maxLights;
+		}
+		indexList.insert (indexList.end (), slices[z].indices.begin (), slices[z].indices.end ());
+	}
+	stats.lights = (unsigned int)count;
+	stats.references = (unsigned int)indexList.size ();
+	// a buffer texture needs at least one texel
+	if (indexList.empty ())
+		indexList.push_back (0);
+
+	std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now () - start;
+	stats.binMs = ms.count ();
+	stats.binMsTotal += stats.binMs;
+	stats.builds++;
+}
+
+void LightClusters::bin_slice (int z) {
+	Slice& slice = slices[z];
+	Spheres& candidates = slice.lights;
+	size_t n = 0;
+	for (size_t i = 0; i < viewLights.count; i++) {
+		float depth = -viewLights.z[i];
+		float r = viewLights.r[i];
+		if (depth + r < sliceNear[z] || depth - r > sliceFar[z])
+			continue;
+		candidates.x[n] = viewLights.x[i];
+		candidates.y[n] = viewLights.y[i];
+		candidates.z[n] = viewLights.z[i];
+		candidates.r[n] = r;
+		candidates.ids[n] = (unsigned int)i;
+		n++;
+	}
+	candidates.count = n;
+
+	slice.indices.clear ();
+	unsigned int* hits = slice.hits.data ();
+	for (int y = 0; y < CLUSTERS_Y; y++) {
+		// the lights of the whole row first, then each tile tests only those
+		const Box& row_box = rowBoxes[z * CLUSTERS_Y + y];
+		Spheres& row = slice.row;
+		row.count = n == 0 ? 0 : spheres_touching_box (candidates.x.data (), candidates.y.data (), candidates.z.data (),
+			candidates.r.data (), n, row_box.lo, row_box.hi, hits);
+		for (size_t j = 0; j < row.count; j++) {
+			unsigned int k = hits[j];
+			row.x[j] = candidates.x[k];
+			row.y[j] = candidates.y[k];
+			row.z[j] = candidates.z[k];
+			row.r[j] = candidates.r[k];
+			row.ids[j] = candidates.ids[k];
+		}
+		for (int x = 0; x < CLUSTERS_X; x++) {
+			int c = (z * CLUSTERS_Y + y) * CLUSTERS_X + x;
+			const Box& box = clusterBoxes[c];
+			size_t lit = row.count == 0 ? 0 : spheres_touching_box (row.x.data (), row.y.data (), row.z.data (),
+				row.r.data (), row.count, box.lo, box.hi, hits);
+			// offsets within the slice for now, build() adds where it starts
+			grid[c * 2] = (GLuint)slice.indices.size ();
+			grid[c * 2 + 1] = (GLuint)lit;
+			for (size_t j = 0; j < lit; j++)
+				slice.indices.push_back (row.ids[hits[j]]);
+		}
+	}
+}
+
+void LightClusters::upload (GLuint firstUnit) {
+	PROFILE_FUNCTION ();
+	const void* data[3] = { lightData.data (), grid.data (), indexList.data () };
+	size_t bytes[3] = { lightData.size () * sizeof (glm::vec4), grid.size () * sizeof (GLuint), indexList.size () * sizeof (GLuint) };
+	static const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+	size_t offsets[3] = { 0, 0, 0 };
+	void* dst[3] = { NULL, NULL, NULL };
+	bool streamed = false;
+	for (int i = 0; i < 3; i++) {
+		if (streamBuffer && textureRange)
+			dst[i] = streamBuffer->allocate (bytes[i], texelAlign, &offsets[i]);
+		if (dst[i]) {
+			memcpy (dst[i], data[i], bytes[i]);
+			streamed = true;
+		}
+	}
+	if (streamed)
+		streamBuffer->commit ();
+
+	for (int i = 0; i < 3; i++) {
+		if (!dst[i]) {
+			// orphan and fill, the buffer only ever grows
+			glBindBuffer (GL_TEXTURE_BUFFER, buffers[i]);
+			if (bytes[i] > capacities[i])
+				capacities[i] = bytes[i] * 2;
+			glBufferData (GL_TEXTURE_BUFFER, capacities[i], NULL, GL_STREAM_DRAW);
+			glBufferSubData (GL_TEXTURE_BUFFER, 0, bytes[i], data[i]);
+		}
+		glActiveTexture (GL_TEXTURE0 + firstUnit + i);
+		glBindTexture (GL_TEXTURE_BUFFER, textures[i]);
+		if (dst[i])
+			glTexBufferRange (GL_TEXTURE_BUFFER, formats[i], streamBuffer->buffer (), offsets[i], bytes[i]);
+		else
+			glTexBuffer (GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+	}
+}
+
+void LightClusters::set_uniforms (GLuint program, GLuint firstUnit, int width, int height) const {
+	glUniform1i (glGetUniformLocation (program, "lightData"), firstUnit);
+	glUniform1i (glGetUniformLocation (program, "clusterGrid"), firstUnit + 1);
+	glUniform1i (glGetUniformLocation (program, "lightIndices"), firstUnit + 2);
+	glUniform1i (glGetUniformLocation (program, "clusterSlices"), CLUSTERS_Z);
+	float tile[4] = { (float)CLUSTERS_X / width, (float)CLUSTERS_Y / height, (float)CLUSTERS_X, (float)CLUSTERS_Y };
+	glUniform4fv (glGetUniformLocation (program, "clusterTile"), 1, tile);
+	// slice = log(depth) * z + w
+	float log_ratio = logf (farPlane / nearPlane);
+	float depth[4] = { nearPlane, farPlane, CLUSTERS_Z / log_ratio, -CLUSTERS_Z * logf (nearPlane) / log_ratio };
+	glUniform4fv (glGetUniformLocation (program, "clusterDepth"), 1, depth);
+}
+
+void LightClusters::print () const {
+	printf ("light clusters: %u lights, %u of %d clusters lit, %.1f lights per lit cluster (max %u)\n",
+		stats.lights, stats.lit, CLUSTER_COUNT, stats.lit > 0 ? (double)stats.references / stats.lit : 0.0, stats.maxLights);
+	printf ("light binning: %.3f ms last frame, %.3f ms avg over %u frames, %d worker threads\n",
+		stats.binMs, stats.builds > 0 ? stats.binMsTotal / stats.builds : 0.0, stats.builds, job_system.worker_count ());
+}
@@ -0,0 +1,159 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+// Clustered forward lighting. The view frustum is cut into a grid of
+// CLUSTERS_X x CLUSTERS_Y screen tiles by CLUSTERS_Z depth slices, spaced
+// exponentially so near slices are thin and far ones deep. Every frame the
+// point and spot lights are bounded by the sphere their attenuation reaches
+// and each one is listed in the clusters it touches; the fragment shader
+// finds its own cluster from gl_FragCoord and loops over that list only, so
+// a scene can have hundreds of lights while a pixel pays for the few near it.
+//
+//   clusters.set_projection(90.0f, aspect, 0.1f, 100.0f);  // glm::perspective's
+//   clusters.build(view, &lights[0], lights.size());        // bins on the job system
+//   clusters.upload(3);                                     // buffer textures on units 3..5
+//   clusters.set_uniforms(program, 3, width, height);
+//
+// The slices are binned in parallel, each testing its lights against a row
+// of tiles and then every tile in the row four spheres at a time with
+// spheres_touching_box() on simd_f4.h. The lists reach the shader as
+// three buffer textures (GL 3.3 has no storage buffers):
+//   lightData     RGBA32F, LIGHT_DATA_TEXELS per light, world space
+//   clusterGrid   RG32UI, per cluster the first entry in lightIndices and the count
+//   lightIndices  R32UI, the lights of every cluster one after the other
+
+// OpenGL includes
+#include "gl_includes.h"
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "stream_buffer.h"
+
+#define CLUSTERS_X 16
+#define CLUSTERS_Y 9
+#define CLUSTERS_Z 24
+#define CLUSTER_COUNT (CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z)
+// position, direction, ambient, diffuse, specular with the scalars in w
+#define LIGHT_DATA_TEXELS 5
+// a light stops at the distance its attenuation brings its brightest
+// channel below this, a step of the 8 bit colour buffer
+#define LIGHT_CUTOFF (1.0f / 256.0f)
+
+// A point or spot light, the fields of PhongLight in MultiLightFragment.txt
+struct SceneLight {
+	glm::vec3 position;
+	// spot lights only, where the cone points
+	glm::vec3 direction;
+	glm::vec3 ambient;
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+	float constant;
+	float linear;
+	float quadratic;
+	// cosines of the cone's inner and outer edge, a point light's are below
+	// -1 so every direction is inside
+	float bounds;
+	float outerBounds;
+};
+
+inline SceneLight point_light(const glm::vec3& position, const glm::vec3& ambient, const glm::vec3& diffuse,
+	const glm::vec3& specular, float constant, float linear, float quadratic)
+{
+	SceneLight light = { position, glm::vec3(0.0f, 0.0f, -1.0f), ambient, diffuse, specular,
+		constant, linear, quadratic, -2.0f, -3.0f };
+	return light;
+}
+
+// Distance at which the light's attenuation drops it below LIGHT_CUTOFF
+float light_range(const SceneLight& light);
+
+struct LightClusterStats {
+	unsigned int lights;
+	// clusters with at least one light
+	unsigned int lit;
+	// entries in lightIndices, summed over the clusters
+	unsigned int references;
+	unsigned int maxLights;
+	// CPU time of the last build() and the sum over all of them
+	double binMs;
+	double binMsTotal;
+	unsigned int builds;
+};
+
+class LightClusters
+{
+public:
+	LightClusterStats stats;
+	// The lists are written here when it is set and has room, otherwise to
+	// buffers of their own that are orphaned every frame
+	StreamBuffer* streamBuffer;
+
+	LightClusters();
+
+	void init();
+	void release();
+
+	// Cluster bounds for glm::perspective(fovy, aspect, nearPlane, farPlane),
+	// only recomputed when one of them changes. fovy is in degrees.
+	void set_projection(float fovy, float aspect, float nearPlane, float farPlane);
+
+	// Lists each light in the clusters its range touches
+	void build(const glm::mat4& view, const SceneLight* lights, size_t count);
+
+	// Uploads the lists and binds them to units firstUnit, firstUnit + 1 and
+	// firstUnit + 2, leaving firstUnit + 2 active
+	void upload(GLuint firstUnit);
+
+	// Sets the cluster uniforms of the bound program, for a target of
+	// width x height pixels
+	void set_uniforms(GLuint program, GLuint firstUnit, int width, int height) const;
+
+	void print() const;
+
+private:
+	// view space, w unused
+	struct Box {
+		float lo[4];
+		float hi[4];
+	};
+
+	// the slice's lights, then those of the row being binned, as spheres
+	// in view space, structure of arrays for spheres_touching_box()
+	struct Spheres {
+		std::vector<float> x, y, z, r;
+		std::vector<unsigned int> ids;
+		size_t count;
+	};
+
+	struct Slice {
+		Spheres lights;
+		Spheres row;
+		std::vector<unsigned int> hits;
+		std::vector<GLuint> indices;
+	};
+
+	float fovy, aspect, nearPlane, farPlane;
+	bool projectionSet;
+	std::vector<Box> clusterBoxes;
+	std::vector<Box> rowBoxes;
+	float sliceNear[CLUSTERS_Z];
+	float sliceFar[CLUSTERS_Z];
+	Spheres viewLights;
+	Slice slices[CLUSTERS_Z];
+
+	std::vector<glm::vec4> lightData;
+	std::vector<GLuint> grid;
+	std::vector<GLuint> indexList;
+
+	GLuint textures[3];
+	GLuint buffers[3];
+	size_t capacities[3];
+	bool textureRange;
+	GLint texelAlign;
+
+	void bin_slice(int z);
+	static void resize(Spheres& spheres, size_t count);
+};
+
+#endif
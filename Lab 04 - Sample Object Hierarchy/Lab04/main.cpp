@@ -1,20 +1,24 @@
-// Windows includes (For Time, IO, etc.)
-#include <windows.h>
-#include <mmsystem.h>
+﻿// Windows includes (For Time, IO, etc.)
+#include "platform.h"
 #include <iostream>
 #include <string>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <vector> // STL dynamic memory.
+#include <chrono>
+#include <thread>
 
 // OpenGL includes
-#include <GL/glew.h>
+#include "gl_includes.h"
 #include <GL/freeglut.h>
 
 // Assimp includes
+#ifndef LAB04_NO_ASSIMP
 #include <assimp/cimport.h> // scene importer
 #include <assimp/scene.h> // collects data
 #include <assimp/postprocess.h> // various extra operations
+#endif
 
 // Project includes
 //#include "maths_funcs.h"
@@ -27,8 +31,28 @@
 #include"cube.h"
 #include"camera.h"
 #define STB_IMAGE_IMPLEMENTATION
+// images decode on several threads at once, the failure string is a shared global
+#define STBI_NO_FAILURE_STRINGS
 #include "stb_image.h"
 #include "particle.h"
+#include "render_queue.h"
+#include "indirect_draw.h"
+#include "baked_scene.h"
+#include "headless.h"
+#include "profiler.h"
+#include "game_loop.h"
+#include "frame_pipeline.h"
+#include "job_system.h"
+#include "frame_arena.h"
+#include "stream_buffer.h"
+#include "shader_cache.h"
+#include "shader_variants.h"
+#include "file_watcher.h"
+#include "light_clusters.h"
+#include "gbuffer.h"
+#include "shadow_cascades.h"
+#include "occlusion_culler.h"
+#include "mesh_lod.h"
 
 
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
@@ -38,11 +62,12 @@ float speed = 0.0f, max_speed = .6f, acc = 0.0f;
 bool stop = false;
 using namespace glm;
 vec3 trans(0.0f);
-vec3 rails[] = {
-	vec3(0.0f, -0.570f, 2.5f),
-	vec3(1.0f, -0.570f, 2.5f),
-	vec3(2.0f, -0.570f, 2.5f)
-};
+
+// The simulation runs in fixed steps, frames draw the state frame_alpha of
+// the way from the previous step to the current one
+GameLoop game_loop;
+vec3 prev_trans(0.0f);
+float frame_alpha = 1.0f;
 
 /*----------------------------------------------------------------------------
 MESH TO LOAD
@@ -62,6 +87,11 @@ MESH TO LOAD
 
 #define NUM_RAILS 3
 
+// the camera's projection, light_clusters is cut from the same frustum
+#define CAMERA_FOVY 90.0f
+#define CAMERA_NEAR 0.1f
+#define CAMERA_FAR 100.0f
+
 float lastX = 800 / 2.0f;
 float lastY = 600 / 2.0f;
 bool firstMouse = true;
@@ -70,16 +100,61 @@ unsigned int diffuseMap;
 unsigned int specularMap;
 unsigned int train_diffuse;
 
-unsigned int brick_diff, brick_height, brick_normal;
+unsigned int brick_diff, brick_height, brick_normal, brick_cone;
 unsigned int concrete, concrete_diff;
 unsigned int particle_sprite, particleVAO;
+unsigned int quadVAO = 0;
+unsigned int quadVBO;
+
+// Draw submission is sorted by state through the render queue
+RenderQueue render_queue;
+int train_material, rail_material, container_material, brick_material, brick_cone_material;
+int skybox_material, particle_material;
+
+// opaque lit meshes go through one multi-draw indirect call
+IndirectRenderer indirect;
+MaterialArray diffuse_array, specular_array;
+int arena_train = -1, arena_box_car = -1, arena_rails = -1, arena_cube = -1;
+int train_layer, rail_layer, container_layer, specular_layer;
+bool use_indirect = true;
+
+// GPU time of each pass, 't' shows it over the scene
+GpuProfiler gpu_profiler;
+bool show_gpu_overlay = false;
+
+// per-frame allocations of the render thread, reset every other frame
+FrameArenas frame_arenas(1 << 20);
+// C++ heap allocations during the last frame drawn, 'p' prints it
+unsigned long long frame_heap_allocations = 0;
+
+// instance data and indirect commands are written into this every frame,
+// --orphan-streams turns off persistent mapping to compare against it
+StreamBuffer stream_buffer;
+bool persistent_streams = true;
 
 
 
 
 vec3 lightPos(1.2f, 1.0f, 2.0f);
 GLuint shader_programID;
-std::map<std::string, GLuint> shaders;
+// std::less<> looks names up without building a std::string, see shader_program
+std::map<std::string, GLuint, std::less<> > shaders;
+
+// Program binaries of earlier runs are reused, --no-shader-cache compiles everything
+ShaderCache shader_cache;
+bool use_shader_cache = true;
+// Saved shader sources are rebuilt while running, always with a window and
+// with --watch-shaders when headless
+FileWatcher shader_watcher;
+std::vector<std::string> changed_shaders;
+bool watch_shaders = false;
+
+// Program by name for code that runs every frame, 0 while it is still being
+// compiled (the render queue drops packets without a program)
+GLuint shader_program(const char* name) {
+	std::map<std::string, GLuint, std::less<> >::const_iterator it = shaders.find(name);
+	return it != shaders.end() && shader_cache.ready(it->second) ? it->second : 0;
+}
 
 // Number of particles
 GLuint NUM_PARTS = 500;
@@ -130,17 +205,39 @@ typedef struct
 
 struct Particle {
 	glm::vec3 Position, Velocity;
+	glm::vec3 PrevPosition; // before the last simulation step
 	glm::vec4 Color;
 	GLfloat Life;
 
 	Particle()
-		: Position(0.0f), Velocity(0.0f), Color(1.0f), Life(0.0f) { }
+		: Position(0.0f), Velocity(0.0f), PrevPosition(0.0f), Color(1.0f), Life(0.0f) { }
+};
+
+struct ParticleSnapshot {
+	glm::vec3 PrevPosition, Position;
+	glm::vec4 Color;
+};
+
+// What the renderer reads of the simulation, copied out after each batch of
+// steps so drawing never touches state the simulation is changing
+struct SceneSnapshot {
+	glm::vec3 prev_trans, trans;
+	std::vector<ParticleSnapshot> particles; // live ones only
+	std::chrono::steady_clock::time_point stepped; // when it was published
 };
 
 #pragma endregion SimpleTypes
 
 std::vector<Particle> particles;
 
+// With --pipeline the simulation runs on its own thread, a step ahead of the
+// frame being drawn. Snapshots go to the renderer and keys that change the
+// simulation come back, both without locks.
+TripleBuffer<SceneSnapshot> scene_buffer;
+SpscQueue<unsigned char, 64> sim_keys;
+bool pipelined = false;
+std::atomic<bool> sim_running(false);
+
 class ModelObject {
 
 public:
@@ -247,6 +344,55 @@ vec3 pointLightPositions[] = {
 	vec3(-4.0f,  2.0f, -12.0f),
 	vec3(1.2f,  0.2f,  2.0f)
 };
+#define NUM_POINT_LIGHTS (sizeof(pointLightPositions) / sizeof(pointLightPositions[0]))
+
+// The point lights above, then --lamps more, then the camera's spot light.
+// With clustered lighting all of them are binned into light_clusters every
+// frame, otherwise the first NUM_POINT_LIGHTS and the spot light are uniforms.
+std::vector<SceneLight> scene_lights;
+LightClusters light_clusters;
+bool clustered_lights = true;
+int extra_lamps = 0;
+// light_clusters' buffer textures are on this unit and the two after it
+#define CLUSTER_TEXTURE_UNIT 3
+
+// Deferred shading, --deferred or 'g': the lit meshes are drawn into gbuffer
+// and lit by one full-screen pass over it, with the same lights. The parallax
+// quad, lamps, sky and particles are drawn forward on top.
+GBuffer gbuffer;
+bool deferred_shading = false;
+// the lighting pass's triangle has no vertex data
+GLuint deferred_vao;
+// gbuffer's targets are read from this unit and the three after it
+#define GBUFFER_TEXTURE_UNIT 6
+
+// where dirLight points
+const vec3 dir_light_direction(-0.2f, -1.0f, -0.3f);
+// dirLight's shadows, --no-shadows turns them off. The arena's meshes cast
+// them; --shadow-intervals sets how often each cascade is redrawn.
+ShadowCascades shadow_cascades;
+bool cast_shadows = true;
+#define SHADOW_TEXTURE_UNIT 10
+
+// --depth-prepass draws the lit meshes' depth first, so the lighting runs
+// once a pixel rather than once for every surface drawn over it
+bool depth_prepass = false;
+
+// --occlusion draws the rails and the lit cube into a small depth buffer on
+// the CPU each frame and leaves out the lit meshes and lamps behind them
+OcclusionCuller occlusion;
+bool occlusion_culling = false;
+bool frame_occlusion = false;
+
+// The loaded meshes get simplified levels of detail and the indirect path
+// draws each object at the one its size on screen calls for, see mesh_lod.h.
+// --no-lods draws everything at full detail.
+LodSelector lod_selector;
+bool use_lods = true;
+
+// --cone-steps marches the parallax quad over heightmap_cone.tga's relaxed
+// cones (see cone_map.h) rather than through depth layers
+bool cone_parallax = false;
 
 unsigned int VBO, cubeVAO;
 
@@ -278,6 +424,7 @@ void reset_particle(Particle &particle, vec3 pos = trans, vec2 offset = vec2(0.0
 	GLfloat random = ((rand() % 100) - 50) / 10.0f;
 	GLfloat rColor = 0.5f;
 	particle.Position = vec3(pos.x + random/1000.0f, pos.y, pos.z);
+	particle.PrevPosition = particle.Position;
 	particle.Color = glm::vec4(rColor, rColor, rColor, 1.0f);
 	particle.Life = 1.0f;
 	particle.Velocity = vel;
@@ -292,7 +439,12 @@ MESH LOADING FUNCTION
 ----------------------------------------------------------------------------*/
 
 ModelData load_mesh(const char* file_name) {
+	PROFILE_FUNCTION();
 	ModelData modelData;
+#ifdef LAB04_NO_ASSIMP
+	fprintf(stderr, "WARNING: built without assimp, skipping mesh %s\n", file_name);
+	return modelData;
+#else
 
 	/* Use assimp to read the model file, forcing it to be read as    */
 	/* triangles. The second flag (aiProcess_PreTransformVertices) is */
@@ -309,13 +461,8 @@ ModelData load_mesh(const char* file_name) {
 		return modelData;
 	}
 
-	printf("  %i materials\n", scene->mNumMaterials);
-	printf("  %i meshes\n", scene->mNumMeshes);
-	printf("  %i textures\n", scene->mNumTextures);
-
 	for (unsigned int m_i = 0; m_i < scene->mNumMeshes; m_i++) {
 		const aiMesh* mesh = scene->mMeshes[m_i];
-		printf("    %i vertices in mesh\n", mesh->mNumVertices);
 		modelData.mPointCount += mesh->mNumVertices;
 		for (unsigned int v_i = 0; v_i < mesh->mNumVertices; v_i++) {
 			if (mesh->HasPositions()) {
@@ -339,20 +486,52 @@ ModelData load_mesh(const char* file_name) {
 		}
 	}
 
+	// one line per file, meshes load in parallel
+	printf("%s: %i materials, %i meshes, %i textures, %i vertices\n", file_name,
+		scene->mNumMaterials, scene->mNumMeshes, scene->mNumTextures, (int)modelData.mPointCount);
 	aiReleaseImport(scene);
 	return modelData;
+#endif
+}
+
+struct MeshLoad {
+	const char* file_name;
+	ModelData* mesh;
+};
+
+static void load_mesh_job(void* data, size_t, size_t) {
+	MeshLoad& load = *(MeshLoad*)data;
+	*load.mesh = load_mesh(load.file_name);
 }
 
 #pragma endregion MESH LOADING
 
 
-unsigned int loadTexture(char const * path)
+// An image file decoded into memory. Decoding needs no GL, so it runs as a
+// job, the upload happens afterwards on the GL thread.
+struct DecodedImage {
+	const char* path;
+	unsigned char* data;
+	int width, height, components;
+
+	DecodedImage(const char* path) : path(path), data(NULL), width(0), height(0), components(0) {}
+};
+
+static void decode_image_job(void* data, size_t, size_t) {
+	PROFILE_SCOPE("decode_image");
+	DecodedImage& image = *(DecodedImage*)data;
+	image.data = stbi_load(image.path, &image.width, &image.height, &image.components, 0);
+}
+
+// Makes a mipmapped 2D texture of the image and frees its pixels
+unsigned int upload_texture(DecodedImage& image)
 {
+	PROFILE_FUNCTION();
 	unsigned int textureID;
 	glGenTextures(1, &textureID);
 
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
+	int width = image.width, height = image.height, nrComponents = image.components;
+	unsigned char *data = image.data;
 	if (data)
 	{
 		GLenum format;
@@ -376,35 +555,38 @@ unsigned int loadTexture(char const * path)
 	}
 	else
 	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
+		std::cout << "Texture failed to load at path: " << image.path << std::endl;
 		stbi_image_free(data);
 	}
+	image.data = NULL;
 
 	return textureID;
 }
 
-unsigned int loadCubemap(vector<string> faces)
+// Six decoded faces in +x, -x, +y, -y, +z, -z order
+unsigned int upload_cubemap(DecodedImage faces[6])
 {
+	PROFILE_FUNCTION();
 	unsigned int textureID;
 	glGenTextures(1, &textureID);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-	int width, height, nrChannels;
-	for (unsigned int i = 0; i < faces.size(); i++)
+	for (unsigned int i = 0; i < 6; i++)
 	{
-		unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
+		unsigned char *data = faces[i].data;
 		if (data)
 		{
 			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-				0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
+				0, GL_RGB, faces[i].width, faces[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
 			);
 			stbi_image_free(data);
 		}
 		else
 		{
-			std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
+			std::cout << "Cubemap texture failed to load at path: " << faces[i].path << std::endl;
 			stbi_image_free(data);
 		}
+		faces[i].data = NULL;
 	}
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -419,63 +601,7 @@ unsigned int loadCubemap(vector<string> faces)
 // Shader Functions- click on + to expand
 #pragma region SHADER_FUNCTIONS
 
-void renderQuad();
-
-char* readShaderSource(const char* shaderFile) {
-	FILE* fp;
-	fopen_s(&fp, shaderFile, "rb");
-
-	if (fp == NULL) { return NULL; }
-
-	fseek(fp, 0L, SEEK_END);
-	long size = ftell(fp);
-
-	fseek(fp, 0L, SEEK_SET);
-	char* buf = new char[size + 1];
-	fread(buf, 1, size, fp);
-	buf[size] = '\0';
-
-	fclose(fp);
-
-	return buf;
-}
-
-
-static void add_shader(GLuint shader_program, const char* p_shader_text, GLenum shader_type)
-{
-	// create a shader object
-	GLuint shader_obj = glCreateShader(shader_type);
-
-	if (shader_obj == 0) {
-		std::cerr << "Error creating shader..." << std::endl;
-		std::cerr << "Press enter/return to exit..." << std::endl;
-		std::cin.get();
-		exit(1);
-	}
-
-	const char* pShaderSource = readShaderSource(p_shader_text);
-
-	// Bind the source code to the shader, this happens before compilation
-	glShaderSource(shader_obj, 1, (const GLchar**)&pShaderSource, NULL);
-	// compile the shader and check for errors
-	glCompileShader(shader_obj);
-	GLint success;
-	// check for shader related errors using glGetShaderiv
-	glGetShaderiv(shader_obj, GL_COMPILE_STATUS, &success);
-	if (!success) {
-		GLchar InfoLog[1024] = { '\0' };
-		glGetShaderInfoLog(shader_obj, 1024, NULL, InfoLog);
-		std::cerr << "Error compiling "
-			<< (shader_type == GL_VERTEX_SHADER ? "vertex" : "fragment")
-			<< " shader program: " << InfoLog << std::endl;
-		std::cerr << "Press enter/return to exit..." << std::endl;
-		std::cin.get();
-		exit(1);
-	}
-	// Attach the compiled shader object to the program object
-	glAttachShader(shader_program, shader_obj);
-}
-
+void gen_quad_buffer();
 
 void validate_shaders(GLuint shader) {
 	GLint success = 0;
@@ -490,17 +616,8 @@ void validate_shaders(GLuint shader) {
 		exit(1);
 	}
 
-	// program has been successfully linked but needs to be validated to check whether the program can execute given the current pipeline state
-	glValidateProgram(shader);
-	// check for program related errors using glGetProgramiv
-	glGetProgramiv(shader, GL_VALIDATE_STATUS, &success);
-	if (!success) {
-		glGetProgramInfoLog(shader, sizeof(ErrorLog), NULL, ErrorLog);
-		std::cerr << "Invalid shader program: " << ErrorLog << std::endl;
-		std::cerr << "Press enter/return to exit..." << std::endl;
-		std::cin.get();
-		exit(1);
-	}
+	// no glValidateProgram here, it checks the samplers against the units bound
+	// at the time and theirs are only set by each draw's uniform setup
 
 }
 
@@ -540,115 +657,188 @@ void set_mat4(GLuint shader_id, const char * var, mat4 matr) {
 }
 
 
-GLuint CompileShaders()
-{
-	//Start the process of setting up our shaders by creating a program ID
-	//Note: we will link all the shaders together into this ID
-	shader_programID = glCreateProgram();
-	if (shader_programID == 0) {
-		std::cerr << "Error creating shader program..." << std::endl;
-		std::cerr << "Press enter/return to exit..." << std::endl;
-		std::cin.get();
-		exit(1);
-	}
-
-	// Create two shader objects, one for the vertex, and one for the fragment shader
-	add_shader(shader_programID, "simpleVertexShader.txt", GL_VERTEX_SHADER);
-	add_shader(shader_programID, "lightConeFragmentShader.txt", GL_FRAGMENT_SHADER);
-	shaders["simple"] = shader_programID;
-
-
-	// After compiling all shader objects and attaching them to the program, we can finally link it
-	glLinkProgram(shader_programID);
-
-	validate_shaders(shader_programID);
-
-	// light on object
-	GLuint light_shader = glCreateProgram();
-	add_shader(light_shader, "lightingVertex.txt", GL_VERTEX_SHADER);
-	add_shader(light_shader, "lightingFragment.txt", GL_FRAGMENT_SHADER);
-	shaders["light"] = light_shader;
-
-	glLinkProgram(light_shader);
-
-	validate_shaders(light_shader);
-
-	// lamp source
-	GLuint light_source = glCreateProgram();
-
-	add_shader(light_source, "lampVertex.txt", GL_VERTEX_SHADER);
-	add_shader(light_source, "lampFragment.txt", GL_FRAGMENT_SHADER);
-	shaders["lamp"] = light_source;
-
-
-
-	
-	glLinkProgram(light_source);
-	validate_shaders(light_source);
-
+// Programs the scene draws with, by the name they go under in shaders
+struct ProgramSource {
+	const char* name;
+	ShaderStage stages[2];
+};
 
+// The lit meshes and the parallax quad are built per feature set, see
+// init_shader_variants
+static const ProgramSource program_sources[] = {
 	// cone of light
-	GLuint light_cone = glCreateProgram();
-
-	add_shader(light_cone, "lightingVertex.txt", GL_VERTEX_SHADER);
-	add_shader(light_cone, "lightConeFragmentShader.txt", GL_FRAGMENT_SHADER);
-	shaders["lightcone"] = light_cone;
-	
-	glLinkProgram(light_cone);
-	validate_shaders(light_cone);
-
-	// skybox shader
-	GLuint skybox_shader = glCreateProgram();
-
-	add_shader(skybox_shader, "skyboxVertex.txt", GL_VERTEX_SHADER);
-	add_shader(skybox_shader, "skyboxFragment.txt", GL_FRAGMENT_SHADER);
-	shaders["skybox"] = skybox_shader;
-
-	glLinkProgram(skybox_shader);
-	validate_shaders(skybox_shader);
-
-	// multilight shader
-	GLuint multilight_shader = glCreateProgram();
-
-	add_shader(multilight_shader, "lightingVertex.txt", GL_VERTEX_SHADER);
-	add_shader(multilight_shader, "MultiLightFragment.txt", GL_FRAGMENT_SHADER);
-	shaders["multilight"] = multilight_shader;
+	{ "simple", { { "simpleVertexShader.txt", GL_VERTEX_SHADER, NULL }, { "MultiLightFragment.txt", GL_FRAGMENT_SHADER, "#define SPOT_LIGHT\n" } } },
+	// lamp source
+	{ "lamp", { { "lampVertex.txt", GL_VERTEX_SHADER, NULL }, { "lampFragment.txt", GL_FRAGMENT_SHADER, NULL } } },
+	{ "skybox", { { "skyboxVertex.txt", GL_VERTEX_SHADER, NULL }, { "skyboxFragment.txt", GL_FRAGMENT_SHADER, NULL } } },
+	{ "particle", { { "particle_vertex.txt", GL_VERTEX_SHADER, NULL }, { "particle_fragment.txt", GL_FRAGMENT_SHADER, NULL } } },
+	{ "shadow", { { "shadowVertex.txt", GL_VERTEX_SHADER, NULL }, { "shadowFragment.txt", GL_FRAGMENT_SHADER, NULL } } },
+	// depth pre-pass, the lit meshes' own vertex shaders with nothing to shade
+	{ "depth", { { "lightingVertex.txt", GL_VERTEX_SHADER, NULL }, { "shadowFragment.txt", GL_FRAGMENT_SHADER, NULL } } },
+	{ "depth_indirect", { { "indirectVertex.txt", GL_VERTEX_SHADER, NULL }, { "shadowFragment.txt", GL_FRAGMENT_SHADER, NULL } } },
+};
 
-	glLinkProgram(multilight_shader);
-	validate_shaders(multilight_shader);
+// Features of MultiLightFragment.txt, in the order of lit_features
+enum LitFeature {
+	LIT_DIR_LIGHT,
+	LIT_POINT_LIGHTS,
+	LIT_SPOT_LIGHT,
+	LIT_SHADOWS,
+	LIT_BLINN,
+	LIT_CLUSTERED,
+	LIT_GBUFFER,
+	LIT_FEATURE_COUNT
+};
 
-	// Parallax mapping
-	GLuint parallax_shader = glCreateProgram();
+static const ShaderFeature lit_features[LIT_FEATURE_COUNT] = {
+	{ "DIR_LIGHT", 0 },
+	{ "NUM_POINT_LIGHTS", 3 },
+	{ "SPOT_LIGHT", 0 },
+	{ "SHADOW_CASCADES", 3 },
+	{ "BLINN", 0 },
+	{ "CLUSTERED_LIGHTS", 0 },
+	{ "GBUFFER_PASS", 0 }
+};
 
-	add_shader(parallax_shader, "parallax_vertex.txt", GL_VERTEX_SHADER);
-	add_shader(parallax_shader, "parallax_fragment.txt", GL_FRAGMENT_SHADER);
-	shaders["parallax"] = parallax_shader;
+static const ShaderFeature parallax_features[] = {
+	{ "PARALLAX_LAYERS", 7 },
+	{ "CONE_STEPS", 5 }
+};
 
-	glLinkProgram(parallax_shader);
-	validate_shaders(parallax_shader);
+#define PARALLAX_LAYERS 32
+#define CONE_STEPS 12
+#define PARALLAX_HEIGHT_SCALE 0.2f
+
+// lit meshes drawn by the queue, lit meshes on the indirect path (per-draw
+// data from a buffer texture), deferred lighting and parallax mapping
+ShaderVariants lit_variants;
+ShaderVariants indirect_variants;
+ShaderVariants deferred_variants;
+ShaderVariants parallax_variants;
+void init_shader_variants();
+
+// the parallax quad's variant, stepping through layers or along cones
+uint32_t parallax_key(bool cones) {
+	int values[2] = { PARALLAX_LAYERS, cones ? CONE_STEPS : 0 };
+	return parallax_variants.key(values);
+}
 
+static void shader_failed() {
+	std::cerr << "Press enter/return to exit..." << std::endl;
+	std::cin.get();
+	exit(1);
+}
 
-	// Parallax mapping
-	GLuint particle_shader = glCreateProgram();
+// Called as each program finishes compiling
+static void program_done(const char* name, GLuint program, GLuint replaced, bool linked) {
+	if (replaced != 0) {
+		if (!linked) {
+			fprintf(stderr, "WARNING: %s did not build, keeping the old program\n", name);
+			return;
+		}
+		if (!lit_variants.replace(replaced, program) && !indirect_variants.replace(replaced, program)
+			&& !deferred_variants.replace(replaced, program) && !parallax_variants.replace(replaced, program))
+			shaders[name] = program;
+		render_queue.replace_program(replaced, program);
+		if (shader_programID == replaced)
+			shader_programID = program;
+		printf("reloaded %s\n", name);
+	}
+	else if (!linked) {
+		shader_failed();
+	}
+	validate_shaders(program);
+}
 
-	add_shader(particle_shader, "particle_vertex.txt", GL_VERTEX_SHADER);
-	add_shader(particle_shader, "particle_fragment.txt", GL_FRAGMENT_SHADER);
-	shaders["particle"] = particle_shader;
+// Only hands the programs to the driver, they compile while the meshes and
+// textures load and poll_shaders() picks them up as they finish
+GLuint CompileShaders()
+{
+	PROFILE_FUNCTION();
+	shader_cache.init(use_shader_cache);
+	for (size_t i = 0; i < sizeof(program_sources) / sizeof(program_sources[0]); i++) {
+		const ProgramSource& source = program_sources[i];
+		GLuint program = shader_cache.submit(source.name, source.stages, 2);
+		if (program == 0)
+			shader_failed();
+		shaders[source.name] = program;
+		if (watch_shaders) {
+			shader_watcher.add(source.stages[0].path);
+			shader_watcher.add(source.stages[1].path);
+		}
+	}
+	init_shader_variants();
+	shader_cache.release_shaders();
 
-	glLinkProgram(particle_shader);
-	validate_shaders(particle_shader);
-	// Finally, use the linked shader program
-	// Note: this program will stay in effect for all draw calls until you replace it with another or explicitly disable its use
-	glUseProgram(shader_programID);
+	shader_programID = shaders["simple"];
 	return shader_programID;
 }
+
+// Once a frame, picks up finished programs and starts rebuilding the ones
+// whose sources were saved. Swapping here, before the frame's first draw,
+// means a frame never mixes old and new programs.
+void poll_shaders() {
+	static bool reported = false;
+	if (watch_shaders && shader_watcher.poll(changed_shaders) > 0) {
+		for (size_t i = 0; i < changed_shaders.size(); i++) {
+			int count = shader_cache.reload(changed_shaders[i].c_str());
+			printf("%s changed, rebuilding %d programs\n", changed_shaders[i].c_str(), count);
+		}
+	}
+	if (shader_cache.pending() == 0)
+		return;
+	if (shader_cache.poll(program_done) == 0 && !reported) {
+		shader_cache.print();
+		reported = true;
+	}
+}
 #pragma endregion SHADER_FUNCTIONS
 
 
 
 // VBO Functions - click on + to expand
 #pragma region VBO_FUNCTIONS
+// Copies a loaded mesh into the geometry arena, -1 if it has nothing to draw
+int add_arena_mesh(ModelData &mesh) {
+	if (mesh.mPointCount == 0 || mesh.mVertices.size() != mesh.mPointCount)
+		return -1;
+	const vec3* normals = mesh.mNormals.size() == mesh.mPointCount ? &mesh.mNormals[0] : NULL;
+	const vec2* uvs = mesh.mTextureCoords.size() == mesh.mPointCount ? &mesh.mTextureCoords[0] : NULL;
+	return indirect.arena.add_mesh(&mesh.mVertices[0], normals, uvs, mesh.mPointCount);
+}
+
+// Fills one attribute of the bound VAO from its own buffer
+static void buffer_attribute(GLuint loc, GLint size, const void* data, size_t bytes) {
+	unsigned int vbo = 0;
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, bytes, data, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(loc);
+	glVertexAttribPointer(loc, size, GL_FLOAT, GL_FALSE, 0, NULL);
+}
+
+// Copies a loaded mesh into its VAO. A mesh that failed to load leaves the
+// VAO empty, and attributes the file doesn't have are left disabled.
+void buffer_mesh(GLuint mesh_vao, ModelData &mesh) {
+	glBindVertexArray(mesh_vao);
+	if (mesh.mPointCount == 0 || mesh.mVertices.size() != mesh.mPointCount)
+		return;
+
+	// the locations lightingVertex.txt declares, asking the program for them
+	// would wait for it to link
+	loc1 = 0;
+	loc2 = 1;
+	loc3 = 2;
+
+	buffer_attribute(loc1, 3, &mesh.mVertices[0], mesh.mPointCount * sizeof(vec3));
+	if (mesh.mNormals.size() == mesh.mPointCount)
+		buffer_attribute(loc2, 3, &mesh.mNormals[0], mesh.mPointCount * sizeof(vec3));
+	if (mesh.mTextureCoords.size() == mesh.mPointCount)
+		buffer_attribute(loc3, 2, &mesh.mTextureCoords[0], mesh.mPointCount * sizeof(vec2));
+}
+
 void gen_buffer_mesh() {
+	PROFILE_FUNCTION();
 	/*----------------------------------------------------------------------------
 	LOAD MESH HERE AND COPY INTO BUFFERS
 	----------------------------------------------------------------------------*/
@@ -656,135 +846,22 @@ void gen_buffer_mesh() {
 	//Note: you may get an error "vector subscript out of range" if you are using this code for a mesh that doesnt have positions and normals
 	//Might be an idea to do a check for that before generating and binding the buffer.
 
-	mesh_data[0] = load_mesh(TRAIN);
-	mesh_data[1] = load_mesh(BOX_CAR);
-	mesh_data[2] = load_mesh(TERRAIN);
-	mesh_data[3] = load_mesh(RAILS);
+	// import the meshes in parallel, buffering them needs the GL thread
+	MeshLoad loads[4] = {
+		{ TRAIN, &mesh_data[0] },
+		{ BOX_CAR, &mesh_data[1] },
+		{ TERRAIN, &mesh_data[2] },
+		{ RAILS, &mesh_data[3] }
+	};
+	JobCounter loaded;
+	for (int i = 0; i < 4; i++)
+		job_system.run(load_mesh_job, &loads[i], &loaded);
+	job_system.wait(&loaded);
 
 	glGenVertexArrays(4, vao);
-	glBindVertexArray(vao[0]);
-
-	unsigned int vp_vbo = 0;
-	unsigned int shader = shaders["light"];
-	loc1 = glGetAttribLocation(shader, "aPos");
-	loc2 = glGetAttribLocation(shader, "aNormal");
-	loc3 = glGetAttribLocation(shader, "aTexCoords");
-
-
-	glGenBuffers(1, &vp_vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vp_vbo);
-	glBufferData(GL_ARRAY_BUFFER, mesh_data[0].mPointCount * sizeof(vec3), &mesh_data[0].mVertices[0], GL_STATIC_DRAW);
-	unsigned int vn_vbo = 0;
-	glGenBuffers(1, &vn_vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vn_vbo);
-	glBufferData(GL_ARRAY_BUFFER, mesh_data[0].mPointCount * sizeof(vec3), &mesh_data[0].mNormals[0], GL_STATIC_DRAW);
-
-
-	glEnableVertexAttribArray(loc1);
-	glBindBuffer(GL_ARRAY_BUFFER, vp_vbo);
-	glVertexAttribPointer(loc1, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-	glEnableVertexAttribArray(loc2);
-	glBindBuffer(GL_ARRAY_BUFFER, vn_vbo);
-	glVertexAttribPointer(loc2, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-
-	//	This is for texture coordinates which you don't currently need, so I have commented it out
-	unsigned int vt_vbo;
-	glGenBuffers (1, &vt_vbo);
-	glBindBuffer (GL_ARRAY_BUFFER, vt_vbo);
-	glBufferData (GL_ARRAY_BUFFER, mesh_data[0].mTextureCoords.size() * sizeof (vec2), &mesh_data[0].mTextureCoords[0], GL_STATIC_DRAW);
-
-
-
-
-	//	This is for texture coordinates which you don't currently need, so I have commented it out
-	glEnableVertexAttribArray (loc3);
-	glBindBuffer (GL_ARRAY_BUFFER, vt_vbo);
-	glVertexAttribPointer (loc3, 2, GL_FLOAT, GL_FALSE, 0, NULL);
-
-	{
-
-		glBindVertexArray(vao[1]);
-
-		unsigned int vp_vbo = 0;
-		unsigned int shader = shaders["light"];
-		loc1 = glGetAttribLocation(shader, "aPos");
-		loc2 = glGetAttribLocation(shader, "aNormal");
-		loc3 = glGetAttribLocation(shader, "aTexCoords");
-
-
-		glGenBuffers(1, &vp_vbo);
-		glBindBuffer(GL_ARRAY_BUFFER, vp_vbo);
-		glBufferData(GL_ARRAY_BUFFER, mesh_data[1].mPointCount * sizeof(vec3), &mesh_data[1].mVertices[0], GL_STATIC_DRAW);
-		unsigned int vn_vbo = 0;
-		glGenBuffers(1, &vn_vbo);
-		glBindBuffer(GL_ARRAY_BUFFER, vn_vbo);
-		glBufferData(GL_ARRAY_BUFFER, mesh_data[1].mPointCount * sizeof(vec3), &mesh_data[1].mNormals[0], GL_STATIC_DRAW);
-
-
-		glEnableVertexAttribArray(loc1);
-		glBindBuffer(GL_ARRAY_BUFFER, vp_vbo);
-		glVertexAttribPointer(loc1, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-		glEnableVertexAttribArray(loc2);
-		glBindBuffer(GL_ARRAY_BUFFER, vn_vbo);
-		glVertexAttribPointer(loc2, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-
-		//	This is for texture coordinates which you don't currently need, so I have commented it out
-		unsigned int vt_vbo;
-		glGenBuffers(1, &vt_vbo);
-		glBindBuffer(GL_ARRAY_BUFFER, vt_vbo);
-		glBufferData(GL_ARRAY_BUFFER, mesh_data[1].mTextureCoords.size() * sizeof(vec2), &mesh_data[1].mTextureCoords[0], GL_STATIC_DRAW);
-
-
-
-
-		//	This is for texture coordinates which you don't currently need, so I have commented it out
-		glEnableVertexAttribArray(loc3);
-		glBindBuffer(GL_ARRAY_BUFFER, vt_vbo);
-		glVertexAttribPointer(loc3, 2, GL_FLOAT, GL_FALSE, 0, NULL);
-	}
-
-	{
-
-		glBindVertexArray(vao[2]);
-
-		unsigned int vp_vbo = 0;
-		unsigned int shader = shaders["light"];
-		loc1 = glGetAttribLocation(shader, "aPos");
-		loc2 = glGetAttribLocation(shader, "aNormal");
-		loc3 = glGetAttribLocation(shader, "aTexCoords");
-
-
-		glGenBuffers(1, &vp_vbo);
-		glBindBuffer(GL_ARRAY_BUFFER, vp_vbo);
-		glBufferData(GL_ARRAY_BUFFER, mesh_data[3].mPointCount * sizeof(vec3), &mesh_data[3].mVertices[0], GL_STATIC_DRAW);
-		unsigned int vn_vbo = 0;
-		glGenBuffers(1, &vn_vbo);
-		glBindBuffer(GL_ARRAY_BUFFER, vn_vbo);
-		glBufferData(GL_ARRAY_BUFFER, mesh_data[3].mPointCount * sizeof(vec3), &mesh_data[3].mNormals[0], GL_STATIC_DRAW);
-
-
-		glEnableVertexAttribArray(loc1);
-		glBindBuffer(GL_ARRAY_BUFFER, vp_vbo);
-		glVertexAttribPointer(loc1, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-		glEnableVertexAttribArray(loc2);
-		glBindBuffer(GL_ARRAY_BUFFER, vn_vbo);
-		glVertexAttribPointer(loc2, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-
-		//	This is for texture coordinates which you don't currently need, so I have commented it out
-		unsigned int vt_vbo;
-		glGenBuffers(1, &vt_vbo);
-		glBindBuffer(GL_ARRAY_BUFFER, vt_vbo);
-		glBufferData(GL_ARRAY_BUFFER, mesh_data[3].mTextureCoords.size() * sizeof(vec2), &mesh_data[3].mTextureCoords[0], GL_STATIC_DRAW);
-
-
-
-
-		//	This is for texture coordinates which you don't currently need, so I have commented it out
-		glEnableVertexAttribArray(loc3);
-		glBindBuffer(GL_ARRAY_BUFFER, vt_vbo);
-		glVertexAttribPointer(loc3, 2, GL_FLOAT, GL_FALSE, 0, NULL);
-	}
-
+	buffer_mesh(vao[0], mesh_data[0]);
+	buffer_mesh(vao[1], mesh_data[1]);
+	buffer_mesh(vao[2], mesh_data[3]);
 
 	// cube
 
@@ -853,6 +930,17 @@ void gen_buffer_mesh() {
 	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
 
 	#pragma endregion particles
+
+	gen_quad_buffer();
+
+	arena_train = add_arena_mesh(mesh_data[0]);
+	arena_box_car = add_arena_mesh(mesh_data[1]);
+	arena_rails = add_arena_mesh(mesh_data[3]);
+	arena_cube = indirect.arena.add_interleaved(vertices, sizeof(vertices) / (8 * sizeof(float)));
+	// not the cube, twelve triangles are not worth it
+	int lod_meshes[] = { arena_train, arena_box_car, arena_rails };
+	build_mesh_lods(indirect.arena, lod_meshes, sizeof(lod_meshes) / sizeof(lod_meshes[0]));
+	indirect.init();
 }
 #pragma endregion VBO_FUNCTIONS
 
@@ -878,54 +966,76 @@ mat4 draw_child(mat4 parent, mat4 child, ModelData &mesh) {
 
 
 
+// One PhongLight uniform, name is "spotLight" or "pointLights[i]"
+void set_light(GLuint shader, const char* name, const SceneLight& light, bool spot) {
+	char field[64];
+	snprintf(field, sizeof(field), "%s.position", name);
+	set_vec3(shader, field, light.position);
+	if (spot) {
+		snprintf(field, sizeof(field), "%s.direction", name);
+		set_vec3(shader, field, light.direction);
+	}
+	snprintf(field, sizeof(field), "%s.ambient", name);
+	set_vec3(shader, field, light.ambient);
+	snprintf(field, sizeof(field), "%s.diffuse", name);
+	set_vec3(shader, field, light.diffuse);
+	snprintf(field, sizeof(field), "%s.specular", name);
+	set_vec3(shader, field, light.specular);
+	snprintf(field, sizeof(field), "%s.constant", name);
+	set_float(shader, field, light.constant);
+	snprintf(field, sizeof(field), "%s.linear", name);
+	set_float(shader, field, light.linear);
+	snprintf(field, sizeof(field), "%s.quadratic", name);
+	set_float(shader, field, light.quadratic);
+	if (spot) {
+		snprintf(field, sizeof(field), "%s.bounds", name);
+		set_float(shader, field, light.bounds);
+		snprintf(field, sizeof(field), "%s.outerBounds", name);
+		set_float(shader, field, light.outerBounds);
+	}
+}
+
 void multi_light(GLuint shader) {
-	set_vec3(shader, "dirLight.direction",vec3( -0.2f, -1.0f, -0.3f));
+	set_vec3(shader, "dirLight.direction", dir_light_direction);
 	set_vec3(shader, "dirLight.ambient", vec3(0.05f, 0.05f, 0.05f));
 	set_vec3(shader, "dirLight.diffuse", vec3(0.4f, 0.4f, 0.4f));
 	set_vec3(shader, "dirLight.specular", vec3(0.5f, 0.5f, 0.5f));
-	// point light 1
-	set_vec3(shader, "pointLights[0].position", pointLightPositions[0]);
-	set_vec3(shader, "pointLights[0].ambient", vec3(0.05f, 0.05f, 0.05f));
-	set_vec3(shader, "pointLights[0].diffuse", vec3(0.8f, 0.8f, 0.8f));
-	set_vec3(shader, "pointLights[0].specular", vec3(1.0f, 1.0f, 1.0f));
-	set_float(shader, "pointLights[0].constant", 1.0f);
-	set_float(shader, "pointLights[0].linear", 0.09);
-	set_float(shader, "pointLights[0].quadratic", 0.032);
-	// point light 2
-	set_vec3(shader, "pointLights[1].position", pointLightPositions[1]);
-	set_vec3(shader, "pointLights[1].ambient", vec3(0.05f, 0.05f, 0.05f));
-	set_vec3(shader, "pointLights[1].diffuse", vec3(0.8f, 0.8f, 0.8f));
-	set_vec3(shader, "pointLights[1].specular", vec3(1.0f, 1.0f, 1.0f));
-	set_float(shader, "pointLights[1].constant", 1.0f);
-	set_float(shader, "pointLights[1].linear", 0.09);
-	set_float(shader, "pointLights[1].quadratic", 0.032);
-	// point light 3
-	set_vec3(shader, "pointLights[2].position", pointLightPositions[2]);
-	set_vec3(shader, "pointLights[2].ambient", vec3(0.05f, 0.05f, 0.05f));
-	set_vec3(shader, "pointLights[2].diffuse", vec3(0.8f, 0.8f, 0.8f));
-	set_vec3(shader, "pointLights[2].specular", vec3(1.0f, 1.0f, 1.0f));
-	set_float(shader, "pointLights[2].constant", 1.0f);
-	set_float(shader, "pointLights[2].linear", 0.09);
-	set_float(shader, "pointLights[2].quadratic", 0.032);
-	// point light 4
-	set_vec3(shader, "pointLights[3].position", pointLightPositions[3]);
-	set_vec3(shader, "pointLights[3].ambient", vec3(0.05f, 0.05f, 0.05f));
-	set_vec3(shader, "pointLights[3].diffuse", vec3(0.8f, 0.8f, 0.8f));
-	set_vec3(shader, "pointLights[3].specular", vec3(1.0f, 1.0f, 1.0f));
-	set_float(shader, "pointLights[3].constant", 1.0f);
-	set_float(shader, "pointLights[3].linear", 0.09);
-	set_float(shader, "pointLights[3].quadratic", 0.032);
-	// spotLight
-	set_vec3(shader, "spotLight.position", camera.Position);
-	set_vec3(shader, "spotLight.direction", camera.Front);
-	set_vec3(shader, "spotLight.ambient", vec3(0.0f, 0.0f, 0.0f));
-	set_vec3(shader, "spotLight.diffuse", vec3(1.0f, 1.0f, 1.0f));
-	set_vec3(shader, "spotLight.specular", vec3(1.0f, 1.0f, 1.0f));
-	set_float(shader, "spotLight.constant", 1.0f);
-	set_float(shader, "spotLight.linear", 0.09);
-	set_float(shader, "spotLight.quadratic", 0.032);
-	set_float(shader, "spotLight.bounds", glm::cos(glm::radians(12.5f)));
-	set_float(shader, "spotLight.outerBounds", glm::cos(glm::radians(15.0f)));
+	if (cast_shadows)
+		shadow_cascades.set_uniforms(shader, SHADOW_TEXTURE_UNIT);
+	if (clustered_lights) {
+		light_clusters.set_uniforms(shader, CLUSTER_TEXTURE_UNIT, width, height);
+		return;
+	}
+	for (unsigned int i = 0; i < NUM_POINT_LIGHTS; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "pointLights[%u]", i);
+		set_light(shader, name, scene_lights[i], false);
+	}
+	set_light(shader, "spotLight", scene_lights.back(), true);
+}
+
+// The scene's lights, extra_lamps of them hung in rows over the yard, each
+// with its own colour and a short reach
+void init_scene_lights() {
+	scene_lights.clear();
+	for (unsigned int i = 0; i < NUM_POINT_LIGHTS; i++)
+		scene_lights.push_back(point_light(pointLightPositions[i], vec3(0.05f, 0.05f, 0.05f), vec3(0.8f, 0.8f, 0.8f), vec3(1.0f, 1.0f, 1.0f), 1.0f, 0.09f, 0.032f));
+	int columns = (int)ceil(sqrt((double)extra_lamps));
+	for (int i = 0; i < extra_lamps; i++) {
+		float x = -20.0f + 40.0f * ((i % columns) + 0.5f) / columns;
+		float z = -30.0f + 40.0f * ((i / columns) + 0.5f) / columns;
+		float y = (i % 3) - 1.5f;
+		vec3 colour(0.5f + 0.5f * sin(i * 1.7f), 0.5f + 0.5f * sin(i * 2.3f + 2.0f), 0.5f + 0.5f * sin(i * 3.1f + 4.0f));
+		scene_lights.push_back(point_light(vec3(x, y, z), vec3(0.0f), colour, colour, 1.0f, 1.4f, 7.2f));
+	}
+	if (!clustered_lights && extra_lamps > 0)
+		printf("WARNING: --lamps needs clustered lighting, only the first %u lights are drawn\n", (unsigned int)NUM_POINT_LIGHTS);
+
+	SceneLight spot = point_light(camera.Position, vec3(0.0f, 0.0f, 0.0f), vec3(1.0f, 1.0f, 1.0f), vec3(1.0f, 1.0f, 1.0f), 1.0f, 0.09f, 0.032f);
+	spot.direction = camera.Front;
+	spot.bounds = glm::cos(glm::radians(12.5f));
+	spot.outerBounds = glm::cos(glm::radians(15.0f));
+	scene_lights.push_back(spot);
 }
 
 bool   gp;                      // G Pressed? ( New )
@@ -934,278 +1044,536 @@ GLuint fogMode[] = { GL_EXP, GL_EXP2, GL_LINEAR };   // Storage For Three Types
 GLuint fogfilter = 0;                    // Which Fog To Use
 GLfloat fogColor[4] = { 0.5f, 0.5f, 0.5f, 1.0f };      // Fog Color
 
-void display() {
+// Per-frame values read by the program setup callbacks
+mat4 frame_view;
+mat4 frame_proj;
+// the lit variants picked for the frame, 0 while they compile; the G-buffer
+// ones when the frame is deferred
+GLuint frame_lit;
+GLuint frame_lit_indirect;
+bool frame_deferred;
+bool frame_prepass;
+
+// Follows the camera with the spot light and, clustered, bins every light
+// for the frame and binds the lists for the lit programs
+void update_lights() {
+	PROFILE_FUNCTION();
+	SceneLight& spot = scene_lights.back();
+	spot.position = camera.Position;
+	spot.direction = camera.Front;
+	if (!clustered_lights)
+		return;
+	light_clusters.set_projection(CAMERA_FOVY, (float)width / (float)height, CAMERA_NEAR, CAMERA_FAR);
+	light_clusters.build(frame_view, &scene_lights[0], scene_lights.size());
+	light_clusters.upload(CLUSTER_TEXTURE_UNIT);
+	glActiveTexture(GL_TEXTURE0);
+	// the queue's state cache no longer matches what is bound
+	render_queue.state.invalidate();
+}
 
-	// tell GL to only draw onto a pixel if the shape is closer to the viewer
-	glEnable(GL_DEPTH_TEST); // enable depth-testing
-	glEnable(GL_BLEND);
+// The G-buffer variants only take the surface, the lights come later
+void setup_gbuffer(RenderQueue& queue, GLuint shader) {
+	glUniformMatrix4fv(queue.uniform_location(shader, "view"), 1, GL_FALSE, value_ptr(frame_view));
+	glUniformMatrix4fv(queue.uniform_location(shader, "projection"), 1, GL_FALSE, value_ptr(frame_proj));
+	glUniform1i(queue.uniform_location(shader, "material.diffuse"), 0);
+	glUniform1i(queue.uniform_location(shader, "material.specular"), 1);
+	glUniform1f(queue.uniform_location(shader, "material.shininess"), 64.0f);
+}
 
-	glDepthFunc(GL_LESS); // depth-testing interprets a smaller value as "closer"
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+void setup_multilight(RenderQueue& queue, GLuint shader) {
+	setup_gbuffer(queue, shader);
+	glUniform3fv(queue.uniform_location(shader, "viewPos"), 1, value_ptr(camera.Position));
+	multi_light(shader);
+}
 
-	GLfloat fogColor[4] = { 0.5f, 0.5f, 0.5f, 0.0f };
-	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-	// Root of the Hierarchy
-	mat4 view = mat4(1.0f);
-	view = camera.GetViewMatrix();
-	//view = translate(view, vec3(0.0f, 0.0f, 0.0f));a
+void setup_parallax(RenderQueue& queue, GLuint shader) {
+	glUniformMatrix4fv(queue.uniform_location(shader, "view"), 1, GL_FALSE, value_ptr(frame_view));
+	glUniformMatrix4fv(queue.uniform_location(shader, "projection"), 1, GL_FALSE, value_ptr(frame_proj));
+	glUniform3fv(queue.uniform_location(shader, "viewPos"), 1, value_ptr(camera.Position));
+	glUniform3fv(queue.uniform_location(shader, "lightPos"), 1, value_ptr(lightPos));
+	glUniform1i(queue.uniform_location(shader, "diffuseMap"), 0);
+	glUniform1i(queue.uniform_location(shader, "normalMap"), 1);
+	glUniform1i(queue.uniform_location(shader, "depthMap"), 2);
+	glUniform1f(queue.uniform_location(shader, "heightScale"), PARALLAX_HEIGHT_SCALE);
+}
 
-	mat4 persp_proj = perspective(90.0f, (float)width / (float)height, 0.1f, 100.0f);
-	mat4 model = mat4(1.0f);
-	model = translate(model, trans + vec3(0.5f, 0.0f, 2.5f));
-	model = rotate(model, 90.0f, vec3(0.0f, 1.0f, 0.0f));
-	model = glm::scale(model, vec3(0.001f, 0.001f, 0.001f));
+void setup_lamp(RenderQueue& queue, GLuint shader) {
+	glUniformMatrix4fv(queue.uniform_location(shader, "view"), 1, GL_FALSE, value_ptr(frame_view));
+	glUniformMatrix4fv(queue.uniform_location(shader, "projection"), 1, GL_FALSE, value_ptr(frame_proj));
+}
 
+void setup_skybox(RenderQueue& queue, GLuint shader) {
+	// remove translation so the skybox stays centred on the camera
+	mat4 newView = glm::mat4(glm::mat3(frame_view));
+	glUniformMatrix4fv(queue.uniform_location(shader, "view"), 1, GL_FALSE, value_ptr(newView));
+	glUniformMatrix4fv(queue.uniform_location(shader, "projection"), 1, GL_FALSE, value_ptr(frame_proj));
+	glUniform1i(queue.uniform_location(shader, "skybox"), 0);
+}
 
+void setup_particle(RenderQueue& queue, GLuint shader) {
+	glUniformMatrix4fv(queue.uniform_location(shader, "view"), 1, GL_FALSE, value_ptr(frame_view));
+	glUniformMatrix4fv(queue.uniform_location(shader, "projection"), 1, GL_FALSE, value_ptr(frame_proj));
+	glUniform1i(queue.uniform_location(shader, "sprite"), 0);
+}
 
-	//glBindVertexArray(cubeVAO);
-	glBindVertexArray(vao[0]);
+void particle_uniforms(RenderQueue& queue, const DrawPacket& packet) {
+	glUniform3fv(queue.uniform_location(packet.program, "offset"), 1, value_ptr(packet.params[0]));
+	glUniform4fv(queue.uniform_location(packet.program, "color"), 1, value_ptr(packet.params[1]));
+}
 
-	//Declare your uniform variables that will be used in your shader
-	int matrix_location;
-	int view_mat_location;
-	int proj_mat_location ;
+static void lit_created(GLuint program, uint32_t key) {
+	bool geometry = lit_variants.value(key, LIT_GBUFFER) != 0;
+	render_queue.set_program_setup(program, geometry ? setup_gbuffer : setup_multilight);
+	render_queue.set_instanced(program);
+	render_queue.set_depth_prepass(program);
+	render_queue.set_program_name(program, geometry ? "lit meshes (g-buffer)" : "lit meshes");
+}
 
-	int light_colour;
+static void parallax_created(GLuint program, uint32_t /*key*/) {
+	render_queue.set_program_setup(program, setup_parallax);
+	render_queue.set_program_name(program, "parallax quad");
+}
 
+// The lit variant for the scene's lights and the current highlight model
+uint32_t lit_key(const ShaderVariants& family) {
+	int values[LIT_FEATURE_COUNT];
+	values[LIT_DIR_LIGHT] = 1;
+	values[LIT_POINT_LIGHTS] = clustered_lights ? 0 : NUM_POINT_LIGHTS;
+	values[LIT_SPOT_LIGHT] = !clustered_lights;
+	values[LIT_SHADOWS] = cast_shadows ? SHADOW_CASCADES : 0;
+	values[LIT_BLINN] = blinn != 0.0f;
+	values[LIT_CLUSTERED] = clustered_lights;
+	values[LIT_GBUFFER] = 0;
+	return family.key(values);
+}
 
+// The geometry pass variant, the same whatever the lights and highlights
+uint32_t gbuffer_key(const ShaderVariants& family) {
+	int values[LIT_FEATURE_COUNT] = {};
+	values[LIT_GBUFFER] = 1;
+	return family.key(values);
+}
 
+void init_shader_variants() {
+	const ShaderStage lit_vertex = { "lightingVertex.txt", GL_VERTEX_SHADER, NULL };
+	const ShaderStage indirect_vertex = { "indirectVertex.txt", GL_VERTEX_SHADER, NULL };
+	const ShaderStage lit_fragment = { "MultiLightFragment.txt", GL_FRAGMENT_SHADER, NULL };
+	const ShaderStage indirect_fragment = { "MultiLightFragment.txt", GL_FRAGMENT_SHADER, "#define MATERIAL_ARRAY\n" };
+	const ShaderStage deferred_vertex = { "deferredVertex.txt", GL_VERTEX_SHADER, NULL };
+	const ShaderStage deferred_fragment = { "MultiLightFragment.txt", GL_FRAGMENT_SHADER, "#define DEFERRED_LIGHTING\n" };
+	const ShaderStage parallax_vertex = { "parallax_vertex.txt", GL_VERTEX_SHADER, NULL };
+	const ShaderStage parallax_fragment = { "parallax_fragment.txt", GL_FRAGMENT_SHADER, NULL };
+	lit_variants.init(&shader_cache, "multilight", lit_vertex, lit_fragment, lit_features, LIT_FEATURE_COUNT, lit_created);
+	// the indirect path sets its uniforms itself
+	indirect_variants.init(&shader_cache, "multilight_indirect", indirect_vertex, indirect_fragment, lit_features, LIT_FEATURE_COUNT);
+	// and so does the deferred lighting pass
+	deferred_variants.init(&shader_cache, "multilight_deferred", deferred_vertex, deferred_fragment, lit_features, LIT_FEATURE_COUNT);
+	parallax_variants.init(&shader_cache, "parallax", parallax_vertex, parallax_fragment, parallax_features, 2, parallax_created);
+	if (watch_shaders) {
+		shader_watcher.add(lit_vertex.path);
+		shader_watcher.add(indirect_vertex.path);
+		shader_watcher.add(deferred_vertex.path);
+		shader_watcher.add(lit_fragment.path);
+		shader_watcher.add(parallax_vertex.path);
+		shader_watcher.add(parallax_fragment.path);
+	}
 
-	vec3 light(1.0f, 1.0f, 1.0f);
+	// both highlight models, so 'b' doesn't wait for a compile
+	uint32_t lit = lit_key(lit_variants);
+	for (int b = 0; b < 2; b++) {
+		lit_variants.prewarm(lit_variants.with(lit, LIT_BLINN, b));
+		indirect_variants.prewarm(indirect_variants.with(lit, LIT_BLINN, b));
+		if (deferred_shading)
+			deferred_variants.prewarm(deferred_variants.with(lit, LIT_BLINN, b));
+	}
+	if (deferred_shading) {
+		lit_variants.prewarm(gbuffer_key(lit_variants));
+		indirect_variants.prewarm(gbuffer_key(indirect_variants));
+	}
+	parallax_variants.prewarm(parallax_key(cone_parallax));
+}
 
-	vec3 viewPos = camera.Position;
+void init_render_queue() {
+	PROFILE_FUNCTION();
+	train_material = render_queue.add_material(GL_TEXTURE_2D, train_diffuse, GL_TEXTURE_2D, specularMap);
+	rail_material = render_queue.add_material(GL_TEXTURE_2D, concrete, GL_TEXTURE_2D, specularMap);
+	container_material = render_queue.add_material(GL_TEXTURE_2D, diffuseMap, GL_TEXTURE_2D, specularMap);
+	brick_material = render_queue.add_material(GL_TEXTURE_2D, brick_diff, GL_TEXTURE_2D, brick_normal, GL_TEXTURE_2D, brick_height);
+	brick_cone_material = render_queue.add_material(GL_TEXTURE_2D, brick_diff, GL_TEXTURE_2D, brick_normal, GL_TEXTURE_2D, brick_cone);
+	skybox_material = render_queue.add_material(GL_TEXTURE_CUBE_MAP, skybox);
+	particle_material = render_queue.add_material(GL_TEXTURE_2D, particle_sprite);
+
+	render_queue.set_program_setup(shaders["lamp"], setup_lamp);
+	render_queue.set_program_setup(shaders["skybox"], setup_skybox);
+	render_queue.set_program_setup(shaders["particle"], setup_particle);
+	// view and projection are all the pre-pass takes, as for the lamps
+	render_queue.set_program_setup(shaders["depth"], setup_lamp);
+	render_queue.set_instanced(shaders["depth"]);
+
+	stream_buffer.init(1 << 20, persistent_streams);
+	render_queue.set_stream_buffer(&stream_buffer);
+	indirect.streamBuffer = &stream_buffer;
+	light_clusters.init();
+	light_clusters.streamBuffer = &stream_buffer;
+	glGenVertexArrays(1, &deferred_vao);
+	if (cast_shadows && !shadow_cascades.init())
+		cast_shadows = false;
+
+	gpu_profiler.init();
+	render_queue.set_gpu_profiler(&gpu_profiler);
+	render_queue.set_program_name(shaders["lamp"], "lamps");
+	render_queue.set_program_name(shaders["skybox"], "skybox");
+	render_queue.set_program_name(shaders["particle"], "particles");
+
+	train_layer = diffuse_array.add(train_diffuse);
+	rail_layer = diffuse_array.add(concrete);
+	container_layer = diffuse_array.add(diffuseMap);
+	specular_layer = specular_array.add(specularMap);
+	diffuse_array.build(512);
+	specular_array.build(512);
+}
 
-	GLuint shader = shaders["multilight"];
+// Lit opaque meshes take the indirect path when it is on, the queue otherwise
+void submit_lit(int arena_mesh, GLuint mesh_vao, int material, int layer, GLsizei count, const mat4 &model) {
+	// ahead of any culling, the selector knows objects by the order they come in
+	int lod = 0;
+	if (use_lods && indirect.ready() && arena_mesh >= 0)
+		lod = lod_selector.select(indirect.arena.mesh(arena_mesh), model);
+	if (cast_shadows && indirect.ready() && arena_mesh >= 0)
+		shadow_cascades.add_caster(indirect.arena.mesh(arena_mesh), model);
+	// hidden, but its shadow may not be
+	if (frame_occlusion && arena_mesh >= 0 && occlusion.occluded(indirect.arena.mesh(arena_mesh).bounds.transformed(model)))
+		return;
+	if (use_indirect && indirect.ready() && arena_mesh >= 0 && frame_lit_indirect) {
+		if (indirect.add(arena_mesh, model, layer, specular_layer, lod) && use_lods)
+			lod_selector.drawn(indirect.arena.mesh(arena_mesh), lod);
+	}
+	else if (count > 0)
+		render_queue.submit(frame_deferred ? PASS_GBUFFER : PASS_OPAQUE, frame_lit, mesh_vao, material, GL_TRIANGLES, 0, count, model);
+}
+
+// The occluders of the frame into the culler's depth buffer, before
+// anything is tested against it
+void render_occluders(const mat4* rail_models, const mat4& cube_model) {
+	PROFILE_FUNCTION();
+	occlusion.begin_frame(frame_proj * frame_view);
+	if (arena_rails >= 0) {
+		for (int i = 0; i < NUM_RAILS; i++)
+			occlusion.add_occluder(indirect.arena, arena_rails, rail_models[i]);
+	}
+	occlusion.add_occluder(indirect.arena, arena_cube, cube_model);
+	occlusion.render();
+}
 
+void draw_indirect() {
+	PROFILE_FUNCTION();
+	if (indirect.empty())
+		return;
+	GLuint shader = frame_lit_indirect;
+	if (shader == 0)
+		return;
 	glUseProgram(shader);
-	matrix_location = glGetUniformLocation(shader, "model");
-	view_mat_location = glGetUniformLocation(shader, "view");
-	proj_mat_location = glGetUniformLocation(shader, "projection");
-	int view_pos = glGetUniformLocation(shader, "viewPos");
-
-	// get material locations
-	int diffuse_loc = glGetUniformLocation(shader, "material.diffuse");
-	int specular_loc = glGetUniformLocation(shader, "material.specular");
-	int shine_loc = glGetUniformLocation(shader, "material.shininess");
-
-	//// set material values
-	vec3 ambient(1.0f, 0.5f, 0.31f);
-	vec3 diff(1.0f, 0.5f, 0.31f);
-	vec3 specular(0.5f, 0.5f, 0.5f);
-	float shininess = 64.0f;
-
-	glUniform1i(diffuse_loc, 0);
-	glUniform1i(specular_loc, 1);
-	//
-	set_float(shader, "material.shininess", shininess);
-	set_bool(shader, "blinn", blinn);
+	set_mat4(shader, "view", frame_view);
+	set_mat4(shader, "projection", frame_proj);
+	set_float(shader, "material.shininess", 64.0f);
+	set_int(shader, "diffuseArray", 0);
+	set_int(shader, "specularArray", 1);
+	set_int(shader, "drawData", 2);
+	if (!frame_deferred) {
+		set_vec3(shader, "viewPos", camera.Position);
+		multi_light(shader);
+	}
+	if (frame_prepass) {
+		// the pre-pass has the depth, only the nearest surface is shaded
+		render_queue.state.depth_func(GL_EQUAL);
+		render_queue.state.depth_mask(false);
+	}
 
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, train_diffuse);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, diffuse_array.texture);
 	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, specularMap);
-
-
-	//glUniform1f(shine_loc, shininess);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, specular_array.texture);
+	gpu_profiler.begin("lit meshes (indirect)");
+	indirect.draw(2);
+	gpu_profiler.end();
+	glActiveTexture(GL_TEXTURE0);
 
-	//// set light values
-	//vec3 light_amb(0.1f, 0.1f, 0.1f);
-	//vec3 light_diff(0.5f, 0.5f, 0.5f);
-	//vec3 dir(-0.2f, -1.0f, -0.3f);
+	// the queue's state cache no longer matches what is bound
+	render_queue.state.invalidate();
+}
 
-	//float constant = 1.0f;
-	//float linear = 0.09f;
-	//float quad = 0.032f;
-	//float bounds = cos(radians(12.5f));
-	//float outerBounds = cos(radians(17.5f));
+// The depth of the lit meshes, indirect and queued, ahead of the pass that
+// shades them. Nearest first, with nothing but positions read.
+void render_depth_prepass(RenderPass pass) {
+	PROFILE_FUNCTION();
+	gpu_profiler.begin("depth pre-pass");
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	render_queue.state.depth_func(GL_LESS);
+	render_queue.state.depth_mask(true);
+	// the same draws draw_indirect() will shade
+	GLuint shader = shader_program("depth_indirect");
+	if (!indirect.empty() && frame_lit_indirect && shader) {
+		glUseProgram(shader);
+		set_mat4(shader, "view", frame_view);
+		set_mat4(shader, "projection", frame_proj);
+		set_int(shader, "drawData", 2);
+		indirect.draw(2, true);
+		glActiveTexture(GL_TEXTURE0);
+		// the queue's state cache no longer matches what is bound
+		render_queue.state.invalidate();
+	}
+	render_queue.depth_prepass(pass, shader_program("depth"));
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	gpu_profiler.end();
+}
 
-	//
-	//set_vec3(shader, "light.ambient", light_amb);
-	//set_vec3(shader, "light.diffuse", light_diff);
-	//set_vec3(shader, "light.specular", light);
-	//set_vec3(shader, "light.position", lightPos);
-	//set_vec3(shader, "light.direction", dir);
+// dirLight's shadow maps, drawn from the casters submit_lit() listed
+void render_shadows() {
+	PROFILE_FUNCTION();
+	GLuint program = shader_program("shadow");
+	if (program == 0 || !indirect.ready())
+		return;
+	// the cascades are cleared and drawn with depth writes on
+	render_queue.state.depth_func(GL_LESS);
+	render_queue.state.depth_mask(true);
+	gpu_profiler.begin("shadows");
+	shadow_cascades.render(frame_view, CAMERA_FOVY, (float)width / (float)height, CAMERA_NEAR, dir_light_direction,
+		indirect.arena.depthVao, program, &gpu_profiler);
+	gpu_profiler.end();
+	shadow_cascades.bind(SHADOW_TEXTURE_UNIT);
+	glActiveTexture(GL_TEXTURE0);
 
-	//set_float(shader, "light.constant", constant);
-	//set_float(shader, "light.linear", linear);
-	//set_float(shader, "light.quadratic", quad);
-	//set_float(shader, "light.bounds", bounds);
-	//set_float(shader, "light.outerBounds", outerBounds);
+	// the queue's state cache no longer matches what is bound
+	render_queue.state.invalidate();
+}
 
+// The deferred lighting pass, one triangle over the target lighting every
+// pixel the geometry pass drew to
+void light_gbuffer(GLuint shader) {
+	PROFILE_FUNCTION();
+	glUseProgram(shader);
+	set_vec3(shader, "viewPos", camera.Position);
+	set_mat4(shader, "inverseViewProjection", inverse(frame_proj * frame_view));
+	set_int(shader, "gAlbedo", GBUFFER_TEXTURE_UNIT + GBUFFER_ALBEDO);
+	set_int(shader, "gSpecular", GBUFFER_TEXTURE_UNIT + GBUFFER_SPECULAR);
+	set_int(shader, "gNormal", GBUFFER_TEXTURE_UNIT + GBUFFER_NORMAL);
+	set_int(shader, "gDepth", GBUFFER_TEXTURE_UNIT + GBUFFER_DEPTH);
 	multi_light(shader);
 
-	vec3 obj_color(1.0f, 0.5f, 0.31f);
-
-	glUniformMatrix4fv(matrix_location, 1, GL_FALSE, value_ptr(model));
-	glUniformMatrix4fv(proj_mat_location, 1, GL_FALSE, value_ptr(persp_proj));
-	glUniformMatrix4fv(view_mat_location, 1, GL_FALSE, value_ptr(view));
-
-
-
-	glUniform3fv(view_pos, 1, value_ptr(viewPos));
+	gbuffer.bind_textures(GBUFFER_TEXTURE_UNIT);
+	glBindVertexArray(deferred_vao);
+	gpu_profiler.begin("deferred lighting");
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	gpu_profiler.end();
+	gbuffer.unbind_textures(GBUFFER_TEXTURE_UNIT);
+	glActiveTexture(GL_TEXTURE0);
+	glBindVertexArray(0);
 
-	glDrawArrays(GL_TRIANGLES, 0, mesh_data[0].mPointCount);
-	//glDrawArrays(GL_TRIANGLES, 0, 36);
+	// the queue's state cache no longer matches what is bound
+	render_queue.state.invalidate();
+}
 
-	glBindVertexArray(vao[1]);
-	mat4 childModel(1.0f);
-	childModel = translate(childModel, vec3(-170.0f, -10.0f, -500.0f));
-	childModel = model * childModel;
-	glUniformMatrix4fv(matrix_location, 1, GL_FALSE, value_ptr(childModel));
-	glDrawArrays(GL_TRIANGLES, 0, mesh_data[1].mPointCount);
+// Draws one frame into whatever framebuffer is bound
+void render_scene() {
+	PROFILE_FUNCTION();
+	const SceneSnapshot& scene = scene_buffer.read_buffer();
+	poll_shaders();
 
-	glBindVertexArray(vao[2]);
-	for (int i = 0; i < NUM_RAILS; i++)
-	{
+	// tell GL to only draw onto a pixel if the shape is closer to the viewer
+	glEnable(GL_DEPTH_TEST); // enable depth-testing
+	glEnable(GL_BLEND);
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, concrete);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, specularMap);
-		mat4 mod(1.0f);
-		mod = translate(mod, rails[i]);
-		mod = scale(mod, vec3(0.005f, 0.005f, 0.005f));
-		glUniformMatrix4fv(matrix_location, 1, GL_FALSE, value_ptr(mod));
-		glDrawArrays(GL_TRIANGLES, 0, mesh_data[3].mPointCount);
+	gpu_profiler.begin_frame();
+	gpu_profiler.begin("clear");
+	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	gpu_profiler.end();
 
+	// Root of the Hierarchy
+	frame_view = camera.GetViewMatrix();
+	frame_proj = perspective(CAMERA_FOVY, (float)width / (float)height, CAMERA_NEAR, CAMERA_FAR);
+	frame_arenas.begin_frame();
+	stream_buffer.begin_frame();
+	render_queue.begin_frame(frame_view, CAMERA_FAR, &frame_arenas.current());
+	indirect.begin_frame(frame_proj * frame_view);
+	lod_selector.begin_frame(frame_view, frame_proj);
+	shadow_cascades.begin_frame();
+	// before update_lights(), which tells the queue its bindings are stale
+	if (deferred_shading && !gbuffer.create(width, height))
+		deferred_shading = false;
+	update_lights();
+	GLuint deferred = 0;
+	frame_deferred = false;
+	if (deferred_shading) {
+		deferred = deferred_variants.program(lit_key(deferred_variants));
+		frame_lit = lit_variants.program(gbuffer_key(lit_variants));
+		frame_lit_indirect = indirect_variants.program(gbuffer_key(indirect_variants));
+		// drawn forward until all three have compiled
+		frame_deferred = deferred && frame_lit && frame_lit_indirect;
 	}
-	// draw light source
-	glBindVertexArray(cubeVAO);
+	if (!frame_deferred) {
+		frame_lit = lit_variants.program(lit_key(lit_variants));
+		frame_lit_indirect = indirect_variants.program(lit_key(indirect_variants));
+	}
+	frame_prepass = depth_prepass && shader_program("depth") && shader_program("depth_indirect");
+	GLuint parallax = parallax_variants.program(parallax_key(cone_parallax));
+
+	// the fixed parts of these transforms are baked at compile time, see
+	// baked_scene.cpp. Past the end of the table the three rail segment
+	// pattern repeats along x.
+	mat4 rail_models[NUM_RAILS];
+	for (int i = 0; i < NUM_RAILS; i++) {
+		rail_models[i] = make_mat4(baked_rail_models[i % NUM_BAKED_RAILS]);
+		rail_models[i][3].x += 3.0f * (i / NUM_BAKED_RAILS);
+	}
+	mat4 cube_model = make_mat4(baked_lit_cube_model);
+	frame_occlusion = occlusion_culling && indirect.ready();
+	if (frame_occlusion)
+		render_occluders(rail_models, cube_model);
 
-	view_mat_location = glGetUniformLocation(shader, "view");
-	proj_mat_location = glGetUniformLocation(shader, "projection");
-	glUniformMatrix4fv(proj_mat_location, 1, GL_FALSE, value_ptr(persp_proj));
-	glUniformMatrix4fv(view_mat_location, 1, GL_FALSE, value_ptr(view));
+	vec3 train_pos = mix(scene.prev_trans, scene.trans, frame_alpha);
+	mat4 model = translate(mat4(1.0f), train_pos + vec3(0.5f, 0.0f, 2.5f)) * make_mat4(baked_train_local);
+	submit_lit(arena_train, vao[0], train_material, train_layer, mesh_data[0].mPointCount, model);
 
-	for (unsigned int i = 3; i < 4; i++)
-	{
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, diffuseMap);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, specularMap);
-
-		model = glm::mat4(1.0f);
-		model = glm::translate(model, pointLightPositions[i]);
-		model = glm::scale(model, glm::vec3(0.2f)); // Make it a smaller cube
-		set_mat4(shader, "model", model);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-	}
+	mat4 childModel = model * make_mat4(baked_box_car_offset);
+	submit_lit(arena_box_car, vao[1], train_material, train_layer, mesh_data[1].mPointCount, childModel);
 
-	// parallax mapping
-	shader = shaders["parallax"];
-	glUseProgram(shader);
+	// every segment shares mesh and material so they go out as one instanced draw
+	for (int i = 0; i < NUM_RAILS; i++)
+		submit_lit(arena_rails, vao[2], rail_material, rail_layer, mesh_data[3].mPointCount, rail_models[i]);
 
-	set_int(shader, "diffuseMap", 0);
-	set_int(shader, "normalMap", 1);
-	set_int(shader, "depthMap", 2);
+	// lit cube at the last point light
+	model = cube_model;
+	submit_lit(arena_cube, cubeVAO, container_material, container_layer, 36, model);
 
+	// parallax mapping, the quad hangs off the cube's transform
 	model = translate(model, vec3(0.0f, -2.0f, 0.0f));
 	model = rotate(model, 270.0f, glm::normalize(glm::vec3(1.0, 0.0, 0.0))); // rotate the quad to show parallax mapping from multiple directions
 	model = scale(model, vec3(20.0f, 20.0f, 20.0f));
+	render_queue.submit(PASS_OPAQUE, parallax, quadVAO, cone_parallax ? brick_cone_material : brick_material, GL_TRIANGLES, 0, 6, model);
 
-	set_mat4(shader, "view", view);
-	set_mat4(shader, "projection", persp_proj);
-	set_mat4(shader, "model", model);
-
-	set_vec3(shader, "viewPos", camera.Position);
-	set_vec3(shader, "lightPos", lightPos);
-	glEnable(GL_MULTISAMPLE);
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, brick_diff);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, brick_normal);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, brick_height);
-	
-	float heightScale = 0.2;
-	set_float(shader, "heightScale", heightScale);
-
-	renderQuad();
-
-	// light source
-	glBindVertexArray(lightVAO);
-	shader = shaders["lamp"];
-	glUseProgram(shader);
-
-
-	view_mat_location = glGetUniformLocation(shader, "view");
-	proj_mat_location = glGetUniformLocation(shader, "projection");
-	glUniformMatrix4fv(proj_mat_location, 1, GL_FALSE, value_ptr(persp_proj));
-	glUniformMatrix4fv(view_mat_location, 1, GL_FALSE, value_ptr(view));
-	
-	for (unsigned int i = 0; i < 3; i++)
+	// light sources
+	for (unsigned int i = 0; i < NUM_BAKED_LAMPS; i++)
 	{
-		model = glm::mat4(1.0f);
-		model = glm::translate(model, pointLightPositions[i]);
-		model = glm::scale(model, glm::vec3(0.1f)); // Make it a smaller cube
-		set_mat4(shader, "model", model);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
+		model = make_mat4(baked_lamp_models[i]);
+		if (frame_occlusion && occlusion.occluded(AABB(vec3(-0.5f), vec3(0.5f)).transformed(model)))
+			continue;
+		render_queue.submit(PASS_OPAQUE, shader_program("lamp"), lightVAO, NO_MATERIAL, GL_TRIANGLES, 0, 36, model);
 	}
 
+	// skybox is drawn after all opaque geometry
+	render_queue.submit(PASS_SKY, shader_program("skybox"), skyboxVAO, skybox_material, GL_TRIANGLES, 0, 36);
 
+	GLuint particle_shader = shader_program("particle");
+	for (size_t i = 0; i < scene.particles.size(); i++)
+	{
+		const ParticleSnapshot& particle = scene.particles[i];
+		vec3 pos = mix(particle.PrevPosition, particle.Position, frame_alpha);
+		vec3 res = vec3(pos.x + 0.294f, pos.y + -0.07f + 0.2275f, pos.z + 2.07f + 0.486f + 0.0135f);
+		DrawPacket& packet = render_queue.submit(PASS_TRANSPARENT, particle_shader, particleVAO, particle_material, GL_TRIANGLES, 0, 6, translate(mat4(1.0f), res));
+		packet.params[0] = vec4(res, 0.0f);
+		packet.params[1] = particle.Color;
+		packet.uniforms = particle_uniforms;
+	}
 
+	if (cast_shadows)
+		render_shadows();
+	if (frame_deferred) {
+		// the lit meshes into the G-buffer, then lit in one pass over the
+		// target, and the forward passes on top of them
+		GLint target = 0;
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+		{
+			PROFILE_SCOPE("g-buffer");
+			gpu_profiler.begin("g-buffer");
+			gbuffer.begin_geometry();
+			// the specular target's alpha is the shininess, not a coverage
+			glDisable(GL_BLEND);
+			if (frame_prepass)
+				render_depth_prepass(PASS_GBUFFER);
+			draw_indirect();
+			render_queue.flush(PASS_GBUFFER, PASS_GBUFFER);
+			glEnable(GL_BLEND);
+			gpu_profiler.end();
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, target);
+		light_gbuffer(deferred);
+		PROFILE_SCOPE("render_queue.flush");
+		render_queue.flush(PASS_OPAQUE, PASS_TRANSPARENT);
+	}
+	else {
+		if (frame_prepass)
+			render_depth_prepass(PASS_OPAQUE);
+		draw_indirect();
+		PROFILE_SCOPE("render_queue.flush");
+		render_queue.flush();
+	}
+	stream_buffer.end_frame();
+	gpu_profiler.end_frame();
+}
 
-	// draw skybox as last
-	glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
-	shader = shaders["skybox"];
-	glUseProgram(shader);
-
-
-	glBindVertexArray(skyboxVAO);
-	glActiveTexture(GL_TEXTURE0);
-	mat4 newView = glm::mat4(glm::mat3(camera.GetViewMatrix()));
-
-	view_mat_location = glGetUniformLocation(shader, "view");
-	proj_mat_location = glGetUniformLocation(shader, "projection");
-	int skybox_loc = glGetUniformLocation(shader, "skybox");
+// GPU pass times in the top left corner, drawn with GLUT's bitmap font
+// through the fixed-function pipeline of the window's compatibility context
+void draw_gpu_overlay() {
+	std::vector<std::string> lines = gpu_profiler.report();
+	glUseProgram(0);
+	glBindVertexArray(0);
+	glDisable(GL_DEPTH_TEST);
+	glColor3f(1.0f, 1.0f, 0.0f);
+	for (size_t i = 0; i < lines.size(); i++) {
+		glWindowPos2i(8, height - 16 * (int)(i + 1));
+		glutBitmapString(GLUT_BITMAP_8_BY_13, (const unsigned char*)lines[i].c_str());
+	}
+	glEnable(GL_DEPTH_TEST);
+	render_queue.state.invalidate();
+}
 
-	glUniformMatrix4fv(proj_mat_location, 1, GL_FALSE, value_ptr(persp_proj));
-	glUniformMatrix4fv(view_mat_location, 1, GL_FALSE, value_ptr(newView));
-	glUniform1i(skybox_loc, 0);
+// frame to frame times of the window, the whole run and the last second
+FrameHistogram frame_times, recent_frame_times;
 
-	glBindTexture(GL_TEXTURE_CUBE_MAP, skybox);
-	glDrawArrays(GL_TRIANGLES, 0, 36);
-	glBindVertexArray(0);
-	glDepthFunc(GL_LESS); // set depth function back to default
+// Shows the last second's percentiles in the title bar
+void track_frame_time() {
+	static std::chrono::steady_clock::time_point last_frame, last_title;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (last_frame.time_since_epoch().count() == 0) {
+		last_frame = last_title = now;
+		return;
+	}
+	double ms = std::chrono::duration<double, std::milli>(now - last_frame).count();
+	last_frame = now;
+	frame_times.add(ms);
+	recent_frame_times.add(ms);
+	if (now - last_title >= std::chrono::seconds(1)) {
+		char title[128];
+		snprintf(title, sizeof(title), "Hello Triangle  p50 %.1f ms  p95 %.1f ms  p99 %.1f ms",
+			recent_frame_times.percentile(0.5), recent_frame_times.percentile(0.95), recent_frame_times.percentile(0.99));
+		glutSetWindowTitle(title);
+		recent_frame_times.reset();
+		last_title = now;
+	}
+}
 
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-	glBindVertexArray(particleVAO);
-	shader = shaders["particle"];
-	glUseProgram(shader);
-	glDepthMask(0);
-	for (Particle particle : particles)
+void display() {
+	PROFILE_FUNCTION();
+	unsigned long long heap_start = heap_allocation_count();
+	render_scene();
+	if (show_gpu_overlay)
+		draw_gpu_overlay();
 	{
-		if (particle.Life > 0.0f)
-		{
-			vec3 pos = particle.Position;
-			set_mat4(shader, "projection", persp_proj);
-			set_int(shader, "sprite", 0);
-			vec3 res = vec3(pos.x + 0.294f, pos.y + -0.07f + 0.2275f, pos.z + 2.07f + 0.486f + 0.0135f);
-			set_vec3(shader, "offset", res);
-			set_mat4(shader, "view", view);
-			set_vec4(shader, "color", particle.Color);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, particle_sprite);
-
-			glDrawArrays(GL_TRIANGLES, 0, 6);
-		}
+		PROFILE_SCOPE("glutSwapBuffers");
+		glutSwapBuffers();
 	}
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glDepthMask(1);
-	glutSwapBuffers();
+	track_frame_time();
+	frame_heap_allocations = heap_allocation_count() - heap_start;
 }
 
 
+// Advances the simulation by one step of dt seconds
+void update_scene(float dt) {
+	PROFILE_FUNCTION();
 
-void updateScene() {
-
-	static DWORD last_time = 0;
-	DWORD curr_time = timeGetTime();
-	if (last_time == 0)
-		last_time = curr_time;
-	delta = (curr_time - last_time) * 0.001f;
-	last_time = curr_time;
+	delta = dt;
+	prev_trans = trans;
 
 	// Rotate the model slowly around the y axis at 20 degrees per second
 	rotate_y += 20.0f * delta;
@@ -1219,17 +1587,20 @@ void updateScene() {
 		int dead_particle = first_dead_particle();
 		reset_particle(particles[dead_particle]);
 	}
-	// Uupdate all particles
-	for (GLuint i = 0; i < NUM_PARTS; i++)
-	{
-		Particle &p = particles[i];
-		p.Life -= delta; // reduce life
-		if (p.Life > 0.0f)
-		{	// particle is alive, thus update
-			p.Position -= p.Velocity * delta;
-			p.Color.a -= delta * 2.5;
+	// Uupdate all particles, each one only touches itself
+	job_system.parallel_for(0, NUM_PARTS, 128, [](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			Particle &p = particles[i];
+			p.PrevPosition = p.Position;
+			p.Life -= delta; // reduce life
+			if (p.Life > 0.0f)
+			{	// particle is alive, thus update
+				p.Position -= p.Velocity * delta;
+				p.Color.a -= delta * 2.5;
+			}
 		}
-	}
+	});
 	#pragma endregion PARTS_UPDATE
 
 	#pragma region SPEED_UPDATE
@@ -1259,6 +1630,124 @@ void updateScene() {
 		}
 	}
 	#pragma endregion SPEED_UPDATE
+}
+
+// Copies what render_scene needs into the snapshot buffer and hands it over
+void publish_scene() {
+	PROFILE_FUNCTION();
+	SceneSnapshot& scene = scene_buffer.write_buffer();
+	scene.prev_trans = prev_trans;
+	scene.trans = trans;
+	scene.particles.clear();
+	// room for every particle once per slot, growing later would allocate mid-run
+	scene.particles.reserve(particles.size());
+	for (size_t i = 0; i < particles.size(); i++) {
+		const Particle& p = particles[i];
+		if (p.Life > 0.0f) {
+			ParticleSnapshot snap = { p.PrevPosition, p.Position, p.Color };
+			scene.particles.push_back(snap);
+		}
+	}
+	scene.stepped = std::chrono::steady_clock::now();
+	scene_buffer.publish();
+}
+
+// Keys that change the simulation, run by whichever thread owns it
+void sim_key(unsigned char key) {
+	switch (key) {
+		case 'r':
+			move_vec.x = 0.0f;
+			move_vec.y = 0.0f;
+			move_vec.z = 0.0f;
+			trans.x = 0.0f;
+			trans.y = 0.0f;
+			trans.z = 0.0f;
+			prev_trans = trans;
+			speed = 0.0f;
+			acc = 0.0f;
+			stop = false;
+			break;
+
+		case 'm':
+			acc = -0.01f;
+			stop = false;
+			break;
+
+		case 'v':
+			acc = -acc;
+			stop = true;
+			break;
+
+		case 'n':
+			acc = 0.01f;
+			stop = false;
+			break;
+
+		case '8':
+			trans.y += delta * 1.5f;
+			break;
+
+		case '2':
+			trans.y -= delta * 1.5f;
+			break;
+
+		case '4':
+			trans.x -= delta * 1.5f;
+			break;
+
+		case '6':
+			trans.x += delta * 1.5f;
+			break;
+
+		case '7':
+			trans.z -= delta * 1.5f;
+			break;
+
+		case '9':
+			trans.z += delta * 1.5f;
+			cout << trans.x << " " << trans.y << " " << trans.z << endl;
+			break;
+
+		default:
+			break;
+	}
+}
+
+// Simulation thread of the windowed pipeline, steps at the fixed rate and
+// publishes after each batch
+void simulation_thread() {
+	PROFILE_THREAD("simulation");
+	while (sim_running.load(std::memory_order_acquire)) {
+		unsigned char key;
+		while (sim_keys.pop(key))
+			sim_key(key);
+		if (game_loop.advance(update_scene) > 0)
+			publish_scene();
+	}
+	game_loop.print();
+}
+
+// paces drawing when the simulation has a thread of its own
+GameLoop render_loop;
+
+// GLUT idle callback, waits for the frame cap, runs the steps that are due
+// unless the simulation thread does that, and picks up the newest snapshot
+void updateScene() {
+
+	if (pipelined) {
+		render_loop.wait_frame();
+		scene_buffer.take();
+		// the snapshot is a whole step, blend by how long ago it was taken
+		std::chrono::duration<float> age = std::chrono::steady_clock::now() - scene_buffer.read_buffer().stepped;
+		frame_alpha = glm::clamp(age.count() / game_loop.step_seconds(), 0.0f, 1.0f);
+	}
+	else {
+		if (game_loop.advance(update_scene) > 0)
+			publish_scene();
+		scene_buffer.take();
+		frame_alpha = game_loop.alpha();
+	}
+
 	// Draw the next frame
 	glutPostRedisplay();
 }
@@ -1274,30 +1763,32 @@ void keyboard(unsigned char key, int x, int y)
 
 	float xoffset = x - lastX;
 	float yoffset = lastY - y; // reversed since y-coordinates go from bottom to top
+	// a key press moves the camera as far as one simulation step would
+	float step = game_loop.step_seconds();
 	switch (key) {
 		case 'q':
-			camera.ProcessKeyboard(UP, delta);
+			camera.ProcessKeyboard(UP, step);
 			break;
 
 		case 'w':
-			camera.ProcessKeyboard(FORWARD, delta);
+			camera.ProcessKeyboard(FORWARD, step);
 			break;
 		
 		case 's':
-			camera.ProcessKeyboard(BACKWARD, delta);
+			camera.ProcessKeyboard(BACKWARD, step);
 			break;
 
 		case 'a':
-			camera.ProcessKeyboard(LEFT, delta);
+			camera.ProcessKeyboard(LEFT, step);
 			break;
 
 
 		case 'd':
-			camera.ProcessKeyboard(RIGHT, delta);
+			camera.ProcessKeyboard(RIGHT, step);
 			break;
 
 		case 'e':
-			camera.ProcessKeyboard(DOWN, delta);
+			camera.ProcessKeyboard(DOWN, step);
 			break;
 
 		case 'i':
@@ -1309,59 +1800,79 @@ void keyboard(unsigned char key, int x, int y)
 			break;
 
 		case 'r':
-			move_vec.x = 0.0f;
-			move_vec.y = 0.0f;
-			move_vec.z = 0.0f;
-			trans.x = 0.0f;
-			trans.y = 0.0f;
-			trans.z = 0.0f;
-			speed = 0.0f;
-			acc = 0.0f;
-			stop = false;
+		case 'm':
+		case 'v':
+		case 'n':
+		case '8':
+		case '2':
+		case '4':
+		case '6':
+		case '7':
+		case '9':
+			if (!pipelined)
+				sim_key(key);
+			else if (!sim_keys.push(key))
+				printf("simulation is not keeping up, dropped key %c\n", key);
 			break;
 
 		case 'b':
 			blinn = !blinn;
 			break;
 
-		case 'm':
-			acc = -0.01f;
-			stop = false;
+		case 'p':
+			render_queue.stats().print();
+			indirect.print_stats();
+			if (clustered_lights)
+				light_clusters.print();
+			if (frame_deferred)
+				printf("g-buffer: %dx%d, %llu KB\n", gbuffer.width, gbuffer.height, (unsigned long long)gbuffer.bytes() / 1024);
+			if (cast_shadows)
+				shadow_cascades.print();
+			if (occlusion_culling)
+				occlusion.print();
+			if (use_lods)
+				lod_selector.print();
+			frame_arenas.print();
+			stream_buffer.print();
+			printf("heap: %llu allocations last frame\n", frame_heap_allocations);
+			frame_times.print("frame times");
+			if (!pipelined)
+				game_loop.print();
+			gpu_profiler.print();
 			break;
 
-		case 'v':
-			acc = -acc;
-			stop = true;
-			break;
-
-		case 'n':
-			acc = 0.01f;
-			stop = false;
+		case 't':
+			show_gpu_overlay = !show_gpu_overlay;
 			break;
 
-		case '8':
-			trans.y += delta * 1.5f;
+		case 'o':
+			use_indirect = !use_indirect;
+			printf("indirect draws %s\n", use_indirect ? "on" : "off");
 			break;
 
-		case '2':
-			trans.y -= delta * 1.5f;
+		case 'g':
+			deferred_shading = !deferred_shading;
+			printf("%s shading\n", deferred_shading ? "deferred" : "forward");
 			break;
 
-		case '4':
-			trans.x -= delta * 1.5f;
+		case 'z':
+			depth_prepass = !depth_prepass;
+			printf("depth pre-pass %s\n", depth_prepass ? "on" : "off");
 			break;
 
-		case '6':
-			trans.x += delta * 1.5f;
+		case 'x':
+			occlusion_culling = !occlusion_culling;
+			printf("occlusion culling %s\n", occlusion_culling ? "on" : "off");
 			break;
 
-		case '7':
-			trans.z -= delta * 1.5f;
+		case 'l':
+			use_lods = !use_lods;
+			printf("mesh lods %s\n", use_lods ? "on" : "off");
 			break;
 
-		case '9':
-			trans.z += delta * 1.5f;
-			cout << trans.x << " " << trans.y << " " << trans.z << endl;
+		case 'c':
+			cone_parallax = !cone_parallax;
+			printf("parallax %s\n", cone_parallax ? "cone steps" : "layers");
 			break;
 
 		default:
@@ -1376,39 +1887,290 @@ void keyboard(unsigned char key, int x, int y)
 
 void init()
 {
-	// Set up the shaders
+	PROFILE_FUNCTION();
+	// the textures decode on the workers while the shaders compile and the
+	// meshes load, the last six are the skybox faces
+	DecodedImage images[] = {
+		{ "bricks.jpg" },
+		{ "container2.png" },
+		{ "container2_specular.png" },
+		{ "sor_hills/hills_dn.JPG" },
+		{ "bricks2_normalcopy.jpg" },
+		{ "heightmap.bmp" },
+		{ "spritesmoke.png" },
+		{ "ConcreteNew0012_2_S.jpg" },
+		{ "heightmap_cone.tga" },
+		{ "sor_hills/hills_lf.JPG" },
+		{ "sor_hills/hills_rt.JPG" },
+		{ "sor_hills/hills_up.JPG" },
+		{ "sor_hills/hills_dn.JPG" },
+		{ "sor_hills/hills_ft.JPG" },
+		{ "sor_hills/hills_bk.jpg" }
+	};
+	JobCounter decoded;
+	for (size_t i = 0; i < sizeof(images) / sizeof(images[0]); i++)
+		job_system.run(decode_image_job, &images[i], &decoded);
+
+	// Set up the shaders, they compile alongside the loading below
 	GLuint shaderProgramID = CompileShaders();
 	// load mesh into a vertex buffer array
 	gen_buffer_mesh();
-	vector<string> faces
-	{
-			"sor_hills\\hills_lf.JPG",
-			"sor_hills\\hills_rt.JPG",
-			"sor_hills\\hills_up.JPG",
-			"sor_hills\\hills_dn.JPG",
-			"sor_hills\\hills_ft.JPG",
-			"sor_hills\\hills_bk.JPG"
-	};
-	train_diffuse = loadTexture("bricks.jpg");
-	diffuseMap = loadTexture("container2.png");
-	specularMap = loadTexture("container2_specular.png");
-	brick_diff = loadTexture("sor_hills\\hills_dn.jpg");
-	brick_normal = loadTexture("bricks2_normalcopy.jpg");
-	brick_height = loadTexture("heightmap.bmp");
-	particle_sprite = loadTexture("spritesmoke.png");
-	concrete = loadTexture("ConcreteNew0012_2_S.jpg");
+
+	job_system.wait(&decoded);
+	train_diffuse = upload_texture(images[0]);
+	diffuseMap = upload_texture(images[1]);
+	specularMap = upload_texture(images[2]);
+	brick_diff = upload_texture(images[3]);
+	brick_normal = upload_texture(images[4]);
+	brick_height = upload_texture(images[5]);
+	particle_sprite = upload_texture(images[6]);
+	concrete = upload_texture(images[7]);
+	brick_cone = upload_texture(images[8]);
 
 
-	skybox = loadCubemap(faces);
+	skybox = upload_cubemap(&images[9]);
 	//root.createChild(left_child);
+	glEnable(GL_MULTISAMPLE);
+	init_scene_lights();
+	init_render_queue();
+	// the first frame draws with whatever has finished by now
+	poll_shaders();
+
+	// the first frame draws the starting state
+	publish_scene();
+	scene_buffer.take();
+}
 
+// Placeholder code for the keypress
+// maths_funcs micro benchmark, lives in maths_bench.cpp
+extern int run_maths_bench(int iterations);
+// job system micro benchmark, lives in jobs_bench.cpp
+extern int run_jobs_bench();
+// relaxed cone step map baker, lives in cone_map.cpp
+extern int run_cone_map_tool(const char* input, const char* output, float heightScale, int layers, int coneSteps);
+
+// Simulation thread of the headless pipeline. Waits for the renderer to take
+// each snapshot before publishing the next, so none are skipped.
+void headless_simulation(int steps) {
+	PROFILE_THREAD("simulation");
+	for (int i = 0; i < steps; i++) {
+		update_scene(1.0f / 60.0f);
+		while (scene_buffer.pending())
+			std::this_thread::yield();
+		publish_scene();
+	}
+}
 
+// Renders frames into an offscreen framebuffer with a fixed 60Hz time step
+// and prints how long each one took. cpu is the time to update and submit the
+// frame, gpu comes from timestamp queries around it and frame runs until
+// glFinish returns. llvmpipe rasterises when the frame is flushed, after its
+// timestamps are taken, so there frame minus cpu is the better GPU figure.
+// The first few frames compile shaders on first use and are not timed.
+// With a record path every GL call goes into a trace for gl_replay.
+// With a profile path the PROFILE_SCOPEs are saved as a Chrome trace at the end,
+// with a gpu_csv path the rolling GPU pass times are saved as CSV.
+// Pipelined, a second thread simulates frame N+1 while frame N is drawn;
+// it still publishes exactly one step per frame so runs stay reproducible.
+int run_headless(int frames, int warmup, const char* record, const char* profile, const char* gpu_csv) {
+	HeadlessContext context;
+	if (!context.create())
+		return 1;
+	if (record && !gl_capture_begin(record))
+		return 1;
+	init();
+	// timed frames draw everything
+	if (shader_cache.pending() > 0) {
+		shader_cache.wait_all(program_done);
+		shader_cache.print();
+	}
+	OffscreenTarget target;
+	if (!target.create(width, height))
+		return 1;
+	// the trace's first frame is the setup
+	gl_capture_frame();
+
+	std::thread sim;
+	if (pipelined)
+		sim = std::thread(headless_simulation, warmup + frames);
+
+	GLuint queries[2];
+	glGenQueries(2, queries);
+	double cpu_total = 0.0, gpu_total = 0.0, frame_total = 0.0, frame_max = 0.0;
+	FrameHistogram histogram;
+	// every thread's allocations, the simulation's and the workers' too
+	unsigned long long heap_total = 0;
+	int heap_frames = 0;
+	for (int f = -warmup; f < frames; f++) {
+		PROFILE_SCOPE("frame");
+		unsigned long long heap_start = heap_allocation_count();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		glQueryCounter(queries[0], GL_TIMESTAMP);
+		if (pipelined) {
+			PROFILE_SCOPE("wait for simulation");
+			while (!scene_buffer.take())
+				std::this_thread::yield();
+		}
+		else {
+			update_scene(1.0f / 60.0f);
+			publish_scene();
+			scene_buffer.take();
+		}
+		target.bind();
+		render_scene();
+		glQueryCounter(queries[1], GL_TIMESTAMP);
+		std::chrono::duration<double, std::milli> cpu = std::chrono::steady_clock::now() - start;
 
+		// waits for the frame, so frames never overlap on the GPU
+		{
+			PROFILE_SCOPE("glFinish");
+			glFinish();
+		}
+		std::chrono::duration<double, std::milli> frame = std::chrono::steady_clock::now() - start;
+		gl_capture_frame();
+		if (f < 0)
+			continue;
+		unsigned long long heap = heap_allocation_count() - heap_start;
+		heap_total += heap;
+		heap_frames += heap > 0;
+		GLuint64 begin_ns = 0, end_ns = 0;
+		glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &begin_ns);
+		glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &end_ns);
+		double gpu_ms = (end_ns - begin_ns) / 1.0e6;
+		printf("frame %4d  cpu %8.3f ms  gpu %8.3f ms  frame %8.3f ms\n", f, cpu.count(), gpu_ms, frame.count());
+		cpu_total += cpu.count();
+		gpu_total += gpu_ms;
+		frame_total += frame.count();
+		frame_max = fmax(frame_max, frame.count());
+		histogram.add(frame.count());
+	}
+	if (frames > 0) {
+		printf("%d frames at %dx%d  avg cpu %.3f ms  gpu %.3f ms  frame %.3f ms (max %.3f ms)\n",
+			frames, width, height, cpu_total / frames, gpu_total / frames, frame_total / frames, frame_max);
+		histogram.print("frame times");
+		frame_arenas.print();
+		stream_buffer.print();
+		if (clustered_lights)
+			light_clusters.print();
+		if (frame_deferred)
+			printf("g-buffer: %dx%d, %llu KB\n", gbuffer.width, gbuffer.height, (unsigned long long)gbuffer.bytes() / 1024);
+		if (cast_shadows)
+			shadow_cascades.print();
+		if (occlusion_culling)
+			occlusion.print();
+		if (use_lods)
+			lod_selector.print();
+		printf("heap: %llu allocations, %d of %d frames allocated\n", heap_total, heap_frames, frames);
+		gpu_profiler.collect_pending();
+		gpu_profiler.print();
+	}
+	if (sim.joinable())
+		sim.join();
+	glDeleteQueries(2, queries);
+	gl_capture_end();
+	if (profile && !profiler_write_trace(profile))
+		return 1;
+	if (gpu_csv && !gpu_profiler.write_csv(gpu_csv))
+		return 1;
+	return 0;
 }
 
-// Placeholder code for the keypress
 int main(int argc, char** argv) {
 
+	bool headless = false;
+	int frames = 100, warmup = 2, repeat = 1;
+	double fps = 60.0;
+	int workers = -1;
+	const char* record = NULL;
+	const char* replay = NULL;
+	const char* profile = NULL;
+	const char* gpu_csv = NULL;
+	const char* cone_input = NULL;
+	const char* cone_output = NULL;
+	PROFILE_THREAD("main");
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--bench-maths") == 0)
+			return run_maths_bench(2000);
+		else if (strcmp(argv[i], "--verify-baked") == 0)
+			return verify_baked_scene(value_ptr(pointLightPositions[0])) ? 0 : 1;
+		else if (strcmp(argv[i], "--verify-lods") == 0)
+			return verify_mesh_lods() ? 0 : 1;
+		else if (strcmp(argv[i], "--bench-jobs") == 0)
+			return run_jobs_bench();
+		else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+			workers = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--headless") == 0)
+			headless = true;
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+			warmup = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+			record = argv[++i];
+		else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+			replay = argv[++i];
+		else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+			repeat = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+			profile = argv[++i];
+		else if (strcmp(argv[i], "--gpu-csv") == 0 && i + 1 < argc)
+			gpu_csv = argv[++i];
+		else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+			fps = atof(argv[++i]);
+		else if (strcmp(argv[i], "--pipeline") == 0)
+			pipelined = true;
+		else if (strcmp(argv[i], "--orphan-streams") == 0)
+			persistent_streams = false;
+		else if (strcmp(argv[i], "--no-shader-cache") == 0)
+			use_shader_cache = false;
+		else if (strcmp(argv[i], "--watch-shaders") == 0)
+			watch_shaders = true;
+		else if (strcmp(argv[i], "--lamps") == 0 && i + 1 < argc)
+			extra_lamps = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--no-clusters") == 0)
+			clustered_lights = false;
+		else if (strcmp(argv[i], "--deferred") == 0)
+			deferred_shading = true;
+		else if (strcmp(argv[i], "--no-shadows") == 0)
+			cast_shadows = false;
+		else if (strcmp(argv[i], "--depth-prepass") == 0)
+			depth_prepass = true;
+		else if (strcmp(argv[i], "--occlusion") == 0)
+			occlusion_culling = true;
+		else if (strcmp(argv[i], "--no-lods") == 0)
+			use_lods = false;
+		else if (strcmp(argv[i], "--cone-steps") == 0)
+			cone_parallax = true;
+		else if (strcmp(argv[i], "--bake-cone-map") == 0 && i + 2 < argc) {
+			cone_input = argv[++i];
+			cone_output = argv[++i];
+		}
+		else if (strcmp(argv[i], "--shadow-intervals") == 0 && i + 1 < argc) {
+			// comma separated, nearest cascade first; the last one given
+			// also goes for the cascades after it
+			const char* list = argv[++i];
+			for (int c = 0; c < SHADOW_CASCADES; c++) {
+				char* end;
+				long interval = strtol(list, &end, 10);
+				shadow_cascades.intervals[c] = interval > 0 ? (int)interval : 1;
+				if (*end == ',')
+					list = end + 1;
+			}
+		}
+		else if (strcmp(argv[i], "--assets") == 0 && i + 1 < argc && !platform_chdir(argv[++i])) {
+			fprintf(stderr, "Error: no asset directory '%s'\n", argv[i]);
+			return 1;
+		}
+	}
+	if (replay)
+		return gl_replay(replay, repeat);
+	// one worker per spare core unless --workers says otherwise
+	job_system.start(workers);
+	if (cone_input)
+		return run_cone_map_tool(cone_input, cone_output, PARALLAX_HEIGHT_SCALE, PARALLAX_LAYERS, CONE_STEPS);
+	if (headless || record)
+		return run_headless(frames, warmup, record, profile, gpu_csv);
+	watch_shaders = true;
 
 	// Set up the window
 	glutInit(&argc, argv);
@@ -1416,6 +2178,16 @@ int main(int argc, char** argv) {
 	glutInitWindowSize(width, height);
 	glutCreateWindow("Hello Triangle");
 
+	// Frames are capped at --fps, 0 leaves pacing to the swap. Pipelined,
+	// the simulation thread sleeps between steps on its own.
+	if (pipelined) {
+		render_loop.set_frame_cap(fps);
+		game_loop.set_frame_cap(1.0 / game_loop.step_seconds());
+	}
+	else {
+		game_loop.set_frame_cap(fps);
+	}
+
 	// Tell glut where the display function is
 	glutDisplayFunc(display);
 	glutIdleFunc(updateScene);
@@ -1429,15 +2201,27 @@ int main(int argc, char** argv) {
 	// Set up your objects and shaders
 	init();
 	glutKeyboardFunc(&keyboard);
+	// Closing the window returns from the loop so the profile can be saved
+	glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_GLUTMAINLOOP_RETURNS);
+	std::thread sim;
+	if (pipelined) {
+		sim_running = true;
+		sim = std::thread(simulation_thread);
+	}
 	// Begin infinite event loop
 	glutMainLoop();
+	if (sim.joinable()) {
+		sim_running = false;
+		sim.join();
+	}
+	frame_times.print("frame times");
+	if (profile && !profiler_write_trace(profile))
+		return 1;
 	return 0;
 }
 
 
-unsigned int quadVAO = 0;
-unsigned int quadVBO;
-void renderQuad()
+void gen_quad_buffer()
 {
 	if (quadVAO == 0)
 	{
@@ -1524,7 +2308,5 @@ void renderQuad()
 		glEnableVertexAttribArray(4);
 		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)(11 * sizeof(float)));
 	}
-	glBindVertexArray(quadVAO);
-	glDrawArrays(GL_TRIANGLES, 0, 6);
 	glBindVertexArray(0);
 }
\ No newline at end of file
@@ -0,0 +1,219 @@
+// Micro benchmark of the maths_funcs kernels against the original scalar code
+// and glm. Run with --bench-maths.
+#include "maths_funcs.h"
+#include "simd_f4.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+typedef std::chrono::high_resolution_clock bench_clock;
+
+// keeps results alive so the optimiser can't drop the loops
+static volatile float bench_sink;
+
+static float rand_float (float lo, float hi) {
+	return lo + (hi - lo) * (float)rand () / (float)RAND_MAX;
+}
+
+static mat4 random_affine () {
+	mat4 m = identity_mat4 ();
+	m = scale (m, vec3 (rand_float (0.5f, 2.0f), rand_float (0.5f, 2.0f), rand_float (0.5f, 2.0f)));
+	m = rotate_x_deg (m, rand_float (0.0f, 360.0f));
+	m = rotate_y_deg (m, rand_float (0.0f, 360.0f));
+	m = translate (m, vec3 (rand_float (-10.0f, 10.0f), rand_float (-10.0f, 10.0f), rand_float (-10.0f, 10.0f)));
+	return m;
+}
+
+static versor random_versor () {
+	vec3 axis = normalise (vec3 (rand_float (-1.0f, 1.0f), rand_float (-1.0f, 1.0f), rand_float (-1.0f, 1.0f) + 0.01f));
+	return quat_from_axis_deg (rand_float (0.0f, 360.0f), axis.v[0], axis.v[1], axis.v[2]);
+}
+
+static double elapsed_ns (bench_clock::time_point start, size_t ops) {
+	std::chrono::duration<double, std::nano> d = bench_clock::now () - start;
+	return d.count () / (double)ops;
+}
+
+static float max_diff (const float* a, const float* b, int n) {
+	float d = 0.0f;
+	for (int i = 0; i < n; i++) {
+		d = fmaxf (d, fabsf (a[i] - b[i]));
+	}
+	return d;
+}
+
+static void report (const char* name, double scalar, double simd, double glm_ns, float err) {
+	printf ("%-18s scalar %7.2f ns  simd %7.2f ns  glm %7.2f ns  x%.2f  max err %g\n",
+		name, scalar, simd, glm_ns, scalar / simd, err);
+}
+
+int run_maths_bench (int iterations) {
+	const size_t n = 1024;
+	srand (1234);
+#if defined(MATHS_SSE)
+	printf ("maths_funcs backend: SSE\n");
+#elif defined(MATHS_NEON)
+	printf ("maths_funcs backend: NEON\n");
+#else
+	printf ("maths_funcs backend: scalar\n");
+#endif
+	printf ("%d iterations over %u elements\n", iterations, (unsigned)n);
+
+	std::vector<mat4> a (n), b (n), out (n), ref (n);
+	std::vector<glm::mat4> ga (n), gb (n), gout (n);
+	std::vector<vec4> v (n), vout (n), vref (n);
+	std::vector<glm::vec4> gv (n), gvout (n);
+	std::vector<vec3> p (n), pout (n);
+	std::vector<versor> qa (n), qb (n), qout (n), qref (n);
+	std::vector<glm::quat> gqa (n), gqb (n), gqout (n);
+	for (size_t i = 0; i < n; i++) {
+		a[i] = random_affine ();
+		b[i] = random_affine ();
+		ga[i] = glm::make_mat4 (a[i].m);
+		gb[i] = glm::make_mat4 (b[i].m);
+		v[i] = vec4 (rand_float (-5.0f, 5.0f), rand_float (-5.0f, 5.0f), rand_float (-5.0f, 5.0f), 1.0f);
+		gv[i] = glm::vec4 (v[i].v[0], v[i].v[1], v[i].v[2], v[i].v[3]);
+		p[i] = vec3 (v[i]);
+		qa[i] = random_versor ();
+		qb[i] = random_versor ();
+		gqa[i] = glm::quat (qa[i].q[0], qa[i].q[1], qa[i].q[2], qa[i].q[3]);
+		gqb[i] = glm::quat (qb[i].q[0], qb[i].q[1], qb[i].q[2], qb[i].q[3]);
+	}
+	const size_t ops = n * (size_t)iterations;
+	float sink = 0.0f;
+	bench_clock::time_point t;
+	double scalar_ns, simd_ns, glm_ns;
+	float err;
+
+	// mat4 * mat4
+	t = bench_clock::now ();
+	for (int it = 0; it < iterations; it++)
+		for (size_t i = 0; i < n; i++)
+			ref[i] = mul_scalar (a[i], b[i]);
+	scalar_ns = elapsed_ns (t, ops);
+	t = bench_clock::now ();
+	for (int it = 0; it < iterations; it++)
+		for (size_t i = 0; i < n; i++)
+			out[i] = a[i] * b[i];
+	simd_ns = elapsed_ns (t, ops);
+	t = bench_clock::now ();
+	for (int it = 0; it < iterations; it++)
+		for (size_t i = 0; i < n; i++)
+			gout[i] = ga[i] * gb[i];
+	glm_ns = elapsed_ns (t, ops);
+	err = 0.0f;
+	for (size_t i = 0; i < n; i++) {
+		err = fmaxf (err, max_diff (out[i].m, ref[i].m, 16));
+		sink += out[i].m[5] + gout[i][1][1];
+	}
+	report ("mat4 * mat4", scalar_ns, simd_ns, glm_ns, err);
+
+	// mat4 * vec4, which is inline and would otherwise be worked out once and
+	// not per iteration: the inputs are read through volatile pointers
+	const vec4* volatile v_in = &v[0];
+	const glm::vec4* volatile gv_in = &gv[0];
+	t = bench_clock::now ();
+	for (int it = 0; it < iterations; it++) {
+		const vec4* in = v_in;
+		for (size_t i = 0; i < n; i++)
+			vref[i] = mul_scalar (a[i], in[i]);
+	}
+	scalar_ns = elapsed_ns (t, ops);
+	t = bench_clock::now ();
+	for (int it = 0; it < iterations; it++) {
+		const vec4* in = v_in;
+		for (size_t i = 0; i < n; i++)
+			vout[i] = a[i] * in[i];
+	}
+	simd_ns = elapsed_ns (t, ops);
+	t = bench_clock::now ();
+	for (int it = 0; it < iterations; it++) {
+		const glm::vec4* in = gv_in;
+		for (size_t i = 0; i < n; i++)
+			gvout[i] = ga[i] * in[i];
+	}
+	glm_ns = elapsed_ns (t, ops);
+	err = 0.0f;
+	for (size_t i = 0; i < n; i++) {
+		err = fmaxf (err, max_diff (vout[i].v, vref[i].v, 4));
+		sink += vout[i].v[0] + gvout[i].x;
+	}
+	report ("mat4 * vec4", scalar_ns, simd_ns, glm_ns, err);
+
+	// one matrix over an array of points, the batch api against a loop of the scalar code
+	t = bench_clock::now ();
+	for (int it = 0; it < iterations; it++)
+		for (size_t i = 0; i < n; i++)
+			vref[i] = mul_scalar (a[0], vec4 (p[i], 1.0f));
+	scalar_ns = elapsed_ns (t, ops);
+	t = bench_clock::now ();
+	for (int it = 0; it < iterations; it++)
+		transform_points (a[0], &p[0], &pout[0], n);
+	simd_ns = elapsed_ns (t, ops);
+	t = bench_clock::now ();
+	for (int it = 0; it < iterations; it++)
+		for (size_t i = 0; i < n; i++)
+			gvout[i] = ga[0] * glm::vec4 (p[i].v[0], p[i].v[1], p[i].v[2], 1.0f);
+	glm_ns = elapsed_ns (t, ops);
+	err = 0.0f;
+	for (size_t i = 0; i < n; i++) {
+		err = fmaxf (err, max_diff (pout[i].v, vref[i].v, 3));
+		sink += pout[i].v[1] + gvout[i].y;
+	}
+	report ("transform_points", scalar_ns, simd_ns, glm_ns, err);
+
+	// inverse: general scalar inverse against the affine kernel and glm's affineInverse
+	t = bench_clock::now ();
+	for (int it = 0; it < iterations; it++)
+		for (size_t i = 0; i < n; i++)
+			ref[i] = inverse (a[i]);
+	scalar_ns = elapsed_ns (t, ops);
+	t = bench_clock::now ();
+	for (int it = 0; it < iterations; it++)
+		for (size_t i = 0; i < n; i++)
+			out[i] = affine_inverse (a[i]);
+	simd_ns = elapsed_ns (t, ops);
+	t = bench_clock::now ();
+	for (int it = 0; it < iterations; it++)
+		for (size_t i = 0; i < n; i++)
+			gout[i] = glm::affineInverse (ga[i]);
+	glm_ns = elapsed_ns (t, ops);
+	err = 0.0f;
+	for (size_t i = 0; i < n; i++) {
+		err = fmaxf (err, max_diff (out[i].m, ref[i].m, 16));
+		sink += out[i].m[12] + gout[i][3][0];
+	}
+	report ("inverse", scalar_ns, simd_ns, glm_ns, err);
+
+	// quaternion product, maths_funcs renormalises so glm's result is normalised too
+	t = bench_clock::now ();
+	for (int it = 0; it < iterations; it++)
+		for (size_t i = 0; i < n; i++)
+			qref[i] = mul_scalar (qa[i], qb[i]);
+	scalar_ns = elapsed_ns (t, ops);
+	t = bench_clock::now ();
+	for (int it = 0; it < iterations; it++)
+		mul_versors (&qa[0], &qb[0], &qout[0], n);
+	simd_ns = elapsed_ns (t, ops);
+	t = bench_clock::now ();
+	for (int it = 0; it < iterations; it++)
+		for (size_t i = 0; i < n; i++)
+			gqout[i] = glm::normalize (gqa[i] * gqb[i]);
+	glm_ns = elapsed_ns (t, ops);
+	err = 0.0f;
+	for (size_t i = 0; i < n; i++) {
+		err = fmaxf (err, max_diff (qout[i].q, qref[i].q, 4));
+		sink += qout[i].q[0] + gqout[i].w;
+	}
+	report ("versor * versor", scalar_ns, simd_ns, glm_ns, err);
+
+	bench_sink = sink;
+	return 0;
+}
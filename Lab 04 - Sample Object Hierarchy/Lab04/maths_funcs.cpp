@@ -1,100 +1,54 @@
 #include "maths_funcs.h"
+#include "simd_f4.h"
 #include <stdio.h>
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <string.h>
 
-/*-----------------------------------CONSTRUCTORS-------------------------------------*/
+/*--------------------------------------KERNELS---------------------------------------*/
+// all kernels read their inputs before writing, so out may alias an input
 
-vec2::vec2 () {}
-
-vec2::vec2 (float x, float y) {
-	v[0] = x;
-	v[1] = y;
-}
-
-vec3::vec3 () {}
-
-vec3::vec3 (float x, float y, float z) {
-	v[0] = x;
-	v[1] = y;
-	v[2] = z;
-}
-
-vec3::vec3 (const vec2& vv, float z) {
-	v[0] = vv.v[0];
-	v[1] = vv.v[1];
-	v[2] = z;
-}
-
-vec3::vec3 (const vec4& vv) {
-	v[0] = vv.v[0];
-	v[1] = vv.v[1];
-	v[2] = vv.v[2];
-}
-
-vec4::vec4 () {}
-
-vec4::vec4 (float x, float y, float z, float w) {
-	v[0] = x;
-	v[1] = y;
-	v[2] = z;
-	v[3] = w;
+// out = a * b, column major
+SIMD_INLINE void mat4_mul_kernel (const float* a, const float* b, float* out) {
+	f4 c0 = f4_load (a);
+	f4 c1 = f4_load (a + 4);
+	f4 c2 = f4_load (a + 8);
+	f4 c3 = f4_load (a + 12);
+	for (int col = 0; col < 4; col++) {
+		const float* bc = b + col * 4;
+		f4 r = f4_mul (c0, f4_splat (bc[0]));
+		r = f4_madd (c1, f4_splat (bc[1]), r);
+		r = f4_madd (c2, f4_splat (bc[2]), r);
+		r = f4_madd (c3, f4_splat (bc[3]), r);
+		f4_store (out + col * 4, r);
+	}
 }
 
-vec4::vec4 (const vec2& vv, float z, float w) {
-	v[0] = vv.v[0];
-	v[1] = vv.v[1];
-	v[2] = z;
-	v[3] = w;
+SIMD_INLINE f4 mat4_vec4_kernel (const f4* cols, float x, float y, float z, float w) {
+	f4 r = f4_mul (cols[0], f4_splat (x));
+	r = f4_madd (cols[1], f4_splat (y), r);
+	r = f4_madd (cols[2], f4_splat (z), r);
+	return f4_madd (cols[3], f4_splat (w), r);
 }
 
-vec4::vec4 (const vec3& vv, float w) {
-	v[0] = vv.v[0];
-	v[1] = vv.v[1];
-	v[2] = vv.v[2];
-	v[3] = w;
+// Hamilton product q * r, both stored w, x, y, z
+SIMD_INLINE f4 versor_mul_kernel (const float* q, const float* r) {
+	f4 b = f4_load (r);
+	f4 res = f4_mul (f4_splat (q[0]), b);
+	res = f4_madd (f4_splat (q[1]), f4_mul (f4_yxwz (b), f4_set (-1.0f, 1.0f, -1.0f, 1.0f)), res);
+	res = f4_madd (f4_splat (q[2]), f4_mul (f4_zwxy (b), f4_set (-1.0f, 1.0f, 1.0f, -1.0f)), res);
+	res = f4_madd (f4_splat (q[3]), f4_mul (f4_wzyx (b), f4_set (-1.0f, -1.0f, 1.0f, 1.0f)), res);
+	return res;
 }
 
-mat3::mat3 () {}
-
-// note: entered in rows, but stored in columns
-mat3::mat3 (float a, float b, float c,
-						float d, float e, float f,
-						float g, float h, float i) {
-	m[0] = a;
-	m[1] = d;
-	m[2] = g;
-	m[3] = b;
-	m[4] = e;
-	m[5] = h;
-	m[6] = c;
-	m[7] = f;
-	m[8] = i;
-}
-
-mat4::mat4 () {}
-
-// note: entered in rows, but stored in columns
-mat4::mat4 (float a, float b, float c, float d,
-						float e, float f, float g, float h,
-						float i, float j, float k, float l,
-						float mm, float n, float o, float p) {
-	m[0] = a;
-	m[1] = e;
-	m[2] = i;
-	m[3] = mm;
-	m[4] = b;
-	m[5] = f;
-	m[6] = j;
-	m[7] = n;
-	m[8] = c;
-	m[9] = g;
-	m[10] = k;
-	m[11] = o;
-	m[12] = d;
-	m[13] = h;
-	m[14] = l;
-	m[15] = p;
+// only compute sqrt if the squared length is not already ~1
+SIMD_INLINE f4 versor_normalise_kernel (f4 q) {
+	float sum = f4_sum (f4_mul (q, q));
+	const float thresh = 0.0001f;
+	if (fabs (1.0f - sum) < thresh) {
+		return q;
+	}
+	return f4_mul (q, f4_splat (1.0f / sqrtf (sum)));
 }
 
 /*----------------------------------PRINT FUNCTIONS-----------------------------------*/
@@ -132,10 +86,6 @@ float length (const vec3& v) {
 	return sqrtf (v.v[0] * v.v[0] + v.v[1] * v.v[1] + v.v[2] * v.v[2]);
 }
 
-float length2 (const vec3& v) {
-	return v.v[0] * v.v[0] + v.v[1] * v.v[1] + v.v[2] * v.v[2];
-}
-
 vec3 normalise (const vec3& v) {
 	vec3 vb;
 	float l = length (v);
@@ -148,93 +98,6 @@ vec3 normalise (const vec3& v) {
 	return vb;
 }
 
-vec3 vec3::operator+ (const vec3& rhs) {
-	vec3 vc;
-	vc.v[0] = v[0] + rhs.v[0];
-	vc.v[1] = v[1] + rhs.v[1];
-	vc.v[2] = v[2] + rhs.v[2];
-	return vc;
-}
-
-vec3& vec3::operator+= (const vec3& rhs) {
-	v[0] += rhs.v[0];
-	v[1] += rhs.v[1];
-	v[2] += rhs.v[2];
-	return *this; // return self
-}
-
-vec3 vec3::operator- (const vec3& rhs) {
-	vec3 vc;
-	vc.v[0] = v[0] - rhs.v[0];
-	vc.v[1] = v[1] - rhs.v[1];
-	vc.v[2] = v[2] - rhs.v[2];
-	return vc;
-}
-
-vec3& vec3::operator-= (const vec3& rhs) {
-	v[0] -= rhs.v[0];
-	v[1] -= rhs.v[1];
-	v[2] -= rhs.v[2];
-	return *this;
-}
-
-vec3 vec3::operator+ (float rhs) {
-	vec3 vc;
-	vc.v[0] = v[0] + rhs;
-	vc.v[1] = v[1] + rhs;
-	vc.v[2] = v[2] + rhs;
-	return vc;
-}
-
-vec3 vec3::operator- (float rhs) {
-	vec3 vc;
-	vc.v[0] = v[0] - rhs;
-	vc.v[1] = v[1] - rhs;
-	vc.v[2] = v[2] - rhs;
-	return vc;
-}
-
-vec3 vec3::operator* (float rhs) {
-	vec3 vc;
-	vc.v[0] = v[0] * rhs;
-	vc.v[1] = v[1] * rhs;
-	vc.v[2] = v[2] * rhs;
-	return vc;
-}
-
-vec3 vec3::operator/ (float rhs) {
-	vec3 vc;
-	vc.v[0] = v[0] / rhs;
-	vc.v[1] = v[1] / rhs;
-	vc.v[2] = v[2] / rhs;
-	return vc;
-}
-
-vec3& vec3::operator*= (float rhs) {
-	v[0] = v[0] * rhs;
-	v[1] = v[1] * rhs;
-	v[2] = v[2] * rhs;
-	return *this;
-}
-
-vec3& vec3::operator= (const vec3& rhs) {
-	v[0] = rhs.v[0];
-	v[1] = rhs.v[1];
-	v[2] = rhs.v[2];
-	return *this;
-}
-
-float dot (const vec3& a, const vec3& b) {
-	return a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2];
-}
-
-vec3 cross (const vec3& a, const vec3& b) {
-	float x = a.v[1] * b.v[2] - a.v[2] * b.v[1];
-	float y = a.v[2] * b.v[0] - a.v[0] * b.v[2];
-	float z = a.v[0] * b.v[1] - a.v[1] * b.v[0];
-	return vec3 (x, y, z);
-}
-
 float get_squared_dist (vec3 from, vec3 to) {
 	float x = (to.v[0] - from.v[0]) * (to.v[0] - from.v[0]);
 	float y = (to.v[1] - from.v[1]) * (to.v[1] - from.v[1]);
@@ -257,40 +120,6 @@ vec3 heading_to_direction (float degrees) {
 
 /*---------------------------------MATRIX FUNCTIONS-----------------------------------*/
 
-mat3 zero_mat3 () {
-	return mat3 (
-	0.0f, 0.0f, 0.0f,
-	0.0f, 0.0f, 0.0f,
-	0.0f, 0.0f, 0.0f
-	);
-}
-
-mat3 identity_mat3 () {
-	return mat3 (
-	1.0f, 0.0f, 0.0f,
-	0.0f, 1.0f, 0.0f,
-	0.0f, 0.0f, 1.0f
-	);
-}
-
-mat4 zero_mat4 () {
-	return mat4 (
-	0.0f, 0.0f, 0.0f, 0.0f,
-	0.0f, 0.0f, 0.0f, 0.0f,
-	0.0f, 0.0f, 0.0f, 0.0f,
-	0.0f, 0.0f, 0.0f, 0.0f
-	);
-}
-
-mat4 identity_mat4 () {
-	return mat4 (
-	1.0f, 0.0f, 0.0f, 0.0f,
-	0.0f, 1.0f, 0.0f, 0.0f,
-	0.0f, 0.0f, 1.0f, 0.0f,
-	0.0f, 0.0f, 0.0f, 1.0f
-	);
-}
-
 /* mat4 array layout
 0 4 8  12
 1 5 9  13
@@ -298,7 +127,15 @@ mat4 identity_mat4 () {
 3 7 11 15
 */
 
-vec4 mat4::operator* (const vec4& rhs) {
+// run-time products behind operator*, see maths_funcs.h
+mat4 mul_runtime (const mat4& a, const mat4& rhs) {
+	mat4 r;
+	mat4_mul_kernel (a.m, rhs.m, r.m);
+	return r;
+}
+
+vec4 mul_scalar (const mat4& mm, const vec4& rhs) {
+	const float* m = mm.m;
 	float x = m[0] * rhs.v[0] + m[4] * rhs.v[1] + m[8] * rhs.v[2] + m[12] * rhs.v[3]; // 0x + 4y + 8z + 12w
 	float y = m[1] * rhs.v[0] + m[5] * rhs.v[1] + m[9] * rhs.v[2] + m[13] * rhs.v[3]; // 1x + 5y + 9z + 13w
 	float z = m[2] * rhs.v[0] + m[6] * rhs.v[1] + m[10] * rhs.v[2] + m[14] * rhs.v[3]; // 2x + 6y + 10z + 14w
@@ -321,7 +158,8 @@ mat4 mat4::operator* (const mat4& rhs) {
 	}
 	return r;
 }*/
-mat4 mat4::operator* (const mat4& rhs) {
+mat4 mul_scalar (const mat4& a, const mat4& rhs) {
+	const float* m = a.m;
 	mat4 r = zero_mat4 ();
 	int r_index = 0;
 	for (int col = 0; col < 4; col++) {
@@ -337,13 +175,6 @@ mat4 mat4::operator* (const mat4& rhs) {
 	return r;
 }
 
-mat4& mat4::operator= (const mat4& rhs) {
-	for (int i = 0; i < 16; i++) {
-		m[i] = rhs.m[i];
-	}
-	return *this;
-}
-
 // returns a scalar value with the determinant for a 4x4 matrix
 // see http://www.euclideanspace.com/maths/algebra/matrix/functions/determinant/fourD/index.htm
 float determinant (const mat4& mm) {
@@ -403,70 +234,39 @@ mat4 inverse (const mat4& mm) {
 					);
 }
 
-// returns a 16-element array flipped on the main diagonal
-mat4 transpose (const mat4& mm) {
-	return mat4 (
-		mm.m[0], mm.m[1], mm.m[2], mm.m[3],
-		mm.m[4], mm.m[5], mm.m[6], mm.m[7],
-		mm.m[8], mm.m[9], mm.m[10], mm.m[11],
-		mm.m[12], mm.m[13], mm.m[14], mm.m[15]
-	);
-}
-
 /*--------------------------------AFFINE MATRIX FUNCTIONS-----------------------------*/
 
-// translate a 4d matrix with xyz array
-mat4 translate (const mat4& m, const vec3& v) {
-	mat4 m_t = identity_mat4 ();
-	m_t.m[12] = v.v[0];
-	m_t.m[13] = v.v[1];
-	m_t.m[14] = v.v[2];
-	return m_t * m;
-}
-
-// rotate around x axis by an angle in degrees
-mat4 rotate_x_deg (const mat4& m, float deg) {
-	// convert to radians
-	float rad = deg * (float)ONE_DEG_IN_RAD;
-	mat4 m_r = identity_mat4 ();
-	m_r.m[5] = cosf(rad);
-	m_r.m[9] = -sinf(rad);
-	m_r.m[6] = sinf(rad);
-	m_r.m[10] = cosf(rad);
-	return m_r * m;
-}
-
-// rotate around y axis by an angle in degrees
-mat4 rotate_y_deg (const mat4& m, float deg) {
-	// convert to radians
-	float rad = deg * (float)ONE_DEG_IN_RAD;
-	mat4 m_r = identity_mat4 ();
-	m_r.m[0] = cosf(rad);
-	m_r.m[8] = sinf(rad);
-	m_r.m[2] = -sinf(rad);
-	m_r.m[10] = cosf(rad);
-	return m_r * m;
-}
-
-// rotate around z axis by an angle in degrees
-mat4 rotate_z_deg (const mat4& m, float deg) {
-	// convert to radians
-	float rad = deg * (float)ONE_DEG_IN_RAD;
-	mat4 m_r = identity_mat4 ();
-	m_r.m[0] = cosf(rad);
-	m_r.m[4] = -sinf(rad);
-	m_r.m[1] = sinf(rad);
-	m_r.m[5] = cosf(rad);
-	return m_r * m;
-}
-
-// scale a matrix by [x, y, z]
-mat4 scale (const mat4& m, const vec3& v) {
-	mat4 a = identity_mat4 ();
-	a.m[0] = v.v[0];
-	a.m[5] = v.v[1];
-	a.m[10] = v.v[2];
-	return a * m;
+// inverts the upper 3x3 with cross products of its columns, then the
+// translation is moved back through it. bottom row must be 0 0 0 1.
+mat4 affine_inverse (const mat4& mm) {
+	f4 a = f4_set (mm.m[0], mm.m[1], mm.m[2], 0.0f);
+	f4 b = f4_set (mm.m[4], mm.m[5], mm.m[6], 0.0f);
+	f4 c = f4_set (mm.m[8], mm.m[9], mm.m[10], 0.0f);
+	f4 r0 = f4_cross (b, c);
+	f4 r1 = f4_cross (c, a);
+	f4 r2 = f4_cross (a, b);
+	float det = f4_sum (f4_mul (a, r0));
+	if (0.0f == det) {
+		printf ("WARNING. matrix has no determinant. can not invert");
+		return mm;
+	}
+	f4 inv_det = f4_splat (1.0f / det);
+	r0 = f4_mul (r0, inv_det);
+	r1 = f4_mul (r1, inv_det);
+	r2 = f4_mul (r2, inv_det);
+	// rows to columns, the zero row becomes the w of each column
+	f4 r3 = f4_splat (0.0f);
+	f4_transpose (r0, r1, r2, r3);
+	f4 t = f4_mul (r0, f4_splat (mm.m[12]));
+	t = f4_madd (r1, f4_splat (mm.m[13]), t);
+	t = f4_madd (r2, f4_splat (mm.m[14]), t);
+
+	mat4 result;
+	f4_store (result.m, r0);
+	f4_store (result.m + 4, r1);
+	f4_store (result.m + 8, r2);
+	f4_store (result.m + 12, f4_sub (f4_set (0.0f, 0.0f, 0.0f, 1.0f), t));
+	return result;
 }
 
 /*------------------------------3D SCENE MATRIX FUNCTIONS-----------------------------*/
@@ -534,31 +334,18 @@ mat4 perspective (float fovy, float aspect, float near, float far) {
 
 
 /*------------------------------HAMILTON IN DA HOUSE!-----------------------------*/
-versor::versor () { }
-
-versor versor::operator/ (float rhs) {
-	versor result;
-	result.q[0] = q[0] / rhs;
-	result.q[1] = q[1] / rhs;
-	result.q[2] = q[2] / rhs;
-	result.q[3] = q[3] / rhs;
-	return result;
+void print (const versor& q) {
+	printf ("[%.2f ,%.2f, %.2f, %.2f]\n", q.q[0], q.q[1], q.q[2], q.q[3]);
 }
 
-versor versor::operator* (float rhs) {
+versor mul_runtime (const versor& q, const versor& rhs) {
 	versor result;
-	result.q[0] = q[0] * rhs;
-	result.q[1] = q[1] * rhs;
-	result.q[2] = q[2] * rhs;
-	result.q[3] = q[3] * rhs;
+	f4_store (result.q, versor_normalise_kernel (versor_mul_kernel (q.q, rhs.q)));
 	return result;
 }
 
-void print (const versor& q) {
-	printf ("[%.2f ,%.2f, %.2f, %.2f]\n", q.q[0], q.q[1], q.q[2], q.q[3]);
-}
-
-versor versor::operator* (const versor& rhs) {
+versor mul_scalar (const versor& qq, const versor& rhs) {
+	const float* q = qq.q;
 	versor result;
 	result.q[0] = rhs.q[0] * q[0] - rhs.q[1] * q[1] - rhs.q[2] * q[2] - rhs.q[3] * q[3];
 	result.q[1] = rhs.q[0] * q[1] + rhs.q[1] * q[0] - rhs.q[2] * q[3] + rhs.q[3] * q[2];
@@ -568,54 +355,6 @@ versor versor::operator* (const versor& rhs) {
 	return normalise (result);
 }
 
-versor versor::operator+ (const versor& rhs) {
-	versor result;
-	result.q[0] = rhs.q[0] + q[0];
-	result.q[1] = rhs.q[1] + q[1];
-	result.q[2] = rhs.q[2] + q[2];
-	result.q[3] = rhs.q[3] + q[3];
-	// re-normalise in case of mangling
-	return normalise (result);
-}
-
-versor quat_from_axis_rad (float radians, float x, float y, float z) {
-	versor result;
-	result.q[0] = cosf(radians / 2.0f);
-	result.q[1] = sinf(radians / 2.0f) * x;
-	result.q[2] = sinf(radians / 2.0f) * y;
-	result.q[3] = sinf(radians / 2.0f) * z;
-	return result;
-}
-
-versor quat_from_axis_deg (float degrees, float x, float y, float z) {
-	return quat_from_axis_rad ((float)ONE_DEG_IN_RAD * degrees, x, y, z);
-}
-
-mat4 quat_to_mat4 (const versor& q) {
-	float w = q.q[0];
-	float x = q.q[1];
-	float y = q.q[2];
-	float z = q.q[3];
-	return mat4 (
-		1.0f - 2.0f * y * y - 2.0f * z * z,
-		2.0f * x * y - 2.0f * w * z,
-		2.0f * x * z + 2.0f * w * y,
-		0.0f,
-		2.0f * x * y + 2.0f * w * z,
-		1.0f - 2.0f * x * x - 2.0f * z * z,
-		2.0f * y * z - 2.0f * w * x,
-		0.0f,
-		2.0f * x * z - 2.0f * w * y,
-		2.0f * y * z + 2.0f * w * x,
-		1.0f - 2.0f * x * x - 2.0f * y * y,
-		0.0f,
-		0.0f,
-		0.0f,
-		0.0f,
-		1.0f
-	);
-}
-
 versor normalise (versor& q) {
 	// norm(q) = q / magnitude (q)
 	// magnitude (q) = sqrt (w*w + x*x...)
@@ -630,10 +369,6 @@ versor normalise (versor& q) {
 	return q / mag;
 }
 
-float dot (const versor& q, const versor& r) {
-	return q.q[0] * r.q[0] + q.q[1] * r.q[1] + q.q[2] * r.q[2] + q.q[3] * r.q[3];
-}
-
 versor slerp (versor& q, versor& r, float t) {
 	// angle between q0-q1
 	float cos_half_theta = dot (q, r);
@@ -670,3 +405,45 @@ versor slerp (versor& q, versor& r, float t) {
 	}
 	return result;
 }
+
+
+/*-----------------------------------BATCH FUNCTIONS----------------------------------*/
+
+// points get w = 1, there is no perspective divide
+void transform_points (const mat4& m, const vec3* in, vec3* out, size_t count) {
+	f4 cols[4] = { f4_load (m.m), f4_load (m.m + 4), f4_load (m.m + 8), f4_load (m.m + 12) };
+	for (size_t i = 0; i < count; i++) {
+		alignas(16) float r[4];
+		f4_store (r, mat4_vec4_kernel (cols, in[i].v[0], in[i].v[1], in[i].v[2], 1.0f));
+		out[i].v[0] = r[0];
+		out[i].v[1] = r[1];
+		out[i].v[2] = r[2];
+	}
+}
+
+void transform_vec4s (const mat4& m, const vec4* in, vec4* out, size_t count) {
+	f4 cols[4] = { f4_load (m.m), f4_load (m.m + 4), f4_load (m.m + 8), f4_load (m.m + 12) };
+	for (size_t i = 0; i < count; i++) {
+		const float* v = in[i].v;
+		f4_store (out[i].v, mat4_vec4_kernel (cols, v[0], v[1], v[2], v[3]));
+	}
+}
+
+// out[i] = parent * in[i], e.g. placing every child of one node
+void mul_mat4s (const mat4& parent, const mat4* in, mat4* out, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		mat4_mul_kernel (parent.m, in[i].m, out[i].m);
+	}
+}
+
+void mul_versors (const versor* a, const versor* b, versor* out, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		f4_store (out[i].q, versor_normalise_kernel (versor_mul_kernel (a[i].q, b[i].q)));
+	}
+}
+
+void normalise_versors (versor* q, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		f4_store (q[i].q, versor_normalise_kernel (f4_load (q[i].q)));
+	}
+}
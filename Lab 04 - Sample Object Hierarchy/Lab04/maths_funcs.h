@@ -6,68 +6,212 @@
 #define ONE_DEG_IN_RAD (2.0f * M_PI) / 360.0f // 0.017444444
 #define ONE_RAD_IN_DEG 57.2957795
 
-struct vec2;
-struct vec3;
-struct vec4;
-struct versor;
-
-struct vec2 {
-	vec2 ();
-	vec2 (float x, float y);
-	float v[2];
+#include <stddef.h>
+
+// constexpr code can't call sinf/sqrtf, so the constexpr functions switch to
+// the cx:: versions when they run at compile time. compilers that can't tell
+// (MSVC before 16.5) always take the constexpr path for those, but keep the
+// SIMD kernels behind operator* so run-time products stay fast.
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_is_constant_evaluated)
+#define MATHS_HAS_CONSTANT_EVALUATED
+#endif
+#endif
+#if !defined(MATHS_HAS_CONSTANT_EVALUATED) && defined(_MSC_VER) && _MSC_VER >= 1925
+#define MATHS_HAS_CONSTANT_EVALUATED
+#endif
+#ifdef MATHS_HAS_CONSTANT_EVALUATED
+#define MATHS_CONSTANT_EVALUATED() __builtin_is_constant_evaluated ()
+#define MATHS_PRODUCT(generic, runtime) (MATHS_CONSTANT_EVALUATED () ? (generic) : (runtime))
+#else
+#define MATHS_CONSTANT_EVALUATED() true
+#define MATHS_PRODUCT(generic, runtime) (runtime)
+#endif
+
+#include <math.h>
+
+// compile-time versions of the libm functions the transforms need
+namespace cx {
+	constexpr double pi = 3.14159265358979323846;
+
+	// reduce to [-pi, pi] so the series converges quickly
+	constexpr double wrap_angle (double x) {
+		long long k = (long long)(x / (2.0 * pi) + (x >= 0.0 ? 0.5 : -0.5));
+		return x - (double)k * 2.0 * pi;
+	}
+
+	constexpr double sin (double x) {
+		x = wrap_angle (x);
+		double term = x, sum = x;
+		for (int i = 1; i < 12; i++) {
+			term *= -x * x / ((2.0 * i) * (2.0 * i + 1.0));
+			sum += term;
+		}
+		return sum;
+	}
+
+	constexpr double cos (double x) {
+		x = wrap_angle (x);
+		double term = 1.0, sum = 1.0;
+		for (int i = 1; i < 12; i++) {
+			term *= -x * x / ((2.0 * i - 1.0) * (2.0 * i));
+			sum += term;
+		}
+		return sum;
+	}
+
+	// Newton's method, stops once the estimate stops changing
+	constexpr double sqrt (double x) {
+		if (x <= 0.0) {
+			return 0.0;
+		}
+		double r = x > 1.0 ? x : 1.0;
+		for (int i = 0; i < 100; i++) {
+			double next = 0.5 * (r + x / r);
+			if (next == r) {
+				break;
+			}
+			r = next;
+		}
+		return r;
+	}
+
+	constexpr float fabs (float x) {
+		return x < 0.0f ? -x : x;
+	}
+}
+
+constexpr float maths_sin (float rad) {
+	return MATHS_CONSTANT_EVALUATED () ? (float)cx::sin (rad) : sinf (rad);
+}
+
+constexpr float maths_cos (float rad) {
+	return MATHS_CONSTANT_EVALUATED () ? (float)cx::cos (rad) : cosf (rad);
+}
+
+constexpr float maths_sqrt (float x) {
+	return MATHS_CONSTANT_EVALUATED () ? (float)cx::sqrt (x) : sqrtf (x);
+}
+
+/*--------------------------------------VECTORS---------------------------------------*/
+// vec<N, T> holds N components in v[]. only the constructors differ between
+// sizes, the arithmetic is shared below.
+
+template <int N, typename T> struct vec {
+	constexpr vec () : v{} {}
+	T v[N];
 };
 
-struct vec3 {
-	vec3 ();
+template <typename T> struct vec<2, T> {
+	constexpr vec () : v{} {}
+	constexpr vec (T x, T y) : v{ x, y } {}
+	T v[2];
+};
+
+template <typename T> struct vec<3, T> {
+	constexpr vec () : v{} {}
 	//! create from 3 scalars
-	vec3 (float x, float y, float z);
+	constexpr vec (T x, T y, T z) : v{ x, y, z } {}
 	//! create from vec2 and a scalar
-	vec3 (const vec2& vv, float z);
+	constexpr vec (const vec<2, T>& vv, T z) : v{ vv.v[0], vv.v[1], z } {}
 	//! create from truncated vec4
-	vec3 (const vec4& vv);
-	//! add vector to vector
-	vec3 operator+ (const vec3& rhs);
-	//! add scalar to vector
-	vec3 operator+ (float rhs);
-	//! because user's expect this too
-	vec3& operator+= (const vec3& rhs);
-	//! subtract vector from vector
-	vec3 operator- (const vec3& rhs);
-	//! add vector to vector
-	vec3 operator- (float rhs);
-	//! because users expect this too
-	vec3& operator-= (const vec3& rhs);
-	//! multiply with scalar
-	vec3 operator* (float rhs);
-	//! because users expect this too
-	vec3& operator*= (float rhs);
-	//! divide vector by scalar
-	vec3 operator/ (float rhs);
-	//! because users expect this too
-	vec3& operator= (const vec3& rhs);
-	
-	//! internal data
-	float v[3];
+	constexpr vec (const vec<4, T>& vv);
+	T v[3];
+};
+
+// vec4, mat4 and versor are 16 byte aligned so a column or quaternion is one
+// SIMD register. The kernels still use unaligned loads, heap arrays of these
+// only get 8 byte alignment from 32 bit allocators before C++17.
+template <typename T> struct alignas(16) vec<4, T> {
+	constexpr vec () : v{} {}
+	constexpr vec (T x, T y, T z, T w) : v{ x, y, z, w } {}
+	constexpr vec (const vec<2, T>& vv, T z, T w) : v{ vv.v[0], vv.v[1], z, w } {}
+	constexpr vec (const vec<3, T>& vv, T w) : v{ vv.v[0], vv.v[1], vv.v[2], w } {}
+	T v[4];
 };
 
-struct vec4 {
-	vec4 ();
-	vec4 (float x, float y, float z, float w);
-	vec4 (const vec2& vv, float z, float w);
-	vec4 (const vec3& vv, float w);
-	float v[4];
+template <typename T>
+constexpr vec<3, T>::vec (const vec<4, T>& vv) : v{ vv.v[0], vv.v[1], vv.v[2] } {}
+
+// keeps the scalar argument of the operators out of template deduction
+template <typename T> struct maths_scalar { typedef T type; };
+
+//! add vector to vector
+template <int N, typename T>
+constexpr vec<N, T> operator+ (const vec<N, T>& a, const vec<N, T>& b) {
+	vec<N, T> r;
+	for (int i = 0; i < N; i++) r.v[i] = a.v[i] + b.v[i];
+	return r;
+}
+
+//! subtract vector from vector
+template <int N, typename T>
+constexpr vec<N, T> operator- (const vec<N, T>& a, const vec<N, T>& b) {
+	vec<N, T> r;
+	for (int i = 0; i < N; i++) r.v[i] = a.v[i] - b.v[i];
+	return r;
+}
+
+//! add scalar to vector
+template <int N, typename T>
+constexpr vec<N, T> operator+ (const vec<N, T>& a, typename maths_scalar<T>::type s) {
+	vec<N, T> r;
+	for (int i = 0; i < N; i++) r.v[i] = a.v[i] + s;
+	return r;
+}
+
+//! subtract scalar from vector
+template <int N, typename T>
+constexpr vec<N, T> operator- (const vec<N, T>& a, typename maths_scalar<T>::type s) {
+	vec<N, T> r;
+	for (int i = 0; i < N; i++) r.v[i] = a.v[i] - s;
+	return r;
+}
+
+//! multiply with scalar
+template <int N, typename T>
+constexpr vec<N, T> operator* (const vec<N, T>& a, typename maths_scalar<T>::type s) {
+	vec<N, T> r;
+	for (int i = 0; i < N; i++) r.v[i] = a.v[i] * s;
+	return r;
+}
+
+//! divide vector by scalar
+template <int N, typename T>
+constexpr vec<N, T> operator/ (const vec<N, T>& a, typename maths_scalar<T>::type s) {
+	vec<N, T> r;
+	for (int i = 0; i < N; i++) r.v[i] = a.v[i] / s;
+	return r;
+}
+
+//! because users expect these too
+template <int N, typename T>
+constexpr vec<N, T>& operator+= (vec<N, T>& a, const vec<N, T>& b) { return a = a + b; }
+template <int N, typename T>
+constexpr vec<N, T>& operator-= (vec<N, T>& a, const vec<N, T>& b) { return a = a - b; }
+template <int N, typename T>
+constexpr vec<N, T>& operator*= (vec<N, T>& a, typename maths_scalar<T>::type s) { return a = a * s; }
+
+/*--------------------------------------MATRICES--------------------------------------*/
+// mat<R, C, T> is stored column major in m[]. the square sizes used by the
+// shaders get constructors that take values row by row.
+
+template <int R, int C, typename T> struct mat {
+	constexpr mat () : m{} {}
+	T m[R * C];
 };
 
 /* stored like this:
 0 3 6
 1 4 7
 2 5 8 */
-struct mat3 {
-	mat3 ();
-	mat3 (float a, float b, float c,
-				float d, float e, float f,
-				float g, float h, float i);
-	float m[9];
+template <typename T> struct mat<3, 3, T> {
+	constexpr mat () : m{} {}
+	// note: entered in rows, but stored in columns
+	constexpr mat (T a, T b, T c,
+				T d, T e, T f,
+				T g, T h, T i) : m{ a, d, g, b, e, h, c, f, i } {}
+	T m[9];
 };
 
 /* stored like this:
@@ -75,27 +219,140 @@ struct mat3 {
 1 5 9  13
 2 6 10 14
 3 7 11 15*/
-struct mat4 {
-	mat4 ();
-	mat4 (float a, float b, float c, float d,
-				float e, float f, float g, float h,
-				float i, float j, float k, float l,
-				float mm, float n, float o, float p);
-	vec4 operator* (const vec4& rhs);
-	mat4 operator* (const mat4& rhs);
-	mat4& operator= (const mat4& rhs);
-	float m[16];
+template <typename T> struct alignas(16) mat<4, 4, T> {
+	constexpr mat () : m{} {}
+	// note: entered in rows, but stored in columns
+	constexpr mat (T a, T b, T c, T d,
+				T e, T f, T g, T h,
+				T i, T j, T k, T l,
+				T mm, T n, T o, T p) : m{ a, e, i, mm, b, f, j, n, c, g, k, o, d, h, l, p } {}
+	T m[16];
 };
 
-struct versor {
-	versor ();
-	versor operator/ (float rhs);
-	versor operator* (float rhs);
-	versor operator* (const versor& rhs);
-	versor operator+ (const versor& rhs);
-	float q[4];
+/*-------------------------------------QUATERNIONS------------------------------------*/
+// stored w, x, y, z
+
+template <typename T> struct alignas(16) qua {
+	constexpr qua () : q{} {}
+	constexpr qua (T w, T x, T y, T z) : q{ w, x, y, z } {}
+	T q[4];
 };
 
+typedef vec<2, float> vec2;
+typedef vec<3, float> vec3;
+typedef vec<4, float> vec4;
+typedef mat<3, 3, float> mat3;
+typedef mat<4, 4, float> mat4;
+typedef qua<float> versor;
+
+/*---------------------------------PRODUCTS AND DISPATCH------------------------------*/
+// the generic products are plain loops that work at compile time. at run time
+// mat4 * mat4 and the quaternion product go to the SIMD kernels in
+// maths_funcs.cpp through the non-template mul_runtime overloads. mat4 * vec4
+// stays on the inline loop, a call out to the kernel costs more than the
+// sixteen multiplies; transform_points() batches it instead.
+
+template <int R, int K, int C, typename T>
+constexpr mat<R, C, T> mul_generic (const mat<R, K, T>& a, const mat<K, C, T>& b) {
+	mat<R, C, T> r;
+	for (int col = 0; col < C; col++) {
+		for (int row = 0; row < R; row++) {
+			T sum = T (0);
+			for (int i = 0; i < K; i++) {
+				sum += a.m[row + i * R] * b.m[i + col * K];
+			}
+			r.m[row + col * R] = sum;
+		}
+	}
+	return r;
+}
+
+template <int R, int C, typename T>
+constexpr vec<R, T> mul_generic (const mat<R, C, T>& a, const vec<C, T>& b) {
+	vec<R, T> r;
+	for (int row = 0; row < R; row++) {
+		T sum = T (0);
+		for (int i = 0; i < C; i++) {
+			sum += a.m[row + i * R] * b.v[i];
+		}
+		r.v[row] = sum;
+	}
+	return r;
+}
+
+// Hamilton product
+template <typename T>
+constexpr qua<T> mul_generic (const qua<T>& q, const qua<T>& r) {
+	return qua<T> (
+		r.q[0] * q.q[0] - r.q[1] * q.q[1] - r.q[2] * q.q[2] - r.q[3] * q.q[3],
+		r.q[0] * q.q[1] + r.q[1] * q.q[0] - r.q[2] * q.q[3] + r.q[3] * q.q[2],
+		r.q[0] * q.q[2] + r.q[1] * q.q[3] + r.q[2] * q.q[0] - r.q[3] * q.q[1],
+		r.q[0] * q.q[3] - r.q[1] * q.q[2] + r.q[2] * q.q[1] + r.q[3] * q.q[0]);
+}
+
+// only compute sqrt if the squared length is not already ~1
+template <typename T>
+constexpr qua<T> normalise_generic (const qua<T>& q) {
+	T sum = q.q[0] * q.q[0] + q.q[1] * q.q[1] + q.q[2] * q.q[2] + q.q[3] * q.q[3];
+	if (cx::fabs ((float)(T (1) - sum)) < 0.0001f) {
+		return q;
+	}
+	T inv = T (1) / (T)cx::sqrt ((double)sum);
+	return qua<T> (q.q[0] * inv, q.q[1] * inv, q.q[2] * inv, q.q[3] * inv);
+}
+
+template <int R, int K, int C, typename T>
+constexpr mat<R, C, T> mul_runtime (const mat<R, K, T>& a, const mat<K, C, T>& b) { return mul_generic (a, b); }
+template <int R, int C, typename T>
+constexpr vec<R, T> mul_runtime (const mat<R, C, T>& a, const vec<C, T>& b) { return mul_generic (a, b); }
+template <typename T>
+constexpr qua<T> mul_runtime (const qua<T>& q, const qua<T>& r) { return normalise_generic (mul_generic (q, r)); }
+mat4 mul_runtime (const mat4& a, const mat4& b);
+versor mul_runtime (const versor& q, const versor& r);
+
+template <int R, int K, int C, typename T>
+constexpr mat<R, C, T> operator* (const mat<R, K, T>& a, const mat<K, C, T>& b) {
+	return MATHS_PRODUCT (mul_generic (a, b), mul_runtime (a, b));
+}
+
+template <int R, int C, typename T>
+constexpr vec<R, T> operator* (const mat<R, C, T>& a, const vec<C, T>& b) {
+	return MATHS_PRODUCT (mul_generic (a, b), mul_runtime (a, b));
+}
+
+// re-normalises in case of mangling
+template <typename T>
+constexpr qua<T> operator* (const qua<T>& q, const qua<T>& r) {
+	return MATHS_PRODUCT (normalise_generic (mul_generic (q, r)), mul_runtime (q, r));
+}
+
+template <typename T>
+constexpr qua<T> operator* (const qua<T>& q, typename maths_scalar<T>::type s) {
+	return qua<T> (q.q[0] * s, q.q[1] * s, q.q[2] * s, q.q[3] * s);
+}
+
+template <typename T>
+constexpr qua<T> operator/ (const qua<T>& q, typename maths_scalar<T>::type s) {
+	return qua<T> (q.q[0] / s, q.q[1] / s, q.q[2] / s, q.q[3] / s);
+}
+
+template <typename T>
+constexpr qua<T> operator+ (const qua<T>& q, const qua<T>& r) {
+	return normalise_generic (qua<T> (q.q[0] + r.q[0], q.q[1] + r.q[1], q.q[2] + r.q[2], q.q[3] + r.q[3]));
+}
+
+// element-wise compare with a tolerance, for checking baked data
+template <int R, int C, typename T>
+constexpr bool nearly_equal (const mat<R, C, T>& a, const mat<R, C, T>& b, T eps) {
+	for (int i = 0; i < R * C; i++) {
+		T d = a.m[i] - b.m[i];
+		if (d > eps || d < -eps) {
+			return false;
+		}
+	}
+	return true;
+}
+
 void print (const vec2& v);
 void print (const vec3& v);
 void print (const vec4& v);
@@ -103,38 +360,193 @@ void print (const mat3& m);
 void print (const mat4& m);
 // vector functions
 float length (const vec3& v);
-float length2 (const vec3& v);
 vec3 normalise (const vec3& v);
-float dot (const vec3& a, const vec3& b);
-vec3 cross (const vec3& a, const vec3& b);
 float get_squared_dist (vec3 from, vec3 to);
 float direction_to_heading (vec3 d);
 vec3 heading_to_direction (float degrees);
 // matrix functions
-mat3 zero_mat3 ();
-mat3 identity_mat3 ();
-mat4 zero_mat4 ();
-mat4 identity_mat4 ();
 float determinant (const mat4& mm);
 mat4 inverse (const mat4& mm);
-mat4 transpose (const mat4& mm);
-// affine functions
-mat4 translate (const mat4& m, const vec3& v);
-mat4 rotate_x_deg (const mat4& m, float deg);
-mat4 rotate_y_deg (const mat4& m, float deg);
-mat4 rotate_z_deg (const mat4& m, float deg);
-mat4 scale (const mat4& m, const vec3& v);
+// inverse of a rotation/scale + translation matrix, much cheaper than inverse
+mat4 affine_inverse (const mat4& mm);
 // camera functions
 mat4 look_at (const vec3& cam_pos, vec3 targ_pos, const vec3& up);
 mat4 perspective (float fovy, float aspect, float near, float far);
 // quaternion functions
-versor quat_from_axis_rad (float radians, float x, float y, float z);
-versor quat_from_axis_deg (float degrees, float x, float y, float z);
-mat4 quat_to_mat4 (const versor& q);
-float dot (const versor& q, const versor& r);
 versor slerp (const versor& q, const versor& r);
 // stupid overloading wouldn't let me use const
 versor normalise (versor& q);
 void print (const versor& q);
 versor slerp (versor& q, versor& r, float t);
+// batch functions, out may be the same array as in
+void transform_points (const mat4& m, const vec3* in, vec3* out, size_t count);
+void transform_vec4s (const mat4& m, const vec4* in, vec4* out, size_t count);
+void mul_mat4s (const mat4& parent, const mat4* in, mat4* out, size_t count);
+void mul_versors (const versor* a, const versor* b, versor* out, size_t count);
+void normalise_versors (versor* q, size_t count);
+// original scalar versions, kept as a reference for the SIMD kernels
+vec4 mul_scalar (const mat4& m, const vec4& v);
+mat4 mul_scalar (const mat4& a, const mat4& b);
+versor mul_scalar (const versor& q, const versor& r);
+
+/*------------------------------CONSTEXPR FUNCTIONS-----------------------------------*/
+// these work in constant expressions, so fixed transforms can be baked into
+// the binary. at run time they behave exactly like the old versions.
+
+constexpr float length2 (const vec3& v) {
+	return v.v[0] * v.v[0] + v.v[1] * v.v[1] + v.v[2] * v.v[2];
+}
+
+constexpr float dot (const vec3& a, const vec3& b) {
+	return a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2];
+}
+
+constexpr vec3 cross (const vec3& a, const vec3& b) {
+	return vec3 (
+		a.v[1] * b.v[2] - a.v[2] * b.v[1],
+		a.v[2] * b.v[0] - a.v[0] * b.v[2],
+		a.v[0] * b.v[1] - a.v[1] * b.v[0]);
+}
+
+constexpr mat3 zero_mat3 () {
+	return mat3 ();
+}
+
+constexpr mat3 identity_mat3 () {
+	return mat3 (
+	1.0f, 0.0f, 0.0f,
+	0.0f, 1.0f, 0.0f,
+	0.0f, 0.0f, 1.0f
+	);
+}
+
+constexpr mat4 zero_mat4 () {
+	return mat4 ();
+}
+
+constexpr mat4 identity_mat4 () {
+	return mat4 (
+	1.0f, 0.0f, 0.0f, 0.0f,
+	0.0f, 1.0f, 0.0f, 0.0f,
+	0.0f, 0.0f, 1.0f, 0.0f,
+	0.0f, 0.0f, 0.0f, 1.0f
+	);
+}
+
+// returns a 16-element array flipped on the main diagonal
+constexpr mat4 transpose (const mat4& mm) {
+	return mat4 (
+		mm.m[0], mm.m[1], mm.m[2], mm.m[3],
+		mm.m[4], mm.m[5], mm.m[6], mm.m[7],
+		mm.m[8], mm.m[9], mm.m[10], mm.m[11],
+		mm.m[12], mm.m[13], mm.m[14], mm.m[15]
+	);
+}
+
+// translate a 4d matrix with xyz array
+constexpr mat4 translate (const mat4& m, const vec3& v) {
+	mat4 m_t = identity_mat4 ();
+	m_t.m[12] = v.v[0];
+	m_t.m[13] = v.v[1];
+	m_t.m[14] = v.v[2];
+	return mul_generic (m_t, m);
+}
+
+// rotate around x axis by an angle in degrees
+constexpr mat4 rotate_x_deg (const mat4& m, float deg) {
+	float rad = deg * (float)(cx::pi / 180.0);
+	mat4 m_r = identity_mat4 ();
+	m_r.m[5] = maths_cos (rad);
+	m_r.m[9] = -maths_sin (rad);
+	m_r.m[6] = maths_sin (rad);
+	m_r.m[10] = maths_cos (rad);
+	return mul_generic (m_r, m);
+}
+
+// rotate around y axis by an angle in degrees
+constexpr mat4 rotate_y_deg (const mat4& m, float deg) {
+	float rad = deg * (float)(cx::pi / 180.0);
+	mat4 m_r = identity_mat4 ();
+	m_r.m[0] = maths_cos (rad);
+	m_r.m[8] = maths_sin (rad);
+	m_r.m[2] = -maths_sin (rad);
+	m_r.m[10] = maths_cos (rad);
+	return mul_generic (m_r, m);
+}
+
+// rotate around z axis by an angle in degrees
+constexpr mat4 rotate_z_deg (const mat4& m, float deg) {
+	float rad = deg * (float)(cx::pi / 180.0);
+	mat4 m_r = identity_mat4 ();
+	m_r.m[0] = maths_cos (rad);
+	m_r.m[4] = -maths_sin (rad);
+	m_r.m[1] = maths_sin (rad);
+	m_r.m[5] = maths_cos (rad);
+	return mul_generic (m_r, m);
+}
+
+// scale a matrix by [x, y, z]
+constexpr mat4 scale (const mat4& m, const vec3& v) {
+	mat4 a = identity_mat4 ();
+	a.m[0] = v.v[0];
+	a.m[5] = v.v[1];
+	a.m[10] = v.v[2];
+	return mul_generic (a, m);
+}
+
+constexpr versor quat_from_axis_rad (float radians, float x, float y, float z) {
+	return versor (
+		maths_cos (radians / 2.0f),
+		maths_sin (radians / 2.0f) * x,
+		maths_sin (radians / 2.0f) * y,
+		maths_sin (radians / 2.0f) * z);
+}
+
+constexpr versor quat_from_axis_deg (float degrees, float x, float y, float z) {
+	return quat_from_axis_rad ((float)(cx::pi / 180.0) * degrees, x, y, z);
+}
+
+constexpr float dot (const versor& q, const versor& r) {
+	return q.q[0] * r.q[0] + q.q[1] * r.q[1] + q.q[2] * r.q[2] + q.q[3] * r.q[3];
+}
+
+constexpr mat4 quat_to_mat4 (const versor& q) {
+	float w = q.q[0];
+	float x = q.q[1];
+	float y = q.q[2];
+	float z = q.q[3];
+	return mat4 (
+		1.0f - 2.0f * y * y - 2.0f * z * z,
+		2.0f * x * y - 2.0f * w * z,
+		2.0f * x * z + 2.0f * w * y,
+		0.0f,
+		2.0f * x * y + 2.0f * w * z,
+		1.0f - 2.0f * x * x - 2.0f * z * z,
+		2.0f * y * z - 2.0f * w * x,
+		0.0f,
+		2.0f * x * z - 2.0f * w * y,
+		2.0f * y * z + 2.0f * w * x,
+		1.0f - 2.0f * x * x - 2.0f * y * y,
+		0.0f,
+		0.0f,
+		0.0f,
+		0.0f,
+		1.0f
+	);
+}
+
+// fused translate * rotate * scale, builds the matrix directly instead of
+// multiplying three of them together
+constexpr mat4 trs (const vec3& t, const versor& r, const vec3& s) {
+	mat4 m = quat_to_mat4 (r);
+	for (int col = 0; col < 3; col++) {
+		for (int row = 0; row < 3; row++) {
+			m.m[col * 4 + row] *= s.v[col];
+		}
+	}
+	m.m[12] = t.v[0];
+	m.m[13] = t.v[1];
+	m.m[14] = t.v[2];
+	return m;
+}
 #endif
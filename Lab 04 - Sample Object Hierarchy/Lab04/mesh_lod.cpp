@@ -0,0 +1,559 @@
+// Mesh simplification and level of detail selection, see mesh_lod.h
+#include "mesh_lod.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <queue>
+#include <utility>
+
+#include "job_system.h"
+#include "profiler.h"
+
+// the share of the mesh's triangles each level after the first keeps
+static const float lod_fractions[MAX_MESH_LODS - 1] = { 0.5f, 0.25f, 0.12f };
+
+namespace {
+
+// Sum of squared distances to a set of planes, each weighted by its
+// triangle's area: the symmetric 4x4 matrix's upper triangle by rows
+struct Quadric {
+	double a[10];
+	double weight;
+};
+
+void quadric_add_plane (Quadric& q, const glm::dvec3& n, double d, double w) {
+	q.a[0] += w * n.x * n.x; q.a[1] += w * n.x * n.y; q.a[2] += w * n.x * n.z; q.a[3] += w * n.x * d;
+	q.a[4] += w * n.y * n.y; q.a[5] += w * n.y * n.z; q.a[6] += w * n.y * d;
+	q.a[7] += w * n.z * n.z; q.a[8] += w * n.z * d;
+	q.a[9] += w * d * d;
+	q.weight += w;
+}
+
+void quadric_add (Quadric& q, const Quadric& r) {
+	for (int i = 0; i < 10; i++)
+		q.a[i] += r.a[i];
+	q.weight += r.weight;
+}
+
+double quadric_error (const Quadric& q, const glm::dvec3& p) {
+	const double* a = q.a;
+	double e = a[0] * p.x * p.x + a[4] * p.y * p.y + a[7] * p.z * p.z + a[9]
+		+ 2.0 * (a[1] * p.x * p.y + a[2] * p.x * p.z + a[5] * p.y * p.z + a[3] * p.x + a[6] * p.y + a[8] * p.z);
+	return e > 0.0 ? e : 0.0;
+}
+
+// Moving from onto to. Stale once either vertex has changed since.
+struct Collapse {
+	float cost;
+	// the squared distance part of cost
+	float distance;
+	GLuint from;
+	GLuint to;
+	unsigned int fromVersion;
+	unsigned int toVersion;
+
+	// cheapest first out of std::priority_queue
+	bool operator< (const Collapse& o) const { return cost > o.cost; }
+};
+
+// The mesh's vertices are welded again by position alone into points, and
+// the collapses, quadrics and topology work on those. A point on a seam has
+// a vertex for each side, and each follows the one the same side of the
+// collapsing edge has on the point it moves to.
+class Simplifier {
+public:
+	// the largest distance a collapse moved a point by, in diagonals
+	float error;
+
+	Simplifier (const ArenaVertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount);
+	void run (size_t targetIndexCount);
+	void result (std::vector<GLuint>& out) const;
+
+private:
+	const ArenaVertex* vertices;
+	// the point of each vertex
+	std::vector<GLuint> points;
+	// of each point, scaled to a unit diagonal
+	std::vector<glm::dvec3> positions;
+	// vertices, three a triangle, rewritten as their points move
+	std::vector<GLuint> triangles;
+	std::vector<unsigned char> alive;
+	// triangles around each point, dead ones dropped lazily
+	std::vector<std::vector<GLuint> > adjacency;
+	std::vector<Quadric> quadrics;
+	std::vector<unsigned char> locked;
+	std::vector<unsigned char> removed;
+	std::vector<unsigned int> versions;
+	std::priority_queue<Collapse> heap;
+	size_t triangleCount;
+	// scratch for neighbours()
+	std::vector<GLuint> around;
+	std::vector<GLuint> aroundOther;
+	// vertex of from and the vertex of to it becomes, from the last remap()
+	std::vector<std::pair<GLuint, GLuint> > vertexMap;
+
+	void neighbours (GLuint point, std::vector<GLuint>& out) const;
+	bool remap (GLuint from, GLuint to);
+	void push_collapses (GLuint point);
+	void push (GLuint from, GLuint to);
+	bool allowed (GLuint from, GLuint to);
+	void collapse (GLuint from, GLuint to);
+	float attribute_cost (GLuint a, GLuint b) const
+	{
+		glm::vec3 dn = vertices[a].normal - vertices[b].normal;
+		glm::vec2 duv = vertices[a].uv - vertices[b].uv;
+		return LOD_NORMAL_WEIGHT * glm::dot (dn, dn) + LOD_UV_WEIGHT * glm::dot (duv, duv);
+	}
+	// the two sides of a seam differ by more than rounding
+	bool same_attributes (GLuint a, GLuint b) const
+	{
+		glm::vec3 dn = vertices[a].normal - vertices[b].normal;
+		glm::vec2 duv = vertices[a].uv - vertices[b].uv;
+		return glm::dot (dn, dn) < 1e-8f && glm::dot (duv, duv) < 1e-10f;
+	}
+	// the corner of triangle t on point, -1 if it has none
+	int corner (GLuint t, GLuint point) const
+	{
+		const GLuint* c = &triangles[t * 3];
+		return points[c[0]] == point ? 0 : points[c[1]] == point ? 1 : points[c[2]] == point ? 2 : -1;
+	}
+};
+
+Simplifier::Simplifier (const ArenaVertex* v, size_t vertexCount, const GLuint* indices, size_t indexCount)
+	: error (0.0f), vertices (v), points (vertexCount), triangles (indices, indices + indexCount - indexCount % 3),
+	alive (indexCount / 3, 1), triangleCount (0) {
+	std::vector<GLuint> order (vertexCount);
+	for (size_t i = 0; i < vertexCount; i++)
+		order[i] = (GLuint)i;
+	std::sort (order.begin (), order.end (), [&] (GLuint a, GLuint b) {
+		const glm::vec3& p = vertices[a].position;
+		const glm::vec3& q = vertices[b].position;
+		return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+	});
+	AABB bounds;
+	for (size_t i = 0; i < vertexCount; i++) {
+		const glm::vec3& p = vertices[order[i]].position;
+		if (i == 0 || p != vertices[order[i - 1]].position) {
+			positions.push_back (glm::dvec3 (p));
+			bounds.extend (p);
+		}
+		points[order[i]] = (GLuint)positions.size () - 1;
+	}
+	size_t pointCount = positions.size ();
+	double diagonal = pointCount > 0 ? glm::length (glm::dvec3 (bounds.max - bounds.min)) : 0.0;
+	double scale = diagonal > 0.0 ? 1.0 / diagonal : 1.0;
+	for (size_t i = 0; i < pointCount; i++)
+		positions[i] = (positions[i] - glm::dvec3 (bounds.min)) * scale;
+
+	adjacency.resize (pointCount);
+	quadrics.resize (pointCount, Quadric ());
+	locked.assign (pointCount, 0);
+	removed.assign (pointCount, 0);
+	versions.assign (pointCount, 0);
+
+	// every edge as a (low, high) key, an edge only one triangle has is open
+	std::vector<unsigned long long> edges;
+	edges.reserve (triangles.size ());
+	for (size_t t = 0; t < alive.size (); t++) {
+		GLuint c[3] = { points[triangles[t * 3]], points[triangles[t * 3 + 1]], points[triangles[t * 3 + 2]] };
+		if (c[0] == c[1] || c[1] == c[2] || c[2] == c[0]) {
+			alive[t] = 0;
+			continue;
+		}
+		triangleCount++;
+		for (int k = 0; k < 3; k++) {
+			GLuint a = c[k], b = c[(k + 1) % 3];
+			edges.push_back ((unsigned long long)std::min (a, b) << 32 | std::max (a, b));
+			adjacency[a].push_back ((GLuint)t);
+		}
+
+		glm::dvec3 n = glm::cross (positions[c[1]] - positions[c[0]], positions[c[2]] - positions[c[0]]);
+		double area = glm::length (n);
+		if (area <= 0.0)
+			continue;
+		n /= area;
+		for (int k = 0; k < 3; k++)
+			quadric_add_plane (quadrics[c[k]], n, -glm::dot (n, positions[c[0]]), area * 0.5);
+	}
+	std::sort (edges.begin (), edges.end ());
+	for (size_t i = 0; i < edges.size ();) {
+		size_t j = i + 1;
+		while (j < edges.size () && edges[j] == edges[i])
+			j++;
+		// open, or shared by more than two triangles
+		if (j - i != 2) {
+			locked[(GLuint)(edges[i] >> 32)] = 1;
+			locked[(GLuint)edges[i]] = 1;
+		}
+		i = j;
+	}
+
+	for (size_t i = 0; i < pointCount; i++) {
+		if (locked[i])
+			continue;
+		neighbours ((GLuint)i, around);
+		for (size_t k = 0; k < around.size (); k++)
+			push ((GLuint)i, around[k]);
+	}
+}
+
+// The points sharing a live triangle with point, once each
+void Simplifier::neighbours (GLuint point, std::vector<GLuint>& out) const {
+	out.clear ();
+	const std::vector<GLuint>& tris = adjacency[point];
+	for (size_t i = 0; i < tris.size (); i++) {
+		if (!alive[tris[i]])
+			continue;
+		const GLuint* c = &triangles[tris[i] * 3];
+		for (int k = 0; k < 3; k++) {
+			if (points[c[k]] != point)
+				out.push_back (points[c[k]]);
+		}
+	}
+	std::sort (out.begin (), out.end ());
+	out.erase (std::unique (out.begin (), out.end ()), out.end ());
+}
+
+// Fills vertexMap: a vertex of from on the two triangles along the edge
+// becomes to's vertex on the same triangle, any other one of those with the
+// same normal and uv. false if the edge splits one of from's vertices
+// between two of to's, or a vertex has no match and would be smeared across
+// a seam.
+bool Simplifier::remap (GLuint from, GLuint to) {
+	vertexMap.clear ();
+	const std::vector<GLuint>& tris = adjacency[from];
+	for (size_t i = 0; i < tris.size (); i++) {
+		if (!alive[tris[i]])
+			continue;
+		int j = corner (tris[i], to);
+		if (j < 0)
+			continue;
+		GLuint a = triangles[tris[i] * 3 + corner (tris[i], from)];
+		GLuint b = triangles[tris[i] * 3 + j];
+		size_t m = 0;
+		while (m < vertexMap.size () && vertexMap[m].first != a)
+			m++;
+		if (m == vertexMap.size ())
+			vertexMap.push_back (std::make_pair (a, b));
+		else if (vertexMap[m].second != b)
+			return false;
+	}
+	if (vertexMap.empty ())
+		return false;
+	size_t onEdge = vertexMap.size ();
+	for (size_t i = 0; i < tris.size (); i++) {
+		if (!alive[tris[i]])
+			continue;
+		GLuint a = triangles[tris[i] * 3 + corner (tris[i], from)];
+		size_t m = 0;
+		while (m < vertexMap.size () && vertexMap[m].first != a)
+			m++;
+		if (m < vertexMap.size ())
+			continue;
+		size_t k = 0;
+		while (k < onEdge && !same_attributes (a, vertexMap[k].second))
+			k++;
+		if (k == onEdge)
+			return false;
+		vertexMap.push_back (std::make_pair (a, vertexMap[k].second));
+	}
+	return true;
+}
+
+void Simplifier::push (GLuint from, GLuint to) {
+	if (!remap (from, to))
+		return;
+	const Quadric& q = quadrics[from];
+	double distance = quadric_error (q, positions[to]) / (q.weight > 0.0 ? q.weight : 1.0);
+	float attributes = 0.0f;
+	for (size_t m = 0; m < vertexMap.size (); m++)
+		attributes = std::max (attributes, attribute_cost (vertexMap[m].first, vertexMap[m].second));
+	Collapse c;
+	c.distance = (float)distance;
+	c.cost = (float)distance + attributes;
+	c.from = from;
+	c.to = to;
+	c.fromVersion = versions[from];
+	c.toVersion = versions[to];
+	heap.push (c);
+}
+
+// Every collapse off point and onto it
+void Simplifier::push_collapses (GLuint point) {
+	neighbours (point, around);
+	for (size_t i = 0; i < around.size (); i++) {
+		if (!locked[point])
+			push (point, around[i]);
+		if (!locked[around[i]])
+			push (around[i], point);
+	}
+}
+
+// false if the collapse would pinch the surface into a non-manifold one or
+// turn one of the triangles moving with it over
+bool Simplifier::allowed (GLuint from, GLuint to) {
+	// an inner edge's ends share exactly the two points across it
+	neighbours (from, around);
+	neighbours (to, aroundOther);
+	size_t shared = 0;
+	for (size_t i = 0, j = 0; i < around.size () && j < aroundOther.size ();) {
+		if (around[i] < aroundOther[j]) {
+			i++;
+		} else if (aroundOther[j] < around[i]) {
+			j++;
+		} else {
+			shared++;
+			i++;
+			j++;
+		}
+	}
+	if (shared != 2)
+		return false;
+
+	const std::vector<GLuint>& tris = adjacency[from];
+	for (size_t i = 0; i < tris.size (); i++) {
+		if (!alive[tris[i]] || corner (tris[i], to) >= 0)
+			continue;
+		const GLuint* c = &triangles[tris[i] * 3];
+		glm::dvec3 p[3], moved[3];
+		for (int k = 0; k < 3; k++) {
+			p[k] = positions[points[c[k]]];
+			moved[k] = points[c[k]] == from ? positions[to] : p[k];
+		}
+		glm::dvec3 before = glm::cross (p[1] - p[0], p[2] - p[0]);
+		glm::dvec3 after = glm::cross (moved[1] - moved[0], moved[2] - moved[0]);
+		// also refuses slivers, a quarter is about 75 degrees
+		if (glm::dot (before, after) <= 0.25 * glm::length (before) * glm::length (after))
+			return false;
+	}
+	return true;
+}
+
+void Simplifier::collapse (GLuint from, GLuint to) {
+	remap (from, to);
+	removed[from] = 1;
+	const std::vector<GLuint>& tris = adjacency[from];
+	for (size_t i = 0; i < tris.size (); i++) {
+		GLuint t = tris[i];
+		if (!alive[t])
+			continue;
+		if (corner (t, to) >= 0) {
+			alive[t] = 0;
+			triangleCount--;
+			continue;
+		}
+		GLuint& a = triangles[t * 3 + corner (t, from)];
+		for (size_t m = 0; m < vertexMap.size (); m++) {
+			if (vertexMap[m].first == a) {
+				a = vertexMap[m].second;
+				break;
+			}
+		}
+		adjacency[to].push_back (t);
+	}
+	adjacency[from].clear ();
+
+	std::vector<GLuint>& kept = adjacency[to];
+	size_t n = 0;
+	for (size_t i = 0; i < kept.size (); i++) {
+		if (alive[kept[i]])
+			kept[n++] = kept[i];
+	}
+	kept.resize (n);
+
+	quadric_add (quadrics[to], quadrics[from]);
+	versions[to]++;
+	push_collapses (to);
+}
+
+void Simplifier::run (size_t targetIndexCount) {
+	while (triangleCount * 3 > targetIndexCount && !heap.empty ()) {
+		Collapse c = heap.top ();
+		heap.pop ();
+		if (removed[c.from] || removed[c.to] || versions[c.from] != c.fromVersion || versions[c.to] != c.toVersion)
+			continue;
+		if (!allowed (c.from, c.to))
+			continue;
+		collapse (c.from, c.to);
+		error = std::max (error, sqrtf (c.distance));
+	}
+}
+
+void Simplifier::result (std::vector<GLuint>& out) const {
+	out.clear ();
+	out.reserve (triangleCount * 3);
+	for (size_t t = 0; t < alive.size (); t++) {
+		if (alive[t])
+			out.insert (out.end (), &triangles[t * 3], &triangles[t * 3] + 3);
+	}
+}
+
+} // namespace
+
+void simplify_mesh (const ArenaVertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount,
+	size_t targetIndexCount, std::vector<GLuint>& result, float* error) {
+	Simplifier simplifier (vertices, vertexCount, indices, indexCount);
+	simplifier.run (targetIndexCount);
+	simplifier.result (result);
+	if (error)
+		*error = simplifier.error;
+}
+
+void build_mesh_lods (GeometryArena& arena, const int* meshes, size_t count) {
+	PROFILE_FUNCTION ();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	const size_t perMesh = MAX_MESH_LODS - 1;
+
+	// each level from the mesh itself rather than the level before, so its
+	// error is measured against the original surface
+	std::vector<std::vector<GLuint> > levels (count * perMesh);
+	std::vector<float> errors (levels.size (), 0.0f);
+	job_system.parallel_for (0, levels.size (), 1, [&] (size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			int id = meshes[i / perMesh];
+			if (id < 0)
+				continue;
+			const MeshRange& range = arena.mesh (id);
+			size_t target = (size_t)(range.indexCount / 3 * lod_fractions[i % perMesh]) * 3;
+			simplify_mesh (arena.vertex_data () + range.baseVertex, range.vertexCount,
+				arena.index_data () + range.firstIndex, range.indexCount, target, levels[i], &errors[i]);
+		}
+	});
+
+	int added = 0, simplified = 0;
+	for (size_t m = 0; m < count; m++) {
+		int id = meshes[m];
+		if (id < 0)
+			continue;
+		simplified++;
+		printf ("  arena mesh %d lods: %u triangles", id, arena.mesh (id).indexCount / 3);
+		for (size_t l = 0; l < perMesh; l++) {
+			const std::vector<GLuint>& lod = levels[m * perMesh + l];
+			const MeshRange& range = arena.mesh (id);
+			// not worth a level unless it draws a tenth less than the last
+			if (lod.empty () || lod.size () * 10 > range.lods[range.lodCount - 1].indexCount * 9)
+				break;
+			arena.add_lod (id, lod, errors[m * perMesh + l]);
+			printf (", %u (error %.3f%%)", (unsigned)lod.size () / 3, errors[m * perMesh + l] * 100.0f);
+			added++;
+		}
+		printf ("%s\n", arena.mesh (id).lodCount == 1 ? ", locked" : "");
+	}
+	double ms = std::chrono::duration<double, std::milli> (std::chrono::steady_clock::now () - start).count ();
+	printf ("mesh lods: %d levels for %d meshes in %.1f ms\n", added, simplified, ms);
+}
+
+// A grid whose left and right halves are separate uv charts, the column
+// between them a seam with a vertex for each side. It is bent along the seam
+// and the charts' uvs are close, so moving a point across the seam is the
+// cheapest collapse. Simplified as far as it goes, no triangle may end up
+// with vertices from both charts.
+bool verify_mesh_lods () {
+	const int cells = 16, seam = cells / 2;
+	std::vector<ArenaVertex> vertices;
+	// vertex of each grid point on the left chart and on the right one
+	std::vector<GLuint> left ((cells + 1) * (cells + 1)), right (left.size ());
+	for (int y = 0; y <= cells; y++) {
+		for (int x = 0; x <= cells; x++) {
+			ArenaVertex v;
+			float angle = (float)y / cells * 3.0f;
+			v.position = glm::vec3 ((float)x / cells, sinf (angle), cosf (angle));
+			v.normal = glm::vec3 (0.0f, sinf (angle), cosf (angle));
+			int i = y * (cells + 1) + x;
+			if (x <= seam) {
+				v.uv = glm::vec2 (v.position.x, angle);
+				left[i] = (GLuint)vertices.size ();
+				vertices.push_back (v);
+			}
+			if (x >= seam) {
+				v.uv = glm::vec2 (v.position.x + 0.01f, angle);
+				right[i] = (GLuint)vertices.size ();
+				vertices.push_back (v);
+			}
+		}
+	}
+	std::vector<GLuint> indices;
+	for (int y = 0; y < cells; y++) {
+		for (int x = 0; x < cells; x++) {
+			const std::vector<GLuint>& chart = x < seam ? left : right;
+			GLuint a = chart[y * (cells + 1) + x], b = chart[y * (cells + 1) + x + 1];
+			GLuint c = chart[(y + 1) * (cells + 1) + x], d = chart[(y + 1) * (cells + 1) + x + 1];
+			GLuint quad[6] = { a, b, d, a, d, c };
+			indices.insert (indices.end (), quad, quad + 6);
+		}
+	}
+
+	std::vector<GLuint> lod;
+	simplify_mesh (&vertices[0], vertices.size (), &indices[0], indices.size (), 0, lod, NULL);
+	size_t mixed = 0;
+	for (size_t t = 0; t < lod.size (); t += 3) {
+		// the right chart's uvs are offset from the positions
+		bool a = vertices[lod[t]].uv.x > vertices[lod[t]].position.x;
+		bool b = vertices[lod[t + 1]].uv.x > vertices[lod[t + 1]].position.x;
+		bool c = vertices[lod[t + 2]].uv.x > vertices[lod[t + 2]].position.x;
+		if (a != b || b != c)
+			mixed++;
+	}
+	// an untouched grid would pass too, so it has to have been simplified
+	bool ok = mixed == 0 && lod.size () * 2 < indices.size ();
+	printf ("uv seamed grid: %u triangles to %u, %u across the seam\n",
+		(unsigned)indices.size () / 3, (unsigned)lod.size () / 3, (unsigned)mixed);
+	printf (ok ? "mesh lods keep their seams\n" : "mesh lods do not keep their seams\n");
+	return ok;
+}
+
+LodSelector::LodSelector () : hysteresis (0.15f), view (1.0f), projScale (1.0f), next (0) {
+	memset (&stats, 0, sizeof (stats));
+	// each level at half the size of the one before
+	thresholds[0] = 0.0f;
+	for (int i = 1; i < MAX_MESH_LODS; i++)
+		thresholds[i] = 0.5f / (float)(1 << i);
+}
+
+void LodSelector::begin_frame (const glm::mat4& v, const glm::mat4& projection) {
+	view = v;
+	projScale = projection[1][1];
+	next = 0;
+	stats.objects = 0;
+	memset (stats.drawn, 0, sizeof (stats.drawn));
+	stats.triangles = 0;
+	stats.saved = 0;
+	stats.frames++;
+}
+
+int LodSelector::select (const MeshRange& mesh, const glm::mat4& model) {
+	if (next >= levels.size ())
+		levels.push_back (0);
+	int& level = levels[next++];
+	stats.objects++;
+
+	AABB box = mesh.bounds.transformed (model);
+	float radius = glm::length (box.extents ());
+	float distance = glm::length (glm::vec3 (view * glm::vec4 (box.centre (), 1.0f)));
+	// the camera inside the bounds is as close as it gets
+	float size = distance > radius ? radius * projScale / distance : 1e30f;
+
+	level = std::min (level, mesh.lodCount - 1);
+	while (level + 1 < mesh.lodCount && size < thresholds[level + 1] * (1.0f - hysteresis))
+		level++;
+	while (level > 0 && size > thresholds[level] * (1.0f + hysteresis))
+		level--;
+	return level;
+}
+
+void LodSelector::drawn (const MeshRange& mesh, int level) {
+	stats.drawn[level]++;
+	stats.triangles += mesh.lods[level].indexCount / 3;
+	unsigned int saved = (mesh.lods[0].indexCount - mesh.lods[level].indexCount) / 3;
+	stats.saved += saved;
+	stats.savedTotal += saved;
+}
+
+void LodSelector::print () const {
+	printf ("lod: %u objects, %u/%u/%u/%u drawn at each level, %u triangles, %u saved last frame, %.0f saved a frame avg over %u frames\n",
+		stats.objects, stats.drawn[0], stats.drawn[1], stats.drawn[2], stats.drawn[3], stats.triangles, stats.saved,
+		stats.frames > 0 ? (double)stats.savedTotal / stats.frames : 0.0, stats.frames);
+}
@@ -0,0 +1,93 @@
+#ifndef MESH_LOD_H
+#define MESH_LOD_H
+
+// Levels of detail for the arena's meshes. When the meshes are loaded each
+// one is simplified to about 50, 25 and 12% of its triangles by quadric edge
+// collapse (Garland and Heckbert, "Surface Simplification Using Quadric Error
+// Metrics"), and at draw time the renderer picks a level by how big the
+// object is on screen.
+//
+//   int meshes[] = { arena_train, arena_box_car };
+//   build_mesh_lods(arena, meshes, 2);            // before the arena is uploaded
+//   lods.begin_frame(view, projection);
+//   int level = lods.select(arena.mesh(id), model); // once per object, same order every frame
+//   indirect.add(id, model, diffuse, specular, level);
+//
+// Each collapse moves a point onto a neighbour, so every level indexes the
+// mesh's own vertices and only adds indices to the arena. The cost of a
+// collapse is the squared distance of the neighbour from the planes of the
+// triangles merged into the point, plus how far the normals and uvs of its
+// vertices are from those they are replaced by. A seam, where a point has a
+// vertex for each side, only collapses along itself, so meshes built of
+// hard edged faces keep more of their triangles. Points on an open edge
+// never move, nor does one that would turn a triangle over.
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "geometry_arena.h"
+
+// cost of a unit of normal and of uv difference, against squared distance
+// with the mesh scaled to a unit diagonal
+#define LOD_NORMAL_WEIGHT 0.0025f
+#define LOD_UV_WEIGHT 0.01f
+
+// Collapses edges of the triangle list until at most targetIndexCount indices
+// are left, or no collapse is allowed. indices count from vertices. error is
+// set to the largest distance a point was moved from its planes (the root of
+// their area weighted mean square), as a fraction of the mesh's bounding box
+// diagonal.
+void simplify_mesh(const ArenaVertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount,
+	size_t targetIndexCount, std::vector<GLuint>& result, float* error);
+
+// Gives each mesh its chain of levels, the meshes shared out over the job
+// system, and prints the triangles and error of each level
+void build_mesh_lods(GeometryArena& arena, const int* meshes, size_t count);
+
+// Simplifies a uv seamed grid and checks no triangle crosses the seam,
+// printing what it found. Run by --verify-lods
+bool verify_mesh_lods();
+
+struct LodStats {
+	unsigned int objects;
+	// objects drawn at each level last frame
+	unsigned int drawn[MAX_MESH_LODS];
+	// triangles drawn last frame, and left out against drawing all at level 0
+	unsigned int triangles;
+	unsigned int saved;
+	unsigned long long savedTotal;
+	unsigned int frames;
+};
+
+// Picks the level each object is drawn at from its projected size, the
+// radius of its bounds over half the screen height. Going coarser takes the
+// size below a threshold by the hysteresis fraction and going back finer
+// above it by as much, so an object at a threshold doesn't flicker between
+// two levels. Objects are told apart by the order they are selected in.
+class LodSelector
+{
+public:
+	LodStats stats;
+	// size below which level i is drawn, thresholds[0] unused
+	float thresholds[MAX_MESH_LODS];
+	float hysteresis;
+
+	LodSelector();
+
+	void begin_frame(const glm::mat4& view, const glm::mat4& projection);
+	int select(const MeshRange& mesh, const glm::mat4& model);
+	// An object queued at the level select() gave it, for the stats
+	void drawn(const MeshRange& mesh, int level);
+
+	void print() const;
+
+private:
+	glm::mat4 view;
+	// cotangent of half the vertical field of view
+	float projScale;
+	std::vector<int> levels;
+	size_t next;
+};
+
+#endif
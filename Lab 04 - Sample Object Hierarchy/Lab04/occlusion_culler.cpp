@@ -0,0 +1,335 @@
+// Occlusion culling with a software depth buffer, see occlusion_culler.h
+#include "occlusion_culler.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#include "job_system.h"
+#include "profiler.h"
+#include "simd_f4.h"
+
+#define TILES_X (OCCLUSION_WIDTH / OCCLUSION_TILE_X)
+// vertices or triangles a job takes at once
+#define OCCLUSION_GRAIN 1024
+
+// The triangle (x[i], y[i], z[i]), in pixels with any winding, into the
+// columns [x0, x1) and rows [y0, y1) of a depth buffer stride floats wide;
+// every pixel whose centre it covers keeps the nearer depth. x1 - x0 is a
+// multiple of 4. Edge functions and depth are planes over the pixel centres,
+// stepped four pixels a row at a time; pixels exactly on an edge are left
+// out, so two triangles sharing an edge never cover more than they would
+// drawn by GL.
+static void rasterize_depth (float* depth, int stride, int x0, int y0, int x1, int y1, const float* x, const float* y, const float* z) {
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (area == 0.0f)
+		return;
+	// counter-clockwise, so the inside is where all three are positive
+	int v[3] = { 0, 1, 2 };
+	if (area < 0.0f) {
+		v[1] = 2;
+		v[2] = 1;
+		area = -area;
+	}
+	float ea[3], eb[3], ec[3];
+	for (int e = 0; e < 3; e++) {
+		// edge from p to q, opposite vertex v[e]
+		int p = v[(e + 1) % 3], q = v[(e + 2) % 3];
+		ea[e] = y[p] - y[q];
+		eb[e] = x[q] - x[p];
+		ec[e] = -(ea[e] * x[p] + eb[e] * y[p]);
+	}
+	float inv = 1.0f / area;
+	float za = (ea[0] * z[v[0]] + ea[1] * z[v[1]] + ea[2] * z[v[2]]) * inv;
+	float zb = (eb[0] * z[v[0]] + eb[1] * z[v[1]] + eb[2] * z[v[2]]) * inv;
+	float zc = (ec[0] * z[v[0]] + ec[1] * z[v[1]] + ec[2] * z[v[2]]) * inv;
+
+	// the triangle's bounds in the rect, columns from a multiple of 4 past x0
+	float lx = fminf (x[0], fminf (x[1], x[2])), hx = fmaxf (x[0], fmaxf (x[1], x[2]));
+	float ly = fminf (y[0], fminf (y[1], y[2])), hy = fmaxf (y[0], fmaxf (y[1], y[2]));
+	int bx0 = lx > x0 ? (int)lx : x0, bx1 = hx < x1 ? (int)ceilf (hx) : x1;
+	int by0 = ly > y0 ? (int)ly : y0, by1 = hy < y1 ? (int)ceilf (hy) : y1;
+	bx0 = x0 + ((bx0 - x0) & ~3);
+	if (bx0 >= bx1 || by0 >= by1)
+		return;
+
+	f4 zero = f4_splat (0.0f);
+	f4 lanes = f4_set (0.5f, 1.5f, 2.5f, 3.5f);
+	f4 stepA[3], rowA[3];
+	for (int e = 0; e < 3; e++) {
+		stepA[e] = f4_splat (ea[e] * 4.0f);
+		rowA[e] = f4_madd (f4_splat (ea[e]), f4_add (f4_splat ((float)bx0), lanes), f4_splat (ec[e]));
+	}
+	f4 stepZ = f4_splat (za * 4.0f);
+	f4 rowZ = f4_madd (f4_splat (za), f4_add (f4_splat ((float)bx0), lanes), f4_splat (zc));
+	for (int py = by0; py < by1; py++) {
+		float cy = py + 0.5f;
+		f4 e0 = f4_add (rowA[0], f4_splat (eb[0] * cy));
+		f4 e1 = f4_add (rowA[1], f4_splat (eb[1] * cy));
+		f4 e2 = f4_add (rowA[2], f4_splat (eb[2] * cy));
+		f4 pz = f4_add (rowZ, f4_splat (zb * cy));
+		float* row = depth + (size_t)py * stride;
+		for (int px = bx0; px < bx1; px += 4) {
+			int inside = ~(f4_le_mask (e0, zero) | f4_le_mask (e1, zero) | f4_le_mask (e2, zero)) & 15;
+			if (inside == 15) {
+				f4_store (row + px, f4_min (f4_load (row + px), pz));
+			} else if (inside) {
+				float lz[4];
+				f4_store (lz, pz);
+				for (int lane = 0; lane < 4; lane++) {
+					if (inside & (1 << lane))
+						row[px + lane] = fminf (row[px + lane], lz[lane]);
+				}
+			}
+			e0 = f4_add (e0, stepA[0]);
+			e1 = f4_add (e1, stepA[1]);
+			e2 = f4_add (e2, stepA[2]);
+			pz = f4_add (pz, stepZ);
+		}
+	}
+}
+
+OcclusionCuller::OcclusionCuller () : viewProj (1.0f), vertexCount (0), triangleCount (0) {
+	memset (&stats, 0, sizeof (stats));
+	for (int l = 0; l < OCCLUSION_LEVELS; l++)
+		levels[l].assign ((size_t)(OCCLUSION_WIDTH >> l) * (OCCLUSION_HEIGHT >> l), 1.0f);
+}
+
+void OcclusionCuller::begin_frame (const glm::mat4& m) {
+	viewProj = m;
+	occluders.clear ();
+	vertexCount = 0;
+	triangleCount = 0;
+	stats.tested = 0;
+	stats.occluded = 0;
+}
+
+void OcclusionCuller::add_occluder (const GeometryArena& arena, int mesh, const glm::mat4& model) {
+	const MeshRange& range = arena.mesh (mesh);
+	Occluder o = { arena.vertex_data () + range.baseVertex, arena.index_data () + range.firstIndex, range, viewProj * model,
+		vertexCount, triangleCount };
+	occluders.push_back (o);
+	vertexCount += range.vertexCount;
+	triangleCount += range.indexCount / 3;
+}
+
+// the occluder holding the index'th vertex or triangle of the frame, start
+// says which
+size_t OcclusionCuller::occluder_at (size_t index, size_t Occluder::*start) const {
+	size_t lo = 0, hi = occluders.size ();
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (occluders[mid].*start <= index)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+void OcclusionCuller::render () {
+	PROFILE_FUNCTION ();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	if (clip.size () < vertexCount)
+		clip.resize (vertexCount);
+	if (triangles.size () < triangleCount * 2) {
+		triangles.resize (triangleCount * 2);
+		triangleCounts.resize (triangleCount);
+	}
+
+	// every vertex into clip space, then every triangle clipped and projected
+	job_system.parallel_for (0, vertexCount, OCCLUSION_GRAIN, [this] (size_t begin, size_t end) {
+		size_t o = occluder_at (begin, &Occluder::firstVertex);
+		for (size_t v = begin; v < end; v++) {
+			while (o + 1 < occluders.size () && v >= occluders[o + 1].firstVertex)
+				o++;
+			const Occluder& occluder = occluders[o];
+			clip[v] = occluder.clipMatrix * glm::vec4 (occluder.vertices[v - occluder.firstVertex].position, 1.0f);
+		}
+	});
+	job_system.parallel_for (0, triangleCount, OCCLUSION_GRAIN, [this] (size_t begin, size_t end) {
+		size_t o = occluder_at (begin, &Occluder::firstTriangle);
+		for (size_t t = begin; t < end; t++) {
+			while (o + 1 < occluders.size () && t >= occluders[o + 1].firstTriangle)
+				o++;
+			setup (o, t);
+		}
+	});
+
+	bin ();
+	job_system.parallel_for (0, OCCLUSION_TILES, 1, [this] (size_t begin, size_t end) {
+		for (size_t tile = begin; tile < end; tile++)
+			rasterize_tile ((int)tile);
+	});
+
+	stats.occluders = (unsigned int)occluders.size ();
+	std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now () - start;
+	stats.rasterMs = ms.count ();
+	stats.rasterMsTotal += stats.rasterMs;
+	stats.frames++;
+}
+
+// Clips triangle t against the near plane, which leaves one or two, and
+// projects them to the buffer. Those wholly outside another plane are dropped.
+void OcclusionCuller::setup (size_t o, size_t t) {
+	const Occluder& occluder = occluders[o];
+	const GLuint* index = occluder.indices + (t - occluder.firstTriangle) * 3;
+	glm::vec4 v[3];
+	int outside[6] = { 0 };
+	for (int i = 0; i < 3; i++) {
+		v[i] = clip[occluder.firstVertex + index[i]];
+		outside[0] += v[i].x < -v[i].w;
+		outside[1] += v[i].x > v[i].w;
+		outside[2] += v[i].y < -v[i].w;
+		outside[3] += v[i].y > v[i].w;
+		outside[4] += v[i].z < -v[i].w;
+		outside[5] += v[i].z > v[i].w;
+	}
+	triangleCounts[t] = 0;
+	for (int p = 0; p < 6; p++) {
+		if (outside[p] == 3)
+			return;
+	}
+
+	glm::vec4 polygon[4];
+	int corners = 0;
+	if (outside[4] == 0) {
+		polygon[0] = v[0];
+		polygon[1] = v[1];
+		polygon[2] = v[2];
+		corners = 3;
+	} else {
+		for (int i = 0; i < 3; i++) {
+			const glm::vec4& a = v[i];
+			const glm::vec4& b = v[(i + 1) % 3];
+			float da = a.z + a.w, db = b.z + b.w;
+			if (da >= 0.0f)
+				polygon[corners++] = a;
+			if ((da >= 0.0f) != (db >= 0.0f))
+				polygon[corners++] = a + (b - a) * (da / (da - db));
+		}
+	}
+
+	glm::vec3 window[4];
+	for (int i = 0; i < corners; i++) {
+		float inv = 1.0f / polygon[i].w;
+		window[i] = glm::vec3 ((polygon[i].x * inv * 0.5f + 0.5f) * OCCLUSION_WIDTH,
+			(polygon[i].y * inv * 0.5f + 0.5f) * OCCLUSION_HEIGHT, polygon[i].z * inv * 0.5f + 0.5f);
+	}
+	// a fan from the first corner
+	for (int i = 1; i + 1 < corners; i++) {
+		ScreenTriangle& s = triangles[t * 2 + i - 1];
+		const glm::vec3* fan[3] = { &window[0], &window[i], &window[i + 1] };
+		for (int c = 0; c < 3; c++) {
+			s.x[c] = fan[c]->x;
+			s.y[c] = fan[c]->y;
+			s.z[c] = fan[c]->z;
+		}
+	}
+	triangleCounts[t] = (unsigned char)(corners - 2);
+}
+
+// Lists each triangle in the tiles its bounds touch
+void OcclusionCuller::bin () {
+	for (int tile = 0; tile < OCCLUSION_TILES; tile++)
+		bins[tile].clear ();
+	stats.triangles = 0;
+	for (size_t t = 0; t < triangleCount; t++) {
+		for (int i = 0; i < triangleCounts[t]; i++) {
+			const ScreenTriangle& s = triangles[t * 2 + i];
+			float lx = std::min (s.x[0], std::min (s.x[1], s.x[2])), hx = std::max (s.x[0], std::max (s.x[1], s.x[2]));
+			float ly = std::min (s.y[0], std::min (s.y[1], s.y[2])), hy = std::max (s.y[0], std::max (s.y[1], s.y[2]));
+			// no pixel centre inside
+			if (floorf (hx - 0.5f) < ceilf (lx - 0.5f) || floorf (hy - 0.5f) < ceilf (ly - 0.5f))
+				continue;
+			int tx0 = std::max (0, (int)lx / OCCLUSION_TILE_X), tx1 = std::min (TILES_X - 1, (int)hx / OCCLUSION_TILE_X);
+			int ty0 = std::max (0, (int)ly / OCCLUSION_TILE_Y);
+			int ty1 = std::min (OCCLUSION_HEIGHT / OCCLUSION_TILE_Y - 1, (int)hy / OCCLUSION_TILE_Y);
+			if (tx0 > tx1 || ty0 > ty1)
+				continue;
+			for (int ty = ty0; ty <= ty1; ty++) {
+				for (int tx = tx0; tx <= tx1; tx++)
+					bins[ty * TILES_X + tx].push_back ((unsigned int)(t * 2 + i));
+			}
+			stats.triangles++;
+		}
+	}
+}
+
+void OcclusionCuller::rasterize_tile (int tile) {
+	int x0 = (tile % TILES_X) * OCCLUSION_TILE_X, y0 = (tile / TILES_X) * OCCLUSION_TILE_Y;
+	float* depth = &levels[0][0];
+	for (int y = y0; y < y0 + OCCLUSION_TILE_Y; y++)
+		std::fill (depth + y * OCCLUSION_WIDTH + x0, depth + y * OCCLUSION_WIDTH + x0 + OCCLUSION_TILE_X, 1.0f);
+	const std::vector<unsigned int>& list = bins[tile];
+	for (size_t i = 0; i < list.size (); i++) {
+		const ScreenTriangle& s = triangles[list[i]];
+		rasterize_depth (depth, OCCLUSION_WIDTH, x0, y0, x0 + OCCLUSION_TILE_X, y0 + OCCLUSION_TILE_Y, s.x, s.y, s.z);
+	}
+
+	// the tile's part of each level, the farthest of the four texels above
+	for (int l = 1; l < OCCLUSION_LEVELS; l++) {
+		const float* above = &levels[l - 1][0];
+		float* level = &levels[l][0];
+		int aboveWidth = OCCLUSION_WIDTH >> (l - 1), width = OCCLUSION_WIDTH >> l;
+		for (int y = y0 >> l; y < (y0 + OCCLUSION_TILE_Y) >> l; y++) {
+			for (int x = x0 >> l; x < (x0 + OCCLUSION_TILE_X) >> l; x++) {
+				const float* a = above + (y * 2) * aboveWidth + x * 2;
+				level[y * width + x] = std::max (std::max (a[0], a[1]), std::max (a[aboveWidth], a[aboveWidth + 1]));
+			}
+		}
+	}
+}
+
+bool OcclusionCuller::occluded (const AABB& box) {
+	stats.tested++;
+	stats.testedTotal++;
+	if (occluders.empty ())
+		return false;
+	float lx = 1e30f, hx = -1e30f, ly = 1e30f, hy = -1e30f, nearest = 1.0f;
+	for (int i = 0; i < 8; i++) {
+		glm::vec4 corner ((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z, 1.0f);
+		glm::vec4 c = viewProj * corner;
+		// reaching the near plane, in front of everything
+		if (c.z < -c.w)
+			return false;
+		float inv = 1.0f / c.w;
+		float x = (c.x * inv * 0.5f + 0.5f) * OCCLUSION_WIDTH, y = (c.y * inv * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+		lx = std::min (lx, x);
+		hx = std::max (hx, x);
+		ly = std::min (ly, y);
+		hy = std::max (hy, y);
+		nearest = std::min (nearest, c.z * inv * 0.5f + 0.5f);
+	}
+	// off screen is the frustum culling's business
+	int x0 = std::max (0, (int)floorf (lx)), x1 = std::min (OCCLUSION_WIDTH - 1, (int)floorf (hx));
+	int y0 = std::max (0, (int)floorf (ly)), y1 = std::min (OCCLUSION_HEIGHT - 1, (int)floorf (hy));
+	if (x0 > x1 || y0 > y1)
+		return false;
+
+	int l = 0;
+	while (l + 1 < OCCLUSION_LEVELS && ((x1 >> l) - (x0 >> l) > 3 || (y1 >> l) - (y0 >> l) > 3))
+		l++;
+	const float* level = &levels[l][0];
+	int width = OCCLUSION_WIDTH >> l;
+	for (int y = y0 >> l; y <= y1 >> l; y++) {
+		for (int x = x0 >> l; x <= x1 >> l; x++) {
+			if (level[y * width + x] >= nearest)
+				return false;
+		}
+	}
+	stats.occluded++;
+	stats.occludedTotal++;
+	return true;
+}
+
+void OcclusionCuller::print () const {
+	printf ("occlusion: %dx%d, %u occluders, %u triangles, %u of %u objects occluded last frame, %llu of %llu in all\n",
+		OCCLUSION_WIDTH, OCCLUSION_HEIGHT, stats.occluders, stats.triangles, stats.occluded, stats.tested,
+		stats.occludedTotal, stats.testedTotal);
+	printf ("occlusion rasteriser: %.3f ms last frame, %.3f ms avg over %u frames, %d threads\n",
+		stats.rasterMs, stats.frames > 0 ? stats.rasterMsTotal / stats.frames : 0.0, stats.frames,
+		job_system.worker_count () + 1);
+}
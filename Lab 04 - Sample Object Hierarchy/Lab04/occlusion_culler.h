@@ -0,0 +1,108 @@
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+// Occlusion culling on the CPU. A few big meshes are drawn as occluders into
+// a small depth buffer, and every object after them is tested against it
+// before it is submitted, so what they hide costs neither a draw nor its
+// fragments.
+//
+//   occlusion.begin_frame(projection * view);
+//   occlusion.add_occluder(arena, mesh, model);   // per occluding mesh
+//   occlusion.render();                           // rasterises on the job system
+//   if (!occlusion.occluded(box)) ...             // world space bounds
+//
+// The occluders' triangles are transformed, clipped against the near plane
+// and set up in parallel, binned by the OCCLUSION_TILE_X x OCCLUSION_TILE_Y
+// screen tile they touch, and each tile is then rasterised by one job, four
+// pixels at a time on the f4 wrapper from simd_f4.h. Each job also
+// reduces its tile into the levels of a hierarchical Z, every texel the
+// farthest depth of the four under it. An object is occluded when the
+// nearest corner of its box is behind the farthest depth of every texel its
+// screen rectangle covers, at the first level where that is a few texels.
+//
+// Depth is window z in [0, 1] and only pixel centres are sampled, so a gap
+// between occluders narrower than a pixel of the buffer can hide an object.
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "frustum.h"
+#include "geometry_arena.h"
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+#define OCCLUSION_TILE_X 64
+#define OCCLUSION_TILE_Y 32
+#define OCCLUSION_TILES ((OCCLUSION_WIDTH / OCCLUSION_TILE_X) * (OCCLUSION_HEIGHT / OCCLUSION_TILE_Y))
+// the depth buffer and its reductions, the last 8x4
+#define OCCLUSION_LEVELS 6
+
+struct OcclusionStats {
+	unsigned int occluders;
+	// after clipping and dropping those that cover no pixel centre
+	unsigned int triangles;
+	unsigned int tested;
+	unsigned int occluded;
+	// CPU time of render(), transform to hierarchical Z
+	double rasterMs;
+	double rasterMsTotal;
+	unsigned int frames;
+	unsigned long long testedTotal;
+	unsigned long long occludedTotal;
+};
+
+class OcclusionCuller
+{
+public:
+	OcclusionStats stats;
+
+	OcclusionCuller();
+
+	// Forgets last frame's occluders and tests
+	void begin_frame(const glm::mat4& viewProj);
+	// A mesh of the arena to draw into the buffer this frame
+	void add_occluder(const GeometryArena& arena, int mesh, const glm::mat4& model);
+	void render();
+
+	// true when box, in world space, is hidden behind the occluders
+	bool occluded(const AABB& box);
+
+	void print() const;
+
+private:
+	struct Occluder {
+		const ArenaVertex* vertices;
+		const GLuint* indices;
+		MeshRange range;
+		// model to clip space
+		glm::mat4 clipMatrix;
+		// where its clip space vertices and its triangles start
+		size_t firstVertex;
+		size_t firstTriangle;
+	};
+
+	// In pixels and window depth, up to two from each occluder triangle
+	struct ScreenTriangle {
+		float x[3];
+		float y[3];
+		float z[3];
+	};
+
+	glm::mat4 viewProj;
+	std::vector<Occluder> occluders;
+	std::vector<glm::vec4> clip;
+	std::vector<ScreenTriangle> triangles;
+	std::vector<unsigned char> triangleCounts;
+	std::vector<unsigned int> bins[OCCLUSION_TILES];
+	std::vector<float> levels[OCCLUSION_LEVELS];
+	size_t vertexCount;
+	size_t triangleCount;
+
+	size_t occluder_at(size_t index, size_t Occluder::*start) const;
+	void setup(size_t occluder, size_t triangle);
+	void bin();
+	void rasterize_tile(int tile);
+};
+
+#endif
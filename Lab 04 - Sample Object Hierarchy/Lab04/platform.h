@@ -0,0 +1,61 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+// The few OS calls the lab makes, so the same code builds with Visual Studio
+// and with the CMake target on Linux
+
+#ifdef _WIN32
+#include <windows.h>
+#include <mmsystem.h>
+#else
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+
+// Asks for 1 ms sleep resolution, Windows defaults to its 15.6 ms tick
+inline void platform_fine_sleep()
+{
+#ifdef _WIN32
+	static bool done = false;
+	if (!done)
+		timeBeginPeriod(1);
+	done = true;
+#endif
+}
+
+// fopen without the MSVC deprecation warning, NULL on failure
+inline FILE* platform_fopen(const char* path, const char* mode)
+{
+#ifdef _MSC_VER
+	FILE* fp = NULL;
+	if (fopen_s(&fp, path, mode) != 0)
+		return NULL;
+	return fp;
+#else
+	return fopen(path, mode);
+#endif
+}
+
+inline bool platform_chdir(const char* path)
+{
+#ifdef _WIN32
+	return SetCurrentDirectoryA(path) != 0;
+#else
+	return chdir(path) == 0;
+#endif
+}
+
+// true if the directory exists afterwards
+inline bool platform_mkdir(const char* path)
+{
+#ifdef _WIN32
+	return CreateDirectoryA(path, NULL) != 0 || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+	return mkdir(path, 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+#endif
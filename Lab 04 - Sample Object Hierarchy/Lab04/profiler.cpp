@@ -0,0 +1,115 @@
+// Scoped CPU profiler, see profiler.h
+#include "profiler.h"
+#include "platform.h"
+
+#include <atomic>
+#include <chrono>
+
+struct ProfileEvent {
+	const char* name;
+	uint64_t begin_ns;
+	uint64_t end_ns;
+};
+
+// One per thread that has recorded anything. Only the owning thread writes
+// events, it publishes them by bumping written, so the writer never waits.
+// Rings are never freed, a thread's events outlive it for the trace.
+struct ProfileThread {
+	ProfileEvent events[PROFILER_RING_SIZE];
+	std::atomic<uint64_t> written;
+	std::atomic<const char*> name;
+	unsigned int id;
+	ProfileThread* next;
+};
+
+static const std::chrono::steady_clock::time_point profiler_epoch = std::chrono::steady_clock::now ();
+// every thread's ring, new ones are pushed on the front
+static std::atomic<ProfileThread*> profile_threads (nullptr);
+static std::atomic<unsigned int> profile_thread_count (0);
+static thread_local ProfileThread* current_thread = nullptr;
+
+static ProfileThread* this_thread () {
+	ProfileThread* thread = current_thread;
+	if (thread)
+		return thread;
+	thread = new ProfileThread;
+	thread->written.store (0, std::memory_order_relaxed);
+	thread->name.store (nullptr, std::memory_order_relaxed);
+	thread->id = ++profile_thread_count;
+	thread->next = profile_threads.load (std::memory_order_relaxed);
+	while (!profile_threads.compare_exchange_weak (thread->next, thread, std::memory_order_release, std::memory_order_relaxed)) {
+	}
+	current_thread = thread;
+	return thread;
+}
+
+uint64_t profiler_now_ns () {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now () - profiler_epoch).count ();
+}
+
+void profiler_thread_name (const char* name) {
+	this_thread ()->name.store (name, std::memory_order_release);
+}
+
+void profiler_record (const char* name, uint64_t begin_ns, uint64_t end_ns) {
+	ProfileThread* thread = this_thread ();
+	uint64_t n = thread->written.load (std::memory_order_relaxed);
+	ProfileEvent& event = thread->events[n & (PROFILER_RING_SIZE - 1)];
+	event.name = name;
+	event.begin_ns = begin_ns;
+	event.end_ns = end_ns;
+	thread->written.store (n + 1, std::memory_order_release);
+}
+
+// names are literals or __FUNCTION__, quotes and backslashes are all that need escaping
+static void write_json_string (FILE* fp, const char* s) {
+	fputc ('"', fp);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fputc ('\\', fp);
+		if ((unsigned char)*s >= 0x20)
+			fputc (*s, fp);
+	}
+	fputc ('"', fp);
+}
+
+bool profiler_write_trace (const char* path) {
+	FILE* fp = platform_fopen (path, "w");
+	if (!fp) {
+		fprintf (stderr, "ERROR: could not write profile %s\n", path);
+		return false;
+	}
+	fprintf (fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	uint64_t events = 0, dropped = 0;
+	for (ProfileThread* thread = profile_threads.load (std::memory_order_acquire); thread; thread = thread->next) {
+		const char* name = thread->name.load (std::memory_order_acquire);
+		fprintf (fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",\n", thread->id);
+		if (name) {
+			write_json_string (fp, name);
+		} else {
+			fprintf (fp, "\"thread %u\"", thread->id);
+		}
+		fprintf (fp, "}}");
+		first = false;
+
+		uint64_t n = thread->written.load (std::memory_order_acquire);
+		uint64_t start = n > PROFILER_RING_SIZE ? n - PROFILER_RING_SIZE : 0;
+		for (uint64_t i = start; i < n; i++) {
+			const ProfileEvent& event = thread->events[i & (PROFILER_RING_SIZE - 1)];
+			fprintf (fp, ",\n{\"name\":");
+			write_json_string (fp, event.name);
+			fprintf (fp, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				thread->id, event.begin_ns / 1000.0, (event.end_ns - event.begin_ns) / 1000.0);
+		}
+		events += n - start;
+		dropped += start;
+	}
+	fprintf (fp, "\n]}\n");
+	fclose (fp);
+	printf ("profile: %llu events from %u threads written to %s", (unsigned long long)events, profile_thread_count.load (), path);
+	if (dropped > 0)
+		printf (", %llu older ones were overwritten", (unsigned long long)dropped);
+	printf ("\n");
+	return true;
+}
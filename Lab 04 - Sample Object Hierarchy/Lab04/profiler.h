@@ -0,0 +1,137 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Scoped CPU profiler. PROFILE_SCOPE("name") times the rest of the enclosing
+// block and stores it in the calling thread's ring buffer, no locks are taken
+// on the way. profiler_write_trace saves every thread's ring as Chrome trace
+// JSON, one track per thread, which chrome://tracing and ui.perfetto.dev open.
+// Scope names must outlive the program (string literals), only the pointer
+// is stored. Build with LAB04_NO_PROFILE and the scopes compile to nothing.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Events each thread keeps, older ones are overwritten
+#define PROFILER_RING_SIZE (1 << 16)
+
+// Nanoseconds since the profiler started
+uint64_t profiler_now_ns();
+// Names the calling thread's track in the trace
+void profiler_thread_name(const char* name);
+// Stores a finished scope for the calling thread
+void profiler_record(const char* name, uint64_t begin_ns, uint64_t end_ns);
+// Writes the events of every thread, call it while no scopes are running
+bool profiler_write_trace(const char* path);
+
+#ifndef LAB04_NO_PROFILE
+
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char* name) : name(name), begin(profiler_now_ns()) {}
+	~ProfileScope() { profiler_record(name, begin, profiler_now_ns()); }
+
+private:
+	ProfileScope(const ProfileScope&);
+	ProfileScope& operator=(const ProfileScope&);
+
+	const char* name;
+	uint64_t begin;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__FUNCTION__)
+#define PROFILE_THREAD(name) profiler_thread_name(name)
+
+#else
+
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_FUNCTION() ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+
+#endif
+
+// Frame times in 0.1 ms buckets, anything over 250 ms goes in the last one.
+// Percentiles are the upper edge of their bucket, so they are at most 0.1 ms
+// high, and never above the slowest frame. Not part of the compile-time
+// switch, it costs one increment a frame.
+class FrameHistogram
+{
+public:
+	static const int BUCKETS = 2500;
+
+	FrameHistogram() { reset(); }
+
+	void reset()
+	{
+		memset(buckets, 0, sizeof(buckets));
+		total = 0;
+		max_ms = 0.0;
+	}
+
+	void add(double ms)
+	{
+		int bucket = (int)(ms * 10.0);
+		if (bucket < 0)
+			bucket = 0;
+		if (bucket >= BUCKETS)
+			bucket = BUCKETS - 1;
+		buckets[bucket]++;
+		total++;
+		if (ms > max_ms)
+			max_ms = ms;
+	}
+
+	unsigned int count() const { return total; }
+
+	// p in [0, 1], 0 when nothing has been added
+	double percentile(double p) const
+	{
+		if (total == 0)
+			return 0.0;
+		unsigned int target = (unsigned int)(p * total + 0.5);
+		if (target < 1)
+			target = 1;
+		unsigned int seen = 0;
+		for (int i = 0; i < BUCKETS; i++)
+		{
+			seen += buckets[i];
+			if (seen >= target)
+				return i == BUCKETS - 1 || (i + 1) * 0.1 > max_ms ? max_ms : (i + 1) * 0.1;
+		}
+		return max_ms;
+	}
+
+	// p50/p95/p99 on one line, then a bar per millisecond from p1 to p99
+	void print(const char* label) const
+	{
+		printf("%s: %u frames  p50 %.1f ms  p95 %.1f ms  p99 %.1f ms  max %.1f ms\n",
+			label, total, percentile(0.5), percentile(0.95), percentile(0.99), max_ms);
+		if (total == 0)
+			return;
+		int lo = (int)percentile(0.01), hi = (int)percentile(0.99) + 1;
+		if (hi - lo > 40)
+			lo = hi - 40;
+		for (int ms = lo; ms < hi; ms++)
+		{
+			unsigned int n = 0;
+			for (int i = ms * 10; i < (ms + 1) * 10 && i < BUCKETS; i++)
+				n += buckets[i];
+			char bar[51];
+			int len = (int)(50.0 * n / total + 0.5);
+			memset(bar, '#', len);
+			bar[len] = '\0';
+			printf("  %4d ms %6u %s\n", ms, n, bar);
+		}
+	}
+
+private:
+	unsigned int buckets[BUCKETS];
+	unsigned int total;
+	double max_ms;
+};
+
+#endif
@@ -0,0 +1,661 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+// OpenGL includes
+#include "gl_includes.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "instancing.h"
+#include "gpu_profiler.h"
+#include "frame_arena.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+// Passes are submitted in this order, the pass is the top field of the sort key.
+// PASS_GBUFFER is the geometry pass of deferred shading, flushed on its own
+// into the G-buffer before the lighting pass.
+enum RenderPass {
+	PASS_GBUFFER = 0,
+	PASS_OPAQUE,
+	PASS_SKY,
+	PASS_TRANSPARENT,
+	PASS_COUNT
+};
+
+// Sort key layout, most significant bits first:
+// | pass 4 | program 12 | material 16 | vao 12 | depth 20 |
+#define KEY_DEPTH_BITS 20
+#define KEY_VAO_BITS 12
+#define KEY_MATERIAL_BITS 16
+#define KEY_PROGRAM_BITS 12
+#define KEY_PASS_BITS 4
+
+#define MAX_MATERIAL_TEXTURES 3
+#define NO_MATERIAL 0
+
+// A set of textures bound together, one per texture unit starting at GL_TEXTURE0
+struct Material {
+	GLenum targets[MAX_MATERIAL_TEXTURES];
+	GLuint textures[MAX_MATERIAL_TEXTURES];
+	int count;
+};
+
+// Counters for a single frame, reset by RenderQueue::begin_frame()
+struct RenderStats {
+	unsigned int packets;
+	unsigned int draws;
+	unsigned int instances;
+	unsigned int programChanges;
+	unsigned int vaoChanges;
+	unsigned int textureChanges;
+	unsigned int stateChanges;
+	unsigned int redundantSkipped;
+
+	void reset()
+	{
+		packets = draws = instances = programChanges = vaoChanges = 0;
+		textureChanges = stateChanges = redundantSkipped = 0;
+	}
+
+	void print() const
+	{
+		printf("packets %u, draws %u, instances %u, program %u, vao %u, texture %u, state %u, skipped %u\n",
+			packets, draws, instances, programChanges, vaoChanges, textureChanges, stateChanges, redundantSkipped);
+	}
+};
+
+// Shadows the bits of GL state the renderer touches so binds that would not
+// change anything never reach the driver.
+class RenderState
+{
+public:
+	RenderStats stats;
+
+	RenderState()
+	{
+		stats.reset();
+		invalidate();
+	}
+
+	// Forget everything we know, call this after GL code that bypasses the cache
+	void invalidate()
+	{
+		program = ~0u;
+		vao = ~0u;
+		activeUnit = ~0u;
+		for (int i = 0; i < MAX_MATERIAL_TEXTURES; i++)
+		{
+			textures[i] = ~0u;
+			textureTargets[i] = GL_NONE;
+		}
+		depthFunc = GL_NONE;
+		depthWrite = -1;
+		blendSrc = blendDst = GL_NONE;
+	}
+
+	void use_program(GLuint id)
+	{
+		if (id == program) { stats.redundantSkipped++; return; }
+		glUseProgram(id);
+		program = id;
+		stats.programChanges++;
+	}
+
+	void bind_vertex_array(GLuint id)
+	{
+		if (id == vao) { stats.redundantSkipped++; return; }
+		glBindVertexArray(id);
+		vao = id;
+		stats.vaoChanges++;
+	}
+
+	void bind_texture(unsigned int unit, GLenum target, GLuint id)
+	{
+		if (textures[unit] == id && textureTargets[unit] == target) { stats.redundantSkipped++; return; }
+		if (activeUnit != unit)
+		{
+			glActiveTexture(GL_TEXTURE0 + unit);
+			activeUnit = unit;
+		}
+		glBindTexture(target, id);
+		textures[unit] = id;
+		textureTargets[unit] = target;
+		stats.textureChanges++;
+	}
+
+	void depth_func(GLenum func)
+	{
+		if (func == depthFunc) { stats.redundantSkipped++; return; }
+		glDepthFunc(func);
+		depthFunc = func;
+		stats.stateChanges++;
+	}
+
+	void depth_mask(bool write)
+	{
+		if ((int)write == depthWrite) { stats.redundantSkipped++; return; }
+		glDepthMask(write ? GL_TRUE : GL_FALSE);
+		depthWrite = (int)write;
+		stats.stateChanges++;
+	}
+
+	void blend_func(GLenum src, GLenum dst)
+	{
+		if (src == blendSrc && dst == blendDst) { stats.redundantSkipped++; return; }
+		glBlendFunc(src, dst);
+		blendSrc = src;
+		blendDst = dst;
+		stats.stateChanges++;
+	}
+
+	GLuint current_program() const { return program; }
+
+private:
+	GLuint program;
+	GLuint vao;
+	unsigned int activeUnit;
+	GLuint textures[MAX_MATERIAL_TEXTURES];
+	GLenum textureTargets[MAX_MATERIAL_TEXTURES];
+	GLenum depthFunc;
+	int depthWrite;
+	GLenum blendSrc, blendDst;
+};
+
+class RenderQueue;
+struct DrawPacket;
+
+// Sets the uniforms that are constant for the frame (view, projection, lights),
+// called the first time a program is bound in a frame.
+typedef void (*ProgramSetupFn)(RenderQueue& queue, GLuint program);
+// Sets uniforms that differ per packet beyond the "model" matrix.
+typedef void (*PacketUniformFn)(RenderQueue& queue, const DrawPacket& packet);
+
+struct DrawPacket {
+	uint64_t key;
+	GLuint program;
+	GLuint vao;
+	int material;
+	GLenum mode;
+	GLint first;
+	GLsizei count;
+	// GL_NONE for glDrawArrays, otherwise the index type and first is a byte offset
+	GLenum indexType;
+	glm::mat4 model;
+	// free per-packet data for the uniforms callback (particle offset/colour)
+	glm::vec4 params[2];
+	PacketUniformFn uniforms;
+	// filled in by flush(): size of the instanced run this packet starts, 0 if
+	// it was folded into an earlier packet's run
+	GLsizei instances;
+	GLuint firstInstance;
+};
+
+class RenderQueue
+{
+public:
+	RenderState state;
+
+	RenderQueue() : sorted(false), prepassed(false), prepassPass(PASS_OPAQUE), farPlane(100.0f), gpuProfiler(NULL)
+	{
+		// material 0 means "binds nothing"
+		Material none = {};
+		materials.push_back(none);
+	}
+
+	// Registers a texture set and returns the id used by submit()
+	int add_material(GLenum target0, GLuint tex0, GLenum target1 = GL_NONE, GLuint tex1 = 0, GLenum target2 = GL_NONE, GLuint tex2 = 0)
+	{
+		Material m = {};
+		GLenum targets[MAX_MATERIAL_TEXTURES] = { target0, target1, target2 };
+		GLuint textures[MAX_MATERIAL_TEXTURES] = { tex0, tex1, tex2 };
+		for (int i = 0; i < MAX_MATERIAL_TEXTURES && targets[i] != GL_NONE; i++)
+		{
+			m.targets[i] = targets[i];
+			m.textures[i] = textures[i];
+			m.count = i + 1;
+		}
+		materials.push_back(m);
+		return (int)materials.size() - 1;
+	}
+
+	void set_program_setup(GLuint program, ProgramSetupFn fn)
+	{
+		setups[program] = fn;
+	}
+
+	// Packets using this program take their model and normal matrices from
+	// instance attributes, identical mesh+material draws are merged.
+	void set_instanced(GLuint program)
+	{
+		instancedPrograms[program] = true;
+	}
+
+	// Packets of this program are drawn a first time by depth_prepass() and
+	// then shaded with GL_EQUAL, only where they are the nearest surface. The
+	// program must be instanced too.
+	void set_depth_prepass(GLuint program)
+	{
+		prepassPrograms[program] = true;
+	}
+
+	// flush() then times each run of draws with one program as a GPU pass,
+	// named by set_program_name
+	void set_gpu_profiler(GpuProfiler* profiler)
+	{
+		gpuProfiler = profiler;
+	}
+
+	// Instance data goes through the stream buffer's mapped ring
+	void set_stream_buffer(StreamBuffer* stream)
+	{
+		instanceBuffer.stream = stream;
+	}
+
+	void set_program_name(GLuint program, const char* name)
+	{
+		programNames[program] = name;
+	}
+
+	// Cached glGetUniformLocation. The cache is keyed on the name pointer so
+	// names must be string literals (or otherwise outlive the queue).
+	GLint uniform_location(GLuint program, const char* name)
+	{
+		std::pair<GLuint, const char*> key(program, name);
+		std::map<std::pair<GLuint, const char*>, GLint>::iterator it = locations.find(key);
+		if (it != locations.end())
+			return it->second;
+		GLint loc = glGetUniformLocation(program, name);
+		locations[key] = loc;
+		return loc;
+	}
+
+	// Drop cached locations, needed whenever a program is relinked or replaced
+	void forget_program(GLuint program)
+	{
+		std::map<std::pair<GLuint, const char*>, GLint>::iterator it = locations.begin();
+		while (it != locations.end())
+		{
+			if (it->first.first == program)
+				it = locations.erase(it);
+			else
+				++it;
+		}
+	}
+
+	// Moves everything registered for a program over to the one that
+	// replaces it, a shader reload
+	void replace_program(GLuint oldProgram, GLuint newProgram)
+	{
+		std::map<GLuint, ProgramSetupFn>::iterator setup = setups.find(oldProgram);
+		if (setup != setups.end())
+		{
+			setups[newProgram] = setup->second;
+			setups.erase(setup);
+		}
+		std::map<GLuint, bool>::iterator instanced = instancedPrograms.find(oldProgram);
+		if (instanced != instancedPrograms.end())
+		{
+			instancedPrograms[newProgram] = instanced->second;
+			instancedPrograms.erase(instanced);
+		}
+		std::map<GLuint, bool>::iterator prepass = prepassPrograms.find(oldProgram);
+		if (prepass != prepassPrograms.end())
+		{
+			prepassPrograms[newProgram] = prepass->second;
+			prepassPrograms.erase(prepass);
+		}
+		std::map<GLuint, const char*>::iterator name = programNames.find(oldProgram);
+		if (name != programNames.end())
+		{
+			programNames[newProgram] = name->second;
+			programNames.erase(name);
+		}
+		forget_program(oldProgram);
+		// the old id may be handed out again once it is deleted
+		state.invalidate();
+	}
+
+	// With an arena the frame's packets are allocated from it. Last frame's
+	// list is left where it is, the arena it came from is reset a frame later.
+	void begin_frame(const glm::mat4& viewMatrix, float far_plane, FrameArena* arena = NULL)
+	{
+		view = viewMatrix;
+		farPlane = far_plane;
+		if (arena || packets.get_allocator().arena)
+		{
+			size_t lastCount = packets.size();
+			packets = FrameVector<DrawPacket>(arena);
+			packets.reserve(lastCount);
+		}
+		else
+		{
+			packets.clear();
+		}
+		sorted = false;
+		prepassed = false;
+		setupDone.clear();
+		state.stats.reset();
+	}
+
+	DrawPacket& submit(RenderPass pass, GLuint program, GLuint vao, int material, GLenum mode, GLint first, GLsizei count, const glm::mat4& model = glm::mat4(1.0f))
+	{
+		DrawPacket p;
+		p.program = program;
+		p.vao = vao;
+		p.material = material;
+		p.mode = mode;
+		p.first = first;
+		p.count = count;
+		p.indexType = GL_NONE;
+		p.model = model;
+		p.instances = 1;
+		p.firstInstance = 0;
+		p.params[0] = p.params[1] = glm::vec4(0.0f);
+		p.uniforms = NULL;
+		p.key = make_key(pass, program, material, vao, view_depth(model, pass));
+		packets.push_back(p);
+		sorted = false;
+		state.stats.packets++;
+		return packets.back();
+	}
+
+	// Writes the depth of pass's packets whose programs take a pre-pass with
+	// depthProgram, which must take the same instance attributes and write
+	// nothing but depth (colour writes are the caller's to mask). The runs go
+	// nearest first. Call before flushing the pass.
+	void depth_prepass(RenderPass pass, GLuint depthProgram)
+	{
+		if (depthProgram == 0)
+			return;
+		sort();
+		prepassRuns.clear();
+		for (size_t i = 0; i < packets.size(); i++)
+		{
+			const DrawPacket& p = packets[i];
+			if (p.instances == 0 || p.program == 0 || packet_pass(p) != pass || !is_prepassed(p.program))
+				continue;
+			// a run's first packet is its nearest
+			prepassRuns.push_back(std::make_pair((uint32_t)(p.key & ((1u << KEY_DEPTH_BITS) - 1)), (uint32_t)i));
+		}
+		std::sort(prepassRuns.begin(), prepassRuns.end());
+
+		state.depth_func(GL_LESS);
+		state.depth_mask(true);
+		use(depthProgram);
+		for (size_t i = 0; i < prepassRuns.size(); i++)
+		{
+			const DrawPacket& p = packets[prepassRuns[i].second];
+			state.bind_vertex_array(p.vao);
+			instanceBuffer.bind_attributes(p.firstInstance);
+			if (p.indexType == GL_NONE)
+				glDrawArraysInstanced(p.mode, p.first, p.count, p.instances);
+			else
+				glDrawElementsInstanced(p.mode, p.count, p.indexType, (void*)(size_t)p.first, p.instances);
+			state.stats.instances += p.instances;
+			state.stats.draws++;
+		}
+		state.bind_vertex_array(0);
+		prepassed = true;
+		prepassPass = pass;
+	}
+
+	// Sorts the frame's packets and issues those of passes first..last with
+	// redundant state filtered out. A frame may be flushed a few passes at a
+	// time with other drawing in between, it is only sorted once.
+	void flush(RenderPass first = PASS_GBUFFER, RenderPass last = PASS_TRANSPARENT)
+	{
+		sort();
+
+		int currentPass = -1;
+		int currentMaterial = -1;
+		GLuint timedProgram = 0;
+		for (size_t i = 0; i < packets.size(); i++)
+		{
+			const DrawPacket& p = packets[i];
+			// folded into an earlier run, or its program is still compiling
+			if (p.instances == 0 || p.program == 0)
+				continue;
+			int pass = packet_pass(p);
+			if (pass < first)
+				continue;
+			if (pass > last)
+				break;
+			if (gpuProfiler && (pass != currentPass || p.program != timedProgram))
+			{
+				if (timedProgram)
+					gpuProfiler->end();
+				gpuProfiler->begin(program_name(p.program));
+				timedProgram = p.program;
+			}
+			if (pass != currentPass)
+			{
+				begin_pass((RenderPass)pass);
+				currentPass = pass;
+			}
+			if (prepassed && pass == prepassPass)
+			{
+				// shaded only where the pre-pass left it in front
+				bool equal = is_prepassed(p.program);
+				state.depth_func(equal ? GL_EQUAL : GL_LESS);
+				state.depth_mask(!equal);
+			}
+
+			use(p.program);
+
+			state.bind_vertex_array(p.vao);
+			if (p.material != currentMaterial)
+			{
+				const Material& m = materials[p.material];
+				for (int t = 0; t < m.count; t++)
+					state.bind_texture(t, m.targets[t], m.textures[t]);
+				currentMaterial = p.material;
+			}
+			else
+			{
+				state.stats.redundantSkipped++;
+			}
+
+			if (p.uniforms)
+				p.uniforms(*this, p);
+
+			if (is_instanced(p.program))
+			{
+				instanceBuffer.bind_attributes(p.firstInstance);
+				if (p.indexType == GL_NONE)
+					glDrawArraysInstanced(p.mode, p.first, p.count, p.instances);
+				else
+					glDrawElementsInstanced(p.mode, p.count, p.indexType, (void*)(size_t)p.first, p.instances);
+				state.stats.instances += p.instances;
+			}
+			else
+			{
+				GLint modelLoc = uniform_location(p.program, "model");
+				if (modelLoc >= 0)
+					glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(p.model));
+				if (p.indexType == GL_NONE)
+					glDrawArrays(p.mode, p.first, p.count);
+				else
+					glDrawElements(p.mode, p.count, p.indexType, (void*)(size_t)p.first);
+				state.stats.instances++;
+			}
+			state.stats.draws++;
+		}
+		if (gpuProfiler && timedProgram)
+			gpuProfiler->end();
+
+		// leave GL in the state the rest of the code expects
+		state.depth_func(GL_LESS);
+		state.depth_mask(true);
+		state.blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		state.bind_vertex_array(0);
+	}
+
+	const RenderStats& stats() const { return state.stats; }
+
+private:
+	FrameVector<DrawPacket> packets;
+	// packets is in key order and its instance runs are uploaded
+	bool sorted;
+	// depth_prepass() has drawn prepassPass this frame
+	bool prepassed;
+	RenderPass prepassPass;
+	// the pre-pass's runs, view depth and packet index
+	std::vector<std::pair<uint32_t, uint32_t> > prepassRuns;
+	std::vector<Material> materials;
+	std::map<GLuint, ProgramSetupFn> setups;
+	// programs set up this frame, a handful at most
+	std::vector<GLuint> setupDone;
+	std::map<std::pair<GLuint, const char*>, GLint> locations;
+	std::map<GLuint, bool> instancedPrograms;
+	std::map<GLuint, bool> prepassPrograms;
+	std::map<GLuint, const char*> programNames;
+	InstanceBuffer instanceBuffer;
+	glm::mat4 view;
+	float farPlane;
+	GpuProfiler* gpuProfiler;
+
+	const char* program_name(GLuint program) const
+	{
+		std::map<GLuint, const char*>::const_iterator it = programNames.find(program);
+		return it != programNames.end() ? it->second : "unnamed program";
+	}
+
+	static bool packet_less(const DrawPacket& a, const DrawPacket& b)
+	{
+		return a.key < b.key;
+	}
+
+	bool is_instanced(GLuint program) const
+	{
+		return instancedPrograms.find(program) != instancedPrograms.end();
+	}
+
+	bool is_prepassed(GLuint program) const
+	{
+		return prepassPrograms.find(program) != prepassPrograms.end();
+	}
+
+	static int packet_pass(const DrawPacket& p)
+	{
+		return (int)(p.key >> (64 - KEY_PASS_BITS));
+	}
+
+	void sort()
+	{
+		if (sorted)
+			return;
+		std::sort(packets.begin(), packets.end(), packet_less);
+		build_instance_runs();
+		sorted = true;
+	}
+
+	// Binds program, running its setup the first time it is bound in the frame
+	void use(GLuint program)
+	{
+		state.use_program(program);
+		if (std::find(setupDone.begin(), setupDone.end(), program) == setupDone.end())
+		{
+			setupDone.push_back(program);
+			std::map<GLuint, ProgramSetupFn>::iterator it = setups.find(program);
+			if (it != setups.end() && it->second)
+				it->second(*this, program);
+		}
+	}
+
+	// Same state and same vertex range, only the depth bits may differ
+	static bool same_mesh(const DrawPacket& a, const DrawPacket& b)
+	{
+		return (a.key >> KEY_DEPTH_BITS) == (b.key >> KEY_DEPTH_BITS)
+			&& a.program == b.program && a.vao == b.vao && a.material == b.material
+			&& a.mode == b.mode && a.first == b.first && a.count == b.count
+			&& a.indexType == b.indexType && a.uniforms == NULL && b.uniforms == NULL;
+	}
+
+	// Walks the sorted packets and folds runs of the same mesh into one
+	// instanced draw, then uploads all the instance data for the frame at once
+	void build_instance_runs()
+	{
+		instanceBuffer.begin_frame();
+		size_t i = 0;
+		while (i < packets.size())
+		{
+			DrawPacket& head = packets[i];
+			if (!is_instanced(head.program))
+			{
+				i++;
+				continue;
+			}
+			head.firstInstance = instanceBuffer.add(head.model);
+			head.instances = 1;
+			size_t j = i + 1;
+			while (j < packets.size() && same_mesh(head, packets[j]))
+			{
+				instanceBuffer.add(packets[j].model);
+				packets[j].instances = 0;
+				head.instances++;
+				j++;
+			}
+			i = j;
+		}
+		if (instanceBuffer.size() > 0)
+			instanceBuffer.upload();
+	}
+
+	// Fixed-function state per pass goes through the cache like everything else
+	void begin_pass(RenderPass pass)
+	{
+		switch (pass) {
+		case PASS_GBUFFER:
+		case PASS_OPAQUE:
+			state.depth_func(GL_LESS);
+			state.depth_mask(true);
+			state.blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			break;
+		case PASS_SKY:
+			// depth test passes when values are equal to the cleared depth
+			state.depth_func(GL_LEQUAL);
+			state.depth_mask(true);
+			break;
+		case PASS_TRANSPARENT:
+			state.depth_func(GL_LESS);
+			state.depth_mask(false);
+			state.blend_func(GL_SRC_ALPHA, GL_ONE);
+			break;
+		default:
+			break;
+		}
+	}
+
+	// Quantised view-space distance. Opaque draws go front to back, transparent
+	// ones back to front. The transparent pass is additive so state still sorts
+	// ahead of depth there.
+	uint32_t view_depth(const glm::mat4& model, RenderPass pass) const
+	{
+		glm::vec4 centre = view * model[3];
+		float d = -centre.z / farPlane;
+		if (d < 0.0f) d = 0.0f;
+		if (d > 1.0f) d = 1.0f;
+		uint32_t maxDepth = (1u << KEY_DEPTH_BITS) - 1;
+		uint32_t q = (uint32_t)(d * maxDepth);
+		return pass == PASS_TRANSPARENT ? maxDepth - q : q;
+	}
+
+	static uint64_t make_key(RenderPass pass, GLuint program, int material, GLuint vao, uint32_t depth)
+	{
+		uint64_t key = 0;
+		key |= (uint64_t)(pass & ((1 << KEY_PASS_BITS) - 1));
+		key = (key << KEY_PROGRAM_BITS) | (uint64_t)(program & ((1 << KEY_PROGRAM_BITS) - 1));
+		key = (key << KEY_MATERIAL_BITS) | (uint64_t)(material & ((1 << KEY_MATERIAL_BITS) - 1));
+		key = (key << KEY_VAO_BITS) | (uint64_t)(vao & ((1 << KEY_VAO_BITS) - 1));
+		key = (key << KEY_DEPTH_BITS) | (uint64_t)(depth & ((1 << KEY_DEPTH_BITS) - 1));
+		return key;
+	}
+};
+
+#endif
@@ -0,0 +1,450 @@
+// Program binary cache, see shader_cache.h
+#include "shader_cache.h"
+#include "platform.h"
+#include "profiler.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock cache_clock;
+
+// What a binary file starts with, the program binary follows
+struct BinaryHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t format;
+	uint32_t length;
+	double compileMs;
+};
+
+static double elapsed_ms (cache_clock::time_point start) {
+	return std::chrono::duration<double, std::milli> (cache_clock::now () - start).count ();
+}
+
+// FNV-1a, continued from hash
+static uint64_t hash_bytes (uint64_t hash, const void* data, size_t bytes) {
+	const unsigned char* p = (const unsigned char*)data;
+	for (size_t i = 0; i < bytes; i++) {
+		hash ^= p[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static uint64_t hash_string (uint64_t hash, const std::string& s) {
+	// the terminator keeps "ab" + "c" apart from "a" + "bc"
+	return hash_bytes (hash, s.c_str (), s.size () + 1);
+}
+
+static const char* stage_name (GLenum type) {
+	return type == GL_VERTEX_SHADER ? "vertex" : type == GL_FRAGMENT_SHADER ? "fragment" : "shader";
+}
+
+bool read_text_file (const char* path, std::string& text) {
+	FILE* fp = platform_fopen (path, "rb");
+	if (fp == NULL)
+		return false;
+	fseek (fp, 0L, SEEK_END);
+	long size = ftell (fp);
+	fseek (fp, 0L, SEEK_SET);
+	text.resize (size > 0 ? (size_t)size : 0);
+	size_t got = size > 0 ? fread (&text[0], 1, (size_t)size, fp) : 0;
+	text.resize (got);
+	fclose (fp);
+	return true;
+}
+
+ShaderCache::ShaderCache () : binaries (false), parallelCompile (false), releasePending (false), pendingCount (0) {
+	memset (&stats, 0, sizeof (stats));
+}
+
+void ShaderCache::init (bool use_binaries) {
+	const char* vendor = (const char*)glGetString (GL_VENDOR);
+	const char* renderer = (const char*)glGetString (GL_RENDERER);
+	const char* version = (const char*)glGetString (GL_VERSION);
+	driver = std::string (vendor ? vendor : "") + "\n" + (renderer ? renderer : "") + "\n" + (version ? version : "");
+
+	GLint formats = 0;
+	if (GLEW_ARB_get_program_binary || GLEW_VERSION_4_1)
+		glGetIntegerv (GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	binaries = use_binaries && formats > 0;
+	if (use_binaries && !binaries)
+		printf ("shader cache: the driver has no program binary format, compiling every program\n");
+	if (binaries)
+		platform_mkdir (SHADER_CACHE_DIR);
+
+	// the driver picks how many threads it compiles on
+	parallelCompile = gl_has_extension ("GL_KHR_parallel_shader_compile") || gl_has_extension ("GL_ARB_parallel_shader_compile");
+}
+
+GLuint ShaderCache::submit (const char* name, const ShaderStage* stages, int count) {
+	if (stats.programs == 0)
+		firstSubmit = cache_clock::now ();
+	stats.programs++;
+	return submit_program (name, stages, count, 0);
+}
+
+GLuint ShaderCache::submit_program (const char* name, const ShaderStage* stages, int count, GLuint replaces) {
+	PROFILE_FUNCTION ();
+	cache_clock::time_point start = cache_clock::now ();
+	Program p;
+	p.name = name;
+	p.replaces = replaces;
+	p.stages.assign (stages, stages + count);
+	p.sources.resize (count);
+	p.key = hash_string (14695981039346656037ull, driver);
+	for (int i = 0; i < count; i++) {
+		if (!read_text_file (stages[i].path, p.sources[i])) {
+			fprintf (stderr, "Error reading shader %s\n", stages[i].path);
+			return 0;
+		}
+		p.key = hash_bytes (p.key, &stages[i].type, sizeof (stages[i].type));
+		p.key = hash_string (p.key, stages[i].defines ? stages[i].defines : "");
+		p.key = hash_string (p.key, p.sources[i]);
+	}
+
+	GLuint program = glCreateProgram ();
+	if (program == 0) {
+		fprintf (stderr, "Error creating shader program %s\n", name);
+		return 0;
+	}
+
+	// traces have to carry the sources, see shader_cache.h
+	p.saveBinary = binaries && !gl_capture_active ();
+	p.state = PROGRAM_PENDING;
+	p.fromBinary = false;
+	p.start = start;
+	p.loadMs = 0.0;
+	p.savedMs = 0.0;
+	if (p.saveBinary && load_binary (program, binary_path (name), p.key, p.savedMs)) {
+		p.fromBinary = true;
+		p.loadMs = elapsed_ms (start);
+	}
+	else if (!compile_and_link (program, p)) {
+		glDeleteProgram (program);
+		return 0;
+	}
+	programs[program] = p;
+	pendingCount++;
+	stats.submitMs += elapsed_ms (start);
+	return program;
+}
+
+int ShaderCache::poll (ProgramDoneFn done) {
+	if (pendingCount == 0)
+		return 0;
+	PROFILE_FUNCTION ();
+	cache_clock::time_point start = cache_clock::now ();
+	for (std::map<GLuint, Program>::iterator it = programs.begin (); it != programs.end (); ++it) {
+		if (it->second.state == PROGRAM_PENDING && link_done (it->first))
+			finish (it->first, it->second, done);
+	}
+	// without the extension the link status query in finish() blocks
+	if (!parallelCompile)
+		stats.waitMs += elapsed_ms (start);
+
+	for (size_t i = 0; i < retired.size (); i++) {
+		glDeleteProgram (retired[i]);
+		programs.erase (retired[i]);
+	}
+	retired.clear ();
+	if (pendingCount == 0 && !reloadAgain.empty ()) {
+		std::vector<std::string> paths;
+		paths.swap (reloadAgain);
+		for (size_t i = 0; i < paths.size (); i++)
+			reload (paths[i].c_str ());
+	}
+	return pendingCount;
+}
+
+int ShaderCache::reload (const char* path) {
+	// the compiled stages of the old source go, shared ones are compiled again once
+	std::string prefix = std::string (path) + "\n";
+	for (std::map<std::string, GLuint>::iterator it = shaderObjects.begin (); it != shaderObjects.end (); ) {
+		if (it->first.compare (0, prefix.size (), prefix) == 0) {
+			glDeleteShader (it->second);
+			it = shaderObjects.erase (it);
+		}
+		else {
+			++it;
+		}
+	}
+
+	std::vector<GLuint> targets;
+	bool later = false;
+	for (std::map<GLuint, Program>::const_iterator it = programs.begin (); it != programs.end (); ++it) {
+		bool uses = false;
+		for (size_t i = 0; i < it->second.stages.size (); i++)
+			uses = uses || strcmp (it->second.stages[i].path, path) == 0;
+		if (!uses || it->second.replaces != 0)
+			continue;
+		if (it->second.state == PROGRAM_PENDING || reloading (it->first))
+			later = true;
+		else
+			targets.push_back (it->first);
+	}
+	if (later && std::find (reloadAgain.begin (), reloadAgain.end (), path) == reloadAgain.end ())
+		reloadAgain.push_back (path);
+
+	for (size_t i = 0; i < targets.size (); i++) {
+		// copied, submitting adds to programs
+		Program old = programs[targets[i]];
+		if (submit_program (old.name.c_str (), &old.stages[0], (int)old.stages.size (), targets[i]) == 0)
+			stats.reloadsFailed++;
+	}
+	release_shaders ();
+	return (int)targets.size ();
+}
+
+bool ShaderCache::reloading (GLuint program) const {
+	for (std::map<GLuint, Program>::const_iterator it = programs.begin (); it != programs.end (); ++it) {
+		if (it->second.replaces == program)
+			return true;
+	}
+	return false;
+}
+
+void ShaderCache::wait_all (ProgramDoneFn done) {
+	cache_clock::time_point start = cache_clock::now ();
+	while (poll (done) > 0)
+		std::this_thread::yield ();
+	if (parallelCompile)
+		stats.waitMs += elapsed_ms (start);
+}
+
+GLuint ShaderCache::build (const char* name, const ShaderStage* stages, int count) {
+	GLuint program = submit (name, stages, count);
+	if (program == 0)
+		return 0;
+	while (state (program) == PROGRAM_PENDING) {
+		poll ();
+		std::this_thread::yield ();
+	}
+	return ready (program) ? program : 0;
+}
+
+ProgramState ShaderCache::state (GLuint program) const {
+	std::map<GLuint, Program>::const_iterator it = programs.find (program);
+	return it != programs.end () ? it->second.state : PROGRAM_FAILED;
+}
+
+bool ShaderCache::compile_and_link (GLuint program, const Program& p) {
+	for (size_t i = 0; i < p.stages.size (); i++) {
+		GLuint shader = compile_stage (p.stages[i], p.sources[i]);
+		if (shader == 0)
+			return false;
+		glAttachShader (program, shader);
+	}
+	if (p.saveBinary)
+		glProgramParameteri (program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram (program);
+	return true;
+}
+
+bool ShaderCache::link_done (GLuint program) const {
+	if (!parallelCompile)
+		return true;
+	GLint done = GL_FALSE;
+	glGetProgramiv (program, GL_COMPLETION_STATUS_KHR, &done);
+	return done == GL_TRUE;
+}
+
+void ShaderCache::finish (GLuint program, Program& p, ProgramDoneFn done) {
+	GLint linked = 0;
+	glGetProgramiv (program, GL_LINK_STATUS, &linked);
+	if (!linked && p.fromBinary) {
+		// the driver changed without its version string doing so, build it
+		// from source and come back for it on a later poll
+		stats.rejected++;
+		p.fromBinary = false;
+		p.savedMs = 0.0;
+		p.start = cache_clock::now ();
+		if (compile_and_link (program, p))
+			return;
+	}
+
+	if (!linked) {
+		print_stage_logs (p);
+		GLchar log[1024] = { '\0' };
+		glGetProgramInfoLog (program, sizeof (log), NULL, log);
+		fprintf (stderr, "Error linking shader program %s: %s\n", p.name.c_str (), log);
+		p.state = PROGRAM_FAILED;
+	}
+	else if (p.fromBinary) {
+		// the start up figures leave reloads out
+		if (p.replaces == 0) {
+			stats.loaded++;
+			stats.loadMs += p.loadMs;
+			stats.savedMs += p.savedMs;
+		}
+		p.state = PROGRAM_READY;
+	}
+	else {
+		double compile_ms = elapsed_ms (p.start);
+		if (p.replaces == 0)
+			stats.compileMs += compile_ms;
+		if (p.saveBinary)
+			save_binary (program, binary_path (p.name), p.key, compile_ms);
+		p.state = PROGRAM_READY;
+	}
+
+	// the sources are only kept for a rejected binary
+	p.sources.clear ();
+	pendingCount--;
+	if (pendingCount == 0) {
+		if (stats.allReadyMs == 0.0)
+			stats.allReadyMs = elapsed_ms (firstSubmit);
+		if (releasePending)
+			release_shaders ();
+	}
+	GLuint replaced = p.replaces;
+	if (replaced != 0) {
+		// the survivor is a program like any other from now on
+		if (p.state == PROGRAM_READY) {
+			stats.reloads++;
+			retired.push_back (replaced);
+			p.replaces = 0;
+		}
+		else {
+			stats.reloadsFailed++;
+			retired.push_back (program);
+		}
+	}
+	if (done)
+		done (p.name.c_str (), program, replaced, p.state == PROGRAM_READY);
+}
+
+static std::string stage_id (const ShaderStage& stage) {
+	return std::string (stage.path) + "\n" + stage_name (stage.type) + "\n" + (stage.defines ? stage.defines : "");
+}
+
+GLuint ShaderCache::compile_stage (const ShaderStage& stage, const std::string& source) {
+	std::string id = stage_id (stage);
+	std::map<std::string, GLuint>::iterator it = shaderObjects.find (id);
+	if (it != shaderObjects.end ()) {
+		stats.stagesReused++;
+		return it->second;
+	}
+
+	GLuint shader = glCreateShader (stage.type);
+	if (shader == 0) {
+		fprintf (stderr, "Error creating shader...\n");
+		return 0;
+	}
+
+	// split the source after the #version line
+	size_t body = 0;
+	if (source.compare (0, 8, "#version") == 0) {
+		size_t eol = source.find ('\n');
+		body = eol == std::string::npos ? source.size () : eol + 1;
+	}
+	std::string version = source.substr (0, body);
+	const GLchar* parts[3] = { version.c_str (), stage.defines ? stage.defines : "", source.c_str () + body };
+	glShaderSource (shader, 3, parts, NULL);
+	// the compile status is left for finish(), asking for it here would wait
+	glCompileShader (shader);
+	stats.stagesCompiled++;
+	shaderObjects[id] = shader;
+	return shader;
+}
+
+void ShaderCache::print_stage_logs (const Program& p) {
+	for (size_t i = 0; i < p.stages.size (); i++) {
+		std::map<std::string, GLuint>::iterator it = shaderObjects.find (stage_id (p.stages[i]));
+		if (it == shaderObjects.end ())
+			continue;
+		GLint success = 0;
+		glGetShaderiv (it->second, GL_COMPILE_STATUS, &success);
+		if (!success) {
+			GLchar log[1024] = { '\0' };
+			glGetShaderInfoLog (it->second, sizeof (log), NULL, log);
+			fprintf (stderr, "Error compiling %s shader %s: %s\n", stage_name (p.stages[i].type), p.stages[i].path, log);
+		}
+	}
+}
+
+bool ShaderCache::load_binary (GLuint program, const std::string& path, uint64_t key, double& compile_ms) {
+	FILE* fp = platform_fopen (path.c_str (), "rb");
+	if (fp == NULL)
+		return false;
+	BinaryHeader header;
+	bool ok = fread (&header, sizeof (header), 1, fp) == 1
+		&& header.magic == SHADER_CACHE_MAGIC && header.version == SHADER_CACHE_VERSION && header.key == key;
+	std::vector<unsigned char> data;
+	if (ok) {
+		data.resize (header.length);
+		ok = header.length > 0 && fread (&data[0], 1, header.length, fp) == header.length;
+	}
+	fclose (fp);
+	if (!ok) {
+		// stale sources or another driver, rebuilt and overwritten
+		stats.rejected++;
+		return false;
+	}
+
+	// whether the driver takes it is known once the link status is, see finish()
+	glProgramBinary (program, header.format, &data[0], (GLsizei)header.length);
+	compile_ms = header.compileMs;
+	return true;
+}
+
+void ShaderCache::save_binary (GLuint program, const std::string& path, uint64_t key, double compile_ms) {
+	GLint length = 0;
+	glGetProgramiv (program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	std::vector<unsigned char> data (length);
+	GLenum format = 0;
+	glGetProgramBinary (program, length, &length, &format, &data[0]);
+
+	BinaryHeader header;
+	header.magic = SHADER_CACHE_MAGIC;
+	header.version = SHADER_CACHE_VERSION;
+	header.key = key;
+	header.format = format;
+	header.length = (uint32_t)length;
+	header.compileMs = compile_ms;
+	FILE* fp = platform_fopen (path.c_str (), "wb");
+	if (fp == NULL) {
+		fprintf (stderr, "WARNING: could not write %s\n", path.c_str ());
+		return;
+	}
+	fwrite (&header, sizeof (header), 1, fp);
+	fwrite (&data[0], 1, length, fp);
+	fclose (fp);
+}
+
+void ShaderCache::release_shaders () {
+	// a rejected binary or a failed link still needs them
+	if (pendingCount > 0) {
+		releasePending = true;
+		return;
+	}
+	releasePending = false;
+	// attached shaders are only flagged, the programs keep them
+	for (std::map<std::string, GLuint>::iterator it = shaderObjects.begin (); it != shaderObjects.end (); ++it) {
+		glDeleteShader (it->second);
+	}
+	shaderObjects.clear ();
+}
+
+std::string ShaderCache::binary_path (const std::string& name) const {
+	return std::string (SHADER_CACHE_DIR) + "/" + name + ".bin";
+}
+
+void ShaderCache::print () const {
+	// compiles overlap the loading, so their times are how long each took to
+	// be ready rather than driver time
+	printf ("shader cache: %u programs, %u from binaries (%.1f ms, %.1f ms until linked when they were compiled), %u compiled (%.1f ms until linked), %u stages compiled, %u reused, %u binaries rejected\n",
+		stats.programs, stats.loaded, stats.loadMs, stats.savedMs,
+		stats.programs - stats.loaded, stats.compileMs, stats.stagesCompiled, stats.stagesReused, stats.rejected);
+	printf ("shader cache: %.1f ms submitting, %.1f ms waiting for the driver, %d pending, all ready %.1f ms after the first submit (%s)\n",
+		stats.submitMs, stats.waitMs, pendingCount, stats.allReadyMs, parallelCompile ? "parallel compile" : "no parallel compile");
+	if (stats.reloads > 0 || stats.reloadsFailed > 0)
+		printf ("shader cache: %u programs reloaded, %u reloads failed\n", stats.reloads, stats.reloadsFailed);
+}
@@ -0,0 +1,177 @@
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+// Builds the shader programs, from program binaries saved by an earlier run
+// when it can. A binary is only good for the driver that produced it and the
+// sources it was built from, so each file carries a hash of the vendor,
+// renderer and version strings and of every stage's source and defines; any
+// mismatch, or a driver that turns the binary down, falls back to compiling
+// from source and writes a fresh binary.
+//
+// Stages shared between programs (lightingVertex.txt is in three) are
+// compiled once and the shader object attached to each.
+//
+// While a GL capture is running programs are always built from source, so
+// traces don't depend on a driver's binary format.
+//
+// submit() hands every stage and the link to the driver without asking how
+// they went, so a driver that compiles on its own threads works on all of
+// them while the caller loads meshes and textures. poll() then picks up the
+// programs that have finished, without blocking where the driver has
+// KHR/ARB_parallel_shader_compile; elsewhere it asks for the link status,
+// which waits, but only once the rest of the loading is done.
+//
+//   GLuint p = cache.submit("light", stages, 2);
+//   ... load meshes ...
+//   cache.poll(on_done);  // once a frame until it returns 0
+//   if (cache.ready(p)) ... draw with p ...
+//
+// reload() rebuilds the programs that use a changed file the same way. The
+// new program only takes the old one's place once it has linked, in a
+// poll() on the render thread between frames; if it fails the old one is
+// kept and the log printed.
+
+// OpenGL includes
+#include "gl_includes.h"
+
+#include <stdint.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#define SHADER_CACHE_DIR "shader_cache"
+#define SHADER_CACHE_MAGIC 0x48534c47 // "GLSH"
+#define SHADER_CACHE_VERSION 2
+
+// One stage of a program. defines, if not NULL, is inserted after the
+// #version line so one source file can be built into several variants.
+struct ShaderStage {
+	const char* path;
+	GLenum type;
+	const char* defines;
+};
+
+enum ProgramState {
+	PROGRAM_PENDING,
+	PROGRAM_READY,
+	PROGRAM_FAILED
+};
+
+// Called by poll() for each program as it finishes, linked is false if it
+// failed to compile or link (the logs have been printed). For a reload
+// replaced is the program it stands in for, which is deleted after the call
+// if linked and kept otherwise.
+typedef void (*ProgramDoneFn)(const char* name, GLuint program, GLuint replaced, bool linked);
+
+struct ShaderCacheStats {
+	unsigned int programs;
+	unsigned int loaded;
+	unsigned int rejected;
+	unsigned int stagesCompiled;
+	unsigned int stagesReused;
+	// compiling and linking the programs that had to be built, from submit()
+	// until poll() found them linked
+	double compileMs;
+	// loading the ones that had binaries
+	double loadMs;
+	// what the loaded programs took to compile when their binaries were saved
+	double savedMs;
+	// in submit(), and blocked in poll() waiting for the driver
+	double submitMs;
+	double waitMs;
+	// from the first submit() until the last program was ready
+	double allReadyMs;
+	unsigned int reloads;
+	unsigned int reloadsFailed;
+};
+
+class ShaderCache
+{
+public:
+	ShaderCacheStats stats;
+
+	ShaderCache();
+
+	// Reads the driver strings the binaries are keyed on. Binaries are only
+	// used with use_binaries set and a driver that has a binary format.
+	void init(bool use_binaries);
+
+	// Starts building the program made of the stages and returns it at once,
+	// 0 if a source could not be read. The program can't be used before
+	// ready() says so. name picks the binary's file. The stages' strings must
+	// outlive the build.
+	GLuint submit(const char* name, const ShaderStage* stages, int count);
+
+	// Finishes what the driver has done with, calling done (if not NULL) for
+	// each program. Returns how many are still pending.
+	int poll(ProgramDoneFn done = NULL);
+
+	// poll() until nothing is pending
+	void wait_all(ProgramDoneFn done = NULL);
+
+	// Rebuilds every program with path among its stages, returns how many.
+	// Programs still pending are rebuilt once they are done.
+	int reload(const char* path);
+
+	// submit() and wait for it, 0 if it failed
+	GLuint build(const char* name, const ShaderStage* stages, int count);
+
+	ProgramState state(GLuint program) const;
+	bool ready(GLuint program) const { return state(program) == PROGRAM_READY; }
+	int pending() const { return pendingCount; }
+	// the driver reports completion without blocking
+	bool parallel() const { return parallelCompile; }
+
+	// Deletes the shader objects kept for reuse once every program is built,
+	// straight away if none is pending
+	void release_shaders();
+
+	void print() const;
+
+private:
+	struct Program {
+		std::string name;
+		std::vector<ShaderStage> stages;
+		std::vector<std::string> sources;
+		uint64_t key;
+		// the program this one reloads, 0 if none
+		GLuint replaces;
+		ProgramState state;
+		bool fromBinary;
+		bool saveBinary;
+		std::chrono::steady_clock::time_point start;
+		double loadMs;
+		double savedMs;
+	};
+
+	bool binaries;
+	bool parallelCompile;
+	bool releasePending;
+	int pendingCount;
+	std::chrono::steady_clock::time_point firstSubmit;
+	std::string driver;
+	// compiled stages by path, type and defines
+	std::map<std::string, GLuint> shaderObjects;
+	std::map<GLuint, Program> programs;
+	// deleted by poll() once the callbacks have run
+	std::vector<GLuint> retired;
+	// changed while programs using them were still pending
+	std::vector<std::string> reloadAgain;
+
+	GLuint submit_program(const char* name, const ShaderStage* stages, int count, GLuint replaces);
+	bool reloading(GLuint program) const;
+	GLuint compile_stage(const ShaderStage& stage, const std::string& source);
+	bool compile_and_link(GLuint program, const Program& p);
+	bool link_done(GLuint program) const;
+	void finish(GLuint program, Program& p, ProgramDoneFn done);
+	void print_stage_logs(const Program& p);
+	bool load_binary(GLuint program, const std::string& path, uint64_t key, double& compile_ms);
+	void save_binary(GLuint program, const std::string& path, uint64_t key, double compile_ms);
+	std::string binary_path(const std::string& name) const;
+};
+
+// Reads a whole file, false if it can't be opened
+bool read_text_file(const char* path, std::string& text);
+
+#endif
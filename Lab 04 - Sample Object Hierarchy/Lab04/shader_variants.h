@@ -0,0 +1,172 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+// Builds one uber-shader into a specialised program per feature set, so the
+// choices are made by the preprocessor rather than by branching on uniforms
+// in every fragment. Features are #defines put after the fragment stage's
+// #version line: a switch is defined or not, a value is "#define NAME n".
+// A set of features is packed into a 32 bit key and each key's program is
+// submitted to the ShaderCache the first time it is asked for, which also
+// keeps its binary for the next run.
+//
+//   static const ShaderFeature features[] = { { "BLINN", 0 }, { "NUM_POINT_LIGHTS", 3 } };
+//   lit.init(&shader_cache, "multilight", vertex, fragment, features, 2);
+//   int values[] = { blinn, 4 };
+//   GLuint program = lit.program(lit.key(values)); // 0 until it has compiled
+//
+// Only the fragment stage gets the features, so the vertex stage is compiled
+// once and shared by every variant.
+
+#include "shader_cache.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+
+#define SHADER_VARIANTS_MAX_FEATURES 8
+
+struct ShaderFeature {
+	const char* name;
+	// 0 for a switch, otherwise how many bits its value takes in the key
+	int bits;
+};
+
+// Called as each variant is submitted, to register it with what draws it
+typedef void (*VariantCreatedFn)(GLuint program, uint32_t key);
+
+class ShaderVariants
+{
+public:
+	ShaderVariants() : cache(NULL), featureCount(0), created(NULL) {}
+
+	// The stages' paths and the fragment's defines (always put before the
+	// features) must outlive the variants
+	void init(ShaderCache* shader_cache, const char* family, const ShaderStage& vertex, const ShaderStage& fragment,
+		const ShaderFeature* feature_list, int count, VariantCreatedFn on_created = NULL)
+	{
+		cache = shader_cache;
+		name = family;
+		stages[0] = vertex;
+		stages[1] = fragment;
+		featureCount = count < SHADER_VARIANTS_MAX_FEATURES ? count : SHADER_VARIANTS_MAX_FEATURES;
+		int shift = 0;
+		for (int i = 0; i < featureCount; i++)
+		{
+			features[i] = feature_list[i];
+			shifts[i] = shift;
+			shift += width(i);
+		}
+		if (shift > 32)
+			fprintf(stderr, "ERROR: the features of %s need %d bits, keys have 32\n", family, shift);
+		created = on_created;
+	}
+
+	// One value per feature, switches take 0 or 1
+	uint32_t key(const int* values) const
+	{
+		uint32_t k = 0;
+		for (int i = 0; i < featureCount; i++)
+			k = with(k, i, values[i]);
+		return k;
+	}
+
+	// key with feature i changed to value
+	uint32_t with(uint32_t k, int i, int value) const
+	{
+		uint32_t mask = ((1u << width(i)) - 1) << shifts[i];
+		return (k & ~mask) | (((uint32_t)value << shifts[i]) & mask);
+	}
+
+	int value(uint32_t k, int i) const
+	{
+		return (int)((k >> shifts[i]) & ((1u << width(i)) - 1));
+	}
+
+	// The key's program, 0 until it has compiled. The first call for a key
+	// submits it, after that it is a lookup.
+	GLuint program(uint32_t k)
+	{
+		GLuint p = find_or_submit(k);
+		return cache->ready(p) ? p : 0;
+	}
+
+	// Starts compiling a variant that is going to be wanted
+	void prewarm(uint32_t k)
+	{
+		find_or_submit(k);
+	}
+
+	// Takes a reloaded program in place of the old one, false if the old one
+	// isn't one of ours
+	bool replace(GLuint oldProgram, GLuint newProgram)
+	{
+		for (std::map<uint32_t, Variant>::iterator it = variants.begin(); it != variants.end(); ++it)
+		{
+			if (it->second.program == oldProgram)
+			{
+				it->second.program = newProgram;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	int count() const { return (int)variants.size(); }
+
+private:
+	struct Variant {
+		GLuint program;
+		std::string name;
+		// the ShaderCache keeps a pointer to these for reloads
+		std::string defines;
+	};
+
+	ShaderCache* cache;
+	std::string name;
+	ShaderStage stages[2];
+	ShaderFeature features[SHADER_VARIANTS_MAX_FEATURES];
+	int shifts[SHADER_VARIANTS_MAX_FEATURES];
+	int featureCount;
+	VariantCreatedFn created;
+	std::map<uint32_t, Variant> variants;
+
+	int width(int i) const
+	{
+		return features[i].bits > 0 ? features[i].bits : 1;
+	}
+
+	GLuint find_or_submit(uint32_t k)
+	{
+		std::map<uint32_t, Variant>::iterator it = variants.find(k);
+		if (it != variants.end())
+			return it->second.program;
+
+		Variant& v = variants[k];
+		char id[16];
+		snprintf(id, sizeof(id), "_%x", k);
+		v.name = name + id;
+		v.defines = stages[1].defines ? stages[1].defines : "";
+		for (int i = 0; i < featureCount; i++)
+		{
+			int n = value(k, i);
+			char line[96];
+			if (features[i].bits > 0)
+				snprintf(line, sizeof(line), "#define %s %d\n", features[i].name, n);
+			else if (n)
+				snprintf(line, sizeof(line), "#define %s\n", features[i].name);
+			else
+				continue;
+			v.defines += line;
+		}
+		ShaderStage variant[2] = { stages[0], stages[1] };
+		variant[1].defines = v.defines.c_str();
+		// a failed submit stays 0, and is not tried again every frame
+		v.program = cache->submit(v.name.c_str(), variant, 2);
+		if (v.program && created)
+			created(v.program, k);
+		return v.program;
+	}
+};
+
+#endif
@@ -0,0 +1,222 @@
+// Cascaded shadow maps for the directional light, see shadow_cascades.h
+#include "shadow_cascades.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "profiler.h"
+
+// Offsets of the lookups that keep lit surfaces from shadowing themselves, in
+// texels of the cascade's map: along the surface normal in world space, and
+// towards the light in depth
+#define SHADOW_NORMAL_OFFSET 1.5f
+#define SHADOW_DEPTH_BIAS 1.0f
+
+ShadowCascades::ShadowCascades () : splitLambda (0.75f), shadowDistance (60.0f), size (0), texture (0), fbo (0), frame (0),
+	lightModelProgram (0), lightModelLocation (-1) {
+	memset (&stats, 0, sizeof (stats));
+	for (int c = 0; c < SHADOW_CASCADES; c++) {
+		// the far cascades cover the most ground, so the camera moving
+		// changes least of what they show
+		intervals[c] = c < 2 ? 1 : c;
+		valid[c] = false;
+		params[c] = glm::vec4 (0.0f);
+		snprintf (names[c], sizeof (names[c]), "shadow cascade %d", c);
+	}
+}
+
+bool ShadowCascades::init (int map_size) {
+	size = map_size;
+	glGenTextures (1, &texture);
+	glBindTexture (GL_TEXTURE_2D_ARRAY, texture);
+	glTexImage3D (GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, SHADOW_CASCADES, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	// a lookup compares against the four nearest texels and blends the
+	// results, a 2x2 PCF in hardware; no mipmaps, so no derivatives needed
+	glTexParameteri (GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri (GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri (GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri (GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri (GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri (GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glBindTexture (GL_TEXTURE_2D_ARRAY, 0);
+
+	GLint previous = 0;
+	glGetIntegerv (GL_FRAMEBUFFER_BINDING, &previous);
+	glGenFramebuffers (1, &fbo);
+	glBindFramebuffer (GL_FRAMEBUFFER, fbo);
+	glFramebufferTextureLayer (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, 0);
+	// depth only
+	GLenum none = GL_NONE;
+	glDrawBuffers (1, &none);
+	glReadBuffer (GL_NONE);
+	GLenum status = glCheckFramebufferStatus (GL_FRAMEBUFFER);
+	glBindFramebuffer (GL_FRAMEBUFFER, previous);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf (stderr, "ERROR: shadow map framebuffer incomplete (0x%x)\n", status);
+		release ();
+		return false;
+	}
+	return true;
+}
+
+void ShadowCascades::release () {
+	if (fbo)
+		glDeleteFramebuffers (1, &fbo);
+	if (texture)
+		glDeleteTextures (1, &texture);
+	fbo = 0;
+	texture = 0;
+	for (int c = 0; c < SHADOW_CASCADES; c++)
+		valid[c] = false;
+}
+
+void ShadowCascades::begin_frame () {
+	casters.clear ();
+}
+
+void ShadowCascades::add_caster (const MeshRange& mesh, const glm::mat4& model) {
+	Caster caster = { &mesh, model, mesh.bounds.transformed (model) };
+	casters.push_back (caster);
+}
+
+void ShadowCascades::render (const glm::mat4& view, float fovy, float aspect, float nearPlane, const glm::vec3& lightDir,
+	GLuint depthVao, GLuint program, GpuProfiler* profiler) {
+	PROFILE_FUNCTION ();
+	if (!fbo || !program)
+		return;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+
+	GLint previous = 0;
+	GLint viewport[4];
+	glGetIntegerv (GL_FRAMEBUFFER_BINDING, &previous);
+	glGetIntegerv (GL_VIEWPORT, viewport);
+	glBindFramebuffer (GL_FRAMEBUFFER, fbo);
+	glViewport (0, 0, size, size);
+	glEnable (GL_DEPTH_CLAMP);
+	glUseProgram (program);
+	glBindVertexArray (depthVao);
+	if (program != lightModelProgram) {
+		lightModelLocation = glGetUniformLocation (program, "lightModel");
+		lightModelProgram = program;
+	}
+
+	float tanY = tanf (glm::radians (fovy) * 0.5f);
+	float tanX = tanY * aspect;
+	glm::mat4 cameraWorld = glm::inverse (view);
+	glm::vec3 dir = glm::normalize (lightDir);
+	// splits between the even and the logarithmic spacing, by splitLambda
+	float splitNear = nearPlane;
+	for (int c = 0; c < SHADOW_CASCADES; c++) {
+		float t = (float)(c + 1) / SHADOW_CASCADES;
+		float logSplit = nearPlane * powf (shadowDistance / nearPlane, t);
+		float evenSplit = nearPlane + (shadowDistance - nearPlane) * t;
+		float splitFar = splitLambda * logSplit + (1.0f - splitLambda) * evenSplit;
+		int interval = intervals[c] > 1 ? intervals[c] : 1;
+		if (!valid[c] || (frame + c) % interval == 0) {
+			fit (c, cameraWorld, tanX, tanY, splitNear, splitFar, dir);
+			if (profiler)
+				profiler->begin (names[c]);
+			draw (c);
+			if (profiler)
+				profiler->end ();
+			valid[c] = true;
+			stats.updates++;
+		}
+		splitNear = splitFar;
+	}
+
+	glBindVertexArray (0);
+	glDisable (GL_DEPTH_CLAMP);
+	glBindFramebuffer (GL_FRAMEBUFFER, previous);
+	glViewport (viewport[0], viewport[1], viewport[2], viewport[3]);
+	frame++;
+
+	stats.casters = (unsigned int)casters.size ();
+	std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now () - start;
+	stats.renderMs = ms.count ();
+	stats.renderMsTotal += stats.renderMs;
+	stats.frames++;
+}
+
+void ShadowCascades::fit (int c, const glm::mat4& cameraWorld, float tanX, float tanY, float nearDepth, float farDepth,
+	const glm::vec3& dir) {
+	// The smallest sphere through the slice's eight corners is centred on the
+	// view axis, equally far from the near and far corners. For a wide slice
+	// that point is past the far plane and the far corners alone decide.
+	float k = tanX * tanX + tanY * tanY;
+	float centre = 0.5f * (nearDepth + farDepth) * (1.0f + k);
+	if (centre > farDepth)
+		centre = farDepth;
+	float radius = sqrtf (farDepth * farDepth * k + (farDepth - centre) * (farDepth - centre));
+	glm::vec3 centreWorld = glm::vec3 (cameraWorld * glm::vec4 (0.0f, 0.0f, -centre, 1.0f));
+
+	// the light's rotation alone, the box moves in whole texels across it
+	glm::vec3 up = fabsf (dir.y) > 0.99f ? glm::vec3 (0.0f, 0.0f, 1.0f) : glm::vec3 (0.0f, 1.0f, 0.0f);
+	glm::mat4 lightView = glm::lookAt (glm::vec3 (0.0f), dir, up);
+	glm::vec3 lc = glm::vec3 (lightView * glm::vec4 (centreWorld, 1.0f));
+	float texel = 2.0f * radius / size;
+	lc.x = floorf (lc.x / texel) * texel;
+	lc.y = floorf (lc.y / texel) * texel;
+	glm::mat4 proj = glm::ortho (lc.x - radius, lc.x + radius, lc.y - radius, lc.y + radius, -lc.z - radius, -lc.z + radius);
+	lightViewProj[c] = proj * lightView;
+
+	// clip space [-1, 1] to the map's [0, 1]
+	glm::mat4 bias = glm::translate (glm::mat4 (1.0f), glm::vec3 (0.5f)) * glm::scale (glm::mat4 (1.0f), glm::vec3 (0.5f));
+	shadowMatrices[c] = bias * lightViewProj[c];
+	// the depth range is the sphere's diameter, 2 * radius = size texels
+	params[c] = glm::vec4 (SHADOW_NORMAL_OFFSET * texel, SHADOW_DEPTH_BIAS / size, 0.0f, 0.0f);
+}
+
+void ShadowCascades::draw (int c) {
+	glFramebufferTextureLayer (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, c);
+	glClear (GL_DEPTH_BUFFER_BIT);
+
+	Frustum frustum (lightViewProj[c]);
+	// casters between the light and the box still shadow what is in it
+	frustum.planes[4] = glm::vec4 (0.0f, 0.0f, 0.0f, 1.0f);
+	unsigned int drawn = 0;
+	for (size_t i = 0; i < casters.size (); i++) {
+		const Caster& caster = casters[i];
+		if (!frustum.intersects (caster.bounds))
+			continue;
+		glm::mat4 lightModel = lightViewProj[c] * caster.model;
+		glUniformMatrix4fv (lightModelLocation, 1, GL_FALSE, glm::value_ptr (lightModel));
+		glDrawElementsBaseVertex (GL_TRIANGLES, caster.mesh->indexCount, GL_UNSIGNED_INT,
+			(void*)(caster.mesh->firstIndex * sizeof (GLuint)), caster.mesh->baseVertex);
+		drawn++;
+	}
+	stats.drawn[c] = drawn;
+	stats.culled[c] = (unsigned int)casters.size () - drawn;
+}
+
+void ShadowCascades::bind (GLuint unit) const {
+	glActiveTexture (GL_TEXTURE0 + unit);
+	glBindTexture (GL_TEXTURE_2D_ARRAY, texture);
+}
+
+void ShadowCascades::set_uniforms (GLuint program, GLuint unit) const {
+	glUniform1i (glGetUniformLocation (program, "shadowMap"), unit);
+	glUniformMatrix4fv (glGetUniformLocation (program, "shadowMatrices"), SHADOW_CASCADES, GL_FALSE, glm::value_ptr (shadowMatrices[0]));
+	glUniform4fv (glGetUniformLocation (program, "shadowParams"), SHADOW_CASCADES, glm::value_ptr (params[0]));
+	// a texel, and how far from the edges the 3x3 lookups have to stay
+	float texel[2] = { 1.0f / size, 2.0f / size };
+	glUniform2fv (glGetUniformLocation (program, "shadowTexel"), 1, texel);
+}
+
+void ShadowCascades::print () const {
+	printf ("shadow cascades: %d x %dx%d, %u casters, drawn", SHADOW_CASCADES, size, size, stats.casters);
+	for (int c = 0; c < SHADOW_CASCADES; c++)
+		printf (" %u/%u", stats.drawn[c], stats.drawn[c] + stats.culled[c]);
+	printf (", redrawn every");
+	for (int c = 0; c < SHADOW_CASCADES; c++)
+		printf (" %d", intervals[c] > 1 ? intervals[c] : 1);
+	printf (" frames\n");
+	printf ("shadow rendering: %.3f ms last frame, %.3f ms avg over %u frames, %.2f cascades a frame\n",
+		stats.renderMs, stats.frames > 0 ? stats.renderMsTotal / stats.frames : 0.0, stats.frames,
+		stats.frames > 0 ? (double)stats.updates / stats.frames : 0.0);
+}
@@ -0,0 +1,118 @@
+#ifndef SHADOW_CASCADES_H
+#define SHADOW_CASCADES_H
+
+// Cascaded shadow maps for the directional light. The camera's frustum up to
+// shadowDistance is cut into SHADOW_CASCADES slices, near ones short and far
+// ones long, and each slice gets a square shadow map of its own, a layer of
+// one depth texture array. A slice is fitted with the sphere around its
+// corners and the sphere's centre snapped to whole texels, so the maps
+// neither change size as the camera turns nor crawl as it moves.
+//
+//   shadows.begin_frame();
+//   shadows.add_caster(arena.mesh(id), model);              // per shadow casting mesh
+//   shadows.render(view, 90.0f, aspect, 0.1f, light_dir, arena.depthVao, program, &profiler);
+//   shadows.bind(10);
+//   shadows.set_uniforms(lit_program, 10);                   // MultiLightFragment's SHADOW_CASCADES
+//
+// Each cascade is one depth-only pass over the casters its own box touches
+// (culled on the CPU) with the arena's position-only vertex stream. Casters
+// between the light and the box are kept and flattened onto its near plane
+// by depth clamping. Far cascades can be redrawn every few frames only,
+// see intervals; the shader keeps using the matrices they were drawn with.
+
+// OpenGL includes
+#include "gl_includes.h"
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "frustum.h"
+#include "geometry_arena.h"
+#include "gpu_profiler.h"
+
+#define SHADOW_CASCADES 4
+#define SHADOW_MAP_SIZE 1024
+
+struct ShadowCascadeStats {
+	unsigned int casters;
+	// last time each cascade was drawn
+	unsigned int drawn[SHADOW_CASCADES];
+	unsigned int culled[SHADOW_CASCADES];
+	// cascades drawn over all frames
+	unsigned int updates;
+	unsigned int frames;
+	// CPU time of fitting, culling and submitting in the last render()
+	double renderMs;
+	double renderMsTotal;
+};
+
+class ShadowCascades
+{
+public:
+	ShadowCascadeStats stats;
+	// Frames between redraws of each cascade, 1 is every frame. Staggered so
+	// cascades with the same interval don't all come due on one frame.
+	int intervals[SHADOW_CASCADES];
+	// 0 spaces the splits evenly, 1 logarithmically
+	float splitLambda;
+	// how far from the camera shadows reach
+	float shadowDistance;
+
+	ShadowCascades();
+
+	// Creates the depth array, size x size a layer. false if the framebuffer
+	// can't be drawn to.
+	bool init(int size = SHADOW_MAP_SIZE);
+	void release();
+
+	// Forgets last frame's casters
+	void begin_frame();
+	// A mesh of the arena that casts shadows this frame
+	void add_caster(const MeshRange& mesh, const glm::mat4& model);
+
+	// Fits the cascades to glm::perspective(fovy, aspect, nearPlane, ...)
+	// seen through view and draws the ones that are due, with program (which
+	// takes "lightModel") and depthVao. lightDir is where the light points.
+	// Leaves the framebuffer, viewport and depth clamping as it found them.
+	void render(const glm::mat4& view, float fovy, float aspect, float nearPlane, const glm::vec3& lightDir,
+		GLuint depthVao, GLuint program, GpuProfiler* profiler);
+
+	// Binds the depth array to unit, leaving it active
+	void bind(GLuint unit) const;
+
+	// Sets the shadow uniforms of the bound program, the maps on unit
+	void set_uniforms(GLuint program, GLuint unit) const;
+
+	void print() const;
+
+private:
+	struct Caster {
+		const MeshRange* mesh;
+		glm::mat4 model;
+		AABB bounds;
+	};
+
+	int size;
+	GLuint texture;
+	GLuint fbo;
+	unsigned int frame;
+	// drawn since init(), a cascade is drawn the first frame whatever its interval
+	bool valid[SHADOW_CASCADES];
+	// the GPU profiler keeps the pointers
+	char names[SHADOW_CASCADES][24];
+	// world to light clip space of each cascade as last drawn, and the same
+	// into texture space for the shader
+	glm::mat4 lightViewProj[SHADOW_CASCADES];
+	glm::mat4 shadowMatrices[SHADOW_CASCADES];
+	// per cascade: normal offset in world units, depth bias
+	glm::vec4 params[SHADOW_CASCADES];
+	std::vector<Caster> casters;
+	GLuint lightModelProgram;
+	GLint lightModelLocation;
+
+	void fit(int cascade, const glm::mat4& cameraWorld, float tanX, float tanY, float nearDepth, float farDepth,
+		const glm::vec3& lightDir);
+	void draw(int cascade);
+};
+
+#endif
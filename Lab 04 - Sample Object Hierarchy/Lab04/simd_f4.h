@@ -0,0 +1,144 @@
+#ifndef SIMD_F4_H
+#define SIMD_F4_H
+
+// Just enough of a 4 wide float type to write a kernel once for SSE, NEON
+// and plain C. maths_funcs.cpp builds its matrix and quaternion kernels on
+// it, and the modules with SIMD loops of their own (light binning, the cone
+// map bake, the occlusion rasteriser) include it next to their code. The
+// yzx/zxy swizzles leave the w lane unspecified.
+//
+// Define MATHS_NO_SIMD to force the scalar code.
+
+#include <string.h>
+
+#if !defined(MATHS_NO_SIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define MATHS_SSE
+#elif !defined(MATHS_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define MATHS_NEON
+#endif
+
+#if defined(_MSC_VER)
+#define SIMD_INLINE static __forceinline
+#else
+#define SIMD_INLINE static inline __attribute__((always_inline))
+#endif
+
+#if defined(MATHS_SSE)
+#include <xmmintrin.h>
+
+typedef __m128 f4;
+
+SIMD_INLINE f4 f4_load (const float* p) { return _mm_loadu_ps (p); }
+SIMD_INLINE void f4_store (float* p, f4 a) { _mm_storeu_ps (p, a); }
+SIMD_INLINE f4 f4_set (float x, float y, float z, float w) { return _mm_setr_ps (x, y, z, w); }
+SIMD_INLINE f4 f4_splat (float s) { return _mm_set1_ps (s); }
+SIMD_INLINE f4 f4_add (f4 a, f4 b) { return _mm_add_ps (a, b); }
+SIMD_INLINE f4 f4_sub (f4 a, f4 b) { return _mm_sub_ps (a, b); }
+SIMD_INLINE f4 f4_mul (f4 a, f4 b) { return _mm_mul_ps (a, b); }
+SIMD_INLINE f4 f4_madd (f4 a, f4 b, f4 c) { return _mm_add_ps (_mm_mul_ps (a, b), c); }
+SIMD_INLINE f4 f4_yzx (f4 a) { return _mm_shuffle_ps (a, a, _MM_SHUFFLE (3, 0, 2, 1)); }
+SIMD_INLINE f4 f4_zxy (f4 a) { return _mm_shuffle_ps (a, a, _MM_SHUFFLE (3, 1, 0, 2)); }
+SIMD_INLINE f4 f4_yxwz (f4 a) { return _mm_shuffle_ps (a, a, _MM_SHUFFLE (2, 3, 0, 1)); }
+SIMD_INLINE f4 f4_zwxy (f4 a) { return _mm_shuffle_ps (a, a, _MM_SHUFFLE (1, 0, 3, 2)); }
+SIMD_INLINE f4 f4_wzyx (f4 a) { return _mm_shuffle_ps (a, a, _MM_SHUFFLE (0, 1, 2, 3)); }
+SIMD_INLINE float f4_sum (f4 a) {
+	f4 s = _mm_add_ps (a, _mm_movehl_ps (a, a));
+	s = _mm_add_ss (s, _mm_shuffle_ps (s, s, 1));
+	return _mm_cvtss_f32 (s);
+}
+SIMD_INLINE void f4_transpose (f4& a, f4& b, f4& c, f4& d) { _MM_TRANSPOSE4_PS (a, b, c, d); }
+SIMD_INLINE f4 f4_max (f4 a, f4 b) { return _mm_max_ps (a, b); }
+SIMD_INLINE f4 f4_min (f4 a, f4 b) { return _mm_min_ps (a, b); }
+// bit i set where lane i of a <= b
+SIMD_INLINE int f4_le_mask (f4 a, f4 b) { return _mm_movemask_ps (_mm_cmple_ps (a, b)); }
+
+#elif defined(MATHS_NEON)
+#include <arm_neon.h>
+
+typedef float32x4_t f4;
+
+SIMD_INLINE f4 f4_load (const float* p) { return vld1q_f32 (p); }
+SIMD_INLINE void f4_store (float* p, f4 a) { vst1q_f32 (p, a); }
+SIMD_INLINE f4 f4_set (float x, float y, float z, float w) {
+	float v[4] = { x, y, z, w };
+	return vld1q_f32 (v);
+}
+SIMD_INLINE f4 f4_splat (float s) { return vdupq_n_f32 (s); }
+SIMD_INLINE f4 f4_add (f4 a, f4 b) { return vaddq_f32 (a, b); }
+SIMD_INLINE f4 f4_sub (f4 a, f4 b) { return vsubq_f32 (a, b); }
+SIMD_INLINE f4 f4_mul (f4 a, f4 b) { return vmulq_f32 (a, b); }
+SIMD_INLINE f4 f4_madd (f4 a, f4 b, f4 c) { return vmlaq_f32 (c, a, b); }
+SIMD_INLINE f4 f4_yzx (f4 a) { return vsetq_lane_f32 (vgetq_lane_f32 (a, 0), vextq_f32 (a, a, 1), 2); }
+SIMD_INLINE f4 f4_zxy (f4 a) { return vsetq_lane_f32 (vgetq_lane_f32 (a, 2), vextq_f32 (a, a, 3), 0); }
+SIMD_INLINE f4 f4_yxwz (f4 a) { return vrev64q_f32 (a); }
+SIMD_INLINE f4 f4_zwxy (f4 a) { return vextq_f32 (a, a, 2); }
+SIMD_INLINE f4 f4_wzyx (f4 a) {
+	f4 r = vrev64q_f32 (a);
+	return vextq_f32 (r, r, 2);
+}
+SIMD_INLINE float f4_sum (f4 a) {
+	float32x2_t s = vadd_f32 (vget_low_f32 (a), vget_high_f32 (a));
+	return vget_lane_f32 (vpadd_f32 (s, s), 0);
+}
+SIMD_INLINE void f4_transpose (f4& a, f4& b, f4& c, f4& d) {
+	float32x4x2_t ab = vtrnq_f32 (a, b);
+	float32x4x2_t cd = vtrnq_f32 (c, d);
+	a = vcombine_f32 (vget_low_f32 (ab.val[0]), vget_low_f32 (cd.val[0]));
+	b = vcombine_f32 (vget_low_f32 (ab.val[1]), vget_low_f32 (cd.val[1]));
+	c = vcombine_f32 (vget_high_f32 (ab.val[0]), vget_high_f32 (cd.val[0]));
+	d = vcombine_f32 (vget_high_f32 (ab.val[1]), vget_high_f32 (cd.val[1]));
+}
+SIMD_INLINE f4 f4_max (f4 a, f4 b) { return vmaxq_f32 (a, b); }
+SIMD_INLINE f4 f4_min (f4 a, f4 b) { return vminq_f32 (a, b); }
+SIMD_INLINE int f4_le_mask (f4 a, f4 b) {
+	uint32x4_t c = vshrq_n_u32 (vcleq_f32 (a, b), 31);
+	return (int)(vgetq_lane_u32 (c, 0) | (vgetq_lane_u32 (c, 1) << 1) | (vgetq_lane_u32 (c, 2) << 2) | (vgetq_lane_u32 (c, 3) << 3));
+}
+
+#else
+
+struct f4 { float v[4]; };
+
+SIMD_INLINE f4 f4_load (const float* p) { f4 r; memcpy (r.v, p, sizeof (r.v)); return r; }
+SIMD_INLINE void f4_store (float* p, f4 a) { memcpy (p, a.v, sizeof (a.v)); }
+SIMD_INLINE f4 f4_set (float x, float y, float z, float w) { f4 r = { { x, y, z, w } }; return r; }
+SIMD_INLINE f4 f4_splat (float s) { return f4_set (s, s, s, s); }
+SIMD_INLINE f4 f4_add (f4 a, f4 b) { return f4_set (a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]); }
+SIMD_INLINE f4 f4_sub (f4 a, f4 b) { return f4_set (a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]); }
+SIMD_INLINE f4 f4_mul (f4 a, f4 b) { return f4_set (a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]); }
+SIMD_INLINE f4 f4_madd (f4 a, f4 b, f4 c) { return f4_add (f4_mul (a, b), c); }
+SIMD_INLINE f4 f4_yzx (f4 a) { return f4_set (a.v[1], a.v[2], a.v[0], a.v[3]); }
+SIMD_INLINE f4 f4_zxy (f4 a) { return f4_set (a.v[2], a.v[0], a.v[1], a.v[3]); }
+SIMD_INLINE f4 f4_yxwz (f4 a) { return f4_set (a.v[1], a.v[0], a.v[3], a.v[2]); }
+SIMD_INLINE f4 f4_zwxy (f4 a) { return f4_set (a.v[2], a.v[3], a.v[0], a.v[1]); }
+SIMD_INLINE f4 f4_wzyx (f4 a) { return f4_set (a.v[3], a.v[2], a.v[1], a.v[0]); }
+SIMD_INLINE float f4_sum (f4 a) { return a.v[0] + a.v[1] + a.v[2] + a.v[3]; }
+SIMD_INLINE void f4_transpose (f4& a, f4& b, f4& c, f4& d) {
+	f4 ta = f4_set (a.v[0], b.v[0], c.v[0], d.v[0]);
+	f4 tb = f4_set (a.v[1], b.v[1], c.v[1], d.v[1]);
+	f4 tc = f4_set (a.v[2], b.v[2], c.v[2], d.v[2]);
+	f4 td = f4_set (a.v[3], b.v[3], c.v[3], d.v[3]);
+	a = ta;
+	b = tb;
+	c = tc;
+	d = td;
+}
+SIMD_INLINE f4 f4_max (f4 a, f4 b) {
+	return f4_set (a.v[0] > b.v[0] ? a.v[0] : b.v[0], a.v[1] > b.v[1] ? a.v[1] : b.v[1],
+		a.v[2] > b.v[2] ? a.v[2] : b.v[2], a.v[3] > b.v[3] ? a.v[3] : b.v[3]);
+}
+SIMD_INLINE f4 f4_min (f4 a, f4 b) {
+	return f4_set (a.v[0] < b.v[0] ? a.v[0] : b.v[0], a.v[1] < b.v[1] ? a.v[1] : b.v[1],
+		a.v[2] < b.v[2] ? a.v[2] : b.v[2], a.v[3] < b.v[3] ? a.v[3] : b.v[3]);
+}
+SIMD_INLINE int f4_le_mask (f4 a, f4 b) {
+	return (a.v[0] <= b.v[0]) | ((a.v[1] <= b.v[1]) << 1) | ((a.v[2] <= b.v[2]) << 2) | ((a.v[3] <= b.v[3]) << 3);
+}
+
+#endif
+
+SIMD_INLINE f4 f4_cross (f4 a, f4 b) {
+	return f4_sub (f4_mul (f4_yzx (a), f4_zxy (b)), f4_mul (f4_zxy (a), f4_yzx (b)));
+}
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+// OpenGL includes
+#include "gl_includes.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+// Frames in flight. The CPU fills one region while the GPU may still be
+// reading the other two.
+#define STREAM_BUFFER_REGIONS 3
+
+struct StreamStats {
+	unsigned int frames;
+	// begin_frame had to wait for the GPU to finish with the region
+	unsigned int stalls;
+	double stallMs;
+	// allocations that did not fit, the caller uploaded those itself
+	unsigned int overflows;
+	size_t lastBytes;
+	size_t peakBytes;
+};
+
+// Ring buffer for data that is rewritten every frame: instance transforms,
+// indirect commands, per-draw data. With buffer storage (GL 4.4) the buffer
+// is mapped once, persistent and coherent, and split into regions used on
+// successive frames; a fence after each frame's draws says when its region may
+// be written again. Without it there is a single region that is orphaned every
+// frame with glMapBufferRange(GL_MAP_INVALIDATE_BUFFER_BIT) and filled from a
+// CPU copy.
+//
+//   stream.begin_frame();
+//   size_t offset;
+//   void* p = stream.allocate(bytes, 16, &offset);  // NULL when full
+//   ... write to p ...
+//   stream.commit();    // before any draw reads it
+//   ... draw from stream.buffer() at offset ...
+//   stream.end_frame(); // after the frame's last draw
+//
+// Writes to mapped memory never pass through GL, so commit() also records
+// them in a running GL capture as buffer updates.
+class StreamBuffer
+{
+public:
+	StreamStats stats;
+
+	StreamBuffer()
+		: id(0), regionSize(0), regionCount(0), region(0), head(0), committed(0),
+		mapped(NULL), shadow(NULL), persistent(false), orphan(false)
+	{
+		memset(&stats, 0, sizeof(stats));
+		for (int i = 0; i < STREAM_BUFFER_REGIONS; i++)
+			fences[i] = 0;
+	}
+
+	~StreamBuffer() { delete[] shadow; }
+
+	// allow_persistent false takes the orphaning path even where buffer
+	// storage is available, for comparing the two
+	void init(size_t region_bytes, bool allow_persistent = true)
+	{
+		regionSize = region_bytes;
+		persistent = allow_persistent && (GLEW_ARB_buffer_storage || GLEW_VERSION_4_4);
+		glGenBuffers(1, &id);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+		if (persistent)
+		{
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			regionCount = STREAM_BUFFER_REGIONS;
+			glBufferStorage(GL_COPY_WRITE_BUFFER, regionSize * regionCount, NULL, flags);
+			mapped = (uint8_t*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, regionSize * regionCount, flags);
+			if (!mapped)
+			{
+				// the storage is immutable, start again with a plain buffer
+				fprintf(stderr, "WARNING: could not map the stream buffer, orphaning instead\n");
+				glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+				glDeleteBuffers(1, &id);
+				glGenBuffers(1, &id);
+				glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+				persistent = false;
+			}
+		}
+		if (!persistent)
+		{
+			regionCount = 1;
+			glBufferData(GL_COPY_WRITE_BUFFER, regionSize, NULL, GL_STREAM_DRAW);
+			shadow = new uint8_t[regionSize];
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		printf("stream buffer: %s, %d x %zu KB\n", persistent ? "persistent mapped" : "orphaned", regionCount, regionSize / 1024);
+	}
+
+	void release()
+	{
+		if (id == 0)
+			return;
+		for (int i = 0; i < STREAM_BUFFER_REGIONS; i++)
+		{
+			if (fences[i])
+				glDeleteSync(fences[i]);
+			fences[i] = 0;
+		}
+		if (mapped)
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &id);
+		delete[] shadow;
+		id = 0;
+		mapped = shadow = NULL;
+	}
+
+	bool ready() const { return id != 0; }
+	GLuint buffer() const { return id; }
+	bool is_persistent() const { return persistent; }
+
+	// Moves on to the next region, waiting for the GPU if it still reads it
+	void begin_frame()
+	{
+		if (id == 0)
+			return;
+		region = (region + 1) % regionCount;
+		head = committed = region * regionSize;
+		orphan = !persistent;
+		if (fences[region])
+		{
+			wait(fences[region]);
+			glDeleteSync(fences[region]);
+			fences[region] = 0;
+		}
+		stats.frames++;
+	}
+
+	// Room for bytes in this frame's region, offset is where it starts in
+	// buffer(). align need not be a power of two.
+	void* allocate(size_t bytes, size_t align, size_t* offset)
+	{
+		size_t start = (head + align - 1) / align * align;
+		if (id == 0 || start + bytes > (region + 1) * regionSize)
+		{
+			stats.overflows++;
+			return NULL;
+		}
+		head = start + bytes;
+		*offset = start;
+		return persistent ? mapped + start : shadow + start;
+	}
+
+	// Makes everything allocated so far visible to GL. Uses the
+	// GL_COPY_WRITE_BUFFER binding and leaves it bound.
+	void commit()
+	{
+		if (head == committed)
+			return;
+		size_t bytes = head - committed;
+		glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+		if (persistent)
+		{
+			// coherent, the GPU sees the writes without a flush
+			gl_capture_buffer_write(GL_COPY_WRITE_BUFFER, committed, bytes, mapped + committed);
+		}
+		else
+		{
+			// the frame's first commit orphans, later ones write past what
+			// earlier draws read so they need not wait for them
+			GLbitfield flags = GL_MAP_WRITE_BIT | (orphan ? GL_MAP_INVALIDATE_BUFFER_BIT : GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+			void* p = glMapBufferRange(GL_COPY_WRITE_BUFFER, committed, bytes, flags);
+			if (p)
+			{
+				memcpy(p, shadow + committed, bytes);
+				glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			}
+			gl_capture_buffer_write(GL_COPY_WRITE_BUFFER, committed, bytes, shadow + committed);
+			orphan = false;
+		}
+		committed = head;
+	}
+
+	// Fences the region after the frame's draws have been issued
+	void end_frame()
+	{
+		if (id == 0)
+			return;
+		stats.lastBytes = head - region * regionSize;
+		if (stats.lastBytes > stats.peakBytes)
+			stats.peakBytes = stats.lastBytes;
+		if (persistent)
+			fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	void print() const
+	{
+		printf("stream buffer: %s, %.1f KB last frame, %.1f KB at most of %zu KB, %u stalls (%.3f ms), %u overflows over %u frames\n",
+			persistent ? "persistent" : "orphaned", stats.lastBytes / 1024.0, stats.peakBytes / 1024.0, regionSize / 1024,
+			stats.stalls, stats.stallMs, stats.overflows, stats.frames);
+	}
+
+private:
+	GLuint id;
+	size_t regionSize;
+	int regionCount;
+	int region;
+	// next free byte and the end of what commit() has handed over, buffer offsets
+	size_t head;
+	size_t committed;
+	uint8_t* mapped;
+	// CPU side of the orphaned buffer
+	uint8_t* shadow;
+	bool persistent;
+	bool orphan;
+	GLsync fences[STREAM_BUFFER_REGIONS];
+
+	void wait(GLsync fence)
+	{
+		GLenum result = glClientWaitSync(fence, 0, 0);
+		if (result != GL_TIMEOUT_EXPIRED)
+			return;
+		stats.stalls++;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		do
+		{
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		} while (result == GL_TIMEOUT_EXPIRED);
+		stats.stallMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+};
+
+#endif